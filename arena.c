@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Every allocation is aligned for any type we store.
+#define ARENA_ALIGNMENT 16
+
+Arena *arena_new(void) {
+    Arena *arena = malloc(sizeof(Arena));
+    arena->chunks = NULL;
+    arena->bytes_allocated = 0;
+
+    return arena;
+}
+
+/* Allocate a chunk with room for SIZE bytes. We skip the first few
+ * bytes of data if they aren't aligned.
+ */
+static ArenaChunk *arena_chunk_new(size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size + ARENA_ALIGNMENT);
+    size_t padding = -(uintptr_t)chunk->data & (ARENA_ALIGNMENT - 1);
+
+    chunk->next = NULL;
+    chunk->size = padding + size;
+    chunk->used = padding;
+
+    return chunk;
+}
+
+/* Return SIZE bytes of uninitialised memory that lives until ARENA is
+ * freed.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena->bytes_allocated += size;
+
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        if (size > ARENA_CHUNK_SIZE / 4) {
+            // Give big allocations a chunk of their own, behind the
+            // current one, so we don't waste the rest of it.
+            ArenaChunk *big_chunk = arena_chunk_new(size);
+            void *result = big_chunk->data + big_chunk->used;
+            big_chunk->used = big_chunk->size;
+
+            if (chunk == NULL) {
+                arena->chunks = big_chunk;
+            } else {
+                big_chunk->next = chunk->next;
+                chunk->next = big_chunk;
+            }
+            return result;
+        }
+
+        chunk = arena_chunk_new(ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *result = chunk->data + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+char *arena_strdup(Arena *arena, const char *string) {
+    size_t length = strlen(string) + 1;
+    char *copy = arena_alloc(arena, length);
+    memcpy(copy, string, length);
+
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
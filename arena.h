@@ -0,0 +1,32 @@
+#ifndef MC_ARENA_H
+#define MC_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+/******************************************************************************
+ *
+ * A bump allocator. Allocations are carved out of large chunks and
+ * can't be freed individually; arena_free releases all of them at
+ * once.
+ *
+ ******************************************************************************/
+typedef struct Arena {
+    // The chunk we're allocating from, followed by the full ones.
+    ArenaChunk *chunks;
+    // Total bytes handed out, for statistics.
+    size_t bytes_allocated;
+} Arena;
+
+Arena *arena_new(void);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *string);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,1033 @@
+#include <ctype.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "buffer.h"
+#include "instructions.h"
+#include "intern.h"
+#include "list.h"
+#include "target.h"
+
+// x86 instructions are at most 15 bytes long.
+#define MAX_INSTRUCTION_LENGTH 15
+#define MAX_OPERANDS 2
+
+#define NO_CODE_SYMBOL -1
+// The condition of an unconditional jmp.
+#define ALWAYS -1
+
+#define REX 0x40
+#define REX_W 0x08
+#define REX_R 0x04
+#define REX_B 0x01
+
+/* The encodings we know, grouped by the shape of their operands. */
+typedef enum {
+    FORM_MOV,
+    // add, or, and, sub, xor and cmp, which differ only in the
+    // operation number CODE.
+    FORM_ALU,
+    FORM_TEST,
+    FORM_IMUL,
+    // not, neg and mul: opcode F7 with CODE in the ModRM reg field.
+    FORM_GROUP3,
+    FORM_PUSH,
+    FORM_POP,
+    FORM_SETCC,
+    FORM_MOVZB,
+    FORM_JMP,
+    FORM_JCC,
+    FORM_CALL,
+    FORM_INT,
+    // Instructions without operands, whose bytes are FIXED.
+    FORM_FIXED,
+} Form;
+
+typedef struct Mnemonic {
+    char *name;
+    Form form;
+    int code;
+    char *fixed;
+} Mnemonic;
+
+static const Mnemonic MNEMONICS[] = {
+    {"mov", FORM_MOV, 0, NULL},     {"add", FORM_ALU, 0, NULL},
+    {"or", FORM_ALU, 1, NULL},      {"and", FORM_ALU, 4, NULL},
+    {"sub", FORM_ALU, 5, NULL},     {"xor", FORM_ALU, 6, NULL},
+    {"cmp", FORM_ALU, 7, NULL},     {"test", FORM_TEST, 0, NULL},
+    {"imul", FORM_IMUL, 0, NULL},   {"not", FORM_GROUP3, 2, NULL},
+    {"neg", FORM_GROUP3, 3, NULL},  {"mul", FORM_GROUP3, 4, NULL},
+    {"push", FORM_PUSH, 0, NULL},   {"pop", FORM_POP, 0, NULL},
+    {"movzb", FORM_MOVZB, 0, NULL}, {"jmp", FORM_JMP, 0, NULL},
+    {"call", FORM_CALL, 0, NULL},   {"int", FORM_INT, 0, NULL},
+    {"leave", FORM_FIXED, 0, "\xc9"},
+    {"ret", FORM_FIXED, 0, "\xc3"},
+    {"nop", FORM_FIXED, 0, "\x90"},
+    {"syscall", FORM_FIXED, 0, "\x0f\x05"},
+};
+
+#define NUM_MNEMONICS (sizeof(MNEMONICS) / sizeof(MNEMONICS[0]))
+
+/* The condition codes of setcc and jcc, with all their aliases. */
+static const struct {
+    char *name;
+    int code;
+} CONDITIONS[] = {
+    {"o", 0x0},   {"no", 0x1},  {"b", 0x2},   {"c", 0x2},   {"nae", 0x2},
+    {"ae", 0x3},  {"nb", 0x3},  {"nc", 0x3},  {"e", 0x4},   {"z", 0x4},
+    {"ne", 0x5},  {"nz", 0x5},  {"be", 0x6},  {"na", 0x6},  {"a", 0x7},
+    {"nbe", 0x7}, {"s", 0x8},   {"ns", 0x9},  {"p", 0xa},   {"pe", 0xa},
+    {"np", 0xb},  {"po", 0xb},  {"l", 0xc},   {"nge", 0xc}, {"ge", 0xd},
+    {"nl", 0xd},  {"le", 0xe},  {"ng", 0xe},  {"g", 0xf},   {"nle", 0xf},
+};
+
+#define NUM_CONDITIONS (sizeof(CONDITIONS) / sizeof(CONDITIONS[0]))
+
+/* The registers with names of their own. r8 to r15 are parsed. */
+static const struct {
+    char *name;
+    int number;
+    int size;
+} REGISTERS[] = {
+    {"eax", 0, 4}, {"ecx", 1, 4}, {"edx", 2, 4}, {"ebx", 3, 4},
+    {"esp", 4, 4}, {"ebp", 5, 4}, {"esi", 6, 4}, {"edi", 7, 4},
+    {"rax", 0, 8}, {"rcx", 1, 8}, {"rdx", 2, 8}, {"rbx", 3, 8},
+    {"rsp", 4, 8}, {"rbp", 5, 8}, {"rsi", 6, 8}, {"rdi", 7, 8},
+    {"al", 0, 1},  {"cl", 1, 1},  {"dl", 2, 1},  {"bl", 3, 1},
+    {"spl", 4, 1}, {"bpl", 5, 1}, {"sil", 6, 1}, {"dil", 7, 1},
+};
+
+#define NUM_REGISTERS (sizeof(REGISTERS) / sizeof(REGISTERS[0]))
+
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_IMMEDIATE,
+    OPERAND_MEMORY,
+    OPERAND_LABEL,
+} OperandKind;
+
+typedef struct Operand {
+    OperandKind kind;
+    // The register, or the base register of a memory operand.
+    int reg;
+    // The size in bytes of the register.
+    int size;
+    // The immediate, or the displacement of a memory operand.
+    int64_t value;
+    // OPERAND_LABEL only.
+    const char *label;
+    size_t label_length;
+} Operand;
+
+typedef struct Encoding {
+    uint8_t bytes[MAX_INSTRUCTION_LENGTH];
+    int length;
+} Encoding;
+
+typedef enum {
+    ITEM_BYTES,
+    ITEM_LABEL,
+    // A jmp or jcc, which is two bytes if its target is close enough.
+    ITEM_BRANCH,
+    ITEM_CALL,
+} ItemKind;
+
+/* One instruction or label, waiting for its final address. */
+typedef struct Item {
+    ItemKind kind;
+    Encoding encoding;
+    int symbol;
+    // The condition code of a branch, or ALWAYS.
+    int condition;
+    bool long_form;
+    int offset;
+} Item;
+
+typedef struct Assembler {
+    Target *target;
+    MachineCode *machine_code;
+
+    Item *items;
+    int item_count;
+    int item_capacity;
+
+    // Indices into machine_code->symbols, by the interned Symbol of
+    // their name, or NO_CODE_SYMBOL.
+    int *symbol_indices;
+    uint32_t symbol_indices_capacity;
+
+    // The instruction we're assembling, for error messages.
+    Instruction *instruction;
+    bool failed;
+} Assembler;
+
+static void assembler_error(Assembler *as, char *message) {
+    if (as->instruction->type == INSTRUCTION) {
+        warnx("%s: %s %s", message, as->instruction->name,
+              as->instruction->operands);
+    } else {
+        warnx("%s: %s", message, as->instruction->name);
+    }
+    as->failed = true;
+}
+
+static Item *add_item(Assembler *as, ItemKind kind) {
+    if (as->item_count == as->item_capacity) {
+        as->item_capacity =
+            as->item_capacity == 0 ? 1024 : as->item_capacity * 2;
+        as->items = realloc(as->items, as->item_capacity * sizeof(Item));
+    }
+
+    Item *item = &as->items[as->item_count++];
+    item->kind = kind;
+    item->encoding.length = 0;
+    item->symbol = NO_CODE_SYMBOL;
+    item->condition = ALWAYS;
+    item->long_form = false;
+    item->offset = 0;
+    return item;
+}
+
+/* The index of the symbol called NAME, adding it if it's new. */
+static int code_symbol(Assembler *as, const char *name, size_t length) {
+    Symbol key = intern(name, length);
+    if (key >= as->symbol_indices_capacity) {
+        uint32_t capacity = as->symbol_indices_capacity == 0
+                                ? 256
+                                : as->symbol_indices_capacity;
+        while (capacity <= key) {
+            capacity *= 2;
+        }
+        as->symbol_indices =
+            realloc(as->symbol_indices, capacity * sizeof(int));
+        for (uint32_t i = as->symbol_indices_capacity; i < capacity; i++) {
+            as->symbol_indices[i] = NO_CODE_SYMBOL;
+        }
+        as->symbol_indices_capacity = capacity;
+    }
+
+    if (as->symbol_indices[key] == NO_CODE_SYMBOL) {
+        CodeSymbol *symbol = malloc(sizeof(CodeSymbol));
+        symbol->name = strdup(symbol_name(key));
+        symbol->offset = -1;
+        symbol->global = false;
+
+        List *symbols = as->machine_code->symbols;
+        as->symbol_indices[key] = list_length(symbols);
+        list_append(symbols, symbol);
+    }
+    return as->symbol_indices[key];
+}
+
+static bool parse_register(const char *text, size_t length, Operand *operand) {
+    for (size_t i = 0; i < NUM_REGISTERS; i++) {
+        if (strlen(REGISTERS[i].name) == length &&
+            strncmp(REGISTERS[i].name, text, length) == 0) {
+            operand->reg = REGISTERS[i].number;
+            operand->size = REGISTERS[i].size;
+            return true;
+        }
+    }
+
+    // r8 to r15, with a d suffix for 32 bits or b for 8 bits.
+    if (length < 2 || text[0] != 'r' || !isdigit((unsigned char)text[1])) {
+        return false;
+    }
+    size_t i = 1;
+    int number = 0;
+    while (i < length && isdigit((unsigned char)text[i])) {
+        number = number * 10 + (text[i] - '0');
+        i++;
+    }
+
+    int size = 8;
+    if (i + 1 == length && text[i] == 'd') {
+        size = 4;
+    } else if (i + 1 == length && text[i] == 'b') {
+        size = 1;
+    } else if (i != length) {
+        return false;
+    }
+
+    if (number < 8 || number > 15) {
+        return false;
+    }
+    operand->reg = number;
+    operand->size = size;
+    return true;
+}
+
+static bool parse_integer(const char *text, size_t length, int64_t *value) {
+    char digits[32];
+    if (length == 0 || length >= sizeof(digits)) {
+        return false;
+    }
+    memcpy(digits, text, length);
+    digits[length] = '\0';
+
+    char *end;
+    bool negative = digits[0] == '-';
+    uint64_t magnitude = strtoull(digits + negative, &end, 0);
+    if (*end != '\0' || end == digits + negative) {
+        return false;
+    }
+    *value = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+    return true;
+}
+
+/* Parse one AT&T operand: %reg, $imm, disp(%base) or a label. */
+static bool parse_operand(const char *text, size_t length, Operand *operand) {
+    while (length > 0 && isspace((unsigned char)text[0])) {
+        text++;
+        length--;
+    }
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        length--;
+    }
+    if (length == 0) {
+        return false;
+    }
+
+    if (text[0] == '%') {
+        operand->kind = OPERAND_REGISTER;
+        return parse_register(text + 1, length - 1, operand);
+
+    } else if (text[0] == '$') {
+        operand->kind = OPERAND_IMMEDIATE;
+        return parse_integer(text + 1, length - 1, &operand->value);
+    }
+
+    const char *open = memchr(text, '(', length);
+    if (open != NULL) {
+        operand->kind = OPERAND_MEMORY;
+        operand->value = 0;
+        if (open > text && !parse_integer(text, open - text, &operand->value)) {
+            return false;
+        }
+
+        // We only generate a base register, with no index or scale.
+        const char *base = open + 1;
+        size_t base_length = text + length - base;
+        if (base_length < 3 || base[0] != '%' || base[base_length - 1] != ')') {
+            return false;
+        }
+        return parse_register(base + 1, base_length - 2, operand);
+    }
+
+    operand->kind = OPERAND_LABEL;
+    operand->label = text;
+    operand->label_length = length;
+    for (size_t i = 0; i < length; i++) {
+        if (!isalnum((unsigned char)text[i]) && text[i] != '_' &&
+            text[i] != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Split OPERANDS on commas and parse each. Returns the count, or -1. */
+static int parse_operands(char *operands, Operand *parsed) {
+    int count = 0;
+    const char *start = operands;
+    while (*start != '\0') {
+        if (count == MAX_OPERANDS) {
+            return -1;
+        }
+
+        const char *end = strchr(start, ',');
+        if (end == NULL) {
+            end = start + strlen(start);
+        }
+        if (!parse_operand(start, end - start, &parsed[count])) {
+            return -1;
+        }
+        count++;
+
+        start = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+static void put_byte(Encoding *encoding, uint8_t byte) {
+    encoding->bytes[encoding->length++] = byte;
+}
+
+static void put_bytes(Encoding *encoding, const char *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        put_byte(encoding, bytes[i]);
+    }
+}
+
+static void put_int32(Encoding *encoding, int64_t value) {
+    uint32_t bits = (uint32_t)value;
+    for (int i = 0; i < 4; i++) {
+        put_byte(encoding, bits >> (8 * i));
+    }
+}
+
+static bool fits_int8(int64_t value) { return value >= -128 && value <= 127; }
+
+static bool fits_int32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/* The byte registers spl, bpl, sil and dil only exist with a REX
+ * prefix. Without one, those numbers mean ah, ch, dh and bh.
+ */
+static bool needs_rex(Operand *operand) {
+    return operand->kind == OPERAND_REGISTER && operand->size == 1 &&
+           operand->reg >= 4 && operand->reg < 8;
+}
+
+/* Emit a REX prefix if we need one. RM is the register in the r/m
+ * field, or the base register of a memory operand.
+ */
+static void put_rex(Assembler *as, Encoding *encoding, int size, int reg,
+                    int rm, bool force) {
+    int rex = 0;
+    if (size == 8) {
+        rex |= REX_W;
+    }
+    if (reg >= 8) {
+        rex |= REX_R;
+    }
+    if (rm >= 8) {
+        rex |= REX_B;
+    }
+
+    if (rex == 0 && !force) {
+        return;
+    }
+    if (as->target->arch != TARGET_X86_64) {
+        assembler_error(as, "64-bit operands need --target=x86_64");
+        return;
+    }
+    put_byte(encoding, REX | rex);
+}
+
+/* Encode OPCODE with a ModRM byte whose reg field is REG and whose
+ * r/m field addresses RM, which is a register or memory operand.
+ */
+static void put_modrm(Assembler *as, Encoding *encoding, int size,
+                      char *opcode, int reg, Operand *rm, bool force_rex) {
+    put_rex(as, encoding, size, reg, rm->reg, force_rex);
+    put_bytes(encoding, opcode, strlen(opcode));
+
+    if (rm->kind == OPERAND_REGISTER) {
+        put_byte(encoding, 0xc0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+
+    if (rm->kind != OPERAND_MEMORY) {
+        assembler_error(as, "expected a register or memory operand");
+        return;
+    }
+    if (rm->size != as->target->word_size) {
+        assembler_error(as, "base registers must be the width of an address");
+        return;
+    }
+    if (!fits_int32(rm->value)) {
+        assembler_error(as, "displacement out of range");
+        return;
+    }
+
+    // rbp and r13 as a base always need a displacement, because mod 0
+    // with those means something else.
+    int mod;
+    if (rm->value == 0 && (rm->reg & 7) != 5) {
+        mod = 0;
+    } else if (fits_int8(rm->value)) {
+        mod = 1;
+    } else {
+        mod = 2;
+    }
+
+    put_byte(encoding, mod << 6 | (reg & 7) << 3 | (rm->reg & 7));
+    if ((rm->reg & 7) == 4) {
+        // rsp and r12 as a base need a SIB byte with no index.
+        put_byte(encoding, 0x24);
+    }
+
+    if (mod == 1) {
+        put_byte(encoding, rm->value);
+    } else if (mod == 2) {
+        put_int32(encoding, rm->value);
+    }
+}
+
+/* Emit a one-byte OPCODE with register REG added to it, as in push
+ * and mov $imm.
+ */
+static void put_opcode_register(Assembler *as, Encoding *encoding, int size,
+                                uint8_t opcode, int reg) {
+    put_rex(as, encoding, size, 0, reg, false);
+    put_byte(encoding, opcode + (reg & 7));
+}
+
+/* The operand size of an instruction: the size of its registers, or
+ * the size given by its mnemonic's suffix.
+ */
+static int operand_size(Assembler *as, Operand *operands, int count,
+                        int suffix_size) {
+    int size = suffix_size;
+    for (int i = 0; i < count; i++) {
+        if (operands[i].kind != OPERAND_REGISTER) {
+            continue;
+        }
+        if (size != 0 && size != operands[i].size) {
+            assembler_error(as, "operand sizes don't match");
+            return 0;
+        }
+        size = operands[i].size;
+    }
+
+    if (size == 0) {
+        assembler_error(as, "ambiguous operand size");
+    } else if (size != 4 && size != 8) {
+        assembler_error(as, "only 32-bit and 64-bit operands are supported");
+        size = 0;
+    }
+    return size;
+}
+
+/* Check IMMEDIATE fits an operand of SIZE bytes, and return it as the
+ * sign-extended value the processor will see.
+ */
+static int64_t immediate_value(Assembler *as, Operand *immediate, int size) {
+    int64_t value = immediate->value;
+    if (size == 4 && value >= INT32_MIN && value <= (int64_t)UINT32_MAX) {
+        return (int32_t)(uint32_t)value;
+    } else if (size == 8 && fits_int32(value)) {
+        return value;
+    }
+    assembler_error(as, "immediate out of range");
+    return 0;
+}
+
+static void encode_mov(Assembler *as, Encoding *encoding, Operand *source,
+                       Operand *dest, int size) {
+    if (source->kind == OPERAND_REGISTER && dest->kind != OPERAND_IMMEDIATE) {
+        put_modrm(as, encoding, size, "\x89", source->reg, dest, false);
+
+    } else if (source->kind == OPERAND_MEMORY &&
+               dest->kind == OPERAND_REGISTER) {
+        put_modrm(as, encoding, size, "\x8b", dest->reg, source, false);
+
+    } else if (source->kind == OPERAND_IMMEDIATE &&
+               dest->kind == OPERAND_REGISTER) {
+        if (size == 8 && fits_int32(source->value)) {
+            // A sign-extended 32-bit immediate is shorter.
+            put_modrm(as, encoding, size, "\xc7", 0, dest, false);
+            put_int32(encoding, source->value);
+        } else if (size == 8) {
+            put_opcode_register(as, encoding, size, 0xb8, dest->reg);
+            put_int32(encoding, source->value);
+            put_int32(encoding, source->value >> 32);
+        } else {
+            int64_t value = immediate_value(as, source, size);
+            put_opcode_register(as, encoding, size, 0xb8, dest->reg);
+            put_int32(encoding, value);
+        }
+
+    } else if (source->kind == OPERAND_IMMEDIATE &&
+               dest->kind == OPERAND_MEMORY) {
+        int64_t value = immediate_value(as, source, size);
+        put_modrm(as, encoding, size, "\xc7", 0, dest, false);
+        put_int32(encoding, value);
+
+    } else {
+        assembler_error(as, "unsupported operands");
+    }
+}
+
+static void encode_alu(Assembler *as, Encoding *encoding, int operation,
+                       Operand *source, Operand *dest, int size) {
+    if (source->kind == OPERAND_IMMEDIATE && dest->kind != OPERAND_LABEL &&
+        dest->kind != OPERAND_IMMEDIATE) {
+        int64_t value = immediate_value(as, source, size);
+        if (fits_int8(value)) {
+            put_modrm(as, encoding, size, "\x83", operation, dest, false);
+            put_byte(encoding, value);
+        } else if (dest->kind == OPERAND_REGISTER && dest->reg == 0) {
+            // There's a shorter form for the accumulator.
+            put_rex(as, encoding, size, 0, 0, false);
+            put_byte(encoding, operation * 8 + 5);
+            put_int32(encoding, value);
+        } else {
+            put_modrm(as, encoding, size, "\x81", operation, dest, false);
+            put_int32(encoding, value);
+        }
+
+    } else if (source->kind == OPERAND_REGISTER &&
+               (dest->kind == OPERAND_REGISTER ||
+                dest->kind == OPERAND_MEMORY)) {
+        char opcode[] = {operation * 8 + 1, '\0'};
+        put_modrm(as, encoding, size, opcode, source->reg, dest, false);
+
+    } else if (source->kind == OPERAND_MEMORY &&
+               dest->kind == OPERAND_REGISTER) {
+        char opcode[] = {operation * 8 + 3, '\0'};
+        put_modrm(as, encoding, size, opcode, dest->reg, source, false);
+
+    } else {
+        assembler_error(as, "unsupported operands");
+    }
+}
+
+static void encode_test(Assembler *as, Encoding *encoding, Operand *source,
+                        Operand *dest, int size) {
+    if (source->kind == OPERAND_IMMEDIATE) {
+        int64_t value = immediate_value(as, source, size);
+        if (dest->kind == OPERAND_REGISTER && dest->reg == 0) {
+            put_rex(as, encoding, size, 0, 0, false);
+            put_byte(encoding, 0xa9);
+        } else {
+            put_modrm(as, encoding, size, "\xf7", 0, dest, false);
+        }
+        put_int32(encoding, value);
+
+    } else if (source->kind == OPERAND_REGISTER) {
+        put_modrm(as, encoding, size, "\x85", source->reg, dest, false);
+
+    } else if (dest->kind == OPERAND_REGISTER) {
+        put_modrm(as, encoding, size, "\x85", dest->reg, source, false);
+
+    } else {
+        assembler_error(as, "unsupported operands");
+    }
+}
+
+static void encode_imul(Assembler *as, Encoding *encoding, Operand *source,
+                        Operand *dest, int size) {
+    if (dest->kind != OPERAND_REGISTER) {
+        assembler_error(as, "imul needs a register destination");
+
+    } else if (source->kind == OPERAND_IMMEDIATE) {
+        int64_t value = immediate_value(as, source, size);
+        if (fits_int8(value)) {
+            put_modrm(as, encoding, size, "\x6b", dest->reg, dest, false);
+            put_byte(encoding, value);
+        } else {
+            put_modrm(as, encoding, size, "\x69", dest->reg, dest, false);
+            put_int32(encoding, value);
+        }
+
+    } else {
+        put_modrm(as, encoding, size, "\x0f\xaf", dest->reg, source, false);
+    }
+}
+
+static void encode_push_pop(Assembler *as, Encoding *encoding, Form form,
+                            Operand *operand, int suffix_size) {
+    // push and pop always move a whole word, so they never need REX.W.
+    int word_size = as->target->word_size;
+    if ((operand->kind == OPERAND_REGISTER && operand->size != word_size) ||
+        (suffix_size != 0 && suffix_size != word_size)) {
+        assembler_error(as, "push and pop must move a whole word");
+        return;
+    }
+
+    if (operand->kind == OPERAND_REGISTER) {
+        put_opcode_register(as, encoding, 4, form == FORM_PUSH ? 0x50 : 0x58,
+                            operand->reg);
+    } else if (operand->kind == OPERAND_MEMORY) {
+        put_modrm(as, encoding, 4, form == FORM_PUSH ? "\xff" : "\x8f",
+                  form == FORM_PUSH ? 6 : 0, operand, false);
+    } else if (operand->kind == OPERAND_IMMEDIATE && form == FORM_PUSH) {
+        int64_t value = immediate_value(as, operand, 4);
+        if (fits_int8(value)) {
+            put_byte(encoding, 0x6a);
+            put_byte(encoding, value);
+        } else {
+            put_byte(encoding, 0x68);
+            put_int32(encoding, value);
+        }
+    } else {
+        assembler_error(as, "unsupported operands");
+    }
+}
+
+/* Look up the mnemonic NAME. We accept the AT&T size suffixes l and q,
+ * and set *SUFFIX_SIZE to the size they ask for.
+ */
+static const Mnemonic *find_mnemonic(char *name, int *suffix_size,
+                                     int *condition) {
+    *suffix_size = 0;
+    *condition = ALWAYS;
+
+    for (size_t i = 0; i < NUM_MNEMONICS; i++) {
+        if (strcmp(MNEMONICS[i].name, name) == 0) {
+            return &MNEMONICS[i];
+        }
+    }
+
+    static const Mnemonic setcc = {"set", FORM_SETCC, 0, NULL};
+    static const Mnemonic jcc = {"j", FORM_JCC, 0, NULL};
+    const Mnemonic *conditional = NULL;
+    char *suffix = NULL;
+    if (strncmp(name, "set", 3) == 0) {
+        conditional = &setcc;
+        suffix = name + 3;
+    } else if (name[0] == 'j') {
+        conditional = &jcc;
+        suffix = name + 1;
+    }
+    if (conditional != NULL) {
+        for (size_t i = 0; i < NUM_CONDITIONS; i++) {
+            if (strcmp(CONDITIONS[i].name, suffix) == 0) {
+                *condition = CONDITIONS[i].code;
+                return conditional;
+            }
+        }
+    }
+
+    size_t length = strlen(name);
+    char last = length > 0 ? name[length - 1] : '\0';
+    if (last != 'l' && last != 'q') {
+        return NULL;
+    }
+    for (size_t i = 0; i < NUM_MNEMONICS; i++) {
+        if (strlen(MNEMONICS[i].name) == length - 1 &&
+            strncmp(MNEMONICS[i].name, name, length - 1) == 0) {
+            *suffix_size = last == 'l' ? 4 : 8;
+            return &MNEMONICS[i];
+        }
+    }
+    return NULL;
+}
+
+/* Add a jump or call to the label OPERAND. */
+static void add_branch(Assembler *as, ItemKind kind, int condition,
+                       Operand *operand) {
+    if (operand->kind != OPERAND_LABEL) {
+        assembler_error(as, "jumps and calls must be to a label");
+        return;
+    }
+
+    Item *item = add_item(as, kind);
+    item->condition = condition;
+    item->symbol = code_symbol(as, operand->label, operand->label_length);
+}
+
+static void assemble_instruction(Assembler *as, Instruction *instruction) {
+    int suffix_size, condition;
+    const Mnemonic *mnemonic =
+        find_mnemonic(instruction->name, &suffix_size, &condition);
+    if (mnemonic == NULL) {
+        assembler_error(as, "unknown instruction");
+        return;
+    }
+
+    Operand operands[MAX_OPERANDS];
+    int count = parse_operands(instruction->operands, operands);
+    if (count < 0) {
+        assembler_error(as, "can't parse operands");
+        return;
+    }
+
+    Form form = mnemonic->form;
+    int expected_count;
+    if (form == FORM_FIXED) {
+        expected_count = 0;
+    } else if (form == FORM_GROUP3 || form == FORM_PUSH || form == FORM_POP ||
+               form == FORM_SETCC || form == FORM_JMP || form == FORM_JCC ||
+               form == FORM_CALL || form == FORM_INT) {
+        expected_count = 1;
+    } else {
+        expected_count = 2;
+    }
+    if (count != expected_count) {
+        assembler_error(as, "wrong number of operands");
+        return;
+    }
+
+    if (form == FORM_JMP || form == FORM_JCC) {
+        add_branch(as, ITEM_BRANCH, condition, &operands[0]);
+        return;
+    } else if (form == FORM_CALL) {
+        add_branch(as, ITEM_CALL, ALWAYS, &operands[0]);
+        return;
+    }
+
+    Encoding encoding = {{0}, 0};
+    if (form == FORM_MOV || form == FORM_ALU || form == FORM_TEST ||
+        form == FORM_IMUL) {
+        int size = operand_size(as, operands, count, suffix_size);
+        if (size == 0) {
+            return;
+        }
+
+        if (form == FORM_MOV) {
+            encode_mov(as, &encoding, &operands[0], &operands[1], size);
+        } else if (form == FORM_ALU) {
+            encode_alu(as, &encoding, mnemonic->code, &operands[0],
+                       &operands[1], size);
+        } else if (form == FORM_TEST) {
+            encode_test(as, &encoding, &operands[0], &operands[1], size);
+        } else {
+            encode_imul(as, &encoding, &operands[0], &operands[1], size);
+        }
+
+    } else if (form == FORM_GROUP3) {
+        int size = operand_size(as, operands, count, suffix_size);
+        if (size == 0) {
+            return;
+        }
+        put_modrm(as, &encoding, size, "\xf7", mnemonic->code, &operands[0],
+                  false);
+
+    } else if (form == FORM_PUSH || form == FORM_POP) {
+        encode_push_pop(as, &encoding, form, &operands[0], suffix_size);
+
+    } else if (form == FORM_SETCC) {
+        Operand *dest = &operands[0];
+        if (dest->kind == OPERAND_REGISTER && dest->size != 1) {
+            assembler_error(as, "setcc needs a byte register");
+            return;
+        }
+        char opcode[] = {0x0f, 0x90 + condition, '\0'};
+        put_modrm(as, &encoding, 1, opcode, 0, dest, needs_rex(dest));
+
+    } else if (form == FORM_MOVZB) {
+        Operand *source = &operands[0];
+        Operand *dest = &operands[1];
+        if ((source->kind == OPERAND_REGISTER && source->size != 1) ||
+            dest->kind != OPERAND_REGISTER) {
+            assembler_error(as, "unsupported operands");
+            return;
+        }
+        int size = operand_size(as, dest, 1, suffix_size);
+        if (size == 0) {
+            return;
+        }
+        put_modrm(as, &encoding, size, "\x0f\xb6", dest->reg, source,
+                  needs_rex(source));
+
+    } else if (form == FORM_INT) {
+        if (operands[0].kind != OPERAND_IMMEDIATE || operands[0].value < 0 ||
+            operands[0].value > 255) {
+            assembler_error(as, "int needs a byte immediate");
+            return;
+        }
+        put_byte(&encoding, 0xcd);
+        put_byte(&encoding, operands[0].value);
+
+    } else {
+        put_bytes(&encoding, mnemonic->fixed, strlen(mnemonic->fixed));
+    }
+
+    Item *item = add_item(as, ITEM_BYTES);
+    item->encoding = encoding;
+}
+
+/* Handle .text and .global, the only directives we generate. */
+static void assemble_directive(Assembler *as, Instruction *instruction) {
+    char *text = instruction->name;
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+
+    if (strcmp(text, ".text") == 0) {
+        return;
+    }
+
+    char *name = NULL;
+    if (strncmp(text, ".global ", strlen(".global ")) == 0) {
+        name = text + strlen(".global ");
+    } else if (strncmp(text, ".globl ", strlen(".globl ")) == 0) {
+        name = text + strlen(".globl ");
+    }
+    if (name == NULL) {
+        assembler_error(as, "unsupported directive");
+        return;
+    }
+
+    while (isspace((unsigned char)*name)) {
+        name++;
+    }
+    int index = code_symbol(as, name, strlen(name));
+    CodeSymbol *symbol = list_get(as->machine_code->symbols, index);
+    symbol->global = true;
+}
+
+static int item_length(Item *item) {
+    if (item->kind == ITEM_BYTES) {
+        return item->encoding.length;
+    } else if (item->kind == ITEM_LABEL) {
+        return 0;
+    } else if (item->kind == ITEM_CALL) {
+        return 5;
+    } else if (!item->long_form) {
+        return 2;
+    }
+    return item->condition == ALWAYS ? 5 : 6;
+}
+
+/* Give every item an offset, using short jumps wherever they reach.
+ * Making a jump long only moves code further apart, so we repeat
+ * until no more jumps need to grow.
+ */
+static void layout_items(Assembler *as) {
+    List *symbols = as->machine_code->symbols;
+    bool changed;
+    do {
+        int offset = 0;
+        for (int i = 0; i < as->item_count; i++) {
+            Item *item = &as->items[i];
+            item->offset = offset;
+            if (item->kind == ITEM_LABEL) {
+                CodeSymbol *symbol = list_get(symbols, item->symbol);
+                symbol->offset = offset;
+            }
+            offset += item_length(item);
+        }
+
+        changed = false;
+        for (int i = 0; i < as->item_count; i++) {
+            Item *item = &as->items[i];
+            if (item->kind != ITEM_BRANCH || item->long_form) {
+                continue;
+            }
+
+            CodeSymbol *target = list_get(symbols, item->symbol);
+            if (target->offset < 0 ||
+                !fits_int8(target->offset - (item->offset + 2))) {
+                item->long_form = true;
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+/* Write the bytes of every item, filling in jump displacements. */
+static void emit_items(Assembler *as) {
+    MachineCode *machine_code = as->machine_code;
+    Buffer *code = &machine_code->code;
+
+    for (int i = 0; i < as->item_count; i++) {
+        Item *item = &as->items[i];
+        if (item->kind == ITEM_BYTES) {
+            buffer_append(code, item->encoding.bytes, item->encoding.length);
+            continue;
+        } else if (item->kind == ITEM_LABEL) {
+            continue;
+        }
+
+        Encoding encoding = {{0}, 0};
+        if (item->kind == ITEM_CALL) {
+            put_byte(&encoding, 0xe8);
+        } else if (!item->long_form) {
+            put_byte(&encoding,
+                     item->condition == ALWAYS ? 0xeb : 0x70 + item->condition);
+        } else if (item->condition == ALWAYS) {
+            put_byte(&encoding, 0xe9);
+        } else {
+            put_byte(&encoding, 0x0f);
+            put_byte(&encoding, 0x80 + item->condition);
+        }
+
+        // Displacements are from the end of the instruction.
+        int end = item->offset + item_length(item);
+        CodeSymbol *target = list_get(machine_code->symbols, item->symbol);
+        if (target->offset < 0) {
+            Relocation *relocation = malloc(sizeof(Relocation));
+            relocation->offset = item->offset + encoding.length;
+            relocation->symbol = item->symbol;
+            list_append(machine_code->relocations, relocation);
+            put_int32(&encoding, -4);
+        } else if (item->long_form || item->kind == ITEM_CALL) {
+            put_int32(&encoding, target->offset - end);
+        } else {
+            put_byte(&encoding, target->offset - end);
+        }
+
+        buffer_append(code, encoding.bytes, encoding.length);
+    }
+}
+
+/* Encode INSTRUCTIONS as machine code for TARGET. Returns NULL if
+ * there's anything we can't encode, which we've reported.
+ */
+MachineCode *assemble(List *instructions, Target *target) {
+    MachineCode *machine_code = malloc(sizeof(MachineCode));
+    machine_code->code = (Buffer){NULL, 0, 0};
+    machine_code->symbols = list_new();
+    machine_code->relocations = list_new();
+
+    Assembler as = {target, machine_code, NULL, 0, 0, NULL, 0, NULL, false};
+
+    for (int i = 0; i < list_length(instructions); i++) {
+        Instruction *instruction = list_get(instructions, i);
+        if (instruction->deleted) {
+            continue;
+        }
+        as.instruction = instruction;
+
+        if (instruction->type == INSTRUCTION) {
+            assemble_instruction(&as, instruction);
+
+        } else if (instruction->type == LABEL) {
+            char *name = instruction->name;
+            Item *item = add_item(&as, ITEM_LABEL);
+            item->symbol = code_symbol(&as, name, strlen(name));
+
+            CodeSymbol *symbol =
+                list_get(machine_code->symbols, item->symbol);
+            if (symbol->offset >= 0) {
+                assembler_error(&as, "label defined twice");
+            }
+            // Mark it defined until layout gives it a real offset.
+            symbol->offset = 0;
+
+        } else if (instruction->type == DIRECTIVE) {
+            assemble_directive(&as, instruction);
+        }
+    }
+
+    if (!as.failed) {
+        layout_items(&as);
+        emit_items(&as);
+    }
+
+    free(as.items);
+    free(as.symbol_indices);
+
+    if (as.failed) {
+        machine_code_free(machine_code);
+        return NULL;
+    }
+    return machine_code;
+}
+
+void machine_code_free(MachineCode *machine_code) {
+    for (int i = 0; i < list_length(machine_code->symbols); i++) {
+        CodeSymbol *symbol = list_get(machine_code->symbols, i);
+        free(symbol->name);
+        free(symbol);
+    }
+    list_free(machine_code->symbols);
+
+    for (int i = 0; i < list_length(machine_code->relocations); i++) {
+        free(list_get(machine_code->relocations, i));
+    }
+    list_free(machine_code->relocations);
+
+    free(machine_code->code.data);
+    free(machine_code);
+}
+
+/* The index of the symbol called NAME, or -1 if there isn't one. */
+int find_code_symbol(MachineCode *machine_code, char *name) {
+    for (int i = 0; i < list_length(machine_code->symbols); i++) {
+        CodeSymbol *symbol = list_get(machine_code->symbols, i);
+        if (strcmp(symbol->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,47 @@
+#ifndef MC_ASSEMBLER_H
+#define MC_ASSEMBLER_H
+
+#include <stdbool.h>
+
+#include "buffer.h"
+#include "list.h"
+#include "target.h"
+
+/* A label in the machine code. Labels we only reference, such as
+ * functions defined in another file, have an OFFSET of -1.
+ */
+typedef struct CodeSymbol {
+    char *name;
+    int offset;
+    bool global;
+} CodeSymbol;
+
+/* A 32-bit PC-relative field at OFFSET in the code that must be
+ * pointed at SYMBOL by the linker. The field holds the addend -4, as
+ * the i386 psABI expects.
+ */
+typedef struct Relocation {
+    int offset;
+    // An index into MachineCode.symbols.
+    int symbol;
+} Relocation;
+
+/******************************************************************************
+ *
+ * The result of assembling the Instructions of one file: the bytes
+ * of its .text section and what we need to link them.
+ *
+ ******************************************************************************/
+typedef struct MachineCode {
+    Buffer code;
+    // CodeSymbol*, in the order they were first mentioned.
+    List *symbols;
+    // Relocation*, for references to symbols we didn't define.
+    List *relocations;
+} MachineCode;
+
+MachineCode *assemble(List *instructions, Target *target);
+void machine_code_free(MachineCode *machine_code);
+int find_code_symbol(MachineCode *machine_code, char *name);
+
+#endif
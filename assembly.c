@@ -6,34 +6,39 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "assembler.h"
+#include "assembly.h"
 #include "env.h"
 #include "context.h"
+#include "elf_writer.h"
+#include "instructions.h"
+#include "ir.h"
+#include "list.h"
+#include "options.h"
+#include "peephole.h"
+#include "regalloc.h"
 #include "syntax.h"
+#include "target.h"
+#include "timing.h"
 
-static const int WORD_SIZE = 4;
-const int MAX_MNEMONIC_LENGTH = 7;
+// Enough for any register or -N(%rbp) operand.
+#define MAX_OPERAND_LENGTH 32
 
-void emit_header(FILE *out, char *name) { fprintf(out, "%s\n", name); }
+void emit_header(List *out, char *name) {
+    list_append(out, instruction_new(DIRECTIVE, name, ""));
+}
+
+void emit_blank_line(List *out) {
+    list_append(out, instruction_new(BLANK_LINE, "", ""));
+}
 
 /* Write instruction INSTR with OPERANDS to OUT.
  *
  * Example:
  * emit_instr(out, "MOV", "%eax, 1");
  */
-void emit_instr(FILE *out, char *instr, char *operands) {
-    // TODO: fix duplication with emit_instr_format.
-    // The assembler requires at least 4 spaces for indentation.
-    fprintf(out, "    %s", instr);
-
-    // Ensure our argument are aligned, regardless of the assembly
-    // mnemonic length.
-    int argument_offset = MAX_MNEMONIC_LENGTH - strlen(instr) + 4;
-    while (argument_offset > 0) {
-        fprintf(out, " ");
-        argument_offset--;
-    }
-
-    fprintf(out, "%s\n", operands);
+void emit_instr(List *out, char *instr, char *operands) {
+    list_append(out, instruction_new(INSTRUCTION, instr, operands));
 }
 
 /* Write instruction INSTR with formatted operands OPERANDS_FORMAT to
@@ -42,24 +47,26 @@ void emit_instr(FILE *out, char *instr, char *operands) {
  * Example:
  * emit_instr_format(out, "MOV", "%%eax, %s", 5);
  */
-void emit_instr_format(FILE *out, char *instr, char *operands_format, ...) {
-    // The assembler requires at least 4 spaces for indentation.
-    fprintf(out, "    %s", instr);
+void emit_instr_format(List *out, char *instr, char *operands_format, ...) {
+    // Operands almost always fit here, so we format them only once.
+    char operands[4 * MAX_OPERAND_LENGTH];
+    va_list argptr;
+    va_start(argptr, operands_format);
+    int length = vsnprintf(operands, sizeof(operands), operands_format, argptr);
+    va_end(argptr);
 
-    // Ensure our argument are aligned, regardless of the assembly
-    // mnemonic length.
-    int argument_offset = MAX_MNEMONIC_LENGTH - strlen(instr) + 4;
-    while (argument_offset > 0) {
-        fprintf(out, " ");
-        argument_offset--;
+    if ((size_t)length < sizeof(operands)) {
+        emit_instr(out, instr, operands);
+        return;
     }
 
-    va_list argptr;
+    char *long_operands = malloc(length + 1);
     va_start(argptr, operands_format);
-    vfprintf(out, operands_format, argptr);
+    vsnprintf(long_operands, length + 1, operands_format, argptr);
     va_end(argptr);
 
-    fputs("\n", out);
+    emit_instr(out, instr, long_operands);
+    free(long_operands);
 }
 
 char *fresh_local_label(char *prefix, Context *ctx) {
@@ -73,44 +80,735 @@ char *fresh_local_label(char *prefix, Context *ctx) {
     return buffer;
 }
 
-void emit_label(FILE *out, char *label) { fprintf(out, "%s:\n", label); }
+void emit_label(List *out, char *label) {
+    list_append(out, instruction_new(LABEL, label, ""));
+}
+
+void emit_function_declaration(List *out, char *name) {
+    char *directive = malloc(strlen(name) + strlen("    .global ") + 1);
+    sprintf(directive, "    .global %s", name);
+    emit_header(out, directive);
+    free(directive);
 
-void emit_function_declaration(FILE *out, char *name) {
-    fprintf(out, "    .global %s\n", name);
-    fprintf(out, "%s:\n", name);
+    emit_label(out, name);
 }
 
-void emit_function_prologue(FILE *out) {
-    emit_instr(out, "pushl", "%ebp");
-    emit_instr(out, "mov", "%esp, %ebp");
-    fprintf(out, "\n");
+void emit_function_prologue(List *out, Target *target) {
+    emit_instr(out, target->push, target->frame_pointer);
+    emit_instr_format(out, "mov", "%s, %s", target->stack_pointer,
+                      target->frame_pointer);
+    emit_blank_line(out);
 }
 
-void emit_return(FILE *out) {
-    fprintf(out, "    leave\n");
-    fprintf(out, "    ret\n");
+/* Push the callee-saved registers this function clobbers. They sit
+ * directly below the saved frame pointer, so locals start after them.
+ */
+void emit_save_registers(List *out, Context *ctx) {
+    RegAlloc *regalloc = ctx->regalloc;
+    for (int i = 0; i < regalloc->saved_count; i++) {
+        emit_instr(out, "push",
+                   register_full_name(regalloc->saved[i], regalloc->arch));
+        ctx->stack_offset -= ctx->target->word_size;
+    }
 }
 
-void emit_function_epilogue(FILE *out) {
-    emit_return(out);
-    fprintf(out, "\n");
+/* Restore the callee-saved registers and pop our stack frame. */
+void emit_leave(List *out, Context *ctx) {
+    if (ctx->regalloc != NULL) {
+        RegAlloc *regalloc = ctx->regalloc;
+        for (int i = 0; i < regalloc->saved_count; i++) {
+            emit_instr_format(
+                out, "mov", "%d(%s), %s", -1 * ctx->target->word_size * (i + 1),
+                ctx->target->frame_pointer,
+                register_full_name(regalloc->saved[i], regalloc->arch));
+        }
+    }
+
+    emit_instr(out, "leave", "");
 }
 
-void write_header(FILE *out) { emit_header(out, "    .text"); }
+void emit_return(List *out, Context *ctx) {
+    emit_leave(out, ctx);
+    emit_instr(out, "ret", "");
+}
+
+void emit_function_epilogue(List *out, Context *ctx) {
+    emit_return(out, ctx);
+    emit_blank_line(out);
+}
 
-void write_footer(FILE *out) {
+void write_header(List *out) { emit_header(out, "    .text"); }
+
+void write_footer(List *out, Target *target) {
     // TODO: this will break if a user defines a function called '_start'.
     emit_function_declaration(out, "_start");
-    emit_function_prologue(out);
+    emit_function_prologue(out, target);
     emit_instr(out, "call", "main");
-    emit_instr(out, "mov", "%eax, %ebx");
-    emit_instr(out, "mov", "$1, %eax");
-    emit_instr(out, "int", "$0x80");
+
+    if (target->arch == TARGET_X86_64) {
+        // exit(2) is syscall 60, taking its status in %edi.
+        emit_instr(out, "mov", "%eax, %edi");
+        emit_instr(out, "mov", "$60, %eax");
+        emit_instr(out, "syscall", "");
+    } else {
+        emit_instr(out, "mov", "%eax, %ebx");
+        emit_instr(out, "mov", "$1, %eax");
+        emit_instr(out, "int", "$0x80");
+    }
+}
+
+bool is_expression(Syntax *syntax) {
+    return syntax->type == IMMEDIATE || syntax->type == VARIABLE ||
+           syntax->type == UNARY_OPERATOR || syntax->type == BINARY_OPERATOR ||
+           syntax->type == ASSIGNMENT || syntax->type == FUNCTION_CALL;
+}
+
+/* Write the operand for variable VAR_NAME to BUFFER: its register
+ * if it has one, otherwise its stack slot.
+ */
+void format_variable(char *buffer, Symbol var_name, Context *ctx) {
+    Register reg = regalloc_local_register(ctx->regalloc, var_name);
+    if (reg != NO_REGISTER) {
+        snprintf(buffer, MAX_OPERAND_LENGTH, "%s", register_name(reg));
+    } else {
+        snprintf(buffer, MAX_OPERAND_LENGTH, "%d(%s)",
+                 environment_get_offset(ctx->env, var_name),
+                 ctx->target->frame_pointer);
+    }
+}
+
+/* Write the source operand for a leaf expression (see
+ * is_direct_operand) to BUFFER.
+ */
+void format_operand(char *buffer, Syntax *syntax, Context *ctx) {
+    if (syntax->type == IMMEDIATE) {
+        snprintf(buffer, MAX_OPERAND_LENGTH, "$%d", syntax->immediate->value);
+    } else {
+        format_variable(buffer, syntax->variable->var_name, ctx);
+    }
+}
+
+// The System V x86-64 ABI passes the first six integer arguments in
+// these registers, and the rest on the stack. On i386 every argument
+// goes on the stack.
+static const Register ARGUMENT_REGISTERS[] = {EDI, ESI, EDX, ECX, R8, R9};
+
+int argument_register_count(Target *target) {
+    return target->arch == TARGET_X86_64 ? 6 : 0;
+}
+
+List *call_arguments(Syntax *syntax) {
+    return syntax->function_call->function_arguments->function_arguments
+        ->arguments;
+}
+
+/* Write the operand where a callee finds its argument I to BUFFER:
+ * its argument register, or its stack slot. Stack arguments are
+ * pushed right to left, so they sit in order above the saved frame
+ * pointer and the return address.
+ */
+void format_incoming_argument(char *buffer, int i, Context *ctx) {
+    int register_count = argument_register_count(ctx->target);
+    if (i < register_count) {
+        snprintf(buffer, MAX_OPERAND_LENGTH, "%s",
+                 register_name(ARGUMENT_REGISTERS[i]));
+    } else {
+        snprintf(buffer, MAX_OPERAND_LENGTH, "%d(%s)",
+                 (2 + i - register_count) * ctx->target->word_size,
+                 ctx->target->frame_pointer);
+    }
+}
+
+/* Pop the arguments that didn't fit in registers after a call with
+ * ARGUMENT_COUNT arguments.
+ */
+void emit_stack_arguments_cleanup(List *out, int argument_count,
+                                  Context *ctx) {
+    int register_count = argument_register_count(ctx->target);
+    if (argument_count <= register_count) {
+        return;
+    }
+
+    emit_instr_format(out, "add", "$%d, %s",
+                      (argument_count - register_count) *
+                          ctx->target->word_size,
+                      ctx->target->stack_pointer);
+}
+
+/* Evaluate the arguments of FUNCTION_CALL SYNTAX into fresh frame
+ * slots, returning their offsets from the frame pointer. The caller
+ * must free the result, and releases the slots by restoring
+ * ctx->stack_offset.
+ */
+int *write_argument_slots(List *out, Syntax *syntax, Context *ctx) {
+    Target *target = ctx->target;
+    List *arguments = call_arguments(syntax);
+    int argument_count = list_length(arguments);
+    int *offsets = malloc(argument_count * sizeof(int));
+
+    for (int i = 0; i < argument_count; i++) {
+        offsets[i] = ctx->stack_offset;
+        ctx->stack_offset -= target->word_size;
+
+        write_syntax(out, list_get(arguments, i), ctx);
+        emit_instr_format(out, "mov", "%%eax, %d(%s)", offsets[i],
+                          target->frame_pointer);
+    }
+
+    return offsets;
+}
+
+/* Evaluate the arguments of FUNCTION_CALL SYNTAX and put them where
+ * the callee expects them.
+ */
+void write_arguments(List *out, Syntax *syntax, Context *ctx) {
+    Target *target = ctx->target;
+    int argument_count = list_length(call_arguments(syntax));
+    int register_count = argument_register_count(target);
+    int stack_offset = ctx->stack_offset;
+    int *offsets = write_argument_slots(out, syntax, ctx);
+
+    for (int i = argument_count - 1; i >= register_count; i--) {
+        emit_instr_format(out, target->push, "%d(%s)", offsets[i],
+                          target->frame_pointer);
+    }
+    for (int i = 0; i < argument_count && i < register_count; i++) {
+        emit_instr_format(out, "mov", "%d(%s), %s", offsets[i],
+                          target->frame_pointer,
+                          register_name(ARGUMENT_REGISTERS[i]));
+    }
+
+    ctx->stack_offset = stack_offset;
+    free(offsets);
 }
 
-void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
-    // Note stack_offset is the next unused memory address in the
-    // stack, so we can use it directly but must adjust it for the next caller.
+/* Bind the parameters of FUNCTION SYNTAX: to the register the
+ * allocator gave them, or else to their stack slot. Parameters passed
+ * in registers are stored in the frame, so calls don't clobber them.
+ */
+void emit_parameters(List *out, Syntax *syntax, Context *ctx) {
+    Target *target = ctx->target;
+    List *parameters = syntax->function->parameters;
+    char incoming[MAX_OPERAND_LENGTH];
+
+    for (int i = 0; i < list_length(parameters); i++) {
+        Parameter *parameter = list_get(parameters, i);
+        format_incoming_argument(incoming, i, ctx);
+
+        Register reg = NO_REGISTER;
+        if (ctx->regalloc != NULL) {
+            reg = regalloc_local_register(ctx->regalloc, parameter->name);
+        }
+
+        if (reg != NO_REGISTER) {
+            emit_instr_format(out, "mov", "%s, %s", incoming,
+                              register_name(reg));
+        } else if (i < argument_register_count(target)) {
+            emit_instr_format(out, "mov", "%s, %d(%s)",
+                              register_name(ARGUMENT_REGISTERS[i]),
+                              ctx->stack_offset, target->frame_pointer);
+            environment_set_offset(ctx->env, parameter->name,
+                                   ctx->stack_offset);
+            ctx->stack_offset -= target->word_size;
+        } else {
+            environment_set_offset(ctx->env, parameter->name,
+                                   (2 + i - argument_register_count(target)) *
+                                       target->word_size);
+        }
+    }
+}
+
+/* Can we make a call with ARGUMENT_COUNT arguments from the current
+ * function by jumping to the callee? Our caller pops the stack
+ * arguments it pushed for us, so the callee's must fit in their place.
+ */
+bool can_tail_call(int argument_count, Context *ctx) {
+    if (ctx->options->opt_level < 1) {
+        return false;
+    }
+    return argument_count <= argument_register_count(ctx->target) ||
+           argument_count <= ctx->parameter_count;
+}
+
+/* Call FUNCTION_NAME in tail position, with its ARGUMENT_COUNT
+ * arguments in the stack slots at OFFSETS. We move the arguments to
+ * where our own arrived, then either jump back to the start of this
+ * function, or drop our frame and jump to the callee so it returns
+ * straight to our caller. Either way the stack doesn't grow.
+ */
+void emit_tail_call(List *out, char *function_name, int *offsets,
+                    int argument_count, Context *ctx) {
+    Target *target = ctx->target;
+    char incoming[MAX_OPERAND_LENGTH];
+
+    for (int i = 0; i < argument_count; i++) {
+        format_incoming_argument(incoming, i, ctx);
+        if (i < argument_register_count(target)) {
+            emit_instr_format(out, "mov", "%d(%s), %s", offsets[i],
+                              target->frame_pointer, incoming);
+        } else {
+            emit_instr_format(out, "mov", "%d(%s), %%eax", offsets[i],
+                              target->frame_pointer);
+            emit_instr_format(out, "mov", "%%eax, %s", incoming);
+        }
+    }
+
+    if (strcmp(function_name, ctx->function_name) == 0) {
+        // The frame is reserved before the entry label and nothing is
+        // pushed between statements, so the stack pointer is already
+        // where the entry label expects it.
+        emit_instr(out, "jmp", ctx->entry_label);
+        return;
+    }
+
+    emit_leave(out, ctx);
+    emit_instr(out, "jmp", function_name);
+}
+
+/* Write RETURN_STATEMENT SYNTAX, whose value is a call we can make
+ * with a jump (see can_tail_call).
+ */
+void write_tail_call(List *out, Syntax *syntax, Context *ctx) {
+    Syntax *call = syntax->return_statement->expression;
+    int stack_offset = ctx->stack_offset;
+    int *offsets = write_argument_slots(out, call, ctx);
+    emit_tail_call(out, symbol_name(call->function_call->function_name),
+                   offsets, list_length(call_arguments(call)), ctx);
+    ctx->stack_offset = stack_offset;
+    free(offsets);
+}
+
+/* Lay out the frame slots write_syntax needs for SYNTAX, when DEPTH
+ * slots are already in use. We update MAX_DEPTH with the most slots
+ * in use at once, and return how many are still in use afterwards.
+ *
+ * This must mirror write_syntax: temporaries are released once their
+ * expression is written, and locals at the end of their block, so
+ * later statements reuse the same slots.
+ */
+int layout_frame_slots(Syntax *syntax, int depth, int *max_depth,
+                       Context *ctx) {
+    if (depth > *max_depth) {
+        *max_depth = depth;
+    }
+
+    if (ctx->regalloc != NULL && is_expression(syntax)) {
+        // write_expression spills with balanced pushes and pops.
+        return depth;
+    }
+
+    if (syntax->type == UNARY_OPERATOR) {
+        layout_frame_slots(syntax->unary_expression->expression, depth,
+                           max_depth, ctx);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        // The left operand waits in a slot while we evaluate the right.
+        layout_frame_slots(syntax->binary_expression->left, depth + 1,
+                           max_depth, ctx);
+        layout_frame_slots(syntax->binary_expression->right, depth + 1,
+                           max_depth, ctx);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        layout_frame_slots(syntax->assignment->expression, depth, max_depth,
+                           ctx);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            layout_frame_slots(list_get(arguments, i), depth + i + 1,
+                               max_depth, ctx);
+        }
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        Syntax *expression = syntax->return_statement->expression;
+        if (expression->type == FUNCTION_CALL &&
+            can_tail_call(list_length(call_arguments(expression)), ctx)) {
+            // write_argument_slots uses slots even with registers.
+            List *arguments = call_arguments(expression);
+            for (int i = 0; i < list_length(arguments); i++) {
+                layout_frame_slots(list_get(arguments, i), depth + i + 1,
+                                   max_depth, ctx);
+            }
+        } else {
+            layout_frame_slots(expression, depth, max_depth, ctx);
+        }
+
+    } else if (syntax->type == IF_STATEMENT) {
+        layout_frame_slots(syntax->if_statement->condition, depth,
+                           max_depth, ctx);
+        return layout_frame_slots(syntax->if_statement->then, depth,
+                                  max_depth, ctx);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        layout_frame_slots(syntax->while_statement->condition, depth,
+                           max_depth, ctx);
+        return layout_frame_slots(syntax->while_statement->body, depth,
+                                  max_depth, ctx);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+        if (ctx->regalloc != NULL &&
+            regalloc_local_register(ctx->regalloc,
+                                    define_var_statement->var_name) !=
+                NO_REGISTER) {
+            layout_frame_slots(define_var_statement->init_value, depth,
+                               max_depth, ctx);
+            return depth;
+        }
+
+        layout_frame_slots(define_var_statement->init_value, depth + 1,
+                           max_depth, ctx);
+        return depth + 1;
+
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        int block_depth = depth;
+        for (int i = 0; i < list_length(statements); i++) {
+            block_depth = layout_frame_slots(list_get(statements, i),
+                                             block_depth, max_depth, ctx);
+        }
+    }
+
+    return depth;
+}
+
+/* How many slots FUNCTION SYNTAX needs in its frame, below the
+ * callee-saved registers: one for each parameter we store, plus the
+ * most its body uses at once.
+ */
+int frame_slot_count(Syntax *syntax, Context *ctx) {
+    List *parameters = syntax->function->parameters;
+    int depth = 0;
+    for (int i = 0; i < list_length(parameters) &&
+                    i < argument_register_count(ctx->target);
+         i++) {
+        Parameter *parameter = list_get(parameters, i);
+        if (ctx->regalloc == NULL ||
+            regalloc_local_register(ctx->regalloc, parameter->name) ==
+                NO_REGISTER) {
+            depth++;
+        }
+    }
+
+    int max_depth = depth;
+    layout_frame_slots(syntax->function->root_block, depth, &max_depth, ctx);
+    return max_depth;
+}
+
+/* Set TARGET to 1 if condition code SETCC holds, 0 otherwise. SETcc
+ * needs a byte register, which %esi and %edi don't have on i386.
+ */
+void emit_set_condition(List *out, char *setcc, Register target,
+                        Context *ctx) {
+    TargetArch arch = ctx->regalloc->arch;
+    char *target_name = register_name(target);
+    char *byte_name = register_byte_name(target, arch);
+
+    if (byte_name != NULL) {
+        emit_instr(out, setcc, byte_name);
+        emit_instr_format(out, "movzbl", "%s, %s", byte_name, target_name);
+        return;
+    }
+
+    Register scratch = regalloc_acquire_byte(ctx->regalloc);
+    if (scratch != NO_REGISTER) {
+        emit_instr(out, setcc, register_byte_name(scratch, arch));
+        emit_instr_format(out, "movzbl", "%s, %s",
+                          register_byte_name(scratch, arch), target_name);
+        regalloc_release(ctx->regalloc, scratch);
+    } else {
+        // PUSH and POP leave the flags alone.
+        emit_instr(out, "push", register_full_name(EAX, arch));
+        emit_instr(out, setcc, "%al");
+        emit_instr_format(out, "movzbl", "%%al, %s", target_name);
+        emit_instr(out, "pop", register_full_name(EAX, arch));
+    }
+}
+
+/* Write TARGET = TARGET op SOURCE, or TARGET = SOURCE op TARGET if
+ * REVERSED. If FLAGS_ONLY, a comparison only sets the flags for a
+ * conditional jump, and leaves TARGET unchanged.
+ */
+void emit_binary_operation(List *out, BinaryExpressionType binary_type,
+                           char *source, Register target, bool reversed,
+                           bool flags_only, Context *ctx) {
+    char *target_name = register_name(target);
+
+    if (binary_type == MULTIPLICATION) {
+        // Unlike MULL, the two operand IMUL leaves %edx alone.
+        emit_instr_format(out, "imul", "%s, %s", source, target_name);
+
+    } else if (binary_type == ADDITION) {
+        emit_instr_format(out, "add", "%s, %s", source, target_name);
+
+    } else if (binary_type == SUBTRACTION) {
+        if (reversed) {
+            emit_instr(out, "neg", target_name);
+            emit_instr_format(out, "add", "%s, %s", source, target_name);
+        } else {
+            emit_instr_format(out, "sub", "%s, %s", source, target_name);
+        }
+
+    } else if (binary_type == LESS_THAN || binary_type == LESS_THAN_OR_EQUAL) {
+        // CMP y,x sets the flags for x - y.
+        if (reversed) {
+            emit_instr_format(out, "cmp", "%s, %s", target_name, source);
+        } else {
+            emit_instr_format(out, "cmp", "%s, %s", source, target_name);
+        }
+        if (flags_only) {
+            return;
+        }
+        emit_set_condition(out, binary_type == LESS_THAN ? "setl" : "setle",
+                           target, ctx);
+    }
+}
+
+void write_expression(List *out, Syntax *syntax, Register target,
+                      Context *ctx);
+
+/* Evaluate the arguments of FUNCTION_CALL SYNTAX using register
+ * SCRATCH. We push them right to left, so the ones that don't fit in
+ * registers end up in order on the stack, then pop the first six into
+ * their registers on x86-64.
+ */
+void write_call_arguments(List *out, Syntax *syntax, Register scratch,
+                          Context *ctx) {
+    TargetArch arch = ctx->regalloc->arch;
+    List *arguments = call_arguments(syntax);
+
+    for (int i = list_length(arguments) - 1; i >= 0; i--) {
+        write_expression(out, list_get(arguments, i), scratch, ctx);
+        emit_instr(out, "push", register_full_name(scratch, arch));
+    }
+    for (int i = 0; i < list_length(arguments) &&
+                    i < argument_register_count(ctx->target);
+         i++) {
+        emit_instr(out, "pop", register_full_name(ARGUMENT_REGISTERS[i], arch));
+    }
+}
+
+/* Evaluate BINARY_SYNTAX into register TARGET, as write_expression
+ * does. If FLAGS_ONLY, BINARY_SYNTAX is a comparison and we only set
+ * the flags.
+ */
+void write_binary_expression(List *out, BinaryExpression *binary_syntax,
+                             Register target, bool flags_only,
+                             Context *ctx) {
+    TargetArch arch = ctx->regalloc->arch;
+    char operand[MAX_OPERAND_LENGTH];
+
+    if (is_direct_operand(binary_syntax->right)) {
+        write_expression(out, binary_syntax->left, target, ctx);
+        format_operand(operand, binary_syntax->right, ctx);
+        emit_binary_operation(out, binary_syntax->binary_type, operand,
+                              target, false, flags_only, ctx);
+        return;
+    }
+
+    bool right_first = register_need(binary_syntax->right) >
+                       register_need(binary_syntax->left);
+    Syntax *first = right_first ? binary_syntax->right : binary_syntax->left;
+    Syntax *second =
+        right_first ? binary_syntax->left : binary_syntax->right;
+
+    write_expression(out, first, target, ctx);
+
+    // CMP can't take an immediate as its second operand.
+    bool is_comparison = binary_syntax->binary_type == LESS_THAN ||
+                         binary_syntax->binary_type == LESS_THAN_OR_EQUAL;
+    if (is_direct_operand(second) &&
+        !(is_comparison && second->type == IMMEDIATE)) {
+        format_operand(operand, second, ctx);
+        emit_binary_operation(out, binary_syntax->binary_type, operand,
+                              target, right_first, flags_only, ctx);
+        return;
+    }
+
+    Register temp = regalloc_acquire(ctx->regalloc);
+    if (temp == NO_REGISTER) {
+        // Out of registers: keep the first operand on the stack.
+        char spill[MAX_OPERAND_LENGTH];
+        snprintf(spill, MAX_OPERAND_LENGTH, "(%s)",
+                 ctx->target->stack_pointer);
+
+        emit_instr(out, "push", register_full_name(target, arch));
+        write_expression(out, second, target, ctx);
+        emit_binary_operation(out, binary_syntax->binary_type, spill,
+                              target, !right_first, flags_only, ctx);
+        if (flags_only) {
+            // Unlike ADD, POP leaves the flags alone, and TARGET is
+            // free again.
+            emit_instr(out, "pop", register_full_name(target, arch));
+        } else {
+            emit_instr_format(out, "add", "$%d, %s", ctx->target->word_size,
+                              ctx->target->stack_pointer);
+        }
+    } else {
+        write_expression(out, second, temp, ctx);
+        emit_binary_operation(out, binary_syntax->binary_type,
+                              register_name(temp), target, right_first,
+                              flags_only, ctx);
+        regalloc_release(ctx->regalloc, temp);
+    }
+}
+
+/* Evaluate expression SYNTAX into register TARGET, which the caller
+ * has already reserved. Temporaries come from ctx->regalloc, and we
+ * evaluate the subtree with the larger Sethi-Ullman number first so
+ * we need as few as possible. If we run out, we spill to the stack.
+ */
+void write_expression(List *out, Syntax *syntax, Register target,
+                      Context *ctx) {
+    TargetArch arch = ctx->regalloc->arch;
+    char *target_name = register_name(target);
+    char operand[MAX_OPERAND_LENGTH];
+
+    if (syntax->type == IMMEDIATE) {
+        emit_instr_format(out, "mov", "$%d, %s", syntax->immediate->value,
+                          target_name);
+
+    } else if (syntax->type == VARIABLE) {
+        format_variable(operand, syntax->variable->var_name, ctx);
+        if (strcmp(operand, target_name) != 0) {
+            emit_instr_format(out, "mov", "%s, %s", operand, target_name);
+        }
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        write_expression(out, unary_syntax->expression, target, ctx);
+
+        if (unary_syntax->unary_type == BITWISE_NEGATION) {
+            emit_instr(out, "not", target_name);
+        } else {
+            emit_instr_format(out, "test", "%s, %s", target_name, target_name);
+            emit_set_condition(out, "setz", target, ctx);
+        }
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        write_binary_expression(out, syntax->binary_expression, target, false,
+                                ctx);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        write_expression(out, syntax->assignment->expression, target, ctx);
+
+        format_variable(operand, syntax->assignment->var_name, ctx);
+        if (strcmp(operand, target_name) != 0) {
+            emit_instr_format(out, "mov", "%s, %s", target_name, operand);
+        }
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        // The callee may clobber the caller-saved registers.
+        Register live[NUM_REGISTERS];
+        int live_count = 0;
+        for (Register reg = EAX; reg < NUM_REGISTERS; reg++) {
+            if (ctx->regalloc->busy[reg] && reg != target &&
+                !register_is_callee_saved(reg, arch)) {
+                emit_instr(out, "push", register_full_name(reg, arch));
+                live[live_count++] = reg;
+            }
+        }
+
+        write_call_arguments(out, syntax, target, ctx);
+
+        emit_instr_format(out, "call",
+                          symbol_name(syntax->function_call->function_name));
+        if (target != EAX) {
+            emit_instr_format(out, "mov", "%%eax, %s", target_name);
+        }
+        emit_stack_arguments_cleanup(out, list_length(call_arguments(syntax)),
+                                     ctx);
+
+        while (live_count > 0) {
+            emit_instr(out, "pop",
+                       register_full_name(live[--live_count], arch));
+        }
+
+    } else {
+        warnx("Unknown expression %s", syntax_type_name(syntax));
+        assert(false);
+    }
+}
+
+/* Set the flags by comparing the operands of the comparison
+ * BINARY_SYNTAX, for a conditional jump.
+ */
+void write_comparison(List *out, BinaryExpression *binary_syntax,
+                      Context *ctx) {
+    Target *target = ctx->target;
+
+    if (ctx->regalloc != NULL) {
+        ctx->regalloc->busy[EAX] = true;
+        write_binary_expression(out, binary_syntax, EAX, true, ctx);
+        regalloc_release(ctx->regalloc, EAX);
+        return;
+    }
+
+    int stack_offset = ctx->stack_offset;
+    ctx->stack_offset -= target->word_size;
+
+    write_syntax(out, binary_syntax->left, ctx);
+    emit_instr_format(out, "mov", "%%eax, %d(%s)", stack_offset,
+                      target->frame_pointer);
+
+    write_syntax(out, binary_syntax->right, ctx);
+    emit_instr_format(out, "cmp", "%%eax, %d(%s)", stack_offset,
+                      target->frame_pointer);
+    ctx->stack_offset = stack_offset;
+}
+
+/* Jump to LABEL if CONDITION is JUMP_IF, and fall through otherwise.
+ * Comparisons branch on the flags CMP sets, without computing a 0 or
+ * 1 first.
+ */
+void write_condition_jump(List *out, Syntax *condition, bool jump_if,
+                          char *label, Context *ctx) {
+    if (condition->type == UNARY_OPERATOR &&
+        condition->unary_expression->unary_type == LOGICAL_NEGATION) {
+        write_condition_jump(out, condition->unary_expression->expression,
+                             !jump_if, label, ctx);
+
+    } else if (condition->type == IMMEDIATE) {
+        if ((condition->immediate->value != 0) == jump_if) {
+            emit_instr(out, "jmp", label);
+        }
+
+    } else if (condition->type == BINARY_OPERATOR &&
+               (condition->binary_expression->binary_type == LESS_THAN ||
+                condition->binary_expression->binary_type ==
+                    LESS_THAN_OR_EQUAL)) {
+        bool less_than =
+            condition->binary_expression->binary_type == LESS_THAN;
+        write_comparison(out, condition->binary_expression, ctx);
+
+        if (jump_if) {
+            emit_instr(out, less_than ? "jl" : "jle", label);
+        } else {
+            emit_instr(out, less_than ? "jge" : "jg", label);
+        }
+
+    } else {
+        write_syntax(out, condition, ctx);
+        emit_instr(out, "test", "%eax, %eax");
+        emit_instr(out, jump_if ? "jnz" : "jz", label);
+    }
+}
+
+void write_syntax(List *out, Syntax *syntax, Context *ctx) {
+    Target *target = ctx->target;
+
+    if (ctx->regalloc != NULL && is_expression(syntax)) {
+        // Statement level expressions leave their value in %eax.
+        ctx->regalloc->busy[EAX] = true;
+        write_expression(out, syntax, EAX, ctx);
+        regalloc_release(ctx->regalloc, EAX);
+        return;
+    }
+
+    // Note stack_offset is the next unused slot in the frame, so we can
+    // use it directly but must adjust it for the next caller. The
+    // prologue reserves the whole frame (see frame_slot_count), so
+    // taking a slot needs no instructions.
     if (syntax->type == UNARY_OPERATOR) {
         UnaryExpression *unary_syntax = syntax->unary_expression;
 
@@ -127,34 +825,40 @@ void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
 
     } else if (syntax->type == VARIABLE) {
         emit_instr_format(
-            out, "mov", "%d(%%ebp), %%eax",
-            environment_get_offset(ctx->env, syntax->variable->var_name));
+            out, "mov", "%d(%s), %%eax",
+            environment_get_offset(ctx->env, syntax->variable->var_name),
+            target->frame_pointer);
 
     } else if (syntax->type == BINARY_OPERATOR) {
         BinaryExpression *binary_syntax = syntax->binary_expression;
         int stack_offset = ctx->stack_offset;
-        ctx->stack_offset -= WORD_SIZE;
+        ctx->stack_offset -= target->word_size;
 
-        emit_instr(out, "sub", "$4, %esp");
         write_syntax(out, binary_syntax->left, ctx);
-        emit_instr_format(out, "mov", "%%eax, %d(%%ebp)", stack_offset);
+        emit_instr_format(out, "mov", "%%eax, %d(%s)", stack_offset,
+                          target->frame_pointer);
 
         write_syntax(out, binary_syntax->right, ctx);
 
         if (binary_syntax->binary_type == MULTIPLICATION) {
-            emit_instr_format(out, "mull", "%d(%%ebp)", stack_offset);
+            emit_instr_format(out, "mull", "%d(%s)", stack_offset,
+                              target->frame_pointer);
 
         } else if (binary_syntax->binary_type == ADDITION) {
-            emit_instr_format(out, "add", "%d(%%ebp), %%eax", stack_offset);
+            emit_instr_format(out, "add", "%d(%s), %%eax", stack_offset,
+                              target->frame_pointer);
 
         } else if (binary_syntax->binary_type == SUBTRACTION) {
-            emit_instr_format(out, "sub", "%%eax, %d(%%ebp)", stack_offset);
-            emit_instr_format(out, "mov", "%d(%%ebp), %%eax", stack_offset);
+            emit_instr_format(out, "sub", "%%eax, %d(%s)", stack_offset,
+                              target->frame_pointer);
+            emit_instr_format(out, "mov", "%d(%s), %%eax", stack_offset,
+                              target->frame_pointer);
 
         } else if (binary_syntax->binary_type == LESS_THAN) {
             // To compare x < y in AT&T syntax, we write CMP y,x.
             // http://stackoverflow.com/q/25493255/509706
-            emit_instr_format(out, "cmp", "%%eax, %d(%%ebp)", stack_offset);
+            emit_instr_format(out, "cmp", "%%eax, %d(%s)", stack_offset,
+                              target->frame_pointer);
             // Set the low byte of %eax to 0 or 1 depending on whether
             // it was less than.
             emit_instr(out, "setl", "%al");
@@ -164,7 +868,8 @@ void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
         } else if (binary_syntax->binary_type == LESS_THAN_OR_EQUAL) {
             // To compare x < y in AT&T syntax, we write CMP y,x.
             // http://stackoverflow.com/q/25493255/509706
-            emit_instr_format(out, "cmp", "%%eax, %d(%%ebp)", stack_offset);
+            emit_instr_format(out, "cmp", "%%eax, %d(%s)", stack_offset,
+                              target->frame_pointer);
             // Set the low byte of %eax to 0 or 1 depending on whether
             // it was less than or equal.
             emit_instr(out, "setle", "%al");
@@ -172,31 +877,42 @@ void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
             emit_instr(out, "movzbl", "%al, %eax");
         }
 
+        // The next expression can reuse our slot.
+        ctx->stack_offset = stack_offset;
+
     } else if (syntax->type == ASSIGNMENT) {
         write_syntax(out, syntax->assignment->expression, ctx);
 
         emit_instr_format(
-            out, "mov", "%%eax, %d(%%ebp)",
-            environment_get_offset(ctx->env, syntax->variable->var_name));
+            out, "mov", "%%eax, %d(%s)",
+            environment_get_offset(ctx->env, syntax->variable->var_name),
+            target->frame_pointer);
 
     } else if (syntax->type == RETURN_STATEMENT) {
         ReturnStatement *return_statement = syntax->return_statement;
-        write_syntax(out, return_statement->expression, ctx);
+        Syntax *expression = return_statement->expression;
+        if (expression->type == FUNCTION_CALL &&
+            can_tail_call(list_length(call_arguments(expression)), ctx)) {
+            write_tail_call(out, syntax, ctx);
+            return;
+        }
+
+        write_syntax(out, expression, ctx);
 
-        emit_return(out);
+        emit_return(out, ctx);
 
     } else if (syntax->type == FUNCTION_CALL) {
-        emit_instr_format(out, "call", syntax->function_call->function_name);
+        write_arguments(out, syntax, ctx);
+        emit_instr_format(out, "call",
+                          symbol_name(syntax->function_call->function_name));
+        emit_stack_arguments_cleanup(out, list_length(call_arguments(syntax)),
+                                     ctx);
 
     } else if (syntax->type == IF_STATEMENT) {
         IfStatement *if_statement = syntax->if_statement;
-        write_syntax(out, if_statement->condition, ctx);
-
         char *label = fresh_local_label("if_end", ctx);
 
-        emit_instr(out, "test", "%eax, %eax");
-        emit_instr_format(out, "jz", "%s", label);
-
+        write_condition_jump(out, if_statement->condition, false, label, ctx);
         write_syntax(out, if_statement->then, ctx);
         emit_label(out, label);
 
@@ -206,40 +922,95 @@ void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
         char *start_label = fresh_local_label("while_start", ctx);
         char *end_label = fresh_local_label("while_end", ctx);
 
+        // We write `if (c) do { body } while (c);`, so each iteration
+        // ends with one conditional jump back to the start rather than
+        // a jump to the test and another out of the loop.
+        write_condition_jump(out, while_statement->condition, false,
+                             end_label, ctx);
         emit_label(out, start_label);
-        write_syntax(out, while_statement->condition, ctx);
-
-        emit_instr(out, "test", "%eax, %eax");
-        emit_instr_format(out, "jz", "%s", end_label);
-
         write_syntax(out, while_statement->body, ctx);
-        emit_instr_format(out, "jmp", "%s", start_label);
+        write_condition_jump(out, while_statement->condition, true,
+                             start_label, ctx);
         emit_label(out, end_label);
 
     } else if (syntax->type == DEFINE_VAR) {
         DefineVarStatement *define_var_statement = syntax->define_var_statement;
+
+        if (ctx->regalloc != NULL) {
+            Register reg = regalloc_local_register(
+                ctx->regalloc, define_var_statement->var_name);
+            if (reg != NO_REGISTER) {
+                write_expression(out, define_var_statement->init_value, reg,
+                                 ctx);
+                return;
+            }
+        }
+
         int stack_offset = ctx->stack_offset;
 
         environment_set_offset(ctx->env, define_var_statement->var_name,
                                stack_offset);
-        emit_instr(out, "sub", "$4, %esp");
 
-        ctx->stack_offset -= WORD_SIZE;
+        ctx->stack_offset -= target->word_size;
         write_syntax(out, define_var_statement->init_value, ctx);
-        emit_instr_format(out, "mov", "%%eax, %d(%%ebp)\n", stack_offset);
+        emit_instr_format(out, "mov", "%%eax, %d(%s)", stack_offset,
+                          target->frame_pointer);
+        emit_blank_line(out);
 
     } else if (syntax->type == BLOCK) {
+        environment_push_scope(ctx->env);
+        int stack_offset = ctx->stack_offset;
         List *statements = syntax->block->statements;
         for (int i = 0; i < list_length(statements); i++) {
             write_syntax(out, list_get(statements, i), ctx);
         }
+        // Our locals are out of scope, so later blocks reuse their slots.
+        ctx->stack_offset = stack_offset;
+        environment_pop_scope(ctx->env);
+
     } else if (syntax->type == FUNCTION) {
-        new_scope(ctx);
+        span_begin("function", symbol_name(syntax->function->name));
+        enter_function(ctx);
+
+        if (ctx->options->opt_level >= 1) {
+            span_begin("phase", "regalloc");
+            ctx->regalloc = regalloc_new(syntax, target->arch);
+            span_end();
+        }
+
+        emit_function_declaration(out, symbol_name(syntax->function->name));
+        emit_function_prologue(out, target);
+        if (ctx->regalloc != NULL) {
+            emit_save_registers(out, ctx);
+        }
+
+        // Set before laying out the frame: which returns are tail calls
+        // depends on our parameter count.
+        ctx->function_name = symbol_name(syntax->function->name);
+        ctx->parameter_count = list_length(syntax->function->parameters);
+        int slot_count = frame_slot_count(syntax, ctx);
+        if (slot_count > 0) {
+            emit_instr_format(out, "sub", "$%d, %s",
+                              slot_count * target->word_size,
+                              target->stack_pointer);
+        }
+        if (ctx->options->opt_level >= 1) {
+            // Calls to ourselves in tail position jump here.
+            ctx->entry_label = fresh_local_label("entry", ctx);
+            emit_label(out, ctx->entry_label);
+        }
+        emit_parameters(out, syntax, ctx);
 
-        emit_function_declaration(out, syntax->function->name);
-        emit_function_prologue(out);
         write_syntax(out, syntax->function->root_block, ctx);
-        emit_function_epilogue(out);
+        emit_function_epilogue(out, ctx);
+
+        free(ctx->entry_label);
+        ctx->entry_label = NULL;
+
+        regalloc_free(ctx->regalloc);
+        ctx->regalloc = NULL;
+        leave_function(ctx);
+        span_end();
 
     } else if (syntax->type == TOP_LEVEL) {
         // TODO: treat the 'main' function specially.
@@ -254,16 +1025,304 @@ void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
     }
 }
 
-void write_assembly(Syntax *syntax) {
-    FILE *out = fopen("out.s", "wb");
+/* Every vreg gets its own stack slot, below the saved frame pointer.
+ * Write the operand for VREG's slot to BUFFER.
+ */
+char *format_ir_slot(char *buffer, int vreg, Context *ctx) {
+    snprintf(buffer, MAX_OPERAND_LENGTH, "%d(%s)",
+             -1 * ctx->target->word_size * (vreg + 1),
+             ctx->target->frame_pointer);
+    return buffer;
+}
+
+/* Write the phi copies for the edge from BLOCK to TARGET. The phis
+ * of a block take their values simultaneously, so we push every
+ * source before popping into any destination.
+ *
+ * We place these copies before BLOCK's terminator, so a branch runs
+ * the copies for both its edges. That's safe because we never branch
+ * to a loop header, so the phi destinations we overwrite on the edge
+ * not taken aren't live there.
+ */
+void emit_phi_copies(List *out, IrBlock *block, IrBlock *target,
+                     Context *ctx) {
+    char slot[MAX_OPERAND_LENGTH];
+    List *phis = list_new();
+    for (int i = 0; i < list_length(target->instructions); i++) {
+        IrInstruction *instruction = list_get(target->instructions, i);
+        if (instruction->opcode != IR_PHI) {
+            break;
+        }
+
+        for (int j = 0; j < list_length(instruction->phi_arguments); j++) {
+            IrPhiArgument *argument = list_get(instruction->phi_arguments, j);
+            if (argument->block == block) {
+                emit_instr(out, ctx->target->push,
+                           format_ir_slot(slot, argument->vreg, ctx));
+                list_append(phis, instruction);
+                break;
+            }
+        }
+    }
+
+    for (int i = list_length(phis) - 1; i >= 0; i--) {
+        IrInstruction *phi = list_get(phis, i);
+        emit_instr(out, ctx->target->pop, format_ir_slot(slot, phi->dest, ctx));
+    }
+    list_free(phis);
+}
+
+/* Load the arguments of IR_CALL INSTRUCTION where the callee expects
+ * them.
+ */
+void write_ir_call_arguments(List *out, IrInstruction *instruction,
+                             Context *ctx) {
+    char slot[MAX_OPERAND_LENGTH];
+    int argument_count = instruction->argument_count;
+    int register_count = argument_register_count(ctx->target);
+
+    for (int i = argument_count - 1; i >= register_count; i--) {
+        emit_instr(out, ctx->target->push,
+                   format_ir_slot(slot, instruction->arguments[i], ctx));
+    }
+    for (int i = 0; i < argument_count && i < register_count; i++) {
+        emit_instr_format(out, "mov", "%s, %s",
+                          format_ir_slot(slot, instruction->arguments[i], ctx),
+                          register_name(ARGUMENT_REGISTERS[i]));
+    }
+}
+
+/* Will we make IR_CALL INSTRUCTION with a jump? Then nothing after it
+ * in its block runs.
+ */
+bool is_ir_tail_call(IrInstruction *instruction, Context *ctx) {
+    return instruction->opcode == IR_CALL && instruction->tail_call &&
+           can_tail_call(instruction->argument_count, ctx);
+}
+
+void write_ir_instruction(List *out, IrInstruction *instruction,
+                          IrBlock *block, IrBlock *next_block, char **labels,
+                          Context *ctx) {
+    IrOpcode opcode = instruction->opcode;
+
+    if (opcode == IR_PHI) {
+        // Handled by emit_phi_copies in each predecessor.
+        return;
+    }
+
+    if (ir_is_terminator(instruction)) {
+        for (int i = 0; i < 2 && instruction->targets[i] != NULL; i++) {
+            emit_phi_copies(out, block, instruction->targets[i], ctx);
+        }
+    }
+
+    char slot[MAX_OPERAND_LENGTH];
+    if (instruction->operands[0] != NO_VREG) {
+        emit_instr_format(out, "mov", "%s, %%eax",
+                          format_ir_slot(slot, instruction->operands[0], ctx));
+    }
+
+    char *right = NULL;
+    char right_operand[MAX_OPERAND_LENGTH];
+    if (instruction->operands[1] != NO_VREG) {
+        right = format_ir_slot(right_operand, instruction->operands[1], ctx);
+    }
+
+    if (opcode == IR_CONST) {
+        emit_instr_format(out, "mov", "$%d, %%eax", instruction->value);
+
+    } else if (opcode == IR_ADD) {
+        emit_instr_format(out, "add", "%s, %%eax", right);
+
+    } else if (opcode == IR_SUB) {
+        emit_instr_format(out, "sub", "%s, %%eax", right);
+
+    } else if (opcode == IR_MUL) {
+        emit_instr_format(out, "imul", "%s, %%eax", right);
+
+    } else if (opcode == IR_LESS_THAN || opcode == IR_LESS_OR_EQUAL) {
+        emit_instr_format(out, "cmp", "%s, %%eax", right);
+        emit_instr(out, opcode == IR_LESS_THAN ? "setl" : "setle", "%al");
+        emit_instr(out, "movzbl", "%al, %eax");
+
+    } else if (opcode == IR_NOT) {
+        emit_instr(out, "not", "%eax");
+
+    } else if (opcode == IR_LOGICAL_NOT) {
+        emit_instr(out, "test", "%eax, %eax");
+        emit_instr(out, "setz", "%al");
+        emit_instr(out, "movzbl", "%al, %eax");
+
+    } else if (opcode == IR_PARAM) {
+        format_incoming_argument(slot, instruction->value, ctx);
+        emit_instr_format(out, "mov", "%s, %%eax", slot);
+
+    } else if (opcode == IR_CALL && is_ir_tail_call(instruction, ctx)) {
+        int *offsets = malloc(instruction->argument_count * sizeof(int));
+        for (int i = 0; i < instruction->argument_count; i++) {
+            offsets[i] =
+                -1 * ctx->target->word_size * (instruction->arguments[i] + 1);
+        }
+        emit_tail_call(out, instruction->function_name, offsets,
+                       instruction->argument_count, ctx);
+        free(offsets);
+        return;
+
+    } else if (opcode == IR_CALL) {
+        write_ir_call_arguments(out, instruction, ctx);
+        emit_instr(out, "call", instruction->function_name);
+        emit_stack_arguments_cleanup(out, instruction->argument_count, ctx);
+
+    } else if (opcode == IR_RETURN) {
+        emit_return(out, ctx);
+
+    } else if (opcode == IR_JUMP) {
+        if (instruction->targets[0] != next_block) {
+            emit_instr(out, "jmp", labels[instruction->targets[0]->id]);
+        }
+
+    } else if (opcode == IR_BRANCH) {
+        emit_instr(out, "test", "%eax, %eax");
+        emit_instr(out, "jz", labels[instruction->targets[1]->id]);
+        if (instruction->targets[0] != next_block) {
+            emit_instr(out, "jmp", labels[instruction->targets[0]->id]);
+        }
+    }
+
+    if (instruction->dest != NO_VREG) {
+        emit_instr_format(out, "mov", "%%eax, %s",
+                          format_ir_slot(slot, instruction->dest, ctx));
+    }
+}
+
+/* Lower FUNCTION from SSA to assembly, keeping every vreg in memory. */
+void write_ir_function(List *out, IrFunction *function, Context *ctx) {
+    int block_count = list_length(function->blocks);
+    char **labels = malloc(block_count * sizeof(char *));
+    for (int i = 0; i < block_count; i++) {
+        labels[i] = fresh_local_label("block", ctx);
+    }
+
+    emit_function_declaration(out, function->name);
+    emit_function_prologue(out, ctx->target);
+    if (function->vreg_count > 0) {
+        emit_instr_format(out, "sub", "$%d, %s",
+                          function->vreg_count * ctx->target->word_size,
+                          ctx->target->stack_pointer);
+    }
+
+    // Parameters are loaded at the start of the entry block, so calls
+    // to ourselves in tail position jump there.
+    ctx->function_name = function->name;
+    ctx->parameter_count = function->parameter_count;
+    ctx->entry_label = labels[0];
+
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        IrBlock *next_block =
+            i + 1 < block_count ? list_get(function->blocks, i + 1) : NULL;
+
+        emit_label(out, labels[i]);
+        for (int j = 0; j < list_length(block->instructions); j++) {
+            IrInstruction *instruction = list_get(block->instructions, j);
+            write_ir_instruction(out, instruction, block, next_block, labels,
+                                 ctx);
+            if (is_ir_tail_call(instruction, ctx)) {
+                break;
+            }
+        }
+    }
+    ctx->entry_label = NULL;
+    emit_blank_line(out);
+
+    for (int i = 0; i < block_count; i++) {
+        free(labels[i]);
+    }
+    free(labels);
+}
+
+/* Write LIST to OPTIONS->output_file in the format OPTIONS asks for:
+ * GNU assembler source, or machine code from our own assembler.
+ */
+static bool write_output(List *out, Options *options, Target *target) {
+    if (options->emit == OUTPUT_ASSEMBLY) {
+        Output *out_file = output_open(options->output_file, 0666);
+        if (out_file == NULL) {
+            return false;
+        }
+        span_begin("phase", "write");
+        write_instructions(out_file, out);
+        bool result = output_close(out_file);
+        span_end();
+        return result;
+    }
+
+    span_begin("phase", "assemble");
+    MachineCode *machine_code = assemble(out, target);
+    span_end();
+    if (machine_code == NULL) {
+        return false;
+    }
+    timing_count("machine code bytes", machine_code->code.length);
+
+    span_begin("phase", "write");
+    bool result;
+    if (options->emit == OUTPUT_OBJECT) {
+        result = write_elf_object(options->output_file, machine_code, target);
+    } else {
+        result =
+            write_elf_executable(options->output_file, machine_code, target);
+    }
+    span_end();
+
+    machine_code_free(machine_code);
+    return result;
+}
+
+bool write_assembly(Syntax *syntax, Options *options) {
+    List *out = list_new();
 
     write_header(out);
 
     Context *ctx = new_context();
+    ctx->options = options;
+    ctx->target = target_get(options->target);
+
+    if (options->use_ir) {
+        span_begin("phase", "build IR");
+        IrProgram *program = ir_build(syntax);
+        span_end();
+
+        span_begin("phase", "codegen");
+        for (int i = 0; i < list_length(program->functions); i++) {
+            IrFunction *function = list_get(program->functions, i);
+            span_begin("function", function->name);
+            write_ir_function(out, function, ctx);
+            span_end();
+        }
+        span_end();
+        ir_free(program);
+    } else {
+        span_begin("phase", "codegen");
+        write_syntax(out, syntax, ctx);
+        span_end();
+    }
+    write_footer(out, ctx->target);
+
+    if (options->opt_level >= 1) {
+        span_begin("phase", "peephole");
+        PeepholeStats stats;
+        peephole_optimize(out, &stats);
+        span_end();
+        if (options->print_stats) {
+            print_peephole_stats(stderr, &stats);
+        }
+    }
+    timing_count("instructions", list_length(out));
 
-    write_syntax(out, syntax, ctx);
-    write_footer(out);
+    bool result = write_output(out, options, ctx->target);
 
+    instructions_free(out);
     context_free(ctx);
-    fclose(out);
+    return result;
 }
@@ -1,14 +1,18 @@
 #ifndef MC_ASSEMBLY_H
 #define MC_ASSEMBLY_H
 
-#include <stdio.h>
+#include <stdbool.h>
 
+#include "context.h"
+#include "list.h"
+#include "options.h"
 #include "syntax.h"
+#include "target.h"
 
-void emit_header(FILE *out, char *name);
-void write_header(FILE *out);
-void write_footer(FILE *out);
-void write_syntax(FILE *out, Syntax *syntax);
-void write_assembly(Syntax *syntax);
+void emit_header(List *out, char *name);
+void write_header(List *out);
+void write_footer(List *out, Target *target);
+void write_syntax(List *out, Syntax *syntax, Context *ctx);
+bool write_assembly(Syntax *syntax, Options *options);
 
 #endif
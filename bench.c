@@ -0,0 +1,475 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Each program is compiled this many times, and we keep the fastest
+// run, to smooth out noise.
+#define RUNS_PER_PROGRAM 3
+
+/* What we measure from one compile, as reported by mc --time-report.
+ * Times are in milliseconds.
+ */
+typedef struct Measurement {
+    double total;
+    double preprocess;
+    double parse;
+    double codegen;
+    double peephole;
+    double assemble;
+    double write;
+    long syntax_nodes;
+    long instructions;
+    long machine_code_bytes;
+    long arena_bytes;
+    long peak_rss_kb;
+    // The size of the file mc wrote.
+    long output_bytes;
+} Measurement;
+
+/* A generated program, at the scale we were asked for. */
+typedef struct Program {
+    const char *name;
+    const char *description;
+    void (*generate)(FILE *out, int scale);
+    char path[PATH_MAX];
+    long lines;
+    long bytes;
+} Program;
+
+static void generate_functions(FILE *out, int scale);
+static void generate_long_block(FILE *out, int scale);
+static void generate_deep_expressions(FILE *out, int scale);
+static void generate_locals_and_loops(FILE *out, int scale);
+
+static Program PROGRAMS[] = {
+    {"functions", "many small functions, all called from main",
+     generate_functions, "", 0, 0},
+    {"long_block", "one function with a very long block", generate_long_block,
+     "", 0, 0},
+    {"deep_expressions", "deeply nested arithmetic expressions",
+     generate_deep_expressions, "", 0, 0},
+    {"locals_and_loops", "many locals, nested while loops and ifs",
+     generate_locals_and_loops, "", 0, 0},
+};
+
+#define PROGRAM_COUNT (int)(sizeof(PROGRAMS) / sizeof(PROGRAMS[0]))
+
+static const char *OPTIMIZATION_FLAGS[] = {"-O0", "-O1", "--use-ir"};
+
+#define FLAG_COUNT (int)(sizeof(OPTIMIZATION_FLAGS) / sizeof(char *))
+
+/******************************************************************************
+ *
+ * Program generators. Every program is valid for mc and terminates,
+ * though we only compile them.
+ *
+ ******************************************************************************/
+
+static void generate_functions(FILE *out, int scale) {
+    int function_count = 2000 * scale;
+    for (int i = 0; i < function_count; i++) {
+        fprintf(out, "int f%d() {\n", i);
+        fprintf(out, "    int a = %d;\n", i % 100);
+        fprintf(out, "    int b = a * 3 + %d;\n", i % 7);
+        fprintf(out, "    if (a < b) {\n");
+        fprintf(out, "        a = b - a;\n");
+        fprintf(out, "    }\n");
+        fprintf(out, "    return a + b;\n");
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    int total = 0;\n");
+    for (int i = 0; i < function_count; i++) {
+        fprintf(out, "    total = total + f%d();\n", i);
+    }
+    fprintf(out, "    return total;\n");
+    fprintf(out, "}\n");
+}
+
+static void generate_long_block(FILE *out, int scale) {
+    int statement_count = 20000 * scale;
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    int x = 1;\n");
+    fprintf(out, "    int y = 2;\n");
+    for (int i = 0; i < statement_count; i++) {
+        if (i % 3 == 0) {
+            fprintf(out, "    x = x + y * %d;\n", i % 10);
+        } else if (i % 3 == 1) {
+            fprintf(out, "    y = (x - %d) * 2;\n", i % 13);
+        } else {
+            fprintf(out, "    x = !(x < y) + ~y;\n");
+        }
+    }
+    fprintf(out, "    return x;\n");
+    fprintf(out, "}\n");
+}
+
+/* Write an expression nested DEPTH levels deep, over the locals a, b
+ * and c.
+ */
+static void write_nested_expression(FILE *out, int depth) {
+    static const char *operators[] = {" + ", " - ", " * ", " < "};
+    static const char *leaves[] = {"a", "b", "c", "3"};
+
+    for (int i = 0; i < depth; i++) {
+        fprintf(out, "(%s%s", leaves[i % 4], operators[i % 4]);
+    }
+    fprintf(out, "1");
+    for (int i = 0; i < depth; i++) {
+        fputc(')', out);
+    }
+}
+
+static void generate_deep_expressions(FILE *out, int scale) {
+    int expression_count = 200 * scale;
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    int a = 1;\n");
+    fprintf(out, "    int b = 2;\n");
+    fprintf(out, "    int c = 3;\n");
+    for (int i = 0; i < expression_count; i++) {
+        fprintf(out, "    a = ");
+        write_nested_expression(out, 20 + i % 80);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "    return a;\n");
+    fprintf(out, "}\n");
+}
+
+static void generate_locals_and_loops(FILE *out, int scale) {
+    int function_count = 300 * scale;
+    int local_count = 30;
+    for (int i = 0; i < function_count; i++) {
+        fprintf(out, "int g%d() {\n", i);
+        for (int j = 0; j < local_count; j++) {
+            fprintf(out, "    int v%d = %d;\n", j, (i + j) % 50);
+        }
+        fprintf(out, "    int i = 0;\n");
+        fprintf(out, "    while (i < 10) {\n");
+        fprintf(out, "        int j = 0;\n");
+        fprintf(out, "        while (j < i) {\n");
+        for (int j = 0; j + 1 < local_count; j += 3) {
+            fprintf(out, "            if (v%d < v%d) {\n", j, j + 1);
+            fprintf(out, "                v%d = v%d + j;\n", j, j + 1);
+            fprintf(out, "            }\n");
+        }
+        fprintf(out, "            j = j + 1;\n");
+        fprintf(out, "        }\n");
+        fprintf(out, "        i = i + 1;\n");
+        fprintf(out, "    }\n");
+        fprintf(out, "    return v0 + v%d;\n", local_count - 1);
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    return g0();\n");
+    fprintf(out, "}\n");
+}
+
+/* Write PROGRAM into DIRECTORY and count its lines and bytes. */
+static bool write_program(Program *program, char *directory, int scale) {
+    snprintf(program->path, sizeof(program->path), "%s/%s.c", directory,
+             program->name);
+    FILE *out = fopen(program->path, "w");
+    if (out == NULL) {
+        perror(program->path);
+        return false;
+    }
+    program->generate(out, scale);
+    program->bytes = ftell(out);
+    fclose(out);
+
+    out = fopen(program->path, "r");
+    program->lines = 0;
+    int c;
+    while ((c = getc(out)) != EOF) {
+        if (c == '\n') {
+            program->lines++;
+        }
+    }
+    fclose(out);
+    return true;
+}
+
+/******************************************************************************
+ *
+ * Running mc and reading its --time-report.
+ *
+ ******************************************************************************/
+
+/* Run ARGV with its stderr going to REPORT_PATH. Returns true if it
+ * exited successfully.
+ */
+static bool run_compiler(char **argv, char *report_path) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        int report = open(report_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        int dev_null = open("/dev/null", O_WRONLY);
+        if (report < 0 || dev_null < 0) {
+            _exit(127);
+        }
+        dup2(dev_null, STDOUT_FILENO);
+        dup2(report, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Read the report mc wrote to PATH. Each line is a name, which may
+ * contain single spaces, padded with at least two spaces, then one or
+ * two numbers.
+ */
+static bool read_report(char *path, Measurement *measurement) {
+    FILE *report = fopen(path, "r");
+    if (report == NULL) {
+        return false;
+    }
+
+    memset(measurement, 0, sizeof(Measurement));
+    char line[256];
+    while (fgets(line, sizeof(line), report) != NULL) {
+        char *end_of_name = strstr(line, "  ");
+        if (end_of_name == NULL) {
+            continue;
+        }
+        *end_of_name = '\0';
+
+        double first = 0, second = 0;
+        if (sscanf(end_of_name + 1, "%lf %lf", &first, &second) < 1) {
+            continue;
+        }
+
+        if (strcmp(line, "Total") == 0) {
+            measurement->total = first;
+        } else if (strcmp(line, "preprocess") == 0) {
+            measurement->preprocess = first;
+        } else if (strcmp(line, "parse") == 0) {
+            measurement->parse = first;
+        } else if (strcmp(line, "codegen") == 0) {
+            measurement->codegen = first;
+        } else if (strcmp(line, "peephole") == 0) {
+            measurement->peephole = first;
+        } else if (strcmp(line, "assemble") == 0) {
+            measurement->assemble = first;
+        } else if (strcmp(line, "write") == 0) {
+            measurement->write = first;
+        } else if (strcmp(line, "syntax nodes") == 0) {
+            measurement->syntax_nodes = first;
+        } else if (strcmp(line, "instructions") == 0) {
+            measurement->instructions = first;
+        } else if (strcmp(line, "machine code bytes") == 0) {
+            measurement->machine_code_bytes = first;
+        } else if (strcmp(line, "syntax arena bytes") == 0) {
+            measurement->arena_bytes = first;
+        } else if (strcmp(line, "Peak RSS") == 0) {
+            measurement->peak_rss_kb = first;
+        }
+    }
+
+    fclose(report);
+    return measurement->total > 0;
+}
+
+/* Compile PROGRAM with FLAG a few times, keeping the fastest run.
+ * EMIT is "-c" or "--emit=asm".
+ */
+static bool measure(char *compiler, char *directory, Program *program,
+                    const char *flag, const char *emit, Measurement *best) {
+    char output[PATH_MAX + 16], report[PATH_MAX + 16];
+    snprintf(output, sizeof(output), "%s/out", directory);
+    snprintf(report, sizeof(report), "%s/report.txt", directory);
+
+    char *argv[] = {compiler, (char *)flag,  "--time-report", (char *)emit,
+                    "-o",     output,        program->path,   NULL};
+
+    for (int run = 0; run < RUNS_PER_PROGRAM; run++) {
+        Measurement measurement;
+        if (!run_compiler(argv, report) ||
+            !read_report(report, &measurement)) {
+            printf("Compiling %s with %s %s failed!\n", program->name, flag,
+                   emit);
+            return false;
+        }
+        struct stat output_stat;
+        if (stat(output, &output_stat) == 0) {
+            measurement.output_bytes = output_stat.st_size;
+        }
+        if (run == 0 || measurement.total < best->total) {
+            *best = measurement;
+        }
+    }
+
+    unlink(output);
+    unlink(report);
+    return true;
+}
+
+/* Per second, from a count and a time in milliseconds. */
+static double rate(double count, double milliseconds) {
+    return milliseconds > 0 ? count / (milliseconds / 1000) : 0;
+}
+
+static void print_result(Program *program, const char *flag,
+                         Measurement *m) {
+    printf("%-18s %-9s %9.1f %12.0f %12.0f %12.0f %10ld %8ld\n",
+           program->name, flag, m->total,
+           rate(program->lines, m->preprocess + m->parse),
+           rate(m->syntax_nodes, m->parse), rate(m->syntax_nodes, m->codegen),
+           m->arena_bytes / 1024, m->peak_rss_kb);
+}
+
+static void write_json_result(FILE *out, Program *program, const char *flag,
+                              Measurement *m, bool first) {
+    fprintf(out, "%s    {\n", first ? "" : ",\n");
+    fprintf(out, "      \"program\": \"%s\",\n", program->name);
+    fprintf(out, "      \"description\": \"%s\",\n", program->description);
+    fprintf(out, "      \"flags\": \"%s\",\n", flag);
+    fprintf(out, "      \"lines\": %ld,\n", program->lines);
+    fprintf(out, "      \"bytes\": %ld,\n", program->bytes);
+    fprintf(out, "      \"syntax_nodes\": %ld,\n", m->syntax_nodes);
+    fprintf(out, "      \"instructions\": %ld,\n", m->instructions);
+    fprintf(out, "      \"machine_code_bytes\": %ld,\n",
+            m->machine_code_bytes);
+    fprintf(out, "      \"syntax_arena_bytes\": %ld,\n", m->arena_bytes);
+    fprintf(out, "      \"peak_rss_kb\": %ld,\n", m->peak_rss_kb);
+    fprintf(out, "      \"ms\": {\"total\": %.3f, \"preprocess\": %.3f, ",
+            m->total, m->preprocess);
+    fprintf(out, "\"parse\": %.3f, \"codegen\": %.3f, \"peephole\": %.3f, ",
+            m->parse, m->codegen, m->peephole);
+    fprintf(out, "\"assemble\": %.3f, \"write\": %.3f},\n", m->assemble,
+            m->write);
+    fprintf(out, "      \"lines_per_second\": %.0f,\n",
+            rate(program->lines, m->total));
+    fprintf(out, "      \"parse_lines_per_second\": %.0f,\n",
+            rate(program->lines, m->preprocess + m->parse));
+    fprintf(out, "      \"parse_nodes_per_second\": %.0f,\n",
+            rate(m->syntax_nodes, m->parse));
+    fprintf(out, "      \"codegen_nodes_per_second\": %.0f\n",
+            rate(m->syntax_nodes, m->codegen));
+    fprintf(out, "    }");
+}
+
+static void print_assembly_result(Program *program, Measurement *m) {
+    printf("%-18s %12ld %12.3f %12.1f\n", program->name,
+           m->output_bytes / 1024, m->write,
+           rate(m->output_bytes, m->write) / (1024 * 1024));
+}
+
+static void write_json_assembly_result(FILE *out, Program *program,
+                                       Measurement *m, bool first) {
+    fprintf(out, "%s    {\"program\": \"%s\", \"bytes\": %ld, ",
+            first ? "" : ",\n", program->name, m->output_bytes);
+    fprintf(out, "\"write_ms\": %.3f, \"bytes_per_second\": %.0f}",
+            m->write, rate(m->output_bytes, m->write));
+}
+
+int main(int argc, char *argv[]) {
+    int scale = 1;
+    char *output_path = "build/bench.json";
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--scale=", strlen("--scale=")) == 0) {
+            scale = atoi(argv[i] + strlen("--scale="));
+        } else if (strncmp(argv[i], "--output=", strlen("--output=")) == 0) {
+            output_path = argv[i] + strlen("--output=");
+        } else {
+            printf("Usage: bench [--scale=N] [--output=FILE]\n");
+            return 1;
+        }
+    }
+    if (scale < 1) {
+        scale = 1;
+    }
+
+    char compiler[PATH_MAX];
+    if (realpath("build/mc", compiler) == NULL) {
+        printf("Could not find build/mc!\n");
+        return 1;
+    }
+
+    char directory[] = "/tmp/mc-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        printf("Could not create a temporary directory!\n");
+        return 1;
+    }
+
+    FILE *json = fopen(output_path, "w");
+    if (json == NULL) {
+        perror(output_path);
+        return 1;
+    }
+    fprintf(json, "{\n  \"scale\": %d,\n  \"results\": [\n", scale);
+
+    printf("%-18s %-9s %9s %12s %12s %12s %10s %8s\n", "Program", "Flags",
+           "Total ms", "Parse lines", "Parse nodes", "Gen nodes", "Arena KB",
+           "RSS KB");
+    printf("%-18s %-9s %9s %12s %12s %12s %10s %8s\n", "", "", "", "/s", "/s",
+           "/s", "", "");
+
+    int failures = 0;
+    int results = 0;
+    Measurement assembly[PROGRAM_COUNT];
+    bool assembly_measured[PROGRAM_COUNT];
+    for (int i = 0; i < PROGRAM_COUNT; i++) {
+        Program *program = &PROGRAMS[i];
+        assembly_measured[i] = false;
+        if (!write_program(program, directory, scale)) {
+            failures++;
+            continue;
+        }
+
+        // How fast we write assembly text, apart from compiling it.
+        assembly_measured[i] = measure(compiler, directory, program, "-O1",
+                                       "--emit=asm", &assembly[i]);
+        if (!assembly_measured[i]) {
+            failures++;
+        }
+
+        for (int j = 0; j < FLAG_COUNT; j++) {
+            Measurement measurement;
+            if (!measure(compiler, directory, program, OPTIMIZATION_FLAGS[j],
+                         "-c", &measurement)) {
+                failures++;
+                continue;
+            }
+            print_result(program, OPTIMIZATION_FLAGS[j], &measurement);
+            write_json_result(json, program, OPTIMIZATION_FLAGS[j],
+                              &measurement, results++ == 0);
+        }
+        unlink(program->path);
+    }
+    rmdir(directory);
+
+    printf("\n%-18s %12s %12s %12s\n", "Writing -O1 asm", "KB", "Write ms",
+           "MB/s");
+    fprintf(json, "\n  ],\n  \"assembly_output\": [\n");
+    results = 0;
+    for (int i = 0; i < PROGRAM_COUNT; i++) {
+        if (assembly_measured[i]) {
+            print_assembly_result(&PROGRAMS[i], &assembly[i]);
+            write_json_assembly_result(json, &PROGRAMS[i], &assembly[i],
+                                       results++ == 0);
+        }
+    }
+
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+    printf("\nWrote %s.\n", output_path);
+
+    return failures;
+}
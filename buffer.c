@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+/* Make room for EXTRA more bytes in BUFFER. We double the capacity,
+ * so appending N bytes copies O(N) bytes in total.
+ */
+void buffer_reserve(Buffer *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) {
+        return;
+    }
+
+    size_t capacity =
+        buffer->capacity == 0 ? INITIAL_BUFFER_SIZE : buffer->capacity;
+    while (capacity < buffer->length + extra) {
+        capacity *= 2;
+    }
+    buffer->data = realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+void buffer_append(Buffer *buffer, const void *bytes, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    buffer_reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+void buffer_push(Buffer *buffer, char c) {
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->length++] = c;
+}
+
+/* Append zero bytes until BUFFER's length is a multiple of ALIGNMENT. */
+void buffer_pad(Buffer *buffer, size_t alignment) {
+    while (buffer->length % alignment != 0) {
+        buffer_push(buffer, '\0');
+    }
+}
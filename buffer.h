@@ -0,0 +1,20 @@
+#ifndef MC_BUFFER_H
+#define MC_BUFFER_H
+
+#include <stddef.h>
+
+/* A growable run of bytes. A zeroed Buffer is empty and ready to use. */
+typedef struct Buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+#define INITIAL_BUFFER_SIZE 4096
+
+void buffer_reserve(Buffer *buffer, size_t extra);
+void buffer_append(Buffer *buffer, const void *bytes, size_t length);
+void buffer_push(Buffer *buffer, char c);
+void buffer_pad(Buffer *buffer, size_t alignment);
+
+#endif
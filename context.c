@@ -1,28 +1,33 @@
 #include "env.h"
 #include "context.h"
 
-// TODO: this is duplicated with assembly.c.
-static const int WORD_SIZE = 4;
-
-void new_scope(Context *ctx) {
-    // Each function needs a fresh set of local variables (we
-    // don't support globals yet).
-    environment_free(ctx->env);
-    ctx->env = environment_new();
-
-    ctx->stack_offset = -1 * WORD_SIZE;
+/* Start generating a function. It gets its own scope for local
+ * variables (we don't support globals yet) and a fresh stack frame.
+ */
+void enter_function(Context *ctx) {
+    environment_push_scope(ctx->env);
+    ctx->stack_offset = -1 * ctx->target->word_size;
 }
 
+void leave_function(Context *ctx) { environment_pop_scope(ctx->env); }
+
 Context *new_context() {
     Context *ctx = malloc(sizeof(Context));
     ctx->stack_offset = 0;
-    ctx->env = NULL;
+    ctx->env = environment_new();
     ctx->label_count = 0;
+    ctx->options = NULL;
+    ctx->target = NULL;
+    ctx->regalloc = NULL;
+    ctx->function_name = NULL;
+    ctx->parameter_count = 0;
+    ctx->entry_label = NULL;
 
     return ctx;
 }
 
 void context_free(Context *ctx) {
     environment_free(ctx->env);
+    regalloc_free(ctx->regalloc);
     free(ctx);
 }
@@ -2,15 +2,30 @@
 #define MC_CONTEXT_H
 
 #include "env.h"
+#include "options.h"
+#include "regalloc.h"
+#include "target.h"
 
 typedef struct Context {
     int stack_offset;
     Environment *env;
     int label_count;
+    Options *options;
+    Target *target;
+    // Register assignment for the current function, or NULL.
+    RegAlloc *regalloc;
+
+    // The function we're generating, for tail calls: its name, how
+    // many parameters it takes, and the label just after its prologue
+    // that a call to itself jumps back to.
+    char *function_name;
+    int parameter_count;
+    char *entry_label;
 } Context;
 
 Context *new_context();
 void context_free(Context *ctx);
-void new_scope(Context *ctx);
+void enter_function(Context *ctx);
+void leave_function(Context *ctx);
 
 #endif
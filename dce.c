@@ -0,0 +1,558 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dce.h"
+#include "intern.h"
+#include "list.h"
+#include "symbol_map.h"
+#include "syntax.h"
+#include "timing.h"
+
+// After this many passes over a loop body without its liveness
+// settling, we assume every variable the loop reads is live.
+#define MAX_LOOP_PASSES 4
+
+/* A set of variables, such as those live at some point. */
+typedef struct LiveSet {
+    Symbol *symbols;
+    int count;
+    int capacity;
+    // The index of each member in SYMBOLS, plus one so that it's
+    // never NULL, for constant time membership tests.
+    SymbolMap *positions;
+} LiveSet;
+
+/* How many times a function reads, assigns or defines a variable. */
+typedef struct ReferenceCount {
+    Symbol var_name;
+    int count;
+} ReferenceCount;
+
+typedef struct Eliminator {
+    // The references to each variable in the function we're cleaning
+    // up, as ReferenceCount*, counted before we remove anything. Since
+    // we only ever remove references, a count above one may be stale
+    // but never hides a reference.
+    SymbolMap *reference_counts;
+    List *counts;
+    int unreachable_count;
+    int constant_branch_count;
+    int dead_store_count;
+} Eliminator;
+
+static LiveSet *live_set_new(void) {
+    LiveSet *set = malloc(sizeof(LiveSet));
+    set->symbols = NULL;
+    set->count = 0;
+    set->capacity = 0;
+    set->positions = symbol_map_new();
+    return set;
+}
+
+static void live_set_free(LiveSet *set) {
+    free(set->symbols);
+    symbol_map_free(set->positions);
+    free(set);
+}
+
+static bool live_set_contains(LiveSet *set, Symbol symbol) {
+    return symbol_map_get(set->positions, symbol) != NULL;
+}
+
+static void set_position(LiveSet *set, int index) {
+    symbol_map_set(set->positions, set->symbols[index],
+                   (void *)(intptr_t)(index + 1));
+}
+
+static void live_set_add(LiveSet *set, Symbol symbol) {
+    if (live_set_contains(set, symbol)) {
+        return;
+    }
+
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity * 2 + 8;
+        set->symbols = realloc(set->symbols, sizeof(Symbol) * set->capacity);
+    }
+    set->symbols[set->count] = symbol;
+    set_position(set, set->count++);
+}
+
+static void live_set_remove(LiveSet *set, Symbol symbol) {
+    intptr_t position = (intptr_t)symbol_map_get(set->positions, symbol);
+    if (position == 0) {
+        return;
+    }
+
+    symbol_map_set(set->positions, symbol, NULL);
+    set->symbols[position - 1] = set->symbols[--set->count];
+    if (position - 1 < set->count) {
+        set_position(set, position - 1);
+    }
+}
+
+static void live_set_union(LiveSet *set, LiveSet *other) {
+    for (int i = 0; i < other->count; i++) {
+        live_set_add(set, other->symbols[i]);
+    }
+}
+
+static LiveSet *live_set_copy(LiveSet *set) {
+    LiveSet *copy = live_set_new();
+    live_set_union(copy, set);
+    return copy;
+}
+
+static void live_set_clear(LiveSet *set) {
+    for (int i = 0; i < set->count; i++) {
+        symbol_map_set(set->positions, set->symbols[i], NULL);
+    }
+    set->count = 0;
+}
+
+static List *call_arguments(Syntax *call) {
+    return call->function_call->function_arguments->function_arguments
+        ->arguments;
+}
+
+/* Could evaluating SYNTAX do anything other than produce a value? */
+static bool has_side_effects(Syntax *syntax) {
+    if (syntax->type == FUNCTION_CALL || syntax->type == ASSIGNMENT) {
+        return true;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return has_side_effects(syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return has_side_effects(syntax->binary_expression->left) ||
+               has_side_effects(syntax->binary_expression->right);
+    }
+    return false;
+}
+
+/* Add the variables the expression SYNTAX reads to LIVE. */
+static void add_uses(LiveSet *live, Syntax *syntax) {
+    if (syntax->type == VARIABLE) {
+        live_set_add(live, syntax->variable->var_name);
+    } else if (syntax->type == UNARY_OPERATOR) {
+        add_uses(live, syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        add_uses(live, syntax->binary_expression->left);
+        add_uses(live, syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        add_uses(live, syntax->assignment->expression);
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            add_uses(live, list_get(arguments, i));
+        }
+    }
+}
+
+/* Add every variable read anywhere in the statement SYNTAX to LIVE. */
+static void add_all_uses(LiveSet *live, Syntax *syntax) {
+    if (syntax->type == RETURN_STATEMENT) {
+        add_uses(live, syntax->return_statement->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        add_uses(live, syntax->define_var_statement->init_value);
+    } else if (syntax->type == IF_STATEMENT) {
+        add_uses(live, syntax->if_statement->condition);
+        add_all_uses(live, syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        add_uses(live, syntax->while_statement->condition);
+        add_all_uses(live, syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            add_all_uses(live, list_get(statements, i));
+        }
+    } else {
+        add_uses(live, syntax);
+    }
+}
+
+static void count_reference(Eliminator *eliminator, Symbol var_name) {
+    ReferenceCount *reference_count =
+        symbol_map_get(eliminator->reference_counts, var_name);
+    if (reference_count == NULL) {
+        reference_count = malloc(sizeof(ReferenceCount));
+        reference_count->var_name = var_name;
+        reference_count->count = 0;
+        symbol_map_set(eliminator->reference_counts, var_name,
+                       reference_count);
+        list_append(eliminator->counts, reference_count);
+    }
+    reference_count->count++;
+}
+
+/* Count every read, assignment and definition of a variable in
+ * SYNTAX.
+ */
+static void count_references(Eliminator *eliminator, Syntax *syntax) {
+    if (syntax->type == VARIABLE) {
+        count_reference(eliminator, syntax->variable->var_name);
+    } else if (syntax->type == UNARY_OPERATOR) {
+        count_references(eliminator, syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        count_references(eliminator, syntax->binary_expression->left);
+        count_references(eliminator, syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        count_reference(eliminator, syntax->assignment->var_name);
+        count_references(eliminator, syntax->assignment->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        count_reference(eliminator, syntax->define_var_statement->var_name);
+        count_references(eliminator,
+                         syntax->define_var_statement->init_value);
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            count_references(eliminator, list_get(arguments, i));
+        }
+    } else if (syntax->type == RETURN_STATEMENT) {
+        count_references(eliminator, syntax->return_statement->expression);
+    } else if (syntax->type == IF_STATEMENT) {
+        count_references(eliminator, syntax->if_statement->condition);
+        count_references(eliminator, syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        count_references(eliminator, syntax->while_statement->condition);
+        count_references(eliminator, syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            count_references(eliminator, list_get(statements, i));
+        }
+    }
+}
+
+/* Does anything but its definition refer to VAR_NAME? */
+static bool referenced_elsewhere(Eliminator *eliminator, Symbol var_name) {
+    ReferenceCount *reference_count =
+        symbol_map_get(eliminator->reference_counts, var_name);
+    return reference_count != NULL && reference_count->count > 1;
+}
+
+/******************************************************************************
+ *
+ * Unreachable code and constant branches.
+ *
+ ******************************************************************************/
+
+static bool is_nonzero_immediate(Syntax *syntax) {
+    return syntax->type == IMMEDIATE && syntax->immediate->value != 0;
+}
+
+/* Is the statement after SYNTAX unreachable? There's no break, so
+ * only a return leaves a `while (1)` loop.
+ */
+static bool never_falls_through(Syntax *syntax) {
+    if (syntax->type == RETURN_STATEMENT) {
+        return true;
+    } else if (syntax->type == WHILE_SYNTAX) {
+        return is_nonzero_immediate(syntax->while_statement->condition);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            if (never_falls_through(list_get(statements, i))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void simplify_block(Eliminator *eliminator, Syntax *syntax);
+
+/* Replace an if or while statement SYNTAX whose condition is a
+ * constant with what runs, or NULL if nothing does.
+ */
+static Syntax *simplify_statement(Eliminator *eliminator, Syntax *syntax) {
+    if (syntax->type == IF_STATEMENT) {
+        IfStatement *if_statement = syntax->if_statement;
+        simplify_block(eliminator, if_statement->then);
+        if (if_statement->condition->type != IMMEDIATE) {
+            return syntax;
+        }
+
+        eliminator->constant_branch_count++;
+        Syntax *then = NULL;
+        if (is_nonzero_immediate(if_statement->condition)) {
+            // The block keeps its locals in their own scope.
+            then = if_statement->then;
+            if_statement->then = block_new(syntax_list_new());
+        }
+        syntax_free(syntax);
+        return then;
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        WhileStatement *while_statement = syntax->while_statement;
+        if (while_statement->condition->type == IMMEDIATE &&
+            while_statement->condition->immediate->value == 0) {
+            eliminator->constant_branch_count++;
+            syntax_free(syntax);
+            return NULL;
+        }
+        simplify_block(eliminator, while_statement->body);
+
+    } else if (syntax->type == BLOCK) {
+        simplify_block(eliminator, syntax);
+    }
+    return syntax;
+}
+
+/* Simplify the statements of the BLOCK SYNTAX, and drop those after
+ * one that never falls through.
+ */
+static void simplify_block(Eliminator *eliminator, Syntax *syntax) {
+    List *statements = syntax->block->statements;
+    List *rewritten = syntax_list_new();
+
+    int i = 0;
+    while (i < list_length(statements)) {
+        Syntax *statement =
+            simplify_statement(eliminator, list_get(statements, i++));
+        if (statement == NULL) {
+            continue;
+        }
+
+        list_append(rewritten, statement);
+        if (never_falls_through(statement)) {
+            break;
+        }
+    }
+
+    for (; i < list_length(statements); i++) {
+        eliminator->unreachable_count++;
+        syntax_free(list_get(statements, i));
+    }
+    list_free(statements);
+    syntax->block->statements = rewritten;
+}
+
+/******************************************************************************
+ *
+ * Dead stores. We walk each function backwards, tracking the variables
+ * whose current value may still be read.
+ *
+ ******************************************************************************/
+
+/* Return EXPRESSION, the value of the statement SYNTAX that stores
+ * it, and free the rest of SYNTAX.
+ */
+static Syntax *keep_value(Syntax *syntax, Syntax *expression) {
+    if (syntax->type == ASSIGNMENT) {
+        syntax->assignment->expression = immediate_new(0);
+    } else {
+        syntax->define_var_statement->init_value = immediate_new(0);
+    }
+    syntax_free(syntax);
+    return expression;
+}
+
+/* SYNTAX assigns or defines VAR_NAME with EXPRESSION, and nothing
+ * reads the value. Return what's left of it, or NULL if nothing is.
+ */
+static Syntax *remove_dead_store(Eliminator *eliminator, Syntax *syntax,
+                                 Symbol var_name, Syntax *expression) {
+    if (syntax->type == DEFINE_VAR &&
+        referenced_elsewhere(eliminator, var_name)) {
+        // Later assignments still need the variable to exist, but
+        // not its initial value.
+        if (!has_side_effects(expression) && expression->type != IMMEDIATE) {
+            eliminator->dead_store_count++;
+            syntax_free(expression);
+            syntax->define_var_statement->init_value = immediate_new(0);
+        }
+        return syntax;
+    }
+
+    eliminator->dead_store_count++;
+    if (has_side_effects(expression)) {
+        return keep_value(syntax, expression);
+    }
+    syntax_free(syntax);
+    return NULL;
+}
+
+static Syntax *sweep_statement(Eliminator *eliminator, Syntax *syntax,
+                               LiveSet *live, bool remove);
+
+/* As sweep_statement, for the BLOCK SYNTAX. Its own locals go out of
+ * scope at its end, so defining one doesn't end the life of a
+ * variable of the same name outside.
+ */
+static void sweep_block(Eliminator *eliminator, Syntax *syntax,
+                        LiveSet *live, bool remove) {
+    List *statements = syntax->block->statements;
+    int length = list_length(statements);
+
+    LiveSet *outer = live_set_new();
+    for (int i = 0; i < length; i++) {
+        Syntax *statement = list_get(statements, i);
+        if (statement->type != DEFINE_VAR) {
+            continue;
+        }
+        Symbol var_name = statement->define_var_statement->var_name;
+        if (live_set_contains(live, var_name)) {
+            live_set_add(outer, var_name);
+        }
+    }
+
+    Syntax **swept = malloc(sizeof(Syntax *) * (length + 1));
+    for (int i = length - 1; i >= 0; i--) {
+        swept[i] = sweep_statement(eliminator, list_get(statements, i), live,
+                                   remove);
+    }
+    live_set_union(live, outer);
+    live_set_free(outer);
+
+    if (remove) {
+        List *rewritten = syntax_list_new();
+        for (int i = 0; i < length; i++) {
+            if (swept[i] != NULL) {
+                list_append(rewritten, swept[i]);
+            }
+        }
+        list_free(statements);
+        syntax->block->statements = rewritten;
+    }
+    free(swept);
+}
+
+/* Update LIVE from the variables live after the statement SYNTAX to
+ * those live before it. If REMOVE, also delete the stores nothing
+ * reads and return what's left of SYNTAX, which may be NULL.
+ * Otherwise leave SYNTAX alone.
+ *
+ * The value a dead store computes is never read, so the variables it
+ * reads don't become live.
+ */
+static Syntax *sweep_statement(Eliminator *eliminator, Syntax *syntax,
+                               LiveSet *live, bool remove) {
+    if (syntax->type == RETURN_STATEMENT) {
+        live_set_clear(live);
+        add_uses(live, syntax->return_statement->expression);
+
+    } else if (syntax->type == DEFINE_VAR || syntax->type == ASSIGNMENT) {
+        bool is_definition = syntax->type == DEFINE_VAR;
+        Symbol var_name = is_definition
+                              ? syntax->define_var_statement->var_name
+                              : syntax->assignment->var_name;
+        Syntax *expression = is_definition
+                                 ? syntax->define_var_statement->init_value
+                                 : syntax->assignment->expression;
+
+        bool is_dead = !live_set_contains(live, var_name);
+        live_set_remove(live, var_name);
+        if (!is_dead || has_side_effects(expression)) {
+            add_uses(live, expression);
+        }
+        if (is_dead && remove) {
+            return remove_dead_store(eliminator, syntax, var_name,
+                                     expression);
+        }
+
+    } else if (syntax->type == IF_STATEMENT) {
+        LiveSet *then_live = live_set_copy(live);
+        sweep_block(eliminator, syntax->if_statement->then, then_live,
+                    remove);
+        // The then block might not run.
+        live_set_union(live, then_live);
+        live_set_free(then_live);
+        add_uses(live, syntax->if_statement->condition);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        WhileStatement *while_statement = syntax->while_statement;
+
+        // Find what's live where the condition is tested, which is
+        // before the loop and after every iteration. Sets only grow,
+        // so we're done when one stays the same size. Each pass may
+        // only add one variable of a chain like `a = b; b = c;`, so if
+        // we're still growing after a few, we take everything the loop
+        // reads. That's more than is live, which only costs us dead
+        // stores, and the next pass can't add anything.
+        LiveSet *head_live = live_set_copy(live);
+        add_uses(head_live, while_statement->condition);
+        for (int pass = 1;; pass++) {
+            if (pass > MAX_LOOP_PASSES) {
+                add_all_uses(head_live, while_statement->body);
+            }
+            LiveSet *body_live = live_set_copy(head_live);
+            sweep_block(eliminator, while_statement->body, body_live, false);
+            int count = head_live->count;
+            live_set_union(head_live, body_live);
+            live_set_free(body_live);
+            if (head_live->count == count) {
+                break;
+            }
+        }
+
+        if (remove) {
+            LiveSet *body_live = live_set_copy(head_live);
+            sweep_block(eliminator, while_statement->body, body_live, true);
+            live_set_free(body_live);
+        }
+        live_set_clear(live);
+        live_set_union(live, head_live);
+        live_set_free(head_live);
+
+    } else if (syntax->type == BLOCK) {
+        sweep_block(eliminator, syntax, live, remove);
+
+    } else if (!has_side_effects(syntax)) {
+        // An expression statement whose value is thrown away.
+        if (remove) {
+            eliminator->dead_store_count++;
+            syntax_free(syntax);
+            return NULL;
+        }
+
+    } else {
+        add_uses(live, syntax);
+    }
+    return syntax;
+}
+
+/* Remove the statements in the TOP_LEVEL SYNTAX that can never run,
+ * if and while statements whose condition is a constant, and
+ * assignments to locals that are never read. If REPORT isn't NULL,
+ * say how much we removed there.
+ */
+Syntax *eliminate_dead_code(Syntax *syntax, FILE *report) {
+    Eliminator eliminator = {0};
+
+    List *declarations = syntax->top_level->declarations;
+    for (int i = 0; i < list_length(declarations); i++) {
+        Syntax *declaration = list_get(declarations, i);
+        if (declaration->type != FUNCTION) {
+            continue;
+        }
+
+        Syntax *root_block = declaration->function->root_block;
+        simplify_block(&eliminator, root_block);
+
+        eliminator.reference_counts = symbol_map_new();
+        eliminator.counts = list_new();
+        count_references(&eliminator, root_block);
+
+        LiveSet *live = live_set_new();
+        sweep_block(&eliminator, root_block, live, true);
+        live_set_free(live);
+
+        for (int j = 0; j < list_length(eliminator.counts); j++) {
+            free(list_get(eliminator.counts, j));
+        }
+        list_free(eliminator.counts);
+        symbol_map_free(eliminator.reference_counts);
+    }
+
+    if (report != NULL) {
+        fprintf(report,
+                "Removed %d unreachable statements, %d constant branches "
+                "and %d dead stores.\n",
+                eliminator.unreachable_count, eliminator.constant_branch_count,
+                eliminator.dead_store_count);
+    }
+    timing_count("unreachable statements", eliminator.unreachable_count);
+    timing_count("constant branches", eliminator.constant_branch_count);
+    timing_count("dead stores", eliminator.dead_store_count);
+    return syntax;
+}
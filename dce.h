@@ -0,0 +1,10 @@
+#ifndef MC_DCE_H
+#define MC_DCE_H
+
+#include <stdio.h>
+
+#include "syntax.h"
+
+Syntax *eliminate_dead_code(Syntax *syntax, FILE *report);
+
+#endif
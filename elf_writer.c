@@ -0,0 +1,314 @@
+#include <elf.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "buffer.h"
+#include "elf_writer.h"
+#include "output.h"
+#include "target.h"
+
+// Where ld puts static programs, so ours look familiar in a debugger.
+#define I386_BASE_ADDRESS 0x08048000
+#define X86_64_BASE_ADDRESS 0x400000
+#define PAGE_SIZE 0x1000
+
+#define TEXT_ALIGNMENT 16
+
+/* The sections of an object file, in order. */
+enum {
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_RELOCATIONS,
+    SECTION_SYMBOLS,
+    SECTION_STRINGS,
+    SECTION_SECTION_NAMES,
+    NUM_SECTIONS,
+};
+
+static bool is_64_bit(Target *target) { return target->arch == TARGET_X86_64; }
+
+static void append_elf_header(Buffer *file, Target *target, uint16_t type,
+                              uint64_t entry, uint64_t program_headers,
+                              uint64_t section_headers) {
+    unsigned char ident[EI_NIDENT] = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3};
+    ident[EI_CLASS] = is_64_bit(target) ? ELFCLASS64 : ELFCLASS32;
+    ident[EI_DATA] = ELFDATA2LSB;
+    ident[EI_VERSION] = EV_CURRENT;
+    ident[EI_OSABI] = ELFOSABI_SYSV;
+
+    uint16_t program_header_count = program_headers == 0 ? 0 : 1;
+    uint16_t section_header_count = section_headers == 0 ? 0 : NUM_SECTIONS;
+
+    if (is_64_bit(target)) {
+        Elf64_Ehdr header = {0};
+        memcpy(header.e_ident, ident, EI_NIDENT);
+        header.e_type = type;
+        header.e_machine = EM_X86_64;
+        header.e_version = EV_CURRENT;
+        header.e_entry = entry;
+        header.e_phoff = program_headers;
+        header.e_shoff = section_headers;
+        header.e_ehsize = sizeof(Elf64_Ehdr);
+        header.e_phentsize = program_header_count ? sizeof(Elf64_Phdr) : 0;
+        header.e_phnum = program_header_count;
+        header.e_shentsize = section_header_count ? sizeof(Elf64_Shdr) : 0;
+        header.e_shnum = section_header_count;
+        header.e_shstrndx = section_header_count ? SECTION_SECTION_NAMES : 0;
+        buffer_append(file, &header, sizeof(header));
+    } else {
+        Elf32_Ehdr header = {0};
+        memcpy(header.e_ident, ident, EI_NIDENT);
+        header.e_type = type;
+        header.e_machine = EM_386;
+        header.e_version = EV_CURRENT;
+        header.e_entry = entry;
+        header.e_phoff = program_headers;
+        header.e_shoff = section_headers;
+        header.e_ehsize = sizeof(Elf32_Ehdr);
+        header.e_phentsize = program_header_count ? sizeof(Elf32_Phdr) : 0;
+        header.e_phnum = program_header_count;
+        header.e_shentsize = section_header_count ? sizeof(Elf32_Shdr) : 0;
+        header.e_shnum = section_header_count;
+        header.e_shstrndx = section_header_count ? SECTION_SECTION_NAMES : 0;
+        buffer_append(file, &header, sizeof(header));
+    }
+}
+
+static void append_section_header(Buffer *file, Target *target,
+                                  uint32_t name, uint32_t type, uint64_t flags,
+                                  uint64_t offset, uint64_t size,
+                                  uint32_t link, uint32_t info,
+                                  uint64_t alignment, uint64_t entry_size) {
+    if (is_64_bit(target)) {
+        Elf64_Shdr header = {name,   type, flags, 0,         offset,
+                             size,   link, info,  alignment, entry_size};
+        buffer_append(file, &header, sizeof(header));
+    } else {
+        Elf32_Shdr header = {name,   type, flags, 0,         offset,
+                             size,   link, info,  alignment, entry_size};
+        buffer_append(file, &header, sizeof(header));
+    }
+}
+
+static void append_symbol(Buffer *file, Target *target, uint32_t name,
+                          uint64_t value, unsigned char binding,
+                          uint16_t section) {
+    unsigned char info = is_64_bit(target) ? ELF64_ST_INFO(binding, STT_NOTYPE)
+                                           : ELF32_ST_INFO(binding, STT_NOTYPE);
+    if (is_64_bit(target)) {
+        Elf64_Sym symbol = {name, info, STV_DEFAULT, section, value, 0};
+        buffer_append(file, &symbol, sizeof(symbol));
+    } else {
+        Elf32_Sym symbol = {name, value, 0, info, STV_DEFAULT, section};
+        buffer_append(file, &symbol, sizeof(symbol));
+    }
+}
+
+/* Append a relocation for the PC-relative field at OFFSET. i386 keeps
+ * the addend in the field itself; x86-64 states it explicitly.
+ */
+static void append_relocation(Buffer *file, Target *target, uint64_t offset,
+                              uint32_t symbol) {
+    if (is_64_bit(target)) {
+        Elf64_Rela relocation = {
+            offset, ELF64_R_INFO(symbol, R_X86_64_PLT32), -4};
+        buffer_append(file, &relocation, sizeof(relocation));
+    } else {
+        Elf32_Rel relocation = {offset, ELF32_R_INFO(symbol, R_386_PC32)};
+        buffer_append(file, &relocation, sizeof(relocation));
+    }
+}
+
+static bool write_file(char *path, Buffer *file, int mode) {
+    Output *output = output_open(path, mode);
+    if (output == NULL) {
+        return false;
+    }
+    output_append(output, file->data, file->length);
+    return output_close(output);
+}
+
+static uint32_t add_string(Buffer *strings, char *string) {
+    uint32_t offset = strings->length;
+    buffer_append(strings, string, strlen(string) + 1);
+    return offset;
+}
+
+/* Write MACHINE_CODE to PATH as a relocatable object for ld. */
+bool write_elf_object(char *path, MachineCode *machine_code, Target *target) {
+    bool elf64 = is_64_bit(target);
+    int word_size = elf64 ? 8 : 4;
+
+    Buffer section_names = {NULL, 0, 0};
+    buffer_push(&section_names, '\0');
+    uint32_t text_name = add_string(&section_names, ".text");
+    uint32_t relocations_name =
+        add_string(&section_names, elf64 ? ".rela.text" : ".rel.text");
+    uint32_t symbols_name = add_string(&section_names, ".symtab");
+    uint32_t strings_name = add_string(&section_names, ".strtab");
+    uint32_t section_names_name = add_string(&section_names, ".shstrtab");
+
+    // ELF wants local symbols before global ones, so we number them
+    // in two passes.
+    List *symbols = machine_code->symbols;
+    int symbol_count = list_length(symbols);
+    uint32_t *elf_indices = malloc((symbol_count + 1) * sizeof(uint32_t));
+
+    Buffer strings = {NULL, 0, 0};
+    buffer_push(&strings, '\0');
+    Buffer symbol_table = {NULL, 0, 0};
+    append_symbol(&symbol_table, target, 0, 0, STB_LOCAL, SHN_UNDEF);
+
+    uint32_t next_index = 1;
+    uint32_t first_global = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        bool global_pass = pass == 1;
+        if (global_pass) {
+            first_global = next_index;
+        }
+
+        for (int i = 0; i < symbol_count; i++) {
+            CodeSymbol *symbol = list_get(symbols, i);
+            // Symbols we only reference must be global, so the linker
+            // can find them elsewhere.
+            bool global = symbol->global || symbol->offset < 0;
+            if (global != global_pass) {
+                continue;
+            }
+
+            elf_indices[i] = next_index++;
+            append_symbol(&symbol_table, target,
+                          add_string(&strings, symbol->name),
+                          symbol->offset < 0 ? 0 : symbol->offset,
+                          global ? STB_GLOBAL : STB_LOCAL,
+                          symbol->offset < 0 ? SHN_UNDEF : SECTION_TEXT);
+        }
+    }
+
+    Buffer relocations = {NULL, 0, 0};
+    for (int i = 0; i < list_length(machine_code->relocations); i++) {
+        Relocation *relocation = list_get(machine_code->relocations, i);
+        append_relocation(&relocations, target, relocation->offset,
+                          elf_indices[relocation->symbol]);
+    }
+    free(elf_indices);
+
+    // Lay the sections out after the ELF header, then put the section
+    // headers at the end.
+    Buffer file = {NULL, 0, 0};
+    size_t header_size = elf64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    buffer_reserve(&file, header_size);
+    file.length = header_size;
+
+    buffer_pad(&file, TEXT_ALIGNMENT);
+    size_t text_offset = file.length;
+    buffer_append(&file, machine_code->code.data, machine_code->code.length);
+
+    buffer_pad(&file, word_size);
+    size_t relocations_offset = file.length;
+    buffer_append(&file, relocations.data, relocations.length);
+
+    buffer_pad(&file, word_size);
+    size_t symbols_offset = file.length;
+    buffer_append(&file, symbol_table.data, symbol_table.length);
+
+    size_t strings_offset = file.length;
+    buffer_append(&file, strings.data, strings.length);
+
+    size_t section_names_offset = file.length;
+    buffer_append(&file, section_names.data, section_names.length);
+
+    buffer_pad(&file, word_size);
+    size_t section_headers_offset = file.length;
+
+    append_section_header(&file, target, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0);
+    append_section_header(&file, target, text_name, SHT_PROGBITS,
+                          SHF_ALLOC | SHF_EXECINSTR, text_offset,
+                          machine_code->code.length, 0, 0, TEXT_ALIGNMENT, 0);
+    append_section_header(
+        &file, target, relocations_name, elf64 ? SHT_RELA : SHT_REL,
+        SHF_INFO_LINK, relocations_offset, relocations.length, SECTION_SYMBOLS,
+        SECTION_TEXT, word_size,
+        elf64 ? sizeof(Elf64_Rela) : sizeof(Elf32_Rel));
+    append_section_header(&file, target, symbols_name, SHT_SYMTAB, 0,
+                          symbols_offset, symbol_table.length, SECTION_STRINGS,
+                          first_global, word_size,
+                          elf64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym));
+    append_section_header(&file, target, strings_name, SHT_STRTAB, 0,
+                          strings_offset, strings.length, 0, 0, 1, 0);
+    append_section_header(&file, target, section_names_name, SHT_STRTAB, 0,
+                          section_names_offset, section_names.length, 0, 0, 1,
+                          0);
+
+    // Now we know where everything is, fill in the ELF header.
+    Buffer header = {NULL, 0, 0};
+    append_elf_header(&header, target, ET_REL, 0, 0, section_headers_offset);
+    memcpy(file.data, header.data, header.length);
+
+    bool result = write_file(path, &file, 0666);
+
+    free(header.data);
+    free(file.data);
+    free(relocations.data);
+    free(symbol_table.data);
+    free(strings.data);
+    free(section_names.data);
+    return result;
+}
+
+/* Write MACHINE_CODE to PATH as a static executable that starts at
+ * _start. The headers and code share one read-only, executable
+ * segment, and there are no section headers, like `ld -s` output.
+ */
+bool write_elf_executable(char *path, MachineCode *machine_code,
+                          Target *target) {
+    if (list_length(machine_code->relocations) > 0) {
+        Relocation *relocation = list_get(machine_code->relocations, 0);
+        CodeSymbol *symbol =
+            list_get(machine_code->symbols, relocation->symbol);
+        warnx("undefined reference to '%s'", symbol->name);
+        return false;
+    }
+
+    int start = find_code_symbol(machine_code, "_start");
+    if (start < 0) {
+        warnx("no _start symbol to use as the entry point");
+        return false;
+    }
+    CodeSymbol *start_symbol = list_get(machine_code->symbols, start);
+
+    bool elf64 = is_64_bit(target);
+    uint64_t base_address = elf64 ? X86_64_BASE_ADDRESS : I386_BASE_ADDRESS;
+    size_t header_size = elf64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t program_header_size =
+        elf64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t text_offset = header_size + program_header_size;
+    size_t file_size = text_offset + machine_code->code.length;
+
+    Buffer file = {NULL, 0, 0};
+    append_elf_header(&file, target, ET_EXEC,
+                      base_address + text_offset + start_symbol->offset,
+                      header_size, 0);
+
+    if (elf64) {
+        Elf64_Phdr segment = {PT_LOAD,   PF_R | PF_X,  0,
+                              base_address, base_address, file_size,
+                              file_size, PAGE_SIZE};
+        buffer_append(&file, &segment, sizeof(segment));
+    } else {
+        Elf32_Phdr segment = {PT_LOAD,      0,         base_address,
+                              base_address, file_size, file_size,
+                              PF_R | PF_X,  PAGE_SIZE};
+        buffer_append(&file, &segment, sizeof(segment));
+    }
+
+    buffer_append(&file, machine_code->code.data, machine_code->code.length);
+
+    bool result = write_file(path, &file, 0777);
+    free(file.data);
+    return result;
+}
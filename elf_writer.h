@@ -0,0 +1,13 @@
+#ifndef MC_ELF_WRITER_H
+#define MC_ELF_WRITER_H
+
+#include <stdbool.h>
+
+#include "assembler.h"
+#include "target.h"
+
+bool write_elf_object(char *path, MachineCode *machine_code, Target *target);
+bool write_elf_executable(char *path, MachineCode *machine_code,
+                          Target *target);
+
+#endif
@@ -1,47 +1,165 @@
+#include <assert.h>
 #include <err.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include "env.h"
 
+#define INITIAL_ENVIRONMENT_SIZE 16
+
+static EnvironmentSlot *new_slots(size_t capacity) {
+    EnvironmentSlot *slots = malloc(capacity * sizeof(EnvironmentSlot));
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i].var_name = NO_SYMBOL;
+        slots[i].binding = NO_BINDING;
+    }
+    return slots;
+}
+
 Environment *environment_new() {
     Environment *env = malloc(sizeof(Environment));
+    env->capacity = INITIAL_ENVIRONMENT_SIZE;
+    env->slot_count = 0;
+    env->slots = new_slots(env->capacity);
+
     env->size = 0;
-    env->items = NULL;
+    env->bindings_capacity = 0;
+    env->bindings = NULL;
+
+    env->depth = 0;
+    env->scopes_capacity = 0;
+    env->scope_starts = NULL;
 
     return env;
 }
 
-void environment_set_offset(Environment *env, char *var_name, int offset) {
-    env->size++;
-    env->items = realloc(env->items, env->size * sizeof(VarWithOffset));
-
-    VarWithOffset *vwo = &env->items[env->size - 1];
-    // TODO: use a copy of the string instead
-    vwo->var_name = var_name;
-    vwo->offset = offset;
+/* Symbols are dense small integers, so we scramble them with a
+ * Fibonacci hash to spread neighbours across the table.
+ */
+static size_t hash_name(Symbol var_name) {
+    return (uint32_t)(var_name * 2654435769u) >> 8;
 }
 
-/* Return the offset from %ebp of variable VAR_NAME.
+/* Return the index of the slot for VAR_NAME: the slot holding it, or
+ * the empty slot where it belongs.
  */
-int environment_get_offset(Environment *env, char *var_name) {
-    VarWithOffset vwo;
+static size_t find_slot(EnvironmentSlot *slots, size_t capacity,
+                        Symbol var_name) {
+    size_t index = hash_name(var_name) & (capacity - 1);
+    while (slots[index].var_name != NO_SYMBOL &&
+           slots[index].var_name != var_name) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+/* Double the hash table, keeping bindings pointing at their new slots. */
+static void grow_slots(Environment *env) {
+    size_t capacity = env->capacity * 2;
+    EnvironmentSlot *slots = new_slots(capacity);
+
+    for (size_t i = 0; i < env->capacity; i++) {
+        if (env->slots[i].var_name != NO_SYMBOL) {
+            slots[find_slot(slots, capacity, env->slots[i].var_name)] =
+                env->slots[i];
+        }
+    }
     for (size_t i = 0; i < env->size; i++) {
-        vwo = env->items[i];
+        env->bindings[i].slot =
+            find_slot(slots, capacity, env->bindings[i].var_name);
+    }
+
+    free(env->slots);
+    env->slots = slots;
+    env->capacity = capacity;
+}
+
+void environment_push_scope(Environment *env) {
+    if (env->depth == env->scopes_capacity) {
+        env->scopes_capacity = env->scopes_capacity == 0
+                                   ? INITIAL_ENVIRONMENT_SIZE
+                                   : env->scopes_capacity * 2;
+        env->scope_starts = realloc(env->scope_starts,
+                                    env->scopes_capacity * sizeof(size_t));
+    }
 
-        if (strcmp(vwo.var_name, var_name) == 0) {
-            return vwo.offset;
+    env->scope_starts[env->depth++] = env->size;
+}
+
+/* Forget every variable defined since the matching push. */
+void environment_pop_scope(Environment *env) {
+    assert(env->depth > 0);
+    size_t start = env->scope_starts[--env->depth];
+
+    while (env->size > start) {
+        Binding *binding = &env->bindings[--env->size];
+        env->slots[binding->slot].binding = binding->shadowed;
+    }
+}
+
+void environment_set_offset(Environment *env, Symbol var_name, int offset) {
+    // Keep the table at most half full, so probe sequences stay short.
+    if ((env->slot_count + 1) * 2 > env->capacity) {
+        grow_slots(env);
+    }
+
+    size_t slot = find_slot(env->slots, env->capacity, var_name);
+    EnvironmentSlot *env_slot = &env->slots[slot];
+    if (env_slot->var_name == NO_SYMBOL) {
+        env_slot->var_name = var_name;
+        env_slot->binding = NO_BINDING;
+        env->slot_count++;
+    }
+
+    size_t scope_start = env->depth > 0 ? env->scope_starts[env->depth - 1] : 0;
+    if (env_slot->binding != NO_BINDING) {
+        if ((size_t)env_slot->binding >= scope_start) {
+            warnx("Redefinition of '%s'", symbol_name(var_name));
+            env->bindings[env_slot->binding].offset = offset;
+            return;
         }
+        warnx("Definition of '%s' shadows a variable in an outer scope",
+              symbol_name(var_name));
+    }
+
+    if (env->size == env->bindings_capacity) {
+        env->bindings_capacity = env->bindings_capacity == 0
+                                     ? INITIAL_ENVIRONMENT_SIZE
+                                     : env->bindings_capacity * 2;
+        env->bindings =
+            realloc(env->bindings, env->bindings_capacity * sizeof(Binding));
+    }
+
+    Binding *binding = &env->bindings[env->size];
+    binding->var_name = env_slot->var_name;
+    binding->offset = offset;
+    binding->shadowed = env_slot->binding;
+    binding->slot = slot;
+
+    env_slot->binding = env->size++;
+}
+
+/* Return the offset from the frame pointer of variable VAR_NAME, in
+ * the innermost scope that defines it.
+ */
+int environment_get_offset(Environment *env, Symbol var_name) {
+    EnvironmentSlot *env_slot =
+        &env->slots[find_slot(env->slots, env->capacity, var_name)];
+
+    if (env_slot->var_name == NO_SYMBOL || env_slot->binding == NO_BINDING) {
+        warnx("Could not find %s in environment", symbol_name(var_name));
+        return -1;
     }
 
-    warnx("Could not find %s in environment", var_name);
-    return -1;
+    return env->bindings[env_slot->binding].offset;
 }
 
 void environment_free(Environment *env) {
     if (env != NULL) {
-        free(env->items);
+        free(env->slots);
+        free(env->bindings);
+        free(env->scope_starts);
         free(env);
     }
 }
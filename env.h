@@ -3,25 +3,60 @@
 
 #include <stdlib.h>
 
-typedef struct VarWithOffset {
-    char *var_name;
+#include "intern.h"
+
+#define NO_BINDING -1
+
+typedef struct Binding {
+    Symbol var_name;
     int offset;
-} VarWithOffset;
+    // The binding of the same name in an outer scope that this one
+    // hides, or NO_BINDING.
+    int shadowed;
+    // Where VAR_NAME lives in Environment.slots.
+    size_t slot;
+} Binding;
+
+typedef struct EnvironmentSlot {
+    // NO_SYMBOL if the slot is empty.
+    Symbol var_name;
+    // The innermost binding of VAR_NAME, or NO_BINDING once every
+    // scope defining it has been popped.
+    int binding;
+} EnvironmentSlot;
 
 /******************************************************************************
  *
- * A data structure that maps variable names (i.e. strings) to offsets
- * (integers) in the current stack frame.
+ * A data structure that maps variable names (interned symbols) to offsets
+ * (integers) in the current stack frame, with nested block scopes.
+ *
+ * Names are looked up in an open addressing hash table, which always
+ * points at the innermost binding. Bindings are kept on a stack in
+ * definition order, so popping a scope just unwinds the bindings it
+ * added and restores the ones they shadowed.
  *
  ******************************************************************************/
 typedef struct Environment {
+    EnvironmentSlot *slots;
+    // Always a power of two.
+    size_t capacity;
+    size_t slot_count;
+
+    Binding *bindings;
     size_t size;
-    VarWithOffset *items;
+    size_t bindings_capacity;
+
+    // The index in BINDINGS where each open scope starts.
+    size_t *scope_starts;
+    size_t depth;
+    size_t scopes_capacity;
 } Environment;
 
 Environment *environment_new();
-int environment_get_offset(Environment *env, char *var_name);
-void environment_set_offset(Environment *env, char *var_name, int offset);
+void environment_push_scope(Environment *env);
+void environment_pop_scope(Environment *env);
+int environment_get_offset(Environment *env, Symbol var_name);
+void environment_set_offset(Environment *env, Symbol var_name, int offset);
 void environment_free(Environment *env);
 
 #endif
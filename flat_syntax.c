@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flat_syntax.h"
+#include "list.h"
+#include "syntax.h"
+
+#define INITIAL_FLAT_SIZE 64
+
+/* Make sure ITEMS, which holds COUNT items of ITEM_SIZE bytes, has room
+ * for EXTRA more, doubling CAPACITY as needed.
+ */
+static void *grow(void *items, uint32_t count, uint32_t extra,
+                  uint32_t *capacity, size_t item_size) {
+    if (count + extra <= *capacity) {
+        return items;
+    }
+
+    while (count + extra > *capacity) {
+        *capacity = *capacity == 0 ? INITIAL_FLAT_SIZE : *capacity * 2;
+    }
+    return realloc(items, *capacity * item_size);
+}
+
+static NodeIndex add_node(FlatSyntax *flat, SyntaxType type) {
+    flat->nodes = grow(flat->nodes, flat->node_count, 1, &flat->node_capacity,
+                       sizeof(FlatNode));
+
+    FlatNode *node = &flat->nodes[flat->node_count];
+    node->type = type;
+    node->operator_type = 0;
+    node->children[0] = NO_NODE;
+    node->children[1] = NO_NODE;
+    node->value = 0;
+
+    return flat->node_count++;
+}
+
+static NodeIndex flatten_node(FlatSyntax *flat, Syntax *syntax);
+
+/* Flatten SYNTAXES as the children of the node at INDEX. We reserve
+ * their slots in flat->lists first, since flattening each child may
+ * add lists of its own.
+ */
+static void flatten_list(FlatSyntax *flat, NodeIndex index, List *syntaxes) {
+    uint32_t count = list_length(syntaxes);
+    uint32_t start = flat->list_count;
+
+    flat->lists = grow(flat->lists, flat->list_count, count,
+                       &flat->list_capacity, sizeof(NodeIndex));
+    flat->list_count += count;
+
+    flat->nodes[index].children[0] = start;
+    flat->nodes[index].children[1] = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        NodeIndex child = flatten_node(flat, list_get(syntaxes, i));
+        flat->lists[start + i] = child;
+    }
+}
+
+/* Flatten the children of the node at INDEX. We go through the index
+ * rather than a pointer, because adding nodes may move the array.
+ */
+static void flatten_children(FlatSyntax *flat, NodeIndex index,
+                             Syntax *first, Syntax *second) {
+    NodeIndex child = flatten_node(flat, first);
+    flat->nodes[index].children[0] = child;
+
+    if (second != NULL) {
+        child = flatten_node(flat, second);
+        flat->nodes[index].children[1] = child;
+    }
+}
+
+static NodeIndex flatten_node(FlatSyntax *flat, Syntax *syntax) {
+    NodeIndex index = add_node(flat, syntax->type);
+
+    if (syntax->type == IMMEDIATE) {
+        flat->nodes[index].value = syntax->immediate->value;
+
+    } else if (syntax->type == VARIABLE) {
+        flat->nodes[index].name = syntax->variable->var_name;
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        flat->nodes[index].operator_type = unary_syntax->unary_type;
+        flatten_children(flat, index, unary_syntax->expression, NULL);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+        flat->nodes[index].operator_type = binary_syntax->binary_type;
+        flatten_children(flat, index, binary_syntax->left,
+                         binary_syntax->right);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        FunctionCall *function_call = syntax->function_call;
+        flat->nodes[index].name = function_call->function_name;
+        flatten_children(flat, index, function_call->function_arguments, NULL);
+
+    } else if (syntax->type == FUNCTION_ARGUMENTS) {
+        flatten_list(flat, index, syntax->function_arguments->arguments);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        flat->nodes[index].name = syntax->assignment->var_name;
+        flatten_children(flat, index, syntax->assignment->expression, NULL);
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        flatten_children(flat, index, syntax->return_statement->expression,
+                         NULL);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        flatten_children(flat, index, syntax->if_statement->condition,
+                         syntax->if_statement->then);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+        flat->nodes[index].name = define_var_statement->var_name;
+        flatten_children(flat, index, define_var_statement->init_value, NULL);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        flatten_children(flat, index, syntax->while_statement->condition,
+                         syntax->while_statement->body);
+
+    } else if (syntax->type == BLOCK) {
+        flatten_list(flat, index, syntax->block->statements);
+
+    } else if (syntax->type == FUNCTION) {
+        flat->nodes[index].name = syntax->function->name;
+        flatten_children(flat, index, syntax->function->root_block, NULL);
+
+    } else if (syntax->type == TOP_LEVEL) {
+        flatten_list(flat, index, syntax->top_level->declarations);
+    }
+
+    return index;
+}
+
+/* Copy the tree SYNTAX into a new FlatSyntax. Names are interned
+ * Symbols, so nothing in the result points back into SYNTAX.
+ */
+FlatSyntax *flatten_syntax(Syntax *syntax) {
+    FlatSyntax *flat = malloc(sizeof(FlatSyntax));
+    flat->nodes = NULL;
+    flat->node_count = 0;
+    flat->node_capacity = 0;
+    flat->lists = NULL;
+    flat->list_count = 0;
+    flat->list_capacity = 0;
+
+    flatten_node(flat, syntax);
+    return flat;
+}
+
+void flat_syntax_free(FlatSyntax *flat) {
+    free(flat->nodes);
+    free(flat->lists);
+    free(flat);
+}
+
+/* The bytes used by the nodes and lists of FLAT. */
+size_t flat_syntax_size(FlatSyntax *flat) {
+    return flat->node_count * sizeof(FlatNode) +
+           flat->list_count * sizeof(NodeIndex);
+}
+
+static void print_indent(int indent) {
+    for (int i = 0; i < indent; i++) {
+        printf(" ");
+    }
+}
+
+static void print_node(FlatSyntax *flat, NodeIndex index, int indent) {
+    FlatNode *node = &flat->nodes[index];
+    char *type_name = syntax_kind_name(node->type, node->operator_type);
+
+    print_indent(indent);
+
+    if (node->type == IMMEDIATE) {
+        printf("%s %d\n", type_name, node->value);
+
+    } else if (node->type == VARIABLE) {
+        printf("%s '%s'\n", type_name, symbol_name(node->name));
+
+    } else if (node->type == UNARY_OPERATOR ||
+               node->type == RETURN_STATEMENT) {
+        printf("%s\n", type_name);
+        print_node(flat, node->children[0], indent + 4);
+
+    } else if (node->type == BINARY_OPERATOR) {
+        printf("%s LEFT\n", type_name);
+        print_node(flat, node->children[0], indent + 4);
+
+        print_indent(indent);
+        printf("%s RIGHT\n", type_name);
+        print_node(flat, node->children[1], indent + 4);
+
+    } else if (node->type == FUNCTION_CALL) {
+        printf("%s '%s'\n", type_name, symbol_name(node->name));
+        print_node(flat, node->children[0], indent);
+
+    } else if (node->type == FUNCTION_ARGUMENTS || node->type == BLOCK ||
+               node->type == TOP_LEVEL) {
+        printf("%s\n", type_name);
+        for (uint32_t i = 0; i < node->children[1]; i++) {
+            print_node(flat, flat->lists[node->children[0] + i], indent + 4);
+        }
+
+    } else if (node->type == IF_STATEMENT) {
+        printf("%s CONDITION\n", type_name);
+        print_node(flat, node->children[0], indent + 4);
+
+        print_indent(indent);
+        printf("%s THEN\n", type_name);
+        print_node(flat, node->children[1], indent + 4);
+
+    } else if (node->type == DEFINE_VAR) {
+        char *var_name = symbol_name(node->name);
+        printf("%s '%s'\n", type_name, var_name);
+
+        print_indent(indent);
+        printf("'%s' INITIAL VALUE\n", var_name);
+        print_node(flat, node->children[0], indent + 4);
+
+    } else if (node->type == FUNCTION || node->type == ASSIGNMENT) {
+        printf("%s '%s'\n", type_name, symbol_name(node->name));
+        print_node(flat, node->children[0], indent + 4);
+
+    } else if (node->type == WHILE_SYNTAX) {
+        printf("%s CONDITION\n", type_name);
+        print_node(flat, node->children[0], indent + 4);
+
+        print_indent(indent);
+        printf("%s BODY\n", type_name);
+        print_node(flat, node->children[1], indent + 4);
+
+    } else {
+        printf("??? UNKNOWN SYNTAX TYPE\n");
+    }
+}
+
+void print_flat_syntax(FlatSyntax *flat) { print_node(flat, 0, 0); }
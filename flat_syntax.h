@@ -0,0 +1,57 @@
+#ifndef MC_FLAT_SYNTAX_H
+#define MC_FLAT_SYNTAX_H
+
+#include <stdint.h>
+
+#include "syntax.h"
+
+/* An index into FlatSyntax.nodes. */
+typedef uint32_t NodeIndex;
+
+#define NO_NODE UINT32_MAX
+
+/* A fixed-size syntax node with its payload stored inline. Children
+ * are indices into the same array, so a walk touches one cache line
+ * per node rather than chasing a Syntax and a payload pointer.
+ *
+ * Nodes with a list of children (BLOCK, FUNCTION_ARGUMENTS and
+ * TOP_LEVEL) store the range of FlatSyntax.lists that holds them in
+ * children[0] (start) and children[1] (count).
+ */
+typedef struct FlatNode {
+    uint8_t type;
+    // The UnaryExpressionType or BinaryExpressionType of operators.
+    uint8_t operator_type;
+    NodeIndex children[2];
+    union {
+        // IMMEDIATE only.
+        int32_t value;
+        // The interned name of nodes that have one.
+        Symbol name;
+    };
+} FlatNode;
+
+/******************************************************************************
+ *
+ * A whole syntax tree stored in two contiguous arrays. Nodes are in
+ * pre-order, so the root is nodes[0] and a node's children always
+ * come after it.
+ *
+ ******************************************************************************/
+typedef struct FlatSyntax {
+    FlatNode *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    // Child indices of nodes with a list of children.
+    NodeIndex *lists;
+    uint32_t list_count;
+    uint32_t list_capacity;
+} FlatSyntax;
+
+FlatSyntax *flatten_syntax(Syntax *syntax);
+void flat_syntax_free(FlatSyntax *flat);
+size_t flat_syntax_size(FlatSyntax *flat);
+void print_flat_syntax(FlatSyntax *flat);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "list.h"
+#include "syntax.h"
+
+static bool is_immediate(Syntax *syntax, int value) {
+    return syntax->type == IMMEDIATE && syntax->immediate->value == value;
+}
+
+static bool is_logical_negation(Syntax *syntax) {
+    return syntax->type == UNARY_OPERATOR &&
+           syntax->unary_expression->unary_type == LOGICAL_NEGATION;
+}
+
+/* Is SYNTAX always 0 or 1? */
+static bool is_boolean(Syntax *syntax) {
+    if (is_logical_negation(syntax)) {
+        return true;
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpressionType binary_type =
+            syntax->binary_expression->binary_type;
+        return binary_type == LESS_THAN || binary_type == LESS_THAN_OR_EQUAL;
+    } else if (syntax->type == IMMEDIATE) {
+        return is_immediate(syntax, 0) || is_immediate(syntax, 1);
+    }
+    return false;
+}
+
+/* Could evaluating SYNTAX do anything other than produce a value? */
+static bool has_side_effects(Syntax *syntax) {
+    if (syntax->type == FUNCTION_CALL || syntax->type == ASSIGNMENT) {
+        return true;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return has_side_effects(syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return has_side_effects(syntax->binary_expression->left) ||
+               has_side_effects(syntax->binary_expression->right);
+    }
+    return false;
+}
+
+static Syntax *replace_with_immediate(Syntax *syntax, int value) {
+    syntax_free(syntax);
+    return immediate_new(value);
+}
+
+/* Replace the BINARY_OPERATOR SYNTAX with its operand KEPT, freeing
+ * the other operand.
+ */
+static Syntax *replace_with_operand(Syntax *syntax, Syntax *kept) {
+    BinaryExpression *binary_syntax = syntax->binary_expression;
+    Syntax *discarded = kept == binary_syntax->left ? binary_syntax->right
+                                                    : binary_syntax->left;
+    syntax_free(discarded);
+    syntax_node_free(syntax);
+    return kept;
+}
+
+/* Replace the UNARY_OPERATOR SYNTAX with its operand. */
+static Syntax *unwrap_unary(Syntax *syntax) {
+    Syntax *expression = syntax->unary_expression->expression;
+    syntax_node_free(syntax);
+    return expression;
+}
+
+/* Fold SYNTAX where only its truth value matters, as in an if or
+ * while condition. There !!x is the same as x.
+ */
+static Syntax *fold_condition(Syntax *syntax) {
+    syntax = fold_constants(syntax);
+
+    while (is_logical_negation(syntax) &&
+           is_logical_negation(syntax->unary_expression->expression)) {
+        syntax = unwrap_unary(unwrap_unary(syntax));
+    }
+    return syntax;
+}
+
+static Syntax *fold_unary(Syntax *syntax) {
+    UnaryExpression *unary_syntax = syntax->unary_expression;
+
+    if (unary_syntax->unary_type == LOGICAL_NEGATION) {
+        unary_syntax->expression = fold_condition(unary_syntax->expression);
+    } else {
+        unary_syntax->expression = fold_constants(unary_syntax->expression);
+    }
+
+    Syntax *expression = unary_syntax->expression;
+    if (expression->type == IMMEDIATE) {
+        int value = expression->immediate->value;
+        if (unary_syntax->unary_type == BITWISE_NEGATION) {
+            return replace_with_immediate(syntax, ~value);
+        }
+        return replace_with_immediate(syntax, value == 0);
+    }
+
+    if (unary_syntax->unary_type == BITWISE_NEGATION &&
+        expression->type == UNARY_OPERATOR &&
+        expression->unary_expression->unary_type == BITWISE_NEGATION) {
+        // ~~x is x.
+        return unwrap_unary(unwrap_unary(syntax));
+    }
+
+    if (is_logical_negation(syntax) && is_logical_negation(expression) &&
+        is_boolean(expression->unary_expression->expression)) {
+        // !!x is x when x is already 0 or 1.
+        return unwrap_unary(unwrap_unary(syntax));
+    }
+
+    return syntax;
+}
+
+static Syntax *fold_binary(Syntax *syntax) {
+    BinaryExpression *binary_syntax = syntax->binary_expression;
+    binary_syntax->left = fold_constants(binary_syntax->left);
+    binary_syntax->right = fold_constants(binary_syntax->right);
+
+    Syntax *left = binary_syntax->left;
+    Syntax *right = binary_syntax->right;
+    BinaryExpressionType binary_type = binary_syntax->binary_type;
+
+    if (left->type == IMMEDIATE && right->type == IMMEDIATE) {
+        // The backend works on 32-bit registers, so arithmetic
+        // wraps. Do it unsigned, where overflow is defined.
+        int left_value = left->immediate->value;
+        int right_value = right->immediate->value;
+        uint32_t left_bits = (uint32_t)left_value;
+        uint32_t right_bits = (uint32_t)right_value;
+
+        if (binary_type == ADDITION) {
+            return replace_with_immediate(syntax,
+                                          (int32_t)(left_bits + right_bits));
+        } else if (binary_type == SUBTRACTION) {
+            return replace_with_immediate(syntax,
+                                          (int32_t)(left_bits - right_bits));
+        } else if (binary_type == MULTIPLICATION) {
+            return replace_with_immediate(syntax,
+                                          (int32_t)(left_bits * right_bits));
+        } else if (binary_type == LESS_THAN) {
+            return replace_with_immediate(syntax, left_value < right_value);
+        } else if (binary_type == LESS_THAN_OR_EQUAL) {
+            return replace_with_immediate(syntax, left_value <= right_value);
+        }
+    }
+
+    if (binary_type == ADDITION) {
+        if (is_immediate(right, 0)) {
+            return replace_with_operand(syntax, left);
+        } else if (is_immediate(left, 0)) {
+            return replace_with_operand(syntax, right);
+        }
+
+    } else if (binary_type == SUBTRACTION) {
+        if (is_immediate(right, 0)) {
+            return replace_with_operand(syntax, left);
+        }
+
+    } else if (binary_type == MULTIPLICATION) {
+        if (is_immediate(right, 1)) {
+            return replace_with_operand(syntax, left);
+        } else if (is_immediate(left, 1)) {
+            return replace_with_operand(syntax, right);
+        } else if ((is_immediate(right, 0) && !has_side_effects(left)) ||
+                   (is_immediate(left, 0) && !has_side_effects(right))) {
+            return replace_with_immediate(syntax, 0);
+        }
+    }
+
+    return syntax;
+}
+
+static void fold_list(List *syntaxes) {
+    for (int i = 0; i < list_length(syntaxes); i++) {
+        list_set(syntaxes, i, fold_constants(list_get(syntaxes, i)));
+    }
+}
+
+/* Evaluate constant subexpressions of SYNTAX at compile time and
+ * apply algebraic identities such as x+0 = x. Returns the rewritten
+ * tree, which may be a different node; replaced nodes are freed.
+ */
+Syntax *fold_constants(Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return fold_unary(syntax);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return fold_binary(syntax);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        syntax->assignment->expression =
+            fold_constants(syntax->assignment->expression);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        fold_constants(syntax->function_call->function_arguments);
+
+    } else if (syntax->type == FUNCTION_ARGUMENTS) {
+        fold_list(syntax->function_arguments->arguments);
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        syntax->return_statement->expression =
+            fold_constants(syntax->return_statement->expression);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        syntax->if_statement->condition =
+            fold_condition(syntax->if_statement->condition);
+        syntax->if_statement->then = fold_constants(syntax->if_statement->then);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        syntax->while_statement->condition =
+            fold_condition(syntax->while_statement->condition);
+        syntax->while_statement->body =
+            fold_constants(syntax->while_statement->body);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        syntax->define_var_statement->init_value =
+            fold_constants(syntax->define_var_statement->init_value);
+
+    } else if (syntax->type == BLOCK) {
+        fold_list(syntax->block->statements);
+
+    } else if (syntax->type == FUNCTION) {
+        syntax->function->root_block =
+            fold_constants(syntax->function->root_block);
+
+    } else if (syntax->type == TOP_LEVEL) {
+        fold_list(syntax->top_level->declarations);
+    }
+
+    return syntax;
+}
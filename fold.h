@@ -0,0 +1,8 @@
+#ifndef MC_FOLD_H
+#define MC_FOLD_H
+
+#include "syntax.h"
+
+Syntax *fold_constants(Syntax *syntax);
+
+#endif
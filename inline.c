@@ -0,0 +1,641 @@
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "inline.h"
+#include "intern.h"
+#include "list.h"
+#include "syntax.h"
+#include "timing.h"
+
+typedef enum { UNVISITED, VISITING, VISITED } VisitState;
+
+/* What we know about one function defined in the file. */
+typedef struct FunctionInfo {
+    Syntax *syntax;
+    // How many calls to it there are in the whole file.
+    int call_sites;
+    // Set if it can end up calling itself.
+    bool recursive;
+    VisitState state;
+} FunctionInfo;
+
+/* A local of a function we're inlining, and the name of its copy. */
+typedef struct Renaming {
+    Symbol from;
+    Symbol to;
+} Renaming;
+
+/******************************************************************************
+ *
+ * Inliner: the state of inlining one file. We visit callees before
+ * their callers, so the body we copy has already had its own small
+ * calls inlined.
+ *
+ ******************************************************************************/
+typedef struct Inliner {
+    FunctionInfo *functions;
+    int function_count;
+    int threshold;
+    // Where to explain each decision, or NULL.
+    FILE *report;
+    int inlined_count;
+    int rejected_count;
+
+    // The functions being visited, innermost last.
+    FunctionInfo **visiting;
+    int visiting_count;
+
+    // The locals of the body being copied, innermost scope last.
+    Renaming *renamings;
+    int renaming_count;
+    int renaming_capacity;
+
+    // Numbers each copy, so the names of its locals are unique.
+    int copy_count;
+
+    // Set once the statement being rewritten has done something that
+    // the code of a later call mustn't be moved before.
+    bool blocked;
+} Inliner;
+
+static FunctionInfo *find_function(Inliner *inliner, Symbol name) {
+    for (int i = 0; i < inliner->function_count; i++) {
+        if (inliner->functions[i].syntax->function->name == name) {
+            return &inliner->functions[i];
+        }
+    }
+    return NULL;
+}
+
+static List *call_arguments(Syntax *call) {
+    return call->function_call->function_arguments->function_arguments
+        ->arguments;
+}
+
+/* Call VISIT on every function call in SYNTAX, callees before the
+ * calls whose arguments they are.
+ */
+static void walk_calls(Inliner *inliner, Syntax *syntax,
+                       void (*visit)(Inliner *, Syntax *)) {
+    if (syntax->type == UNARY_OPERATOR) {
+        walk_calls(inliner, syntax->unary_expression->expression, visit);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        walk_calls(inliner, syntax->binary_expression->left, visit);
+        walk_calls(inliner, syntax->binary_expression->right, visit);
+    } else if (syntax->type == ASSIGNMENT) {
+        walk_calls(inliner, syntax->assignment->expression, visit);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        walk_calls(inliner, syntax->return_statement->expression, visit);
+    } else if (syntax->type == DEFINE_VAR) {
+        walk_calls(inliner, syntax->define_var_statement->init_value, visit);
+    } else if (syntax->type == IF_STATEMENT) {
+        walk_calls(inliner, syntax->if_statement->condition, visit);
+        walk_calls(inliner, syntax->if_statement->then, visit);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        walk_calls(inliner, syntax->while_statement->condition, visit);
+        walk_calls(inliner, syntax->while_statement->body, visit);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            walk_calls(inliner, list_get(statements, i), visit);
+        }
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            walk_calls(inliner, list_get(arguments, i), visit);
+        }
+        visit(inliner, syntax);
+    }
+}
+
+static int count_nodes(Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return 1 + count_nodes(syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return 1 + count_nodes(syntax->binary_expression->left) +
+               count_nodes(syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        return 1 + count_nodes(syntax->assignment->expression);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        return 1 + count_nodes(syntax->return_statement->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        return 1 + count_nodes(syntax->define_var_statement->init_value);
+    } else if (syntax->type == IF_STATEMENT) {
+        return 1 + count_nodes(syntax->if_statement->condition) +
+               count_nodes(syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        return 1 + count_nodes(syntax->while_statement->condition) +
+               count_nodes(syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        int count = 1;
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            count += count_nodes(list_get(statements, i));
+        }
+        return count;
+    } else if (syntax->type == FUNCTION_CALL) {
+        int count = 1;
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            count += count_nodes(list_get(arguments, i));
+        }
+        return count;
+    }
+    return 1;
+}
+
+static int count_returns(Syntax *syntax) {
+    if (syntax->type == RETURN_STATEMENT) {
+        return 1;
+    } else if (syntax->type == IF_STATEMENT) {
+        return count_returns(syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        return count_returns(syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        int count = 0;
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            count += count_returns(list_get(statements, i));
+        }
+        return count;
+    }
+    return 0;
+}
+
+/* Does the block BODY return only from its last statement, if at all?
+ * Then its copy can simply fall through to the code after the call.
+ */
+static bool returns_only_at_end(Syntax *body) {
+    List *statements = body->block->statements;
+    int returns = count_returns(body);
+    if (returns == 0) {
+        return true;
+    }
+
+    int length = list_length(statements);
+    if (returns > 1 || length == 0) {
+        return false;
+    }
+    Syntax *last = list_get(statements, length - 1);
+    return last->type == RETURN_STATEMENT;
+}
+
+static void count_call_site(Inliner *inliner, Syntax *call) {
+    FunctionInfo *callee =
+        find_function(inliner, call->function_call->function_name);
+    if (callee != NULL) {
+        callee->call_sites++;
+    }
+}
+
+/******************************************************************************
+ *
+ * Copying function bodies.
+ *
+ ******************************************************************************/
+
+static Symbol copy_name(Symbol name, int copy) {
+    // A '.' can't occur in a C identifier, so this can't clash with a
+    // name in the program. The loop optimizer and scope resolution add
+    // dotted names too, but they end in ".loopN" and ".shadowN".
+    char *original = symbol_name(name);
+    int length = snprintf(NULL, 0, "%s.inline%d", original, copy);
+    char *buffer = malloc(length + 1);
+    snprintf(buffer, length + 1, "%s.inline%d", original, copy);
+    Symbol result = intern_string(buffer);
+    free(buffer);
+    return result;
+}
+
+static void add_renaming(Inliner *inliner, Symbol from, Symbol to) {
+    if (inliner->renaming_count == inliner->renaming_capacity) {
+        inliner->renaming_capacity = inliner->renaming_capacity * 2 + 8;
+        inliner->renamings =
+            realloc(inliner->renamings,
+                    sizeof(Renaming) * inliner->renaming_capacity);
+    }
+    Renaming *renaming = &inliner->renamings[inliner->renaming_count++];
+    renaming->from = from;
+    renaming->to = to;
+}
+
+static Symbol renamed(Inliner *inliner, Symbol name) {
+    for (int i = inliner->renaming_count - 1; i >= 0; i--) {
+        if (inliner->renamings[i].from == name) {
+            return inliner->renamings[i].to;
+        }
+    }
+    return name;
+}
+
+/* Copy SYNTAX, giving the locals it defines the names of copy
+ * number COPY.
+ */
+static Syntax *copy_syntax(Inliner *inliner, Syntax *syntax, int copy) {
+    if (syntax->type == IMMEDIATE) {
+        return immediate_new(syntax->immediate->value);
+    } else if (syntax->type == VARIABLE) {
+        return variable_new(renamed(inliner, syntax->variable->var_name));
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        Syntax *expression = copy_syntax(inliner, unary_syntax->expression,
+                                         copy);
+        if (unary_syntax->unary_type == BITWISE_NEGATION) {
+            return bitwise_negation_new(expression);
+        } else {
+            return logical_negation_new(expression);
+        }
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+        Syntax *left = copy_syntax(inliner, binary_syntax->left, copy);
+        Syntax *right = copy_syntax(inliner, binary_syntax->right, copy);
+        if (binary_syntax->binary_type == ADDITION) {
+            return addition_new(left, right);
+        } else if (binary_syntax->binary_type == SUBTRACTION) {
+            return subtraction_new(left, right);
+        } else if (binary_syntax->binary_type == MULTIPLICATION) {
+            return multiplication_new(left, right);
+        } else if (binary_syntax->binary_type == LESS_THAN) {
+            return less_than_new(left, right);
+        } else {
+            return less_or_equal_new(left, right);
+        }
+    } else if (syntax->type == ASSIGNMENT) {
+        Assignment *assignment = syntax->assignment;
+        return assignment_new(
+            renamed(inliner, assignment->var_name),
+            copy_syntax(inliner, assignment->expression, copy));
+    } else if (syntax->type == FUNCTION_CALL) {
+        Syntax *arguments = function_arguments_new();
+        List *old_arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(old_arguments); i++) {
+            list_append(
+                arguments->function_arguments->arguments,
+                copy_syntax(inliner, list_get(old_arguments, i), copy));
+        }
+        return function_call_new(syntax->function_call->function_name,
+                                 arguments);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        return return_statement_new(
+            copy_syntax(inliner, syntax->return_statement->expression, copy));
+    } else if (syntax->type == IF_STATEMENT) {
+        return if_new(
+            copy_syntax(inliner, syntax->if_statement->condition, copy),
+            copy_syntax(inliner, syntax->if_statement->then, copy));
+    } else if (syntax->type == WHILE_SYNTAX) {
+        return while_new(
+            copy_syntax(inliner, syntax->while_statement->condition, copy),
+            copy_syntax(inliner, syntax->while_statement->body, copy));
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var = syntax->define_var_statement;
+        // The initial value can't see the variable being defined.
+        Syntax *init_value =
+            copy_syntax(inliner, define_var->init_value, copy);
+        Symbol name = copy_name(define_var->var_name, copy);
+        add_renaming(inliner, define_var->var_name, name);
+        return define_var_new(name, init_value);
+    } else if (syntax->type == BLOCK) {
+        int scope_start = inliner->renaming_count;
+        List *statements = syntax_list_new();
+        List *old_statements = syntax->block->statements;
+        for (int i = 0; i < list_length(old_statements); i++) {
+            list_append(statements, copy_syntax(
+                                        inliner, list_get(old_statements, i),
+                                        copy));
+        }
+        inliner->renaming_count = scope_start;
+        return block_new(statements);
+    }
+
+    warnx("Don't know how to copy syntax of type %s",
+          syntax_type_name(syntax));
+    return NULL;
+}
+
+/* Free the FUNCTION_CALL node CALL, but not its arguments. */
+static void call_node_free(Syntax *call) {
+    if (syntax_arena != NULL) {
+        return;
+    }
+
+    Syntax *arguments = call->function_call->function_arguments;
+    list_free(arguments->function_arguments->arguments);
+    free(arguments->function_arguments);
+    free(arguments);
+    free(call->function_call);
+    free(call);
+}
+
+/* Append to OUT a copy of the body of CALLEE with its parameters set
+ * to the arguments of CALL. Return a variable holding the value the
+ * call would have returned.
+ */
+static Syntax *expand_call(Inliner *inliner, FunctionInfo *callee,
+                           Syntax *call, List *out) {
+    Function *function = callee->syntax->function;
+    int copy = inliner->copy_count++;
+
+    // Like a call, falling off the end of the body returns 0.
+    Symbol result = copy_name(function->name, copy);
+    list_append(out, define_var_new(result, immediate_new(0)));
+
+    List *statements = syntax_list_new();
+    List *arguments = call_arguments(call);
+    int scope_start = inliner->renaming_count;
+    for (int i = 0; i < list_length(function->parameters); i++) {
+        Parameter *parameter = list_get(function->parameters, i);
+        Symbol name = copy_name(parameter->name, copy);
+        list_append(statements, define_var_new(name, list_get(arguments, i)));
+        add_renaming(inliner, parameter->name, name);
+    }
+
+    List *body = function->root_block->block->statements;
+    for (int i = 0; i < list_length(body); i++) {
+        Syntax *statement = list_get(body, i);
+        if (statement->type == RETURN_STATEMENT) {
+            // Only the last statement returns; see returns_only_at_end.
+            Syntax *value = copy_syntax(
+                inliner, statement->return_statement->expression, copy);
+            list_append(statements, assignment_new(result, value));
+        } else {
+            list_append(statements, copy_syntax(inliner, statement, copy));
+        }
+    }
+    inliner->renaming_count = scope_start;
+
+    list_append(out, block_new(statements));
+    call_node_free(call);
+    return variable_new(result);
+}
+
+/******************************************************************************
+ *
+ * Choosing and inlining calls.
+ *
+ ******************************************************************************/
+
+/* Should we inline CALL, made from CALLER? If so, return the callee. */
+static FunctionInfo *choose_callee(Inliner *inliner, FunctionInfo *caller,
+                                   Syntax *call) {
+    FunctionInfo *callee =
+        find_function(inliner, call->function_call->function_name);
+    if (callee == NULL) {
+        // Defined in another file, so there's nothing to decide.
+        return NULL;
+    }
+
+    Function *function = callee->syntax->function;
+    int size = count_nodes(function->root_block);
+    int argument_count = list_length(call_arguments(call));
+    int parameter_count = list_length(function->parameters);
+    char reason[80] = "";
+
+    if (callee->recursive) {
+        snprintf(reason, sizeof(reason), "recursive");
+    } else if (argument_count != parameter_count) {
+        snprintf(reason, sizeof(reason), "takes %d arguments, given %d",
+                 parameter_count, argument_count);
+    } else if (!returns_only_at_end(function->root_block)) {
+        snprintf(reason, sizeof(reason), "returns before its end");
+    } else if (size > inliner->threshold && callee->call_sites > 1) {
+        snprintf(reason, sizeof(reason),
+                 "%d nodes is over the threshold of %d", size,
+                 inliner->threshold);
+    }
+
+    char *caller_name = symbol_name(caller->syntax->function->name);
+    char *callee_name = symbol_name(function->name);
+    if (reason[0] != '\0') {
+        inliner->rejected_count++;
+        if (inliner->report != NULL) {
+            fprintf(inliner->report, "Not inlining '%s' into '%s': %s.\n",
+                    callee_name, caller_name, reason);
+        }
+        return NULL;
+    }
+
+    inliner->inlined_count++;
+    if (inliner->report != NULL) {
+        fprintf(inliner->report, "Inlined '%s' into '%s' (%d nodes, %s).\n",
+                callee_name, caller_name, size,
+                callee->call_sites == 1 ? "called once" : "small");
+    }
+    return callee;
+}
+
+static bool contains_call(Syntax *syntax) {
+    if (syntax->type == FUNCTION_CALL) {
+        return true;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return contains_call(syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return contains_call(syntax->binary_expression->left) ||
+               contains_call(syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        return contains_call(syntax->assignment->expression);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        return contains_call(syntax->return_statement->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        return contains_call(syntax->define_var_statement->init_value);
+    } else if (syntax->type == IF_STATEMENT) {
+        return contains_call(syntax->if_statement->condition) ||
+               contains_call(syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        return contains_call(syntax->while_statement->condition) ||
+               contains_call(syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            if (contains_call(list_get(statements, i))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Inline the calls we can in *EXPRESSION, appending the copied code
+ * to OUT. The copies run before the rest of the statement, so once
+ * it has assigned a variable or made a call we keep, later calls
+ * stay where they are.
+ */
+static void inline_calls(Inliner *inliner, FunctionInfo *caller,
+                         Syntax **expression, List *out) {
+    Syntax *syntax = *expression;
+    if (inliner->blocked) {
+        return;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        inline_calls(inliner, caller, &syntax->unary_expression->expression,
+                     out);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        inline_calls(inliner, caller, &syntax->binary_expression->left, out);
+        inline_calls(inliner, caller, &syntax->binary_expression->right, out);
+    } else if (syntax->type == ASSIGNMENT) {
+        inline_calls(inliner, caller, &syntax->assignment->expression, out);
+        inliner->blocked = true;
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            Syntax *argument = list_get(arguments, i);
+            inline_calls(inliner, caller, &argument, out);
+            list_set(arguments, i, argument);
+        }
+
+        FunctionInfo *callee = NULL;
+        if (!inliner->blocked) {
+            callee = choose_callee(inliner, caller, syntax);
+        }
+        if (callee != NULL) {
+            *expression = expand_call(inliner, callee, syntax, out);
+            // The copy only changes its own locals, unless it calls out.
+            inliner->blocked =
+                contains_call(callee->syntax->function->root_block);
+        } else {
+            inliner->blocked = true;
+        }
+    }
+}
+
+static void inline_in_block(Inliner *inliner, FunctionInfo *caller,
+                            Syntax *syntax);
+
+/* Inline the calls we can in the statement SYNTAX, appending the
+ * copied code to OUT. Return the statement to follow it, or NULL if
+ * nothing is left to do.
+ */
+static Syntax *inline_in_statement(Inliner *inliner, FunctionInfo *caller,
+                                   Syntax *syntax, List *out) {
+    inliner->blocked = false;
+    if (syntax->type == BLOCK) {
+        inline_in_block(inliner, caller, syntax);
+    } else if (syntax->type == IF_STATEMENT) {
+        inline_calls(inliner, caller, &syntax->if_statement->condition, out);
+        inline_in_block(inliner, caller, syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        // The condition is evaluated on every iteration, so we can't
+        // move its calls before the loop.
+        inline_in_block(inliner, caller, syntax->while_statement->body);
+    } else if (syntax->type == DEFINE_VAR) {
+        inline_calls(inliner, caller,
+                     &syntax->define_var_statement->init_value, out);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        inline_calls(inliner, caller, &syntax->return_statement->expression,
+                     out);
+    } else {
+        inline_calls(inliner, caller, &syntax, out);
+        if (syntax->type == VARIABLE) {
+            // A call statement whose body we copied.
+            syntax_node_free(syntax);
+            return NULL;
+        }
+    }
+    return syntax;
+}
+
+/* Inline the calls we can in the BLOCK SYNTAX, putting each copied
+ * body just before the statement that made the call.
+ */
+static void inline_in_block(Inliner *inliner, FunctionInfo *caller,
+                            Syntax *syntax) {
+    if (syntax->type != BLOCK) {
+        // There's nowhere to put copied code.
+        return;
+    }
+
+    List *statements = syntax->block->statements;
+    List *rewritten = syntax_list_new();
+    for (int i = 0; i < list_length(statements); i++) {
+        Syntax *statement =
+            inline_in_statement(inliner, caller, list_get(statements, i),
+                                rewritten);
+        if (statement != NULL) {
+            list_append(rewritten, statement);
+        }
+    }
+    list_free(statements);
+    syntax->block->statements = rewritten;
+}
+
+static void visit_function(Inliner *inliner, FunctionInfo *function);
+
+static void visit_callee(Inliner *inliner, Syntax *call) {
+    FunctionInfo *callee =
+        find_function(inliner, call->function_call->function_name);
+    if (callee == NULL) {
+        return;
+    }
+
+    if (callee->state == UNVISITED) {
+        visit_function(inliner, callee);
+    } else if (callee->state == VISITING) {
+        // Every function from the callee down to us is on a cycle.
+        for (int i = inliner->visiting_count - 1; i >= 0; i--) {
+            inliner->visiting[i]->recursive = true;
+            if (inliner->visiting[i] == callee) {
+                break;
+            }
+        }
+    }
+}
+
+static void visit_function(Inliner *inliner, FunctionInfo *function) {
+    Syntax *root_block = function->syntax->function->root_block;
+
+    function->state = VISITING;
+    inliner->visiting[inliner->visiting_count++] = function;
+    walk_calls(inliner, root_block, visit_callee);
+    inliner->visiting_count--;
+
+    inline_in_block(inliner, function, root_block);
+    function->state = VISITED;
+}
+
+/* Replace calls to small functions in the TOP_LEVEL SYNTAX, and calls
+ * to functions that are only called once, with copies of their
+ * bodies. Functions of at most THRESHOLD nodes count as small, and a
+ * THRESHOLD of 0 turns inlining off. If REPORT isn't NULL, explain
+ * each decision there.
+ */
+Syntax *inline_functions(Syntax *syntax, int threshold, FILE *report) {
+    if (threshold <= 0) {
+        return syntax;
+    }
+
+    List *declarations = syntax->top_level->declarations;
+    int function_count = list_length(declarations);
+
+    Inliner inliner = {0};
+    inliner.functions = calloc(function_count + 1, sizeof(FunctionInfo));
+    inliner.visiting = calloc(function_count + 1, sizeof(FunctionInfo *));
+    inliner.threshold = threshold;
+    inliner.report = report;
+    for (int i = 0; i < function_count; i++) {
+        Syntax *declaration = list_get(declarations, i);
+        if (declaration->type == FUNCTION) {
+            inliner.functions[inliner.function_count++].syntax = declaration;
+        }
+    }
+
+    for (int i = 0; i < inliner.function_count; i++) {
+        walk_calls(&inliner, inliner.functions[i].syntax->function->root_block,
+                   count_call_site);
+    }
+    for (int i = 0; i < inliner.function_count; i++) {
+        if (inliner.functions[i].state == UNVISITED) {
+            visit_function(&inliner, &inliner.functions[i]);
+        }
+    }
+
+    if (report != NULL) {
+        fprintf(report, "Inlined %d calls, kept %d.\n", inliner.inlined_count,
+                inliner.rejected_count);
+    }
+    timing_count("inlined calls", inliner.inlined_count);
+
+    free(inliner.functions);
+    free(inliner.visiting);
+    free(inliner.renamings);
+    return syntax;
+}
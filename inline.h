@@ -0,0 +1,14 @@
+#ifndef MC_INLINE_H
+#define MC_INLINE_H
+
+#include <stdio.h>
+
+#include "syntax.h"
+
+// Functions with at most this many syntax nodes are inlined at every
+// call, unless --inline-threshold says otherwise.
+#define DEFAULT_INLINE_THRESHOLD 40
+
+Syntax *inline_functions(Syntax *syntax, int threshold, FILE *report);
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "list.h"
+#include "output.h"
+
+const int MAX_MNEMONIC_LENGTH = 7;
+
+/* Create an instruction, taking copies of NAME and OPERANDS. */
+Instruction *instruction_new(InstructionType type, char *name,
+                             char *operands) {
+    Instruction *instruction = malloc(sizeof(Instruction));
+    instruction->type = type;
+    instruction->name = strdup(name);
+    instruction->operands = strdup(operands);
+    instruction->deleted = false;
+
+    return instruction;
+}
+
+void instruction_free(Instruction *instruction) {
+    free(instruction->name);
+    free(instruction->operands);
+    free(instruction);
+}
+
+void instruction_set_name(Instruction *instruction, char *name) {
+    free(instruction->name);
+    instruction->name = strdup(name);
+}
+
+void instructions_free(List *instructions) {
+    for (int i = 0; i < list_length(instructions); i++) {
+        instruction_free(list_get(instructions, i));
+    }
+    list_free(instructions);
+}
+
+void write_instruction(Output *out, Instruction *instruction) {
+    if (instruction->type == LABEL) {
+        output_string(out, instruction->name);
+        output_append(out, ":\n", 2);
+        return;
+    } else if (instruction->type == DIRECTIVE) {
+        output_string(out, instruction->name);
+        output_char(out, '\n');
+        return;
+    } else if (instruction->type == BLANK_LINE) {
+        output_char(out, '\n');
+        return;
+    }
+
+    // The assembler requires at least 4 spaces for indentation.
+    output_spaces(out, 4);
+    size_t name_length = strlen(instruction->name);
+    output_append(out, instruction->name, name_length);
+
+    if (instruction->operands[0] != '\0') {
+        // Ensure our argument are aligned, regardless of the assembly
+        // mnemonic length.
+        output_spaces(out, MAX_MNEMONIC_LENGTH - (int)name_length + 4);
+        output_string(out, instruction->operands);
+    }
+
+    output_char(out, '\n');
+}
+
+/* Write INSTRUCTIONS to OUT as GNU assembler source, skipping any
+ * that have been deleted.
+ */
+void write_instructions(Output *out, List *instructions) {
+    for (int i = 0; i < list_length(instructions); i++) {
+        Instruction *instruction = list_get(instructions, i);
+        if (!instruction->deleted) {
+            write_instruction(out, instruction);
+        }
+    }
+}
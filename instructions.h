@@ -0,0 +1,43 @@
+#ifndef MC_INSTRUCTIONS_H
+#define MC_INSTRUCTIONS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "list.h"
+#include "output.h"
+
+typedef enum {
+    INSTRUCTION,
+    LABEL,
+    // Assembler directives such as .text, written out verbatim.
+    DIRECTIVE,
+    // An empty line, to make the output easier to read.
+    BLANK_LINE,
+} InstructionType;
+
+/******************************************************************************
+ *
+ * One line of assembly output. The backend emits these into a List
+ * rather than straight to a file, so we can rewrite them (see
+ * peephole.c) before writing them out.
+ *
+ ******************************************************************************/
+typedef struct Instruction {
+    InstructionType type;
+    // The mnemonic, label name or directive text.
+    char *name;
+    // Comma separated operands in AT&T order, or "" if none.
+    char *operands;
+    // Set by rewrites to drop the instruction from the output.
+    bool deleted;
+} Instruction;
+
+Instruction *instruction_new(InstructionType type, char *name,
+                             char *operands);
+void instruction_free(Instruction *instruction);
+void instruction_set_name(Instruction *instruction, char *name);
+void instructions_free(List *instructions);
+void write_instructions(Output *out, List *instructions);
+
+#endif
@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "intern.h"
+
+#define INITIAL_INTERNER_SIZE 256
+
+/******************************************************************************
+ *
+ * Every distinct identifier we've seen, for the whole compilation.
+ * Names are stored once, in an arena, and symbols index NAMES. An
+ * open addressing hash table maps names back to their symbols.
+ * Files are compiled on several threads, so LOCK guards all of it.
+ *
+ ******************************************************************************/
+typedef struct Interner {
+    Arena *arena;
+
+    char **names;
+    uint32_t *hashes;
+    uint32_t count;
+    uint32_t names_capacity;
+
+    // Symbols, or NO_SYMBOL for empty slots. Always a power of two in
+    // size, and at most half full.
+    Symbol *table;
+    uint32_t table_capacity;
+} Interner;
+
+static Interner *interner = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Interner *interner_new(void) {
+    Interner *result = malloc(sizeof(Interner));
+    result->arena = arena_new();
+
+    result->count = 0;
+    result->names_capacity = INITIAL_INTERNER_SIZE;
+    result->names = malloc(result->names_capacity * sizeof(char *));
+    result->hashes = malloc(result->names_capacity * sizeof(uint32_t));
+
+    result->table_capacity = INITIAL_INTERNER_SIZE * 2;
+    result->table = malloc(result->table_capacity * sizeof(Symbol));
+    memset(result->table, 0xff, result->table_capacity * sizeof(Symbol));
+
+    return result;
+}
+
+/* FNV-1a. */
+static uint32_t hash_string(const char *string, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void grow_table(void) {
+    uint32_t capacity = interner->table_capacity * 2;
+    Symbol *table = malloc(capacity * sizeof(Symbol));
+    memset(table, 0xff, capacity * sizeof(Symbol));
+
+    for (Symbol symbol = 0; symbol < interner->count; symbol++) {
+        uint32_t index = interner->hashes[symbol] & (capacity - 1);
+        while (table[index] != NO_SYMBOL) {
+            index = (index + 1) & (capacity - 1);
+        }
+        table[index] = symbol;
+    }
+
+    free(interner->table);
+    interner->table = table;
+    interner->table_capacity = capacity;
+}
+
+/* Return the symbol for the LENGTH bytes at STRING, which need not be
+ * NUL terminated.
+ */
+Symbol intern(const char *string, size_t length) {
+    pthread_mutex_lock(&lock);
+    if (interner == NULL) {
+        interner = interner_new();
+    }
+
+    uint32_t hash = hash_string(string, length);
+    uint32_t mask = interner->table_capacity - 1;
+    uint32_t index = hash & mask;
+
+    Symbol symbol;
+    while ((symbol = interner->table[index]) != NO_SYMBOL) {
+        char *name = interner->names[symbol];
+        if (interner->hashes[symbol] == hash &&
+            strncmp(name, string, length) == 0 && name[length] == '\0') {
+            pthread_mutex_unlock(&lock);
+            return symbol;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (interner->count == interner->names_capacity) {
+        interner->names_capacity *= 2;
+        interner->names = realloc(interner->names,
+                                  interner->names_capacity * sizeof(char *));
+        interner->hashes = realloc(
+            interner->hashes, interner->names_capacity * sizeof(uint32_t));
+    }
+
+    char *name = arena_alloc(interner->arena, length + 1);
+    memcpy(name, string, length);
+    name[length] = '\0';
+
+    symbol = interner->count++;
+    interner->names[symbol] = name;
+    interner->hashes[symbol] = hash;
+    interner->table[index] = symbol;
+
+    if (interner->count * 2 > interner->table_capacity) {
+        grow_table();
+    }
+
+    pthread_mutex_unlock(&lock);
+    return symbol;
+}
+
+Symbol intern_string(const char *string) {
+    return intern(string, strlen(string));
+}
+
+/* The name SYMBOL was interned from. It lives until interner_free. */
+char *symbol_name(Symbol symbol) {
+    pthread_mutex_lock(&lock);
+    assert(interner != NULL && symbol < interner->count);
+    char *name = interner->names[symbol];
+    pthread_mutex_unlock(&lock);
+    return name;
+}
+
+void interner_free(void) {
+    if (interner == NULL) {
+        return;
+    }
+
+    arena_free(interner->arena);
+    free(interner->names);
+    free(interner->hashes);
+    free(interner->table);
+    free(interner);
+    interner = NULL;
+}
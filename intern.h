@@ -0,0 +1,19 @@
+#ifndef MC_INTERN_H
+#define MC_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A handle for an interned identifier. Two identifiers are equal
+ * exactly when their symbols are.
+ */
+typedef uint32_t Symbol;
+
+#define NO_SYMBOL UINT32_MAX
+
+Symbol intern(const char *string, size_t length);
+Symbol intern_string(const char *string);
+char *symbol_name(Symbol symbol);
+void interner_free(void);
+
+#endif
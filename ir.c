@@ -0,0 +1,657 @@
+#include <assert.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ir.h"
+#include "list.h"
+#include "symbol_map.h"
+#include "syntax.h"
+
+/* SSA construction follows Braun et al., "Simple and Efficient
+ * Construction of Static Single Assignment Form" (CC 2013): we look
+ * up variables on demand, placing phis lazily, and only complete the
+ * phis of a block once all its predecessors are known ("sealed").
+ */
+
+typedef struct IrDefinition {
+    Symbol var_name;
+    int vreg;
+    // For incomplete phis, the phi waiting for its arguments.
+    IrInstruction *phi;
+} IrDefinition;
+
+typedef struct IrBuilder {
+    IrFunction *function;
+    // The block we're appending to, or NULL when the code we're
+    // lowering is unreachable (after a return).
+    IrBlock *current;
+} IrBuilder;
+
+bool ir_is_terminator(IrInstruction *instruction) {
+    return instruction->opcode == IR_RETURN || instruction->opcode == IR_JUMP ||
+           instruction->opcode == IR_BRANCH;
+}
+
+static IrInstruction *ir_instruction_new(IrOpcode opcode) {
+    IrInstruction *instruction = malloc(sizeof(IrInstruction));
+    instruction->opcode = opcode;
+    instruction->dest = NO_VREG;
+    instruction->operands[0] = NO_VREG;
+    instruction->operands[1] = NO_VREG;
+    instruction->value = 0;
+    instruction->function_name = NULL;
+    instruction->arguments = NULL;
+    instruction->argument_count = 0;
+    instruction->tail_call = false;
+    instruction->phi_arguments = NULL;
+    instruction->targets[0] = NULL;
+    instruction->targets[1] = NULL;
+
+    return instruction;
+}
+
+static void ir_instruction_free(IrInstruction *instruction) {
+    if (instruction->phi_arguments != NULL) {
+        for (int i = 0; i < list_length(instruction->phi_arguments); i++) {
+            free(list_get(instruction->phi_arguments, i));
+        }
+        list_free(instruction->phi_arguments);
+    }
+    free(instruction->arguments);
+    free(instruction);
+}
+
+static IrBlock *ir_block_new() {
+    IrBlock *block = malloc(sizeof(IrBlock));
+    block->id = -1;
+    block->instructions = list_new();
+    block->predecessors = list_new();
+    block->definitions = list_new();
+    block->definition_index = symbol_map_new();
+    block->incomplete_phis = list_new();
+    block->sealed = false;
+
+    return block;
+}
+
+/* Add BLOCK to the function layout and start appending to it. */
+static void start_block(IrBuilder *builder, IrBlock *block) {
+    block->id = list_length(builder->function->blocks);
+    list_append(builder->function->blocks, block);
+    builder->current = block;
+}
+
+static int new_vreg(IrBuilder *builder) {
+    return builder->function->vreg_count++;
+}
+
+static IrInstruction *emit(IrBuilder *builder, IrOpcode opcode) {
+    IrInstruction *instruction = ir_instruction_new(opcode);
+    list_append(builder->current->instructions, instruction);
+    return instruction;
+}
+
+static int emit_value(IrBuilder *builder, IrOpcode opcode, int left,
+                      int right) {
+    IrInstruction *instruction = emit(builder, opcode);
+    instruction->dest = new_vreg(builder);
+    instruction->operands[0] = left;
+    instruction->operands[1] = right;
+    return instruction->dest;
+}
+
+static void emit_jump(IrBuilder *builder, IrBlock *target) {
+    IrInstruction *instruction = emit(builder, IR_JUMP);
+    instruction->targets[0] = target;
+    list_append(target->predecessors, builder->current);
+}
+
+static void emit_branch(IrBuilder *builder, int condition, IrBlock *if_true,
+                        IrBlock *if_false) {
+    IrInstruction *instruction = emit(builder, IR_BRANCH);
+    instruction->operands[0] = condition;
+    instruction->targets[0] = if_true;
+    instruction->targets[1] = if_false;
+    list_append(if_true->predecessors, builder->current);
+    list_append(if_false->predecessors, builder->current);
+}
+
+/* Variables are identified by name, which resolve_scopes has made
+ * unique wherever two locals are in scope at once.
+ */
+static void write_variable(IrBlock *block, Symbol var_name, int vreg) {
+    IrDefinition *definition =
+        symbol_map_get(block->definition_index, var_name);
+    if (definition != NULL) {
+        definition->vreg = vreg;
+        return;
+    }
+
+    definition = malloc(sizeof(IrDefinition));
+    definition->var_name = var_name;
+    definition->vreg = vreg;
+    definition->phi = NULL;
+    list_append(block->definitions, definition);
+    symbol_map_set(block->definition_index, var_name, definition);
+}
+
+static int read_variable(IrBuilder *builder, IrBlock *block, Symbol var_name);
+
+/* Phis go at the start of their block. */
+static IrInstruction *new_phi(IrBuilder *builder, IrBlock *block) {
+    IrInstruction *phi = ir_instruction_new(IR_PHI);
+    phi->dest = new_vreg(builder);
+    phi->phi_arguments = list_new();
+    list_push(block->instructions, phi);
+    return phi;
+}
+
+static void add_phi_arguments(IrBuilder *builder, IrBlock *block,
+                              Symbol var_name, IrInstruction *phi) {
+    for (int i = 0; i < list_length(block->predecessors); i++) {
+        IrPhiArgument *argument = malloc(sizeof(IrPhiArgument));
+        argument->block = list_get(block->predecessors, i);
+        argument->vreg = read_variable(builder, argument->block, var_name);
+        list_append(phi->phi_arguments, argument);
+    }
+}
+
+static int read_variable_recursive(IrBuilder *builder, IrBlock *block,
+                                   Symbol var_name) {
+    int vreg;
+    List *predecessors = block->predecessors;
+
+    if (!block->sealed) {
+        // We don't know all the predecessors yet, so fill this phi
+        // in once we do.
+        IrInstruction *phi = new_phi(builder, block);
+        IrDefinition *incomplete = malloc(sizeof(IrDefinition));
+        incomplete->var_name = var_name;
+        incomplete->vreg = phi->dest;
+        incomplete->phi = phi;
+        list_append(block->incomplete_phis, incomplete);
+        vreg = phi->dest;
+
+    } else if (list_length(predecessors) == 0) {
+        // We've reached the entry block without a definition.
+        warnx("Could not find %s in environment", symbol_name(var_name));
+        IrInstruction *zero = ir_instruction_new(IR_CONST);
+        zero->dest = new_vreg(builder);
+        list_push(block->instructions, zero);
+        vreg = zero->dest;
+
+    } else if (list_length(predecessors) == 1) {
+        vreg = read_variable(builder, list_get(predecessors, 0), var_name);
+
+    } else {
+        // Define the phi before looking at predecessors, to break
+        // cycles through loops.
+        IrInstruction *phi = new_phi(builder, block);
+        write_variable(block, var_name, phi->dest);
+        add_phi_arguments(builder, block, var_name, phi);
+        vreg = phi->dest;
+    }
+
+    write_variable(block, var_name, vreg);
+    return vreg;
+}
+
+static int read_variable(IrBuilder *builder, IrBlock *block, Symbol var_name) {
+    IrDefinition *definition =
+        symbol_map_get(block->definition_index, var_name);
+    if (definition != NULL) {
+        return definition->vreg;
+    }
+
+    return read_variable_recursive(builder, block, var_name);
+}
+
+/* All predecessors of BLOCK are now known. */
+static void seal_block(IrBuilder *builder, IrBlock *block) {
+    for (int i = 0; i < list_length(block->incomplete_phis); i++) {
+        IrDefinition *incomplete = list_get(block->incomplete_phis, i);
+        add_phi_arguments(builder, block, incomplete->var_name,
+                          incomplete->phi);
+        free(incomplete);
+    }
+    list_free(block->incomplete_phis);
+    block->incomplete_phis = list_new();
+
+    block->sealed = true;
+}
+
+static int lower_expression(IrBuilder *builder, Syntax *syntax) {
+    if (syntax->type == IMMEDIATE) {
+        IrInstruction *instruction = emit(builder, IR_CONST);
+        instruction->dest = new_vreg(builder);
+        instruction->value = syntax->immediate->value;
+        return instruction->dest;
+
+    } else if (syntax->type == VARIABLE) {
+        return read_variable(builder, builder->current,
+                             syntax->variable->var_name);
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        int operand = lower_expression(builder, unary_syntax->expression);
+        IrOpcode opcode = unary_syntax->unary_type == BITWISE_NEGATION
+                              ? IR_NOT
+                              : IR_LOGICAL_NOT;
+        return emit_value(builder, opcode, operand, NO_VREG);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+        int left = lower_expression(builder, binary_syntax->left);
+        int right = lower_expression(builder, binary_syntax->right);
+
+        IrOpcode opcode = IR_ADD;
+        if (binary_syntax->binary_type == SUBTRACTION) {
+            opcode = IR_SUB;
+        } else if (binary_syntax->binary_type == MULTIPLICATION) {
+            opcode = IR_MUL;
+        } else if (binary_syntax->binary_type == LESS_THAN) {
+            opcode = IR_LESS_THAN;
+        } else if (binary_syntax->binary_type == LESS_THAN_OR_EQUAL) {
+            opcode = IR_LESS_OR_EQUAL;
+        }
+        return emit_value(builder, opcode, left, right);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        int value = lower_expression(builder, syntax->assignment->expression);
+        write_variable(builder->current, syntax->assignment->var_name, value);
+        return value;
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments =
+            syntax->function_call->function_arguments->function_arguments
+                ->arguments;
+        int argument_count = list_length(arguments);
+        int *argument_vregs = malloc(argument_count * sizeof(int));
+        for (int i = 0; i < argument_count; i++) {
+            argument_vregs[i] =
+                lower_expression(builder, list_get(arguments, i));
+        }
+
+        IrInstruction *instruction = emit(builder, IR_CALL);
+        instruction->dest = new_vreg(builder);
+        instruction->function_name =
+            symbol_name(syntax->function_call->function_name);
+        instruction->arguments = argument_vregs;
+        instruction->argument_count = argument_count;
+        return instruction->dest;
+    }
+
+    warnx("Unknown expression %s", syntax_type_name(syntax));
+    assert(false);
+    return NO_VREG;
+}
+
+static void lower_statement(IrBuilder *builder, Syntax *syntax) {
+    if (builder->current == NULL) {
+        // Unreachable, so there's nothing to generate.
+        return;
+    }
+
+    if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            lower_statement(builder, list_get(statements, i));
+        }
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        Syntax *expression = syntax->return_statement->expression;
+        int value = lower_expression(builder, expression);
+        if (expression->type == FUNCTION_CALL) {
+            // The call is the last thing we emitted.
+            List *instructions = builder->current->instructions;
+            IrInstruction *call =
+                list_get(instructions, list_length(instructions) - 1);
+            call->tail_call = true;
+        }
+
+        IrInstruction *instruction = emit(builder, IR_RETURN);
+        instruction->operands[0] = value;
+        builder->current = NULL;
+
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+        int value = lower_expression(builder, define_var_statement->init_value);
+        write_variable(builder->current, define_var_statement->var_name, value);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        IfStatement *if_statement = syntax->if_statement;
+        int condition = lower_expression(builder, if_statement->condition);
+
+        IrBlock *then_block = ir_block_new();
+        IrBlock *end_block = ir_block_new();
+        emit_branch(builder, condition, then_block, end_block);
+
+        seal_block(builder, then_block);
+        start_block(builder, then_block);
+        lower_statement(builder, if_statement->then);
+        if (builder->current != NULL) {
+            emit_jump(builder, end_block);
+        }
+
+        seal_block(builder, end_block);
+        start_block(builder, end_block);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        WhileStatement *while_statement = syntax->while_statement;
+
+        // The header isn't sealed until we've seen the back edge.
+        IrBlock *header_block = ir_block_new();
+        emit_jump(builder, header_block);
+        start_block(builder, header_block);
+        int condition = lower_expression(builder, while_statement->condition);
+
+        IrBlock *body_block = ir_block_new();
+        IrBlock *exit_block = ir_block_new();
+        emit_branch(builder, condition, body_block, exit_block);
+
+        seal_block(builder, body_block);
+        start_block(builder, body_block);
+        lower_statement(builder, while_statement->body);
+        if (builder->current != NULL) {
+            emit_jump(builder, header_block);
+        }
+        seal_block(builder, header_block);
+
+        seal_block(builder, exit_block);
+        start_block(builder, exit_block);
+
+    } else {
+        lower_expression(builder, syntax);
+    }
+}
+
+static int resolve_alias(int *aliases, int vreg) {
+    while (vreg != NO_VREG && aliases[vreg] != vreg) {
+        vreg = aliases[vreg];
+    }
+    return vreg;
+}
+
+/* Remove phis whose arguments are all the same value (or the phi
+ * itself), which lazy construction leaves behind in loop headers.
+ * Removing one phi may make another trivial, so repeat.
+ */
+static void remove_trivial_phis(IrFunction *function) {
+    int *aliases = malloc(function->vreg_count * sizeof(int));
+    for (int i = 0; i < function->vreg_count; i++) {
+        aliases[i] = i;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < list_length(function->blocks); i++) {
+            IrBlock *block = list_get(function->blocks, i);
+            List *kept = list_new();
+
+            for (int j = 0; j < list_length(block->instructions); j++) {
+                IrInstruction *instruction = list_get(block->instructions, j);
+                if (instruction->opcode != IR_PHI) {
+                    list_append(kept, instruction);
+                    continue;
+                }
+
+                int same = NO_VREG;
+                bool trivial = true;
+                for (int k = 0; k < list_length(instruction->phi_arguments);
+                     k++) {
+                    IrPhiArgument *argument =
+                        list_get(instruction->phi_arguments, k);
+                    int vreg = resolve_alias(aliases, argument->vreg);
+                    if (vreg == same || vreg == instruction->dest) {
+                        continue;
+                    }
+                    if (same != NO_VREG) {
+                        trivial = false;
+                        break;
+                    }
+                    same = vreg;
+                }
+
+                if (trivial && same != NO_VREG) {
+                    aliases[instruction->dest] = same;
+                    ir_instruction_free(instruction);
+                    changed = true;
+                } else {
+                    list_append(kept, instruction);
+                }
+            }
+
+            list_free(block->instructions);
+            block->instructions = kept;
+        }
+    }
+
+    // Point every use at the surviving value.
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < list_length(block->instructions); j++) {
+            IrInstruction *instruction = list_get(block->instructions, j);
+            instruction->operands[0] =
+                resolve_alias(aliases, instruction->operands[0]);
+            instruction->operands[1] =
+                resolve_alias(aliases, instruction->operands[1]);
+            for (int k = 0; k < instruction->argument_count; k++) {
+                instruction->arguments[k] =
+                    resolve_alias(aliases, instruction->arguments[k]);
+            }
+            if (instruction->phi_arguments != NULL) {
+                for (int k = 0; k < list_length(instruction->phi_arguments);
+                     k++) {
+                    IrPhiArgument *argument =
+                        list_get(instruction->phi_arguments, k);
+                    argument->vreg = resolve_alias(aliases, argument->vreg);
+                }
+            }
+        }
+    }
+
+    free(aliases);
+}
+
+/* Number vregs densely, in layout order of their definitions. */
+static void renumber_vregs(IrFunction *function) {
+    int *numbers = malloc(function->vreg_count * sizeof(int));
+    int count = 0;
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < list_length(block->instructions); j++) {
+            IrInstruction *instruction = list_get(block->instructions, j);
+            if (instruction->dest != NO_VREG) {
+                numbers[instruction->dest] = count;
+                instruction->dest = count++;
+            }
+        }
+    }
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < list_length(block->instructions); j++) {
+            IrInstruction *instruction = list_get(block->instructions, j);
+            for (int k = 0; k < 2; k++) {
+                if (instruction->operands[k] != NO_VREG) {
+                    instruction->operands[k] =
+                        numbers[instruction->operands[k]];
+                }
+            }
+            for (int k = 0; k < instruction->argument_count; k++) {
+                instruction->arguments[k] = numbers[instruction->arguments[k]];
+            }
+            if (instruction->phi_arguments != NULL) {
+                for (int k = 0; k < list_length(instruction->phi_arguments);
+                     k++) {
+                    IrPhiArgument *argument =
+                        list_get(instruction->phi_arguments, k);
+                    argument->vreg = numbers[argument->vreg];
+                }
+            }
+        }
+    }
+
+    function->vreg_count = count;
+    free(numbers);
+}
+
+static IrFunction *build_function(Syntax *syntax) {
+    IrFunction *function = malloc(sizeof(IrFunction));
+    function->name = symbol_name(syntax->function->name);
+    function->blocks = list_new();
+    function->vreg_count = 0;
+
+    IrBuilder builder = {function, NULL};
+
+    IrBlock *entry_block = ir_block_new();
+    seal_block(&builder, entry_block);
+    start_block(&builder, entry_block);
+
+    List *parameters = syntax->function->parameters;
+    function->parameter_count = list_length(parameters);
+    for (int i = 0; i < function->parameter_count; i++) {
+        Parameter *parameter = list_get(parameters, i);
+        IrInstruction *instruction = emit(&builder, IR_PARAM);
+        instruction->dest = new_vreg(&builder);
+        instruction->value = i;
+        write_variable(entry_block, parameter->name, instruction->dest);
+    }
+
+    lower_statement(&builder, syntax->function->root_block);
+    if (builder.current != NULL) {
+        // Falling off the end of a function returns nothing.
+        emit(&builder, IR_RETURN);
+    }
+
+    remove_trivial_phis(function);
+    renumber_vregs(function);
+
+    return function;
+}
+
+/* Build the SSA form of TOP_LEVEL syntax SYNTAX. The program borrows
+ * names from the syntax tree, so must be freed first.
+ */
+IrProgram *ir_build(Syntax *syntax) {
+    assert(syntax->type == TOP_LEVEL);
+
+    IrProgram *program = malloc(sizeof(IrProgram));
+    program->functions = list_new();
+
+    List *declarations = syntax->top_level->declarations;
+    for (int i = 0; i < list_length(declarations); i++) {
+        list_append(program->functions,
+                    build_function(list_get(declarations, i)));
+    }
+
+    return program;
+}
+
+static void ir_block_free(IrBlock *block) {
+    for (int i = 0; i < list_length(block->instructions); i++) {
+        ir_instruction_free(list_get(block->instructions, i));
+    }
+    list_free(block->instructions);
+    list_free(block->predecessors);
+
+    for (int i = 0; i < list_length(block->definitions); i++) {
+        free(list_get(block->definitions, i));
+    }
+    list_free(block->definitions);
+    symbol_map_free(block->definition_index);
+    list_free(block->incomplete_phis);
+
+    free(block);
+}
+
+void ir_free(IrProgram *program) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        for (int j = 0; j < list_length(function->blocks); j++) {
+            ir_block_free(list_get(function->blocks, j));
+        }
+        list_free(function->blocks);
+        free(function);
+    }
+    list_free(program->functions);
+    free(program);
+}
+
+static char *opcode_name(IrOpcode opcode) {
+    static char *names[] = {"const", "param", "add",  "sub",  "mul",
+                            "lt",    "le",    "not",  "lnot", "call",
+                            "phi",   "ret",   "jump", "branch"};
+    return names[opcode];
+}
+
+static void print_instruction(IrInstruction *instruction) {
+    printf("    ");
+    if (instruction->dest != NO_VREG) {
+        printf("v%d = ", instruction->dest);
+    }
+    printf("%s", opcode_name(instruction->opcode));
+
+    if (instruction->opcode == IR_CONST || instruction->opcode == IR_PARAM) {
+        printf(" %d", instruction->value);
+
+    } else if (instruction->opcode == IR_CALL) {
+        printf(" %s(", instruction->function_name);
+        for (int i = 0; i < instruction->argument_count; i++) {
+            printf("%sv%d", i > 0 ? ", " : "", instruction->arguments[i]);
+        }
+        printf(")%s", instruction->tail_call ? " ; tail" : "");
+
+    } else if (instruction->opcode == IR_PHI) {
+        for (int i = 0; i < list_length(instruction->phi_arguments); i++) {
+            IrPhiArgument *argument = list_get(instruction->phi_arguments, i);
+            printf("%s [block%d: v%d]", i > 0 ? "," : "", argument->block->id,
+                   argument->vreg);
+        }
+
+    } else if (instruction->opcode == IR_JUMP) {
+        printf(" block%d", instruction->targets[0]->id);
+
+    } else if (instruction->opcode == IR_BRANCH) {
+        printf(" v%d, block%d, block%d", instruction->operands[0],
+               instruction->targets[0]->id, instruction->targets[1]->id);
+
+    } else {
+        for (int i = 0; i < 2 && instruction->operands[i] != NO_VREG; i++) {
+            printf("%s v%d", i > 0 ? "," : "", instruction->operands[i]);
+        }
+    }
+
+    printf("\n");
+}
+
+void print_ir(IrProgram *program) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        printf("function %s\n", function->name);
+
+        for (int j = 0; j < list_length(function->blocks); j++) {
+            IrBlock *block = list_get(function->blocks, j);
+            printf("block%d:", block->id);
+
+            if (list_length(block->predecessors) > 0) {
+                printf(" ; preds:");
+                for (int k = 0; k < list_length(block->predecessors); k++) {
+                    IrBlock *predecessor = list_get(block->predecessors, k);
+                    printf(" block%d", predecessor->id);
+                }
+            }
+            printf("\n");
+
+            for (int k = 0; k < list_length(block->instructions); k++) {
+                print_instruction(list_get(block->instructions, k));
+            }
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef MC_IR_H
+#define MC_IR_H
+
+#include <stdbool.h>
+
+#include "list.h"
+#include "symbol_map.h"
+#include "syntax.h"
+
+/* A three-address intermediate representation in SSA form. Every
+ * value lives in a virtual register that is assigned exactly once;
+ * where control flow joins, phi instructions choose between the
+ * values from each predecessor.
+ */
+
+#define NO_VREG -1
+
+typedef enum {
+    IR_CONST,
+    // Parameter number VALUE of the function, as passed in.
+    IR_PARAM,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_LESS_THAN,
+    IR_LESS_OR_EQUAL,
+    IR_NOT,
+    IR_LOGICAL_NOT,
+    IR_CALL,
+    IR_PHI,
+    // Terminators, which end every basic block.
+    IR_RETURN,
+    IR_JUMP,
+    IR_BRANCH,
+} IrOpcode;
+
+struct IrBlock;
+
+typedef struct IrPhiArgument {
+    struct IrBlock *block;
+    int vreg;
+} IrPhiArgument;
+
+typedef struct IrInstruction {
+    IrOpcode opcode;
+    // The virtual register defined, or NO_VREG.
+    int dest;
+    // Source virtual registers, or NO_VREG if unused. IR_RETURN may
+    // have no operand.
+    int operands[2];
+    // IR_CONST and IR_PARAM only.
+    int value;
+    // IR_CALL only.
+    char *function_name;
+    int *arguments;
+    int argument_count;
+    // Set on calls whose value is returned immediately.
+    bool tail_call;
+    // IR_PHI only: a list of IrPhiArgument.
+    List *phi_arguments;
+    // IR_JUMP takes targets[0], IR_BRANCH takes targets[0] if
+    // operands[0] is non-zero and targets[1] otherwise.
+    struct IrBlock *targets[2];
+} IrInstruction;
+
+typedef struct IrBlock {
+    int id;
+    List *instructions;
+    List *predecessors;
+
+    // SSA construction state: the latest vreg for each variable in
+    // this block (indexed by name in DEFINITION_INDEX), and phis
+    // waiting for predecessors to be known.
+    List *definitions;
+    SymbolMap *definition_index;
+    List *incomplete_phis;
+    bool sealed;
+} IrBlock;
+
+typedef struct IrFunction {
+    char *name;
+    int parameter_count;
+    // Blocks in layout order, entry block first.
+    List *blocks;
+    int vreg_count;
+} IrFunction;
+
+typedef struct IrProgram {
+    List *functions;
+} IrProgram;
+
+IrProgram *ir_build(Syntax *syntax);
+void ir_free(IrProgram *program);
+void print_ir(IrProgram *program);
+bool ir_is_terminator(IrInstruction *instruction);
+
+#endif
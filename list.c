@@ -9,11 +9,52 @@ List *list_new(void) {
     List *list = malloc(sizeof(List));
     list->size = 0;
     list->items = NULL;
+    list->capacity = 0;
+    list->arena = NULL;
 
     return list;
 };
 
+/* Create a list that lives in ARENA, along with its items array. */
+List *list_new_in(Arena *arena) {
+    List *list = arena_alloc(arena, sizeof(List));
+    list->size = 0;
+    list->items = NULL;
+    list->capacity = 0;
+    list->arena = arena;
+
+    return list;
+}
+
+/* Make room for one more item in LIST. We double the capacity, so
+ * appending N items copies O(N) items in total. Lists in an arena
+ * can't give old arrays back, so they copy into a fresh one.
+ */
+static void list_grow(List *list) {
+    if (list->size < list->capacity) {
+        return;
+    }
+
+    int capacity =
+        list->capacity == 0 ? INITIAL_LIST_SIZE : list->capacity * 2;
+    if (list->arena != NULL) {
+        void **items = arena_alloc(list->arena, capacity * sizeof(void *));
+        if (list->size > 0) {
+            memcpy(items, list->items, list->size * sizeof(void *));
+        }
+        list->items = items;
+    } else {
+        list->items = realloc(list->items, capacity * sizeof(void *));
+    }
+
+    list->capacity = capacity;
+}
+
 void list_free(List *list) {
+    if (list->arena != NULL) {
+        return;
+    }
+
     if (list->items != NULL) {
         free(list->items);
     }
@@ -23,34 +64,26 @@ void list_free(List *list) {
 int list_length(List *list) { return list->size; }
 
 void list_append(List *list, void *item) {
-    list->size++;
-    list->items = realloc(list->items, list->size * sizeof(item));
-
-    list->items[list->size - 1] = item;
+    list_grow(list);
+    list->items[list->size++] = item;
 }
 
-/* Insert item as the first element in list. */
+/* Insert item as the first element in list. This moves every other
+ * item, so build long lists with list_append instead.
+ */
 void list_push(List *list, void *item) {
-    list->size++;
-
-    void **new_items = malloc(list->size * sizeof(item));
-    memcpy(new_items + 1, list->items, (list->size - 1) * sizeof(item));
-
-    if (list->items != NULL) {
-        free(list->items);
-    }
-    list->items = new_items;
-
+    list_grow(list);
+    memmove(list->items + 1, list->items, list->size * sizeof(item));
     list->items[0] = item;
+    list->size++;
 }
 
-/* Remove the last item from the list, and return it.
+/* Remove the last item from the list, and return it. We keep the
+ * capacity, as the list is likely to grow again.
  */
 void *list_pop(List *list) {
     void *value = list_get(list, list->size - 1);
-
     list->size--;
-    list->items = realloc(list->items, list->size * sizeof(value));
 
     return value;
 }
@@ -1,14 +1,22 @@
 #ifndef MC_LIST_H
 #define MC_LIST_H
 
+#include "arena.h"
+
 typedef struct List {
     int size;
     void **items;
+    // The number of items there's room for before we must grow.
+    int capacity;
+    // The arena the list and its items live in, and are freed with.
+    // NULL for lists on the heap.
+    Arena *arena;
 } List;
 
 #define INITIAL_LIST_SIZE 32
 
 List *list_new(void);
+List *list_new_in(Arena *arena);
 int list_length(List *list);
 void list_free(List *list);
 void list_append(List *list, void *item);
@@ -0,0 +1,560 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "intern.h"
+#include "list.h"
+#include "loop.h"
+#include "symbol_map.h"
+#include "syntax.h"
+#include "timing.h"
+
+/* A variable that only changes by the same amount on every
+ * iteration: its one assignment is `i = i + step` or `i = i - step`,
+ * at the top level of the loop body.
+ */
+typedef struct InductionVariable {
+    Symbol var_name;
+    int step;
+    // The statement that adds the step.
+    Syntax *update;
+} InductionVariable;
+
+/* A product of an induction variable and a loop-invariant factor,
+ * which we keep in a variable of its own and update by addition.
+ */
+typedef struct Reduction {
+    InductionVariable *induction_variable;
+    // An IMMEDIATE, or a VARIABLE the loop doesn't change.
+    Syntax *factor;
+    Symbol product;
+} Reduction;
+
+/******************************************************************************
+ *
+ * Loop: what we know about the while loop being optimized.
+ *
+ ******************************************************************************/
+typedef struct Loop {
+    Syntax *syntax;
+
+    // How many times each variable is assigned or defined anywhere in
+    // the loop, as (void *)(intptr_t)count. Variables the loop doesn't
+    // change aren't in it.
+    SymbolMap *writes;
+
+    InductionVariable *induction_variables;
+    int induction_variable_count;
+
+    Reduction *reductions;
+    int reduction_count;
+    int reduction_capacity;
+
+    // Statements to run just before the loop.
+    List *preheader;
+} Loop;
+
+typedef struct LoopOptimizer {
+    // Numbers the variables we introduce, so their names are unique.
+    int temporary_count;
+    int hoisted_count;
+    int reduced_count;
+} LoopOptimizer;
+
+static Symbol new_temporary(LoopOptimizer *optimizer) {
+    // A '.' can't occur in a C identifier, so this can't clash with a
+    // name in the program. The inliner and scope resolution add dotted
+    // names too, but they end in ".inlineN" and ".shadowN".
+    char name[32];
+    snprintf(name, sizeof(name), "temporary.loop%d",
+             optimizer->temporary_count++);
+    return intern_string(name);
+}
+
+static List *call_arguments(Syntax *call) {
+    return call->function_call->function_arguments->function_arguments
+        ->arguments;
+}
+
+static int write_count(Loop *loop, Symbol var_name) {
+    return (int)(intptr_t)symbol_map_get(loop->writes, var_name);
+}
+
+static bool is_changed(Loop *loop, Symbol var_name) {
+    return write_count(loop, var_name) > 0;
+}
+
+static void add_write(Loop *loop, Symbol var_name) {
+    symbol_map_set(loop->writes, var_name,
+                   (void *)(intptr_t)(write_count(loop, var_name) + 1));
+}
+
+/* Count every assignment and definition in SYNTAX in the variables
+ * LOOP changes.
+ */
+static void collect_changes(Loop *loop, Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        collect_changes(loop, syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        collect_changes(loop, syntax->binary_expression->left);
+        collect_changes(loop, syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        add_write(loop, syntax->assignment->var_name);
+        collect_changes(loop, syntax->assignment->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        add_write(loop, syntax->define_var_statement->var_name);
+        collect_changes(loop, syntax->define_var_statement->init_value);
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = call_arguments(syntax);
+        for (int i = 0; i < list_length(arguments); i++) {
+            collect_changes(loop, list_get(arguments, i));
+        }
+    } else if (syntax->type == RETURN_STATEMENT) {
+        collect_changes(loop, syntax->return_statement->expression);
+    } else if (syntax->type == IF_STATEMENT) {
+        collect_changes(loop, syntax->if_statement->condition);
+        collect_changes(loop, syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        collect_changes(loop, syntax->while_statement->condition);
+        collect_changes(loop, syntax->while_statement->body);
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            collect_changes(loop, list_get(statements, i));
+        }
+    }
+}
+
+/* Does SYNTAX have the same value on every iteration of LOOP? Calls
+ * never do, since they may have side effects.
+ */
+static bool is_invariant(Loop *loop, Syntax *syntax) {
+    if (syntax->type == IMMEDIATE) {
+        return true;
+    } else if (syntax->type == VARIABLE) {
+        return !is_changed(loop, syntax->variable->var_name);
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return is_invariant(loop, syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return is_invariant(loop, syntax->binary_expression->left) &&
+               is_invariant(loop, syntax->binary_expression->right);
+    }
+    return false;
+}
+
+static bool is_leaf(Syntax *syntax) {
+    return syntax->type == IMMEDIATE || syntax->type == VARIABLE;
+}
+
+/* Is SYNTAX worth computing once before the loop, if it's invariant?
+ * A leaf is already as cheap as the variable we'd replace it with.
+ */
+static bool is_worth_hoisting(Syntax *syntax) {
+    if (syntax->type == BINARY_OPERATOR) {
+        return true;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return !is_leaf(syntax->unary_expression->expression);
+    }
+    return false;
+}
+
+/******************************************************************************
+ *
+ * Loop-invariant code motion.
+ *
+ ******************************************************************************/
+
+/* Move the largest invariant expressions in *SYNTAX into variables
+ * defined in the preheader of LOOP. Evaluating them can't fail or
+ * have side effects, so it's safe even when the loop runs zero times
+ * or the expression is in a branch the loop never takes.
+ */
+static void hoist_invariants(LoopOptimizer *optimizer, Loop *loop,
+                             Syntax **syntax_ptr) {
+    Syntax *syntax = *syntax_ptr;
+    if (is_worth_hoisting(syntax) && is_invariant(loop, syntax)) {
+        Symbol temporary = new_temporary(optimizer);
+        list_append(loop->preheader, define_var_new(temporary, syntax));
+        *syntax_ptr = variable_new(temporary);
+        optimizer->hoisted_count++;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        hoist_invariants(optimizer, loop,
+                         &syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        hoist_invariants(optimizer, loop, &syntax->binary_expression->left);
+        hoist_invariants(optimizer, loop, &syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        hoist_invariants(optimizer, loop, &syntax->assignment->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        hoist_invariants(optimizer, loop,
+                         &syntax->define_var_statement->init_value);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        hoist_invariants(optimizer, loop,
+                         &syntax->return_statement->expression);
+    } else if (syntax->type == IF_STATEMENT) {
+        hoist_invariants(optimizer, loop, &syntax->if_statement->condition);
+        hoist_invariants(optimizer, loop, &syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        hoist_invariants(optimizer, loop,
+                         &syntax->while_statement->condition);
+        hoist_invariants(optimizer, loop, &syntax->while_statement->body);
+    } else if (syntax->type == FUNCTION_CALL || syntax->type == BLOCK) {
+        List *children = syntax->type == BLOCK ? syntax->block->statements
+                                               : call_arguments(syntax);
+        for (int i = 0; i < list_length(children); i++) {
+            Syntax *child = list_get(children, i);
+            hoist_invariants(optimizer, loop, &child);
+            list_set(children, i, child);
+        }
+    }
+}
+
+/******************************************************************************
+ *
+ * Induction variable strength reduction.
+ *
+ ******************************************************************************/
+
+/* If STATEMENT is `i = i + c`, `i = c + i` or `i = i - c` for an
+ * immediate c, return the amount it adds to i and set *VAR_NAME.
+ * Otherwise return 0.
+ */
+static int update_step(Syntax *statement, Symbol *var_name) {
+    if (statement->type != ASSIGNMENT ||
+        statement->assignment->expression->type != BINARY_OPERATOR) {
+        return 0;
+    }
+
+    *var_name = statement->assignment->var_name;
+    BinaryExpression *binary_syntax =
+        statement->assignment->expression->binary_expression;
+    Syntax *left = binary_syntax->left;
+    Syntax *right = binary_syntax->right;
+
+    bool left_is_var =
+        left->type == VARIABLE && left->variable->var_name == *var_name;
+    bool right_is_var =
+        right->type == VARIABLE && right->variable->var_name == *var_name;
+
+    if (binary_syntax->binary_type == ADDITION && left_is_var &&
+        right->type == IMMEDIATE) {
+        return right->immediate->value;
+    } else if (binary_syntax->binary_type == ADDITION && right_is_var &&
+               left->type == IMMEDIATE) {
+        return left->immediate->value;
+    } else if (binary_syntax->binary_type == SUBTRACTION && left_is_var &&
+               right->type == IMMEDIATE) {
+        // Wraps like the subtraction would, even for INT_MIN.
+        return (int)(0u - (unsigned)right->immediate->value);
+    }
+    return 0;
+}
+
+static void find_induction_variables(Loop *loop) {
+    Syntax *body = loop->syntax->while_statement->body;
+    List *statements = body->block->statements;
+    loop->induction_variables =
+        malloc(sizeof(InductionVariable) * (list_length(statements) + 1));
+
+    for (int i = 0; i < list_length(statements); i++) {
+        Syntax *statement = list_get(statements, i);
+        Symbol var_name;
+        int step = update_step(statement, &var_name);
+        if (step == 0 || write_count(loop, var_name) != 1) {
+            continue;
+        }
+
+        InductionVariable *induction_variable =
+            &loop->induction_variables[loop->induction_variable_count++];
+        induction_variable->var_name = var_name;
+        induction_variable->step = step;
+        induction_variable->update = statement;
+    }
+}
+
+static InductionVariable *find_induction_variable(Loop *loop,
+                                                  Syntax *syntax) {
+    if (syntax->type != VARIABLE) {
+        return NULL;
+    }
+
+    for (int i = 0; i < loop->induction_variable_count; i++) {
+        if (loop->induction_variables[i].var_name ==
+            syntax->variable->var_name) {
+            return &loop->induction_variables[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_invariant_leaf(Loop *loop, Syntax *syntax) {
+    return is_leaf(syntax) && is_invariant(loop, syntax);
+}
+
+static bool same_leaf(Syntax *left, Syntax *right) {
+    if (left->type == IMMEDIATE && right->type == IMMEDIATE) {
+        return left->immediate->value == right->immediate->value;
+    } else if (left->type == VARIABLE && right->type == VARIABLE) {
+        return left->variable->var_name == right->variable->var_name;
+    }
+    return false;
+}
+
+static Syntax *copy_leaf(Syntax *syntax) {
+    if (syntax->type == IMMEDIATE) {
+        return immediate_new(syntax->immediate->value);
+    }
+    return variable_new(syntax->variable->var_name);
+}
+
+/* Return the variable that holds INDUCTION_VARIABLE * FACTOR in LOOP,
+ * creating it if this is the first such product.
+ */
+static Symbol product_variable(LoopOptimizer *optimizer, Loop *loop,
+                               InductionVariable *induction_variable,
+                               Syntax *factor) {
+    for (int i = 0; i < loop->reduction_count; i++) {
+        Reduction *reduction = &loop->reductions[i];
+        if (reduction->induction_variable == induction_variable &&
+            same_leaf(reduction->factor, factor)) {
+            return reduction->product;
+        }
+    }
+
+    if (loop->reduction_count == loop->reduction_capacity) {
+        loop->reduction_capacity = loop->reduction_capacity * 2 + 4;
+        loop->reductions = realloc(
+            loop->reductions, sizeof(Reduction) * loop->reduction_capacity);
+    }
+    Reduction *reduction = &loop->reductions[loop->reduction_count++];
+    reduction->induction_variable = induction_variable;
+    reduction->factor = copy_leaf(factor);
+    reduction->product = new_temporary(optimizer);
+    return reduction->product;
+}
+
+/* Replace each product of an induction variable and an invariant
+ * leaf in *SYNTAX with the variable holding it.
+ */
+static void reduce_multiplications(LoopOptimizer *optimizer, Loop *loop,
+                                   Syntax **syntax_ptr) {
+    Syntax *syntax = *syntax_ptr;
+    if (syntax->type == BINARY_OPERATOR &&
+        syntax->binary_expression->binary_type == MULTIPLICATION) {
+        Syntax *left = syntax->binary_expression->left;
+        Syntax *right = syntax->binary_expression->right;
+
+        InductionVariable *induction_variable = NULL;
+        Syntax *factor = NULL;
+        if (find_induction_variable(loop, left) &&
+            is_invariant_leaf(loop, right)) {
+            induction_variable = find_induction_variable(loop, left);
+            factor = right;
+        } else if (find_induction_variable(loop, right) &&
+                   is_invariant_leaf(loop, left)) {
+            induction_variable = find_induction_variable(loop, right);
+            factor = left;
+        }
+
+        if (induction_variable != NULL) {
+            Symbol product = product_variable(optimizer, loop,
+                                              induction_variable, factor);
+            syntax_free(syntax);
+            *syntax_ptr = variable_new(product);
+            optimizer->reduced_count++;
+            return;
+        }
+    }
+
+    if (syntax->type == UNARY_OPERATOR) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->binary_expression->left);
+        reduce_multiplications(optimizer, loop,
+                               &syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->assignment->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->define_var_statement->init_value);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->return_statement->expression);
+    } else if (syntax->type == IF_STATEMENT) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->if_statement->condition);
+        reduce_multiplications(optimizer, loop, &syntax->if_statement->then);
+    } else if (syntax->type == WHILE_SYNTAX) {
+        reduce_multiplications(optimizer, loop,
+                               &syntax->while_statement->condition);
+        reduce_multiplications(optimizer, loop,
+                               &syntax->while_statement->body);
+    } else if (syntax->type == FUNCTION_CALL || syntax->type == BLOCK) {
+        List *children = syntax->type == BLOCK ? syntax->block->statements
+                                               : call_arguments(syntax);
+        for (int i = 0; i < list_length(children); i++) {
+            Syntax *child = list_get(children, i);
+            reduce_multiplications(optimizer, loop, &child);
+            list_set(children, i, child);
+        }
+    }
+}
+
+/* The statement that keeps REDUCTION's product up to date after its
+ * induction variable steps.
+ */
+static Syntax *product_update(LoopOptimizer *optimizer, Loop *loop,
+                              Reduction *reduction) {
+    Symbol product = reduction->product;
+    Syntax *factor = reduction->factor;
+    int step = reduction->induction_variable->step;
+
+    Syntax *increment;
+    if (factor->type == IMMEDIATE) {
+        increment = immediate_new(
+            (int)((unsigned)step * (unsigned)factor->immediate->value));
+    } else if (step == 1) {
+        increment = copy_leaf(factor);
+    } else if (step == -1) {
+        return assignment_new(product, subtraction_new(variable_new(product),
+                                                       copy_leaf(factor)));
+    } else {
+        // The factor is only known at run time, so multiply by the
+        // step once, before the loop.
+        Symbol scaled_step = new_temporary(optimizer);
+        list_append(loop->preheader,
+                    define_var_new(scaled_step,
+                                   multiplication_new(copy_leaf(factor),
+                                                      immediate_new(step))));
+        increment = variable_new(scaled_step);
+    }
+    return assignment_new(product,
+                          addition_new(variable_new(product), increment));
+}
+
+/* Replace multiplications by the induction variables of LOOP with
+ * running products. Each product starts at its value on entry, and is
+ * updated right after its induction variable is.
+ */
+static void reduce_strength(LoopOptimizer *optimizer, Loop *loop) {
+    WhileStatement *while_statement = loop->syntax->while_statement;
+    reduce_multiplications(optimizer, loop, &while_statement->condition);
+    reduce_multiplications(optimizer, loop, &while_statement->body);
+    if (loop->reduction_count == 0) {
+        return;
+    }
+
+    List *statements = while_statement->body->block->statements;
+    List *rewritten = syntax_list_new();
+    for (int i = 0; i < list_length(statements); i++) {
+        Syntax *statement = list_get(statements, i);
+        list_append(rewritten, statement);
+
+        for (int j = 0; j < loop->reduction_count; j++) {
+            Reduction *reduction = &loop->reductions[j];
+            if (reduction->induction_variable->update == statement) {
+                list_append(rewritten,
+                            product_update(optimizer, loop, reduction));
+            }
+        }
+    }
+    list_free(statements);
+    while_statement->body->block->statements = rewritten;
+
+    for (int i = 0; i < loop->reduction_count; i++) {
+        Reduction *reduction = &loop->reductions[i];
+        Syntax *initial_value = multiplication_new(
+            variable_new(reduction->induction_variable->var_name),
+            copy_leaf(reduction->factor));
+        list_append(loop->preheader,
+                    define_var_new(reduction->product, initial_value));
+    }
+}
+
+/******************************************************************************
+ *
+ * Finding loops.
+ *
+ ******************************************************************************/
+
+/* Optimize the while loop SYNTAX, appending the code that has to run
+ * before it to PREHEADER.
+ */
+static void optimize_loop(LoopOptimizer *optimizer, Syntax *syntax,
+                          List *preheader) {
+    Loop loop = {0};
+    loop.syntax = syntax;
+    loop.preheader = preheader;
+    loop.writes = symbol_map_new();
+
+    // Hoisting only moves expressions that don't write anything, so
+    // these counts stay right for the whole loop.
+    collect_changes(&loop, syntax);
+    hoist_invariants(optimizer, &loop, &syntax->while_statement->condition);
+    hoist_invariants(optimizer, &loop, &syntax->while_statement->body);
+
+    // Hoisting may have given us invariant factors to reduce by.
+    find_induction_variables(&loop);
+    reduce_strength(optimizer, &loop);
+
+    for (int i = 0; i < loop.reduction_count; i++) {
+        syntax_free(loop.reductions[i].factor);
+    }
+    free(loop.reductions);
+    free(loop.induction_variables);
+    symbol_map_free(loop.writes);
+}
+
+/* Optimize the loops in the BLOCK SYNTAX. Outer loops go first, so
+ * an expression invariant in several nested loops is hoisted out of
+ * all of them.
+ */
+static void optimize_block(LoopOptimizer *optimizer, Syntax *syntax) {
+    List *statements = syntax->block->statements;
+    List *rewritten = syntax_list_new();
+    for (int i = 0; i < list_length(statements); i++) {
+        Syntax *statement = list_get(statements, i);
+        if (statement->type == WHILE_SYNTAX) {
+            optimize_loop(optimizer, statement, rewritten);
+            optimize_block(optimizer, statement->while_statement->body);
+        } else if (statement->type == IF_STATEMENT) {
+            optimize_block(optimizer, statement->if_statement->then);
+        } else if (statement->type == BLOCK) {
+            optimize_block(optimizer, statement);
+        }
+        list_append(rewritten, statement);
+    }
+    list_free(statements);
+    syntax->block->statements = rewritten;
+}
+
+/* Move loop-invariant expressions out of the while loops in the
+ * TOP_LEVEL SYNTAX, and replace multiplications by induction
+ * variables with additions. If REPORT isn't NULL, say how much we
+ * changed there.
+ */
+Syntax *optimize_loops(Syntax *syntax, FILE *report) {
+    LoopOptimizer optimizer = {0};
+
+    List *declarations = syntax->top_level->declarations;
+    for (int i = 0; i < list_length(declarations); i++) {
+        Syntax *declaration = list_get(declarations, i);
+        if (declaration->type == FUNCTION) {
+            optimize_block(&optimizer, declaration->function->root_block);
+        }
+    }
+
+    if (report != NULL) {
+        fprintf(report,
+                "Hoisted %d loop-invariant expressions, strength-reduced %d "
+                "multiplications.\n",
+                optimizer.hoisted_count, optimizer.reduced_count);
+    }
+    timing_count("hoisted expressions", optimizer.hoisted_count);
+    timing_count("reduced multiplications", optimizer.reduced_count);
+    return syntax;
+}
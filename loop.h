@@ -0,0 +1,10 @@
+#ifndef MC_LOOP_H
+#define MC_LOOP_H
+
+#include <stdio.h>
+
+#include "syntax.h"
+
+Syntax *optimize_loops(Syntax *syntax, FILE *report);
+
+#endif
@@ -1,14 +1,31 @@
 #include <assert.h>
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#include "stack.h"
+#include "arena.h"
 #include "syntax.h"
 #include "assembly.h"
-#include "build/y.tab.h"
+#include "flat_syntax.h"
+#include "dce.h"
+#include "fold.h"
+#include "inline.h"
+#include "loop.h"
+#include "intern.h"
+#include "ir.h"
+#include "list.h"
+#include "options.h"
+#include "parse.h"
+#include "preprocessor.h"
+#include "scope.h"
+#include "target.h"
+#include "timing.h"
 
 void print_help() {
     printf("mc(mingxicc) is a very basic C compiler.\n\n");
@@ -16,117 +33,475 @@ void print_help() {
     printf("    $ mc foo.c\n");
     printf("To output the AST without compiling:\n");
     printf("    $ mc --dump-ast foo.c\n");
+    printf("To output the AST after constant folding:\n");
+    printf("    $ mc --dump-folded-ast foo.c\n");
     printf("To output the preprocessed code without parsing:\n");
     printf("    $ mc --dump-expansion foo.c\n");
+    printf("To search a directory for included headers:\n");
+    printf("    $ mc -I include foo.c\n");
+    printf("To output the SSA intermediate representation:\n");
+    printf("    $ mc --dump-ir foo.c\n");
+    printf("To fold constants and keep temporaries and locals in registers:\n");
+    printf("    $ mc -O1 foo.c\n");
+    printf("To inline functions of up to 20 syntax nodes, or none at all:\n");
+    printf("    $ mc -O1 --inline-threshold=20 foo.c\n");
+    printf("    $ mc -O1 --inline-threshold=0 foo.c\n");
+    printf("To report what the optimizer did:\n");
+    printf("    $ mc -O1 --stats foo.c\n");
+    printf("To report where compile time went, or trace it for a viewer:\n");
+    printf("    $ mc --time-report foo.c\n");
+    printf("    $ mc --trace=trace.json foo.c\n");
+    printf("To generate code from the SSA intermediate representation:\n");
+    printf("    $ mc --use-ir foo.c\n");
+    printf("To write an object file, or choose the output file:\n");
+    printf("    $ mc -c foo.c\n");
+    printf("    $ mc -o foo foo.c\n");
+    printf("To compile several files, in parallel, into a directory:\n");
+    printf("    $ mc -c -o build foo.c bar.c @more_files.txt\n");
+    printf("    $ mc -j4 -c -o build foo.c bar.c\n");
+    printf("To write assembly for the GNU assembler instead:\n");
+    printf("    $ mc --emit=asm foo.c\n");
+    printf("To generate 64-bit code (the default is i386):\n");
+    printf("    $ mc --target=x86_64 foo.c\n");
     printf("To print this message:\n");
     printf("    $ mc --help\n\n");
 }
 
-extern Stack *syntax_stack;
-
-extern int yyparse(void);
-extern FILE *yyin;
-
 typedef enum {
     MACRO_EXPAND,
     PARSE,
+    FOLD_CONSTANTS,
+    BUILD_IR,
     EMIT_ASM,
 } stage_t;
 
-int main(int argc, char *argv[]) {
-    ++argv, --argc; /* Skip over program name. */
+/* One input file, and the options to compile it with. Every job has
+ * its own copy of the options so that it can have its own output
+ * file.
+ */
+typedef struct Job {
+    char *file_name;
+    Options options;
+    bool failed;
+} Job;
 
-    stage_t terminate_at = EMIT_ASM;
+/******************************************************************************
+ *
+ * All the files we were asked to compile. Worker threads take the
+ * next job under LOCK until there are none left.
+ *
+ ******************************************************************************/
+typedef struct Batch {
+    Job *jobs;
+    int job_count;
+    int next_job;
+    pthread_mutex_t lock;
+    // The preprocessor and its header cache are shared, so only one
+    // worker may use them at a time. Everything after preprocessing
+    // runs in parallel.
+    pthread_mutex_t preprocessor_lock;
+    Preprocessor *preprocessor;
+    stage_t terminate_at;
+} Batch;
 
-    char *file_name;
-    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
-        print_help();
-        return 0;
-    } else if (argc == 1) {
-        file_name = argv[0];
-    } else if (argc == 2 && strcmp(argv[0], "--dump-expansion") == 0) {
-        terminate_at = MACRO_EXPAND;
-        file_name = argv[1];
-    } else if (argc == 2 && strcmp(argv[0], "--dump-ast") == 0) {
-        terminate_at = PARSE;
-        file_name = argv[1];
-    } else {
-        print_help();
-        return 1;
+/* Add the number of nodes in SYNTAX to the counter NAME, when we're
+ * reporting on the compile.
+ */
+static void count_syntax_nodes(const char *name, Syntax *syntax) {
+    if (timing_enabled()) {
+        FlatSyntax *flat = flatten_syntax(syntax);
+        timing_count(name, flat->node_count);
+        flat_syntax_free(flat);
     }
+}
 
-    int result;
+static void compile_file(Batch *batch, Job *job) {
+    span_begin("file", job->file_name);
 
-    // TODO: create a proper temporary file from the preprocessor.
-    char command[1024] = {0};
-    snprintf(command, 1024, "gcc -E %s > .expanded.c", file_name);
-    result = system(command);
-    if (result != 0) {
+    // The syntax tree lives until we've written the assembly, so we
+    // allocate it all in one arena. syntax_arena is per thread.
+    syntax_arena = arena_new();
+
+    pthread_mutex_lock(&batch->preprocessor_lock);
+    span_begin("phase", "preprocess");
+    SourceBuffer *source = preprocess(batch->preprocessor, job->file_name);
+    span_end();
+    pthread_mutex_unlock(&batch->preprocessor_lock);
+
+    if (source == NULL) {
         puts("Macro expansion failed!");
-        return result;
+        job->failed = true;
+        goto cleanup;
+    }
+
+    if (batch->terminate_at == MACRO_EXPAND) {
+        fwrite(source->data, 1, source->length, stdout);
+        source_buffer_free(source);
+        goto cleanup;
     }
 
-    yyin = fopen(".expanded.c", "r");
+    // The tree doesn't point into the source, so we can drop it now.
+    span_begin("phase", "parse");
+    Syntax *complete_syntax = parse(source);
+    span_end();
+    source_buffer_free(source);
 
-    if (terminate_at == MACRO_EXPAND) {
-        int c;
-        while ((c = getc(yyin)) != EOF) {
-            putchar(c);
-        }
-        goto cleanup_file;
+    if (complete_syntax == NULL) {
+        job->failed = true;
+        goto cleanup;
     }
+    count_syntax_nodes("syntax nodes", complete_syntax);
 
-    if (yyin == NULL) {
-        // TODO: work out what the error was.
-        // TODO: Unit test this.
-        printf("Could not open file: '%s'\n", file_name);
-        result = 2;
-        goto cleanup_file;
+    if (batch->terminate_at == PARSE) {
+        print_syntax(complete_syntax);
+        goto cleanup;
     }
 
-    syntax_stack = stack_new();
+    if ((job->options.opt_level >= 1 || job->options.use_ir ||
+         batch->terminate_at == BUILD_IR) &&
+        batch->terminate_at != FOLD_CONSTANTS) {
+        // The register allocator, the SSA builder and the -O1 passes
+        // tell locals apart by name.
+        span_begin("phase", "scopes");
+        complete_syntax = resolve_scopes(complete_syntax);
+        span_end();
+    }
 
-    result = yyparse();
-    if (result != 0) {
-        printf("\n");
-        goto cleanup_syntax;
+    if (job->options.opt_level >= 1 ||
+        batch->terminate_at == FOLD_CONSTANTS) {
+        span_begin("phase", "fold");
+        complete_syntax = fold_constants(complete_syntax);
+        span_end();
+        count_syntax_nodes("folded syntax nodes", complete_syntax);
     }
 
-    Syntax *complete_syntax = stack_pop(syntax_stack);
-    if (syntax_stack->size > 0) {
-        warnx(
-            "Did not consume the whole syntax stack during parsing! "
-            "Remaining:");
+    if (job->options.opt_level >= 1 &&
+        batch->terminate_at != FOLD_CONSTANTS) {
+        span_begin("phase", "inline");
+        complete_syntax = inline_functions(
+            complete_syntax, job->options.inline_threshold,
+            job->options.print_stats ? stderr : NULL);
+        span_end();
+        count_syntax_nodes("inlined syntax nodes", complete_syntax);
 
-        while (syntax_stack->size > 0) {
-            fprintf(stderr, "%s", syntax_type_name(stack_pop(syntax_stack)));
-        }
+        span_begin("phase", "dead code");
+        complete_syntax = eliminate_dead_code(
+            complete_syntax, job->options.print_stats ? stderr : NULL);
+        span_end();
+        count_syntax_nodes("live syntax nodes", complete_syntax);
+
+        span_begin("phase", "loops");
+        complete_syntax = optimize_loops(
+            complete_syntax, job->options.print_stats ? stderr : NULL);
+        span_end();
     }
 
-    if (terminate_at == PARSE) {
+    if (batch->terminate_at == FOLD_CONSTANTS) {
         print_syntax(complete_syntax);
+    } else if (batch->terminate_at == BUILD_IR) {
+        span_begin("phase", "build IR");
+        IrProgram *program = ir_build(complete_syntax);
+        span_end();
+        print_ir(program);
+        ir_free(program);
     } else {
-        write_assembly(complete_syntax);
+        if (!write_assembly(complete_syntax, &job->options)) {
+            job->failed = true;
+        }
         syntax_free(complete_syntax);
 
-        printf("Written out.s.\n");
-        printf("Build it with:\n");
-        printf("    $ as out.s -o out.o\n");
-        printf("    $ ld -s -o out out.o\n");
+        if (!job->failed) {
+            printf("Written %s.\n", job->options.output_file);
+        }
+    }
+
+cleanup:
+    timing_count("syntax arena bytes", syntax_arena->bytes_allocated);
+    arena_free(syntax_arena);
+    syntax_arena = NULL;
+    span_end();
+}
+
+static void *worker(void *argument) {
+    Batch *batch = argument;
+
+    while (true) {
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next_job++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (index >= batch->job_count) {
+            return NULL;
+        }
+        compile_file(batch, &batch->jobs[index]);
+    }
+}
+
+/* Append the file names in the response file PATH to INPUTS, one per
+ * line.
+ */
+static bool read_file_list(char *path, List *inputs) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        warn("%s", path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, file)) != -1) {
+        while (length > 0 && isspace((unsigned char)line[length - 1])) {
+            line[--length] = '\0';
+        }
+        if (length > 0) {
+            list_append(inputs, strdup(line));
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return true;
+}
+
+/* The output file for INPUT when compiling several files into
+ * DIRECTORY: its base name, with the extension for EMIT.
+ */
+static char *output_path(char *directory, char *input, OutputKind emit) {
+    char *base = strrchr(input, '/');
+    base = base == NULL ? input : base + 1;
+
+    size_t base_length = strlen(base);
+    char *dot = strrchr(base, '.');
+    if (dot != NULL && dot != base) {
+        base_length = dot - base;
+    }
+
+    char *extension = "";
+    if (emit == OUTPUT_ASSEMBLY) {
+        extension = ".s";
+    } else if (emit == OUTPUT_OBJECT) {
+        extension = ".o";
+    }
+
+    size_t size = strlen(directory) + base_length + strlen(extension) + 2;
+    char *path = malloc(size);
+    snprintf(path, size, "%s/%.*s%s", directory, (int)base_length, base,
+             extension);
+    return path;
+}
+
+static int compare_output_paths(const void *left, const void *right) {
+    const Job *left_job = *(const Job *const *)left;
+    const Job *right_job = *(const Job *const *)right;
+    int order =
+        strcmp(left_job->options.output_file, right_job->options.output_file);
+    if (order != 0) {
+        return order;
+    }
+    // Keep jobs with the same output in input order, for the message.
+    return (left_job > right_job) - (left_job < right_job);
+}
+
+/* Check that no two jobs in BATCH write the same file. Inputs with
+ * the same base name in different directories would overwrite each
+ * other's output, so we report them instead.
+ */
+static bool check_output_paths(Batch *batch) {
+    Job **sorted = malloc(batch->job_count * sizeof(Job *));
+    for (int i = 0; i < batch->job_count; i++) {
+        sorted[i] = &batch->jobs[i];
+    }
+    qsort(sorted, batch->job_count, sizeof(Job *), compare_output_paths);
+
+    bool distinct = true;
+    for (int i = 1; i < batch->job_count; i++) {
+        if (strcmp(sorted[i - 1]->options.output_file,
+                   sorted[i]->options.output_file) == 0) {
+            warnx("%s and %s would both be written to %s",
+                  sorted[i - 1]->file_name, sorted[i]->file_name,
+                  sorted[i]->options.output_file);
+            distinct = false;
+        }
+    }
+
+    free(sorted);
+    return distinct;
+}
+
+int main(int argc, char *argv[]) {
+    ++argv, --argc; /* Skip over program name. */
+
+    stage_t terminate_at = EMIT_ASM;
+    Options options = {0,           false, false, DEFAULT_INLINE_THRESHOLD,
+                       TARGET_I386, OUTPUT_EXECUTABLE, NULL};
+    Preprocessor *preprocessor = preprocessor_new();
+    List *inputs = list_new();
+    long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    bool time_report = false;
+    char *trace_file = NULL;
+    int result = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            print_help();
+            goto cleanup_inputs;
+        } else if (strcmp(argv[i], "--dump-expansion") == 0) {
+            terminate_at = MACRO_EXPAND;
+        } else if (strcmp(argv[i], "--dump-ast") == 0) {
+            terminate_at = PARSE;
+        } else if (strcmp(argv[i], "--dump-folded-ast") == 0) {
+            terminate_at = FOLD_CONSTANTS;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            terminate_at = BUILD_IR;
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            options.opt_level = 0;
+        } else if (strcmp(argv[i], "-O1") == 0) {
+            options.opt_level = 1;
+        } else if (strcmp(argv[i], "--use-ir") == 0) {
+            options.use_ir = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.print_stats = true;
+        } else if (strncmp(argv[i], "--inline-threshold=",
+                           strlen("--inline-threshold=")) == 0) {
+            options.inline_threshold =
+                atoi(argv[i] + strlen("--inline-threshold="));
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            time_report = true;
+        } else if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0) {
+            trace_file = argv[i] + strlen("--trace=");
+        } else if (strncmp(argv[i], "--target=", strlen("--target=")) == 0) {
+            Target *target = target_from_name(argv[i] + strlen("--target="));
+            if (target == NULL) {
+                warnx("Unknown target: %s", argv[i] + strlen("--target="));
+                result = 1;
+                goto cleanup_inputs;
+            }
+            options.target = target->arch;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options.emit = OUTPUT_OBJECT;
+        } else if (strcmp(argv[i], "--emit=asm") == 0) {
+            options.emit = OUTPUT_ASSEMBLY;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_file = argv[++i];
+        } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            preprocessor_add_include_dir(preprocessor, argv[++i]);
+        } else if (strncmp(argv[i], "-I", strlen("-I")) == 0) {
+            preprocessor_add_include_dir(preprocessor, argv[i] + strlen("-I"));
+        } else if (strncmp(argv[i], "-j", strlen("-j")) == 0 &&
+                   argv[i][2] != '\0') {
+            worker_count = atol(argv[i] + strlen("-j"));
+        } else if (argv[i][0] == '@') {
+            if (!read_file_list(argv[i] + 1, inputs)) {
+                result = 1;
+                goto cleanup_inputs;
+            }
+        } else if (argv[i][0] != '-') {
+            list_append(inputs, strdup(argv[i]));
+        } else {
+            print_help();
+            result = 1;
+            goto cleanup_inputs;
+        }
+    }
+
+    if (list_length(inputs) == 0) {
+        print_help();
+        result = 1;
+        goto cleanup_inputs;
+    }
+
+    // With one input, -o names the output file. With several, it
+    // names the directory they're all written to.
+    char *output_dir = NULL;
+    if (list_length(inputs) > 1) {
+        output_dir = options.output_file == NULL ? "." : options.output_file;
+        if (mkdir(output_dir, 0777) != 0 && errno != EEXIST) {
+            warn("%s", output_dir);
+            result = 1;
+            goto cleanup_inputs;
+        }
+    } else if (options.output_file == NULL) {
+        if (options.emit == OUTPUT_ASSEMBLY) {
+            options.output_file = "out.s";
+        } else if (options.emit == OUTPUT_OBJECT) {
+            options.output_file = "out.o";
+        } else {
+            options.output_file = "out";
+        }
+    }
+
+    Batch batch = {0};
+    batch.job_count = list_length(inputs);
+    batch.jobs = calloc(batch.job_count, sizeof(Job));
+    batch.preprocessor = preprocessor;
+    batch.terminate_at = terminate_at;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_mutex_init(&batch.preprocessor_lock, NULL);
+
+    for (int i = 0; i < batch.job_count; i++) {
+        Job *job = &batch.jobs[i];
+        job->file_name = list_get(inputs, i);
+        job->options = options;
+        if (output_dir != NULL) {
+            job->options.output_file =
+                output_path(output_dir, job->file_name, options.emit);
+        }
+    }
+    if (output_dir != NULL && !check_output_paths(&batch)) {
+        result = 1;
     }
 
-cleanup_syntax:
-    /* TODO: if we exit early from syntactically invalid code, we will
-       need to free multiple Syntax structs on this stack.
-     */
-    stack_free(syntax_stack);
+    // One worker per CPU by default. The dumps go to stdout, so we
+    // keep them in order by using just one. If the outputs clash, we
+    // don't compile anything.
+    if (terminate_at != EMIT_ASM || worker_count < 1) {
+        worker_count = 1;
+    }
+    if (result != 0) {
+        worker_count = 0;
+    }
+    if (worker_count > batch.job_count) {
+        worker_count = batch.job_count;
+    }
 
-cleanup_file:
-    if (yyin != NULL) {
-        fclose(yyin);
+    if (time_report || trace_file != NULL) {
+        timing_start(time_report, trace_file);
     }
 
-    unlink(".expanded.c");
+    pthread_t *workers = malloc(worker_count * sizeof(pthread_t));
+    for (long i = 0; i < worker_count; i++) {
+        pthread_create(&workers[i], NULL, worker, &batch);
+    }
+    for (long i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    for (int i = 0; i < batch.job_count; i++) {
+        if (batch.jobs[i].failed) {
+            result = 1;
+        }
+        if (output_dir != NULL) {
+            free(batch.jobs[i].options.output_file);
+        }
+    }
+
+    if (!timing_finish()) {
+        result = 1;
+    }
+
+    pthread_mutex_destroy(&batch.lock);
+    pthread_mutex_destroy(&batch.preprocessor_lock);
+    free(batch.jobs);
+
+cleanup_inputs:
+    for (int i = 0; i < list_length(inputs); i++) {
+        free(list_get(inputs, i));
+    }
+    list_free(inputs);
+    preprocessor_free(preprocessor);
+    interner_free();
 
     return result;
 }
@@ -2,36 +2,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include "../intern.h"
 #include "../syntax.h"
 #include "../stack.h"
+%}
 
-#define YYSTYPE char*
+%code requires {
+#include "../intern.h"
+#include "../list.h"
+#include "../stack.h"
 
-int yyparse(void);
-int yylex();
+// The scanner's state. flex defines it the same way.
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
 
-void yyerror(const char *str)
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+
+void yyerror(yyscan_t scanner, Stack *syntax_stack, const char *str)
 {
+	(void)scanner;
+	(void)syntax_stack;
 	fprintf(stderr,"error: %s\n",str);
 }
-
-int yywrap()
-{
-	return 1;
 }
 
-extern FILE *yyin;
-
-Stack *syntax_stack;
+/* A pure parser with a reentrant scanner. The scanner and the stack
+ * we build the syntax tree on are passed in, so several files can be
+ * parsed at once on different threads.
+ */
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {Stack *syntax_stack}
 
-%}
+/* Token values. Identifiers are interned, and numbers are converted
+ * by the lexer, so neither needs freeing.
+ */
+%union {
+    int number;
+    Symbol symbol;
+    List *list;
+}
 
 %token INCLUDE HEADER_NAME
-%token TYPE IDENTIFIER RETURN NUMBER
+%token TYPE RETURN
+%token <number> NUMBER
+%token <symbol> IDENTIFIER
 %token OPEN_BRACE CLOSE_BRACE
 %token IF WHILE
 %token LESS_OR_EQUAL
 
+%type <list> parameter_list nonempty_parameter_list
+
 /* Operator associativity, least precedence first.
  * See http://en.cppreference.com/w/c/language/operator_precedence
  */
@@ -46,22 +71,18 @@ Stack *syntax_stack;
 %%
 
 program
-    : function program
-      {
-          Syntax *top_level_syntax;
-          if (stack_empty(syntax_stack)) {
-              top_level_syntax = top_level_new();
-          } else if (((Syntax *)stack_peek(syntax_stack))->type != TOP_LEVEL) {
-              top_level_syntax = top_level_new();
-          } else {
-              top_level_syntax = stack_pop(syntax_stack);
-          }
-
-          list_push(top_level_syntax->top_level->declarations,
-                    stack_pop(syntax_stack));
-          stack_push(syntax_stack, top_level_syntax);
-      }
-    |
+    : program function
+      {
+          // Rules are left recursive, so we see functions in order.
+          Syntax *function_syntax = stack_pop(syntax_stack);
+          Syntax *top_level_syntax = stack_peek(syntax_stack);
+          list_append(top_level_syntax->top_level->declarations,
+                      function_syntax);
+      }
+    | // Empty program.
+      {
+          stack_push(syntax_stack, top_level_new());
+      }
     ;
 
 function
@@ -69,37 +90,42 @@ function
       {
           Syntax *current_syntax = stack_pop(syntax_stack);
           // TODO: assert current_syntax has type BLOCK.
-          stack_push(syntax_stack, function_new((char*)$2, current_syntax));
+          stack_push(syntax_stack, function_new($2, $4, current_syntax));
       }
     ;
 
 parameter_list
     : nonempty_parameter_list
-    |
+    | // No parameters.
+      {
+          $$ = syntax_list_new();
+      }
     ;
 
 nonempty_parameter_list
-    : TYPE IDENTIFIER ',' parameter_list
+    : nonempty_parameter_list ',' TYPE IDENTIFIER
+      {
+          list_append($1, parameter_new($4));
+          $$ = $1;
+      }
     | TYPE IDENTIFIER
+      {
+          $$ = syntax_list_new();
+          list_append($$, parameter_new($2));
+      }
     ;
 
 block
-    : statement block
-      {
-          /* Append to the current block, or start a new block. */
-          Syntax *block_syntax;
-          if (stack_empty(syntax_stack)) {
-              block_syntax = block_new(list_new());
-          } else if (((Syntax *)stack_peek(syntax_stack))->type != BLOCK) {
-              block_syntax = block_new(list_new());
-          } else {
-              block_syntax = stack_pop(syntax_stack);
-          }
-
-          list_push(block_syntax->block->statements, stack_pop(syntax_stack));
-          stack_push(syntax_stack, block_syntax);
-      }
-    |
+    : block statement
+      {
+          Syntax *statement_syntax = stack_pop(syntax_stack);
+          Syntax *block_syntax = stack_peek(syntax_stack);
+          list_append(block_syntax->block->statements, statement_syntax);
+      }
+    | // Empty block.
+      {
+          stack_push(syntax_stack, block_new(syntax_list_new()));
+      }
     ;
 
 argument_list
@@ -111,35 +137,19 @@ argument_list
     ;
 
 nonempty_argument_list
-    : expression ',' nonempty_argument_list
-      {
-          Syntax *arguments_syntax;
-          if (stack_empty(syntax_stack)) {
-              // This should be impossible, we shouldn't be able to
-              // parse this on its own.
-              assert(false);
-          } else if (((Syntax *)stack_peek(syntax_stack))->type != FUNCTION_ARGUMENTS) {
-              arguments_syntax = function_arguments_new();
-          } else {
-              arguments_syntax = stack_pop(syntax_stack);
-          }
-
-          list_push(arguments_syntax->function_arguments->arguments, stack_pop(syntax_stack));
-          stack_push(syntax_stack, arguments_syntax);
+    : nonempty_argument_list ',' expression
+      {
+          Syntax *argument_syntax = stack_pop(syntax_stack);
+          Syntax *arguments_syntax = stack_peek(syntax_stack);
+          list_append(arguments_syntax->function_arguments->arguments,
+                      argument_syntax);
       }
 
     | expression
       {
-          // TODO: find a way to factor out the duplication with the above.
-          if (stack_empty(syntax_stack)) {
-              // This should be impossible, we shouldn't be able to
-              // parse this on its own.
-              assert(false);
-          }
-
           Syntax *arguments_syntax = function_arguments_new();
-          list_push(arguments_syntax->function_arguments->arguments, stack_pop(syntax_stack));
-
+          list_append(arguments_syntax->function_arguments->arguments,
+                      stack_pop(syntax_stack));
           stack_push(syntax_stack, arguments_syntax);
       }
     ;
@@ -169,7 +179,7 @@ statement
     | TYPE IDENTIFIER '=' expression ';'
       {
           Syntax *init_value = stack_pop(syntax_stack);
-          stack_push(syntax_stack, define_var_new((char*)$2, init_value));
+          stack_push(syntax_stack, define_var_new($2, init_value));
       }
 
     | expression ';'
@@ -181,19 +191,23 @@ statement
 expression
     : NUMBER
       {
-          stack_push(syntax_stack, immediate_new(atoi((char*)$1)));
-          free($1);
+          stack_push(syntax_stack, immediate_new($1));
       }
 
     | IDENTIFIER
       {
-          stack_push(syntax_stack, variable_new((char*)$1));
+          stack_push(syntax_stack, variable_new($1));
+      }
+
+    | '(' expression ')'
+      {
+          // Nothing to do, the inner expression is already on the stack.
       }
 
     | IDENTIFIER '=' expression
       {
           Syntax *expression = stack_pop(syntax_stack);
-          stack_push(syntax_stack, assignment_new((char*)$1, expression));
+          stack_push(syntax_stack, assignment_new($1, expression));
       }
 
     | '~' expression
@@ -246,6 +260,6 @@ expression
     | IDENTIFIER '(' argument_list ')'
       {
           Syntax *arguments = stack_pop(syntax_stack);
-          stack_push(syntax_stack, function_call_new((char*)$1, arguments));
+          stack_push(syntax_stack, function_call_new($1, arguments));
       }
     ;
@@ -0,0 +1,32 @@
+#ifndef MC_OPTIONS_H
+#define MC_OPTIONS_H
+
+#include <stdbool.h>
+
+#include "target.h"
+
+/* What the compiler writes: a linked program, an object file for
+ * the linker, or assembly source for the GNU assembler.
+ */
+typedef enum { OUTPUT_EXECUTABLE, OUTPUT_OBJECT, OUTPUT_ASSEMBLY } OutputKind;
+
+/* Command line settings that affect code generation. */
+typedef struct Options {
+    // 0 for the naive stack machine, 1 to fold constants and
+    // allocate registers.
+    int opt_level;
+    // Generate code by lowering the SSA IR instead of walking the
+    // syntax tree.
+    bool use_ir;
+    // Report what the optimization passes did on stderr.
+    bool print_stats;
+    // Functions of at most this many syntax nodes are inlined at -O1.
+    int inline_threshold;
+    // The architecture we generate assembly for.
+    TargetArch target;
+    OutputKind emit;
+    // Where to write the output.
+    char *output_file;
+} Options;
+
+#endif
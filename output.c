@@ -0,0 +1,122 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+
+// Padding is copied out of here rather than written a space at a time.
+static const char SPACES[] = "                                ";
+
+#define MAX_SPACES (int)(sizeof(SPACES) - 1)
+
+/* Open PATH for writing with permissions MODE, truncating it. Returns
+ * NULL, with a warning, if we can't.
+ */
+Output *output_open(char *path, int mode) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd < 0) {
+        warn("%s", path);
+        return NULL;
+    }
+
+    Output *output = malloc(sizeof(Output));
+    output->path = path;
+    output->fd = fd;
+    output->buffer = (Buffer){0};
+    output->failed = false;
+    return output;
+}
+
+/* Write the IOV_COUNT pieces in IOV, retrying after short writes. */
+static void write_all(Output *output, struct iovec *iov, int iov_count) {
+    while (iov_count > 0 && !output->failed) {
+        ssize_t written = writev(output->fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            warn("%s", output->path);
+            output->failed = true;
+            return;
+        }
+
+        while (iov_count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/* Write what's buffered, followed by EXTRA_LENGTH bytes from EXTRA,
+ * in one system call if we can.
+ */
+static void flush(Output *output, const char *extra, size_t extra_length) {
+    struct iovec iov[2] = {
+        {output->buffer.data, output->buffer.length},
+        {(char *)extra, extra_length},
+    };
+    write_all(output, iov, extra_length > 0 ? 2 : 1);
+    output->buffer.length = 0;
+}
+
+void output_append(Output *output, const char *bytes, size_t length) {
+    if (output->buffer.length + length < OUTPUT_FLUSH_SIZE) {
+        buffer_append(&output->buffer, bytes, length);
+        return;
+    }
+
+    // Large writes, such as a whole ELF file, skip the copy.
+    if (length >= OUTPUT_FLUSH_SIZE) {
+        flush(output, bytes, length);
+    } else {
+        buffer_append(&output->buffer, bytes, length);
+        flush(output, NULL, 0);
+    }
+}
+
+void output_string(Output *output, const char *string) {
+    output_append(output, string, strlen(string));
+}
+
+void output_char(Output *output, char c) {
+    if (output->buffer.length + 1 < OUTPUT_FLUSH_SIZE) {
+        buffer_push(&output->buffer, c);
+    } else {
+        output_append(output, &c, 1);
+    }
+}
+
+void output_spaces(Output *output, int count) {
+    while (count > 0) {
+        int length = count < MAX_SPACES ? count : MAX_SPACES;
+        output_append(output, SPACES, length);
+        count -= length;
+    }
+}
+
+/* Flush and close OUTPUT, and free it. Returns false if any write
+ * failed.
+ */
+bool output_close(Output *output) {
+    if (output->buffer.length > 0) {
+        flush(output, NULL, 0);
+    }
+    bool result = !output->failed;
+    if (close(output->fd) < 0 && result) {
+        warn("%s", output->path);
+        result = false;
+    }
+
+    free(output->buffer.data);
+    free(output);
+    return result;
+}
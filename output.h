@@ -0,0 +1,34 @@
+#ifndef MC_OUTPUT_H
+#define MC_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+/******************************************************************************
+ *
+ * An append-only file we're writing. Bytes collect in BUFFER and go
+ * to the file in large write calls, so writing a line costs a few
+ * memcpys rather than a stdio call per piece.
+ *
+ ******************************************************************************/
+typedef struct Output {
+    char *path;
+    int fd;
+    Buffer buffer;
+    // Set if a write failed. Later writes are skipped.
+    bool failed;
+} Output;
+
+// We flush once this much is buffered.
+#define OUTPUT_FLUSH_SIZE (64 * 1024)
+
+Output *output_open(char *path, int mode);
+void output_append(Output *output, const char *bytes, size_t length);
+void output_string(Output *output, const char *string);
+void output_char(Output *output, char c);
+void output_spaces(Output *output, int count);
+bool output_close(Output *output);
+
+#endif
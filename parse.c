@@ -0,0 +1,54 @@
+#include <err.h>
+#include <stdio.h>
+
+#include "parse.h"
+#include "stack.h"
+#include "build/y.tab.h"
+
+// The parts of flex's reentrant interface we use. flex only writes a
+// header for them when asked to.
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+extern int yylex_init(yyscan_t *scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_buffer(char *base, size_t size,
+                                      yyscan_t scanner);
+extern void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+
+Syntax *parse(SourceBuffer *source) {
+    yyscan_t scanner;
+    if (yylex_init(&scanner) != 0) {
+        warn("yylex_init");
+        return NULL;
+    }
+
+    // The lexer scans our source buffer in place.
+    YY_BUFFER_STATE lexer_buffer = yy_scan_buffer(
+        source->data, source->length + SOURCE_BUFFER_PADDING, scanner);
+
+    Stack *syntax_stack = stack_new();
+
+    Syntax *complete_syntax = NULL;
+    if (yyparse(scanner, syntax_stack) != 0) {
+        printf("\n");
+    } else {
+        complete_syntax = stack_pop(syntax_stack);
+        if (syntax_stack->size > 0) {
+            warnx(
+                "Did not consume the whole syntax stack during parsing! "
+                "Remaining:");
+
+            while (syntax_stack->size > 0) {
+                fprintf(stderr, "%s",
+                        syntax_type_name(stack_pop(syntax_stack)));
+            }
+        }
+    }
+
+    // This also frees any Syntax structs left on the stack if we
+    // exited early from syntactically invalid code.
+    stack_free(syntax_stack);
+    yy_delete_buffer(lexer_buffer, scanner);
+    yylex_destroy(scanner);
+
+    return complete_syntax;
+}
@@ -0,0 +1,13 @@
+#ifndef MC_PARSE_H
+#define MC_PARSE_H
+
+#include "source_buffer.h"
+#include "syntax.h"
+
+/* Parse the preprocessed SOURCE into a syntax tree, or return NULL
+ * if it has a syntax error. Each call has its own scanner and parser
+ * state, so any number of files can be parsed at once.
+ */
+Syntax *parse(SourceBuffer *source);
+
+#endif
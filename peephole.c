@@ -0,0 +1,273 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "list.h"
+#include "peephole.h"
+
+// Large enough for any operand the backend emits.
+#define MAX_OPERAND_LENGTH 64
+
+typedef struct PeepholeRule {
+    char *name;
+    // Try to rewrite INSTRUCTIONS starting at INDEX, returning true if
+    // we changed anything.
+    bool (*apply)(List *instructions, int index);
+} PeepholeRule;
+
+/* Return the index of the first live instruction after INDEX, skipping
+ * blank lines and deleted instructions, or -1 if there is none.
+ */
+static int next_index(List *instructions, int index) {
+    for (int i = index + 1; i < list_length(instructions); i++) {
+        Instruction *instruction = list_get(instructions, i);
+        if (!instruction->deleted && instruction->type != BLANK_LINE) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Instruction *next_instruction(List *instructions, int *index) {
+    *index = next_index(instructions, *index);
+    if (*index == -1) {
+        return NULL;
+    }
+    return list_get(instructions, *index);
+}
+
+static bool is_instruction(Instruction *instruction, char *name) {
+    return instruction != NULL && instruction->type == INSTRUCTION &&
+           strcmp(instruction->name, name) == 0;
+}
+
+/* Split "src, dst" operands into SOURCE and DEST. */
+static bool split_operands(Instruction *instruction, char *source,
+                           char *dest) {
+    char *comma = strstr(instruction->operands, ", ");
+    if (comma == NULL) {
+        return false;
+    }
+
+    size_t source_length = comma - instruction->operands;
+    if (source_length >= MAX_OPERAND_LENGTH ||
+        strlen(comma + 2) >= MAX_OPERAND_LENGTH) {
+        return false;
+    }
+
+    memcpy(source, instruction->operands, source_length);
+    source[source_length] = '\0';
+    strcpy(dest, comma + 2);
+    return true;
+}
+
+/* mov A, B
+ * mov B, A      <- already true, so delete it.
+ *
+ * Typically a store to a stack slot followed by a load of the same
+ * slot.
+ */
+static bool remove_store_load(List *instructions, int index) {
+    Instruction *first = list_get(instructions, index);
+    int second_index = index;
+    Instruction *second = next_instruction(instructions, &second_index);
+
+    if (!is_instruction(first, "mov") || !is_instruction(second, "mov")) {
+        return false;
+    }
+
+    char first_source[MAX_OPERAND_LENGTH], first_dest[MAX_OPERAND_LENGTH];
+    char second_source[MAX_OPERAND_LENGTH], second_dest[MAX_OPERAND_LENGTH];
+    if (!split_operands(first, first_source, first_dest) ||
+        !split_operands(second, second_source, second_dest)) {
+        return false;
+    }
+
+    if (strcmp(first_source, second_dest) == 0 &&
+        strcmp(first_dest, second_source) == 0) {
+        second->deleted = true;
+        return true;
+    }
+    return false;
+}
+
+/* Return the jump taken when the condition of SETCC does not hold. */
+static char *inverted_jump(char *setcc) {
+    static char *pairs[][2] = {
+        {"setl", "jge"}, {"setle", "jg"}, {"setg", "jle"}, {"setge", "jl"},
+        {"setz", "jnz"}, {"setnz", "jz"}, {"sete", "jne"}, {"setne", "je"},
+    };
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (strcmp(pairs[i][0], setcc) == 0) {
+            return pairs[i][1];
+        }
+    }
+    return NULL;
+}
+
+/* setCC  %al
+ * movzbl %al, %eax
+ * test   %eax, %eax
+ * jz     label
+ *
+ * becomes jNCC label, branching on the original flags. The boolean
+ * in %eax is dead once we've branched on it.
+ */
+static bool fuse_setcc_branch(List *instructions, int index) {
+    Instruction *setcc = list_get(instructions, index);
+    if (setcc->type != INSTRUCTION || inverted_jump(setcc->name) == NULL) {
+        return false;
+    }
+
+    int movzbl_index = index;
+    Instruction *movzbl = next_instruction(instructions, &movzbl_index);
+    int test_index = movzbl_index;
+    Instruction *test =
+        movzbl ? next_instruction(instructions, &test_index) : NULL;
+    int jz_index = test_index;
+    Instruction *jz = test ? next_instruction(instructions, &jz_index) : NULL;
+
+    if (!is_instruction(movzbl, "movzbl") || !is_instruction(test, "test") ||
+        !is_instruction(jz, "jz")) {
+        return false;
+    }
+
+    char byte[MAX_OPERAND_LENGTH], reg[MAX_OPERAND_LENGTH];
+    char test_source[MAX_OPERAND_LENGTH], test_dest[MAX_OPERAND_LENGTH];
+    if (!split_operands(movzbl, byte, reg) ||
+        !split_operands(test, test_source, test_dest)) {
+        return false;
+    }
+
+    if (strcmp(setcc->operands, byte) != 0 || strcmp(test_source, reg) != 0 ||
+        strcmp(test_dest, reg) != 0) {
+        return false;
+    }
+
+    instruction_set_name(jz, inverted_jump(setcc->name));
+    setcc->deleted = true;
+    movzbl->deleted = true;
+    test->deleted = true;
+    return true;
+}
+
+/* jmp label
+ * label:        <- we'd get here anyway, so delete the jump.
+ */
+static bool remove_jump_to_next(List *instructions, int index) {
+    Instruction *jump = list_get(instructions, index);
+    if (!is_instruction(jump, "jmp")) {
+        return false;
+    }
+
+    int next = index;
+    Instruction *label;
+    while ((label = next_instruction(instructions, &next)) != NULL &&
+           label->type == LABEL) {
+        if (strcmp(label->name, jump->operands) == 0) {
+            jump->deleted = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Nothing after a jmp or ret runs until the next label, which is the
+ * only way control can reach it. Directives end the dead region too,
+ * as they start a new function.
+ */
+static bool remove_dead_after_jump(List *instructions, int index) {
+    Instruction *jump = list_get(instructions, index);
+    if (!is_instruction(jump, "jmp") && !is_instruction(jump, "ret")) {
+        return false;
+    }
+
+    bool changed = false;
+    int next = index;
+    Instruction *dead;
+    while ((dead = next_instruction(instructions, &next)) != NULL &&
+           dead->type == INSTRUCTION) {
+        dead->deleted = true;
+        changed = true;
+    }
+    return changed;
+}
+
+static PeepholeRule RULES[NUM_PEEPHOLE_RULES] = {
+    {"store-load", remove_store_load},
+    {"setcc-branch", fuse_setcc_branch},
+    {"jump-to-next", remove_jump_to_next},
+    {"dead-after-jump", remove_dead_after_jump},
+};
+
+static int count_instructions(List *instructions) {
+    int count = 0;
+    for (int i = 0; i < list_length(instructions); i++) {
+        Instruction *instruction = list_get(instructions, i);
+        if (!instruction->deleted && instruction->type == INSTRUCTION) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Apply every rule at every position until none of them fire. Rules
+ * mark instructions as deleted, and we drop those from the list at
+ * the end.
+ */
+void peephole_optimize(List *instructions, PeepholeStats *stats) {
+    for (int i = 0; i < NUM_PEEPHOLE_RULES; i++) {
+        stats->hits[i] = 0;
+    }
+    stats->instructions_before = count_instructions(instructions);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < list_length(instructions); i++) {
+            Instruction *instruction = list_get(instructions, i);
+            if (instruction->deleted) {
+                continue;
+            }
+
+            for (int r = 0; r < NUM_PEEPHOLE_RULES; r++) {
+                if (RULES[r].apply(instructions, i)) {
+                    stats->hits[r]++;
+                    changed = true;
+
+                    if (instruction->deleted) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < list_length(instructions); i++) {
+        Instruction *instruction = list_get(instructions, i);
+        if (instruction->deleted) {
+            instruction_free(instruction);
+        } else {
+            list_set(instructions, kept++, instruction);
+        }
+    }
+    while (list_length(instructions) > kept) {
+        list_pop(instructions);
+    }
+
+    stats->instructions_after = count_instructions(instructions);
+}
+
+void print_peephole_stats(FILE *out, PeepholeStats *stats) {
+    fprintf(out, "Peephole rule         Hits\n");
+    for (int i = 0; i < NUM_PEEPHOLE_RULES; i++) {
+        fprintf(out, "%-20s %5d\n", RULES[i].name, stats->hits[i]);
+    }
+    fprintf(out, "Instructions: %d before, %d after peephole.\n",
+            stats->instructions_before, stats->instructions_after);
+}
@@ -0,0 +1,20 @@
+#ifndef MC_PEEPHOLE_H
+#define MC_PEEPHOLE_H
+
+#include <stdio.h>
+
+#include "list.h"
+
+#define NUM_PEEPHOLE_RULES 4
+
+typedef struct PeepholeStats {
+    // How many times each rule fired, indexed as the rule table.
+    int hits[NUM_PEEPHOLE_RULES];
+    int instructions_before;
+    int instructions_after;
+} PeepholeStats;
+
+void peephole_optimize(List *instructions, PeepholeStats *stats);
+void print_peephole_stats(FILE *out, PeepholeStats *stats);
+
+#endif
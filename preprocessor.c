@@ -0,0 +1,1326 @@
+#include <ctype.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "intern.h"
+#include "list.h"
+#include "preprocessor.h"
+#include "source_buffer.h"
+
+// Deeper than this, we assume a header includes itself.
+#define MAX_INCLUDE_DEPTH 200
+
+#define INITIAL_MACROS_SIZE 256
+#define INITIAL_CONDITIONALS_SIZE 16
+
+/* A stretch of text owned by someone else. */
+typedef struct Slice {
+    const char *start;
+    size_t length;
+} Slice;
+
+/* Our position within a directive. END is the end of its line. */
+typedef struct Cursor {
+    const char *p;
+    const char *end;
+} Cursor;
+
+typedef struct Macro {
+    Symbol name;
+    bool function_like;
+    Symbol *parameters;
+    int parameter_count;
+    // The replacement list, without surrounding whitespace.
+    char *body;
+    // Set while we expand this macro, so it can't expand itself.
+    bool disabled;
+} Macro;
+
+/* The text of a file after splicing lines and removing comments. */
+typedef struct SourceFile {
+    char *path;
+    char *text;
+    size_t length;
+    // Headers are cached, so we remember this to report it to every
+    // file that includes one.
+    bool unterminated_comment;
+} SourceFile;
+
+/* One level of #if nesting. */
+typedef struct Conditional {
+    // Are we emitting the current branch?
+    bool active;
+    // Has a branch been taken, so later ones must be skipped?
+    bool taken;
+    bool seen_else;
+    // Where the #if is, for error messages.
+    int line;
+} Conditional;
+
+struct Preprocessor {
+    // Directories to search for headers, as char*.
+    List *include_dirs;
+    // Every header we've read, as SourceFile*.
+    List *headers;
+
+    // Macros indexed by the Symbol of their name, NULL when not
+    // defined. Symbols are dense, so this beats a hash table.
+    Macro **macros;
+    uint32_t macros_capacity;
+
+    Conditional *conditionals;
+    int conditional_depth;
+    int conditional_capacity;
+
+    int include_depth;
+    // Where we are, for error messages.
+    char *file_name;
+    int line;
+    bool failed;
+
+    Buffer output;
+};
+
+static void preprocessor_error(Preprocessor *pp, const char *format, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    warnx("%s:%d: %s", pp->file_name, pp->line, message);
+    pp->failed = true;
+}
+
+static bool is_identifier_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_identifier_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool slice_equals(Slice slice, const char *string) {
+    return strlen(string) == slice.length &&
+           strncmp(slice.start, string, slice.length) == 0;
+}
+
+static void skip_spaces(Cursor *cursor) {
+    while (cursor->p < cursor->end && is_space(*cursor->p)) {
+        cursor->p++;
+    }
+}
+
+static bool read_identifier(Cursor *cursor, Slice *identifier) {
+    if (cursor->p == cursor->end || !is_identifier_start(*cursor->p)) {
+        return false;
+    }
+
+    identifier->start = cursor->p;
+    while (cursor->p < cursor->end && is_identifier_char(*cursor->p)) {
+        cursor->p++;
+    }
+    identifier->length = cursor->p - identifier->start;
+    return true;
+}
+
+/* If a character constant, string literal or number starts at
+ * TEXT[I], return the index just past it. Otherwise return I. Macros
+ * are never expanded inside these.
+ */
+static size_t skip_opaque_token(const char *text, size_t length, size_t i) {
+    char c = text[i];
+    if (c == '"' || c == '\'') {
+        i++;
+        while (i < length && text[i] != c && text[i] != '\n') {
+            if (text[i] == '\\' && i + 1 < length) {
+                i++;
+            }
+            i++;
+        }
+        return i < length && text[i] == c ? i + 1 : i;
+    }
+
+    if (isdigit((unsigned char)c) ||
+        (c == '.' && i + 1 < length && isdigit((unsigned char)text[i + 1]))) {
+        // A preprocessing number, such as 0x1F or 1e+5.
+        i++;
+        while (i < length) {
+            char d = text[i];
+            if ((d == '+' || d == '-') && strchr("eEpP", text[i - 1])) {
+                i++;
+            } else if (is_identifier_char(d) || d == '.') {
+                i++;
+            } else {
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+/* Splice lines that end in a backslash. The newlines we remove are
+ * emitted after the next real newline, so later lines keep their
+ * numbers.
+ */
+static void splice_lines(const char *raw, size_t length, Buffer *out) {
+    int pending_newlines = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (raw[i] == '\\' && i + 1 < length && raw[i + 1] == '\n') {
+            pending_newlines++;
+            i++;
+        } else if (raw[i] == '\\' && i + 2 < length && raw[i + 1] == '\r' &&
+                   raw[i + 2] == '\n') {
+            pending_newlines++;
+            i += 2;
+        } else {
+            buffer_push(out, raw[i]);
+            if (raw[i] == '\n') {
+                for (; pending_newlines > 0; pending_newlines--) {
+                    buffer_push(out, '\n');
+                }
+            }
+        }
+    }
+}
+
+/* Replace each comment in TEXT with a space. A block comment may
+ * span lines, but it must still act as one space if it's inside a
+ * directive, so its newlines are moved after the end of the line.
+ */
+static bool remove_comments(const char *text, size_t length, Buffer *out) {
+    int pending_newlines = 0;
+    size_t i = 0;
+    while (i < length) {
+        size_t end = skip_opaque_token(text, length, i);
+        if (end > i) {
+            buffer_append(out, text + i, end - i);
+            i = end;
+
+        } else if (text[i] == '/' && i + 1 < length && text[i + 1] == '/') {
+            while (i < length && text[i] != '\n') {
+                i++;
+            }
+            buffer_push(out, ' ');
+
+        } else if (text[i] == '/' && i + 1 < length && text[i + 1] == '*') {
+            i += 2;
+            while (i < length && !(text[i] == '*' && i + 1 < length &&
+                                   text[i + 1] == '/')) {
+                if (text[i] == '\n') {
+                    pending_newlines++;
+                }
+                i++;
+            }
+            if (i == length) {
+                return false;
+            }
+            i += 2;
+            buffer_push(out, ' ');
+
+        } else {
+            buffer_push(out, text[i]);
+            if (text[i] == '\n') {
+                for (; pending_newlines > 0; pending_newlines--) {
+                    buffer_push(out, '\n');
+                }
+            }
+            i++;
+        }
+    }
+
+    for (; pending_newlines > 0; pending_newlines--) {
+        buffer_push(out, '\n');
+    }
+    return true;
+}
+
+/* Do the translation phases that come before preprocessing proper
+ * on RAW, the text of the file at PATH.
+ */
+static SourceFile *clean_source(Preprocessor *pp, char *path,
+                                SourceBuffer *raw) {
+    Buffer spliced = {NULL, 0, 0};
+    splice_lines(raw->data, raw->length, &spliced);
+
+    Buffer text = {NULL, 0, 0};
+    buffer_reserve(&text, spliced.length + 1);
+    bool unterminated_comment =
+        !remove_comments(spliced.data, spliced.length, &text);
+    if (unterminated_comment) {
+        warnx("%s: unterminated comment", path);
+        pp->failed = true;
+    }
+    free(spliced.data);
+
+    SourceFile *source = malloc(sizeof(SourceFile));
+    source->path = strdup(path);
+    source->text = text.data;
+    source->length = text.length;
+    source->unterminated_comment = unterminated_comment;
+    return source;
+}
+
+/* Read and clean the file at PATH. Returns NULL if we can't read it. */
+static SourceFile *load_source(Preprocessor *pp, char *path) {
+    SourceBuffer *raw = source_buffer_map(path);
+    if (raw == NULL) {
+        return NULL;
+    }
+
+    SourceFile *source = clean_source(pp, path, raw);
+    source_buffer_free(raw);
+    return source;
+}
+
+/* Does TEXT need anything besides removing comments, which the lexer
+ * can do itself? We look for anything that might be a directive or a
+ * spliced line.
+ */
+static bool needs_preprocessing(const char *text, size_t length) {
+    bool line_start = true;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < length &&
+            (text[i + 1] == '\n' || text[i + 1] == '\r')) {
+            return true;
+        } else if (c == '\n') {
+            line_start = true;
+        } else if (c == '#' && line_start) {
+            return true;
+        } else if (!is_space(c)) {
+            line_start = false;
+        }
+    }
+    return false;
+}
+
+static void source_file_free(SourceFile *source) {
+    free(source->path);
+    free(source->text);
+    free(source);
+}
+
+/* The header at PATH, read from disk the first time we're asked. */
+static SourceFile *find_header(Preprocessor *pp, char *path) {
+    for (int i = 0; i < list_length(pp->headers); i++) {
+        SourceFile *header = list_get(pp->headers, i);
+        if (strcmp(header->path, path) == 0) {
+            if (header->unterminated_comment) {
+                warnx("%s: unterminated comment", path);
+                pp->failed = true;
+            }
+            return header;
+        }
+    }
+
+    SourceFile *header = load_source(pp, path);
+    if (header != NULL) {
+        list_append(pp->headers, header);
+    }
+    return header;
+}
+
+/* Search for the header NAME. Quoted includes look next to the
+ * current file before trying the include directories.
+ */
+static SourceFile *find_include(Preprocessor *pp, Slice name, bool quoted) {
+    char path[4096];
+
+    if (name.length > 0 && name.start[0] == '/') {
+        snprintf(path, sizeof(path), "%.*s", (int)name.length, name.start);
+        return find_header(pp, path);
+    }
+
+    if (quoted) {
+        char *slash = strrchr(pp->file_name, '/');
+        int dir_length = slash == NULL ? 0 : slash - pp->file_name + 1;
+        snprintf(path, sizeof(path), "%.*s%.*s", dir_length, pp->file_name,
+                 (int)name.length, name.start);
+
+        SourceFile *header = find_header(pp, path);
+        if (header != NULL) {
+            return header;
+        }
+    }
+
+    for (int i = 0; i < list_length(pp->include_dirs); i++) {
+        snprintf(path, sizeof(path), "%s/%.*s",
+                 (char *)list_get(pp->include_dirs, i), (int)name.length,
+                 name.start);
+
+        SourceFile *header = find_header(pp, path);
+        if (header != NULL) {
+            return header;
+        }
+    }
+    return NULL;
+}
+
+static Macro *find_macro(Preprocessor *pp, Symbol name) {
+    return name < pp->macros_capacity ? pp->macros[name] : NULL;
+}
+
+static void macro_free(Macro *macro) {
+    free(macro->parameters);
+    free(macro->body);
+    free(macro);
+}
+
+/* Define NAME as MACRO, or undefine it if MACRO is NULL. */
+static void set_macro(Preprocessor *pp, Symbol name, Macro *macro) {
+    if (name >= pp->macros_capacity) {
+        uint32_t capacity = pp->macros_capacity == 0 ? INITIAL_MACROS_SIZE
+                                                     : pp->macros_capacity;
+        while (capacity <= name) {
+            capacity *= 2;
+        }
+        pp->macros = realloc(pp->macros, capacity * sizeof(Macro *));
+        memset(pp->macros + pp->macros_capacity, 0,
+               (capacity - pp->macros_capacity) * sizeof(Macro *));
+        pp->macros_capacity = capacity;
+    }
+
+    if (pp->macros[name] != NULL) {
+        macro_free(pp->macros[name]);
+    }
+    pp->macros[name] = macro;
+}
+
+/* Macros only apply to the file that defines them. */
+static void forget_macros(Preprocessor *pp) {
+    for (uint32_t i = 0; i < pp->macros_capacity; i++) {
+        if (pp->macros[i] != NULL) {
+            macro_free(pp->macros[i]);
+            pp->macros[i] = NULL;
+        }
+    }
+}
+
+static void expand(Preprocessor *pp, const char *text, size_t length,
+                   Buffer *out);
+
+/* Split the arguments of the macro call whose opening parenthesis is
+ * at TEXT[*INDEX]. On success, *INDEX is moved past the closing
+ * parenthesis. Returns NULL if the call is never closed.
+ */
+static Slice *collect_arguments(const char *text, size_t length,
+                                size_t *index, int *count) {
+    Slice *arguments = NULL;
+    int capacity = 0;
+    *count = 0;
+
+    size_t start = *index + 1;
+    int depth = 0;
+    size_t i = start;
+    while (i < length) {
+        size_t end = skip_opaque_token(text, length, i);
+        if (end > i) {
+            i = end;
+            continue;
+        }
+
+        char c = text[i];
+        if (c == '(') {
+            depth++;
+        } else if ((c == ',' && depth == 0) || (c == ')' && depth == 0)) {
+            if (*count == capacity) {
+                capacity = capacity == 0 ? 4 : capacity * 2;
+                arguments = realloc(arguments, capacity * sizeof(Slice));
+            }
+
+            // Arguments don't include surrounding whitespace.
+            size_t argument_end = i;
+            while (start < argument_end &&
+                   isspace((unsigned char)text[start])) {
+                start++;
+            }
+            while (argument_end > start &&
+                   isspace((unsigned char)text[argument_end - 1])) {
+                argument_end--;
+            }
+            arguments[(*count)++] =
+                (Slice){text + start, argument_end - start};
+            start = i + 1;
+
+            if (c == ')') {
+                *index = i + 1;
+                return arguments;
+            }
+        } else if (c == ')') {
+            depth--;
+        }
+        i++;
+    }
+
+    free(arguments);
+    return NULL;
+}
+
+/* Write the expansion of MACRO to OUT. ARGUMENTS holds the already
+ * expanded argument for each parameter of a function-like macro.
+ */
+static void expand_macro(Preprocessor *pp, Macro *macro, Buffer *arguments,
+                         Buffer *out) {
+    const char *body = macro->body;
+    size_t length = strlen(body);
+
+    Buffer replacement = {NULL, 0, 0};
+    if (macro->function_like) {
+        size_t i = 0;
+        while (i < length) {
+            size_t end = skip_opaque_token(body, length, i);
+            if (end > i) {
+                buffer_append(&replacement, body + i, end - i);
+                i = end;
+                continue;
+            }
+            if (!is_identifier_start(body[i])) {
+                buffer_push(&replacement, body[i]);
+                i++;
+                continue;
+            }
+
+            size_t start = i;
+            while (i < length && is_identifier_char(body[i])) {
+                i++;
+            }
+
+            Symbol name = intern(body + start, i - start);
+            int parameter = 0;
+            while (parameter < macro->parameter_count &&
+                   macro->parameters[parameter] != name) {
+                parameter++;
+            }
+
+            if (parameter < macro->parameter_count) {
+                buffer_append(&replacement, arguments[parameter].data,
+                              arguments[parameter].length);
+            } else {
+                buffer_append(&replacement, body + start, i - start);
+            }
+        }
+
+        body = replacement.data;
+        length = replacement.length;
+    }
+
+    // Rescan the result for more macros, but not this one.
+    macro->disabled = true;
+    expand(pp, body, length, out);
+    macro->disabled = false;
+
+    free(replacement.data);
+}
+
+/* Write TEXT to OUT with every macro expanded. */
+static void expand(Preprocessor *pp, const char *text, size_t length,
+                   Buffer *out) {
+    size_t i = 0;
+    while (i < length) {
+        size_t end = skip_opaque_token(text, length, i);
+        if (end > i) {
+            buffer_append(out, text + i, end - i);
+            i = end;
+            continue;
+        }
+        if (!is_identifier_start(text[i])) {
+            buffer_push(out, text[i]);
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < length && is_identifier_char(text[i])) {
+            i++;
+        }
+
+        Macro *macro = find_macro(pp, intern(text + start, i - start));
+        if (macro == NULL || macro->disabled) {
+            buffer_append(out, text + start, i - start);
+            continue;
+        }
+
+        if (!macro->function_like) {
+            expand_macro(pp, macro, NULL, out);
+            continue;
+        }
+
+        // The name of a function-like macro is only a call if it's
+        // followed by arguments.
+        size_t open = i;
+        while (open < length && isspace((unsigned char)text[open])) {
+            open++;
+        }
+        if (open == length || text[open] != '(') {
+            buffer_append(out, text + start, i - start);
+            continue;
+        }
+
+        int count;
+        Slice *arguments = collect_arguments(text, length, &open, &count);
+        if (arguments == NULL) {
+            preprocessor_error(pp, "unterminated call to macro '%s'",
+                               symbol_name(macro->name));
+            buffer_append(out, text + start, i - start);
+            continue;
+        }
+        i = open;
+
+        if (macro->parameter_count == 0 && count == 1 &&
+            arguments[0].length == 0) {
+            count = 0;
+        }
+        if (count != macro->parameter_count) {
+            preprocessor_error(pp,
+                               "macro '%s' passed %d arguments, but takes %d",
+                               symbol_name(macro->name), count,
+                               macro->parameter_count);
+            free(arguments);
+            continue;
+        }
+
+        // Arguments are fully expanded before they're substituted.
+        Buffer *expanded = calloc(count, sizeof(Buffer));
+        for (int k = 0; k < count; k++) {
+            expand(pp, arguments[k].start, arguments[k].length, &expanded[k]);
+        }
+
+        expand_macro(pp, macro, expanded, out);
+
+        for (int k = 0; k < count; k++) {
+            free(expanded[k].data);
+        }
+        free(expanded);
+        free(arguments);
+    }
+}
+
+static void define_macro(Preprocessor *pp, Cursor *cursor) {
+    Slice name;
+    skip_spaces(cursor);
+    if (!read_identifier(cursor, &name)) {
+        preprocessor_error(pp, "macro names must be identifiers");
+        return;
+    }
+
+    Macro *macro = malloc(sizeof(Macro));
+    macro->name = intern(name.start, name.length);
+    macro->function_like = false;
+    macro->parameters = NULL;
+    macro->parameter_count = 0;
+    macro->disabled = false;
+
+    // Only a parenthesis straight after the name, with no space,
+    // makes a function-like macro.
+    if (cursor->p < cursor->end && *cursor->p == '(') {
+        macro->function_like = true;
+        cursor->p++;
+
+        skip_spaces(cursor);
+        if (cursor->p < cursor->end && *cursor->p == ')') {
+            cursor->p++;
+        } else {
+            while (true) {
+                Slice parameter;
+                skip_spaces(cursor);
+                if (!read_identifier(cursor, &parameter)) {
+                    preprocessor_error(pp, "expected a parameter name in "
+                                           "macro '%.*s' (variadic macros "
+                                           "are not supported)",
+                                       (int)name.length, name.start);
+                    macro->body = NULL;
+                    macro_free(macro);
+                    return;
+                }
+
+                macro->parameters =
+                    realloc(macro->parameters,
+                            (macro->parameter_count + 1) * sizeof(Symbol));
+                macro->parameters[macro->parameter_count++] =
+                    intern(parameter.start, parameter.length);
+
+                skip_spaces(cursor);
+                if (cursor->p < cursor->end && *cursor->p == ',') {
+                    cursor->p++;
+                } else if (cursor->p < cursor->end && *cursor->p == ')') {
+                    cursor->p++;
+                    break;
+                } else {
+                    preprocessor_error(pp, "expected ',' or ')' in the "
+                                           "parameters of macro '%.*s'",
+                                       (int)name.length, name.start);
+                    macro->body = NULL;
+                    macro_free(macro);
+                    return;
+                }
+            }
+        }
+    }
+
+    skip_spaces(cursor);
+    const char *end = cursor->end;
+    while (end > cursor->p && is_space(end[-1])) {
+        end--;
+    }
+    macro->body = strndup(cursor->p, end - cursor->p);
+
+    set_macro(pp, macro->name, macro);
+}
+
+static void undefine_macro(Preprocessor *pp, Cursor *cursor) {
+    Slice name;
+    skip_spaces(cursor);
+    if (!read_identifier(cursor, &name)) {
+        preprocessor_error(pp, "macro names must be identifiers");
+        return;
+    }
+
+    set_macro(pp, intern(name.start, name.length), NULL);
+}
+
+/******************************************************************************
+ *
+ * Evaluating #if expressions. We use intmax_t as the standard asks,
+ * but do the arithmetic unsigned so overflow wraps instead of being
+ * undefined.
+ *
+ ******************************************************************************/
+typedef struct ExpressionParser {
+    Preprocessor *pp;
+    const char *p;
+    const char *end;
+    bool failed;
+} ExpressionParser;
+
+typedef struct BinaryOperator {
+    const char *text;
+    int precedence;
+} BinaryOperator;
+
+// Longer operators come first, so "<<" isn't read as "<".
+static const BinaryOperator BINARY_OPERATORS[] = {
+    {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<=", 7}, {">=", 7},
+    {"<<", 8}, {">>", 8}, {"|", 3},  {"^", 4},  {"&", 5},  {"<", 7},
+    {">", 7},  {"+", 9},  {"-", 9},  {"*", 10}, {"/", 10}, {"%", 10},
+};
+
+#define NUM_BINARY_OPERATORS \
+    (sizeof(BINARY_OPERATORS) / sizeof(BINARY_OPERATORS[0]))
+
+static void expression_error(ExpressionParser *parser, const char *message) {
+    if (!parser->failed) {
+        preprocessor_error(parser->pp, "%s in #if", message);
+        parser->failed = true;
+    }
+}
+
+static void skip_expression_spaces(ExpressionParser *parser) {
+    while (parser->p < parser->end && isspace((unsigned char)*parser->p)) {
+        parser->p++;
+    }
+}
+
+static const BinaryOperator *peek_operator(ExpressionParser *parser) {
+    skip_expression_spaces(parser);
+    for (size_t i = 0; i < NUM_BINARY_OPERATORS; i++) {
+        size_t length = strlen(BINARY_OPERATORS[i].text);
+        if ((size_t)(parser->end - parser->p) >= length &&
+            strncmp(parser->p, BINARY_OPERATORS[i].text, length) == 0) {
+            return &BINARY_OPERATORS[i];
+        }
+    }
+    return NULL;
+}
+
+static intmax_t parse_conditional(ExpressionParser *parser, bool evaluate);
+
+static intmax_t parse_character(ExpressionParser *parser) {
+    // Skip the opening quote.
+    parser->p++;
+
+    intmax_t value = 0;
+    if (parser->p < parser->end && *parser->p == '\\' &&
+        parser->p + 1 < parser->end) {
+        parser->p++;
+        char escaped = *parser->p;
+        if (escaped == 'n') {
+            value = '\n';
+        } else if (escaped == 't') {
+            value = '\t';
+        } else if (escaped == '0') {
+            value = '\0';
+        } else {
+            value = escaped;
+        }
+    } else if (parser->p < parser->end) {
+        value = *parser->p;
+    }
+    parser->p++;
+
+    if (parser->p >= parser->end || *parser->p != '\'') {
+        expression_error(parser, "invalid character constant");
+        return 0;
+    }
+    parser->p++;
+    return value;
+}
+
+static intmax_t parse_unary(ExpressionParser *parser, bool evaluate) {
+    skip_expression_spaces(parser);
+    if (parser->p == parser->end) {
+        expression_error(parser, "expected a value");
+        return 0;
+    }
+
+    char c = *parser->p;
+    if (c == '(') {
+        parser->p++;
+        intmax_t value = parse_conditional(parser, evaluate);
+        skip_expression_spaces(parser);
+        if (parser->p == parser->end || *parser->p != ')') {
+            expression_error(parser, "missing ')'");
+            return 0;
+        }
+        parser->p++;
+        return value;
+
+    } else if (c == '!' || c == '~' || c == '-' || c == '+') {
+        parser->p++;
+        uintmax_t value = parse_unary(parser, evaluate);
+        if (c == '!') {
+            return value == 0;
+        } else if (c == '~') {
+            return ~value;
+        } else if (c == '-') {
+            return -value;
+        }
+        return value;
+
+    } else if (isdigit((unsigned char)c)) {
+        char *end;
+        uintmax_t value = strtoumax(parser->p, &end, 0);
+        parser->p = end;
+        while (parser->p < parser->end && strchr("uUlL", *parser->p)) {
+            parser->p++;
+        }
+        return value;
+
+    } else if (c == '\'') {
+        return parse_character(parser);
+
+    } else if (is_identifier_start(c)) {
+        // Identifiers that are still here after macro expansion
+        // evaluate to 0.
+        while (parser->p < parser->end && is_identifier_char(*parser->p)) {
+            parser->p++;
+        }
+        return 0;
+    }
+
+    expression_error(parser, "unexpected character");
+    return 0;
+}
+
+static intmax_t apply_operator(ExpressionParser *parser,
+                               const BinaryOperator *op, intmax_t left,
+                               intmax_t right, bool evaluate) {
+    const char *text = op->text;
+    uintmax_t left_bits = left;
+    uintmax_t right_bits = right;
+
+    if (strcmp(text, "||") == 0) {
+        return left != 0 || right != 0;
+    } else if (strcmp(text, "&&") == 0) {
+        return left != 0 && right != 0;
+    } else if (strcmp(text, "==") == 0) {
+        return left == right;
+    } else if (strcmp(text, "!=") == 0) {
+        return left != right;
+    } else if (strcmp(text, "<=") == 0) {
+        return left <= right;
+    } else if (strcmp(text, ">=") == 0) {
+        return left >= right;
+    } else if (strcmp(text, "<") == 0) {
+        return left < right;
+    } else if (strcmp(text, ">") == 0) {
+        return left > right;
+    } else if (strcmp(text, "<<") == 0 || strcmp(text, ">>") == 0) {
+        if (right < 0 || right >= (intmax_t)(sizeof(intmax_t) * 8)) {
+            return 0;
+        }
+        return text[0] == '<' ? (intmax_t)(left_bits << right)
+                              : (intmax_t)(left_bits >> right);
+    } else if (strcmp(text, "|") == 0) {
+        return left_bits | right_bits;
+    } else if (strcmp(text, "^") == 0) {
+        return left_bits ^ right_bits;
+    } else if (strcmp(text, "&") == 0) {
+        return left_bits & right_bits;
+    } else if (strcmp(text, "+") == 0) {
+        return left_bits + right_bits;
+    } else if (strcmp(text, "-") == 0) {
+        return left_bits - right_bits;
+    } else if (strcmp(text, "*") == 0) {
+        return left_bits * right_bits;
+    }
+
+    // Division, which may be in a branch that isn't evaluated.
+    if (right == 0) {
+        if (evaluate) {
+            expression_error(parser, "division by zero");
+        }
+        return 0;
+    } else if (right == -1) {
+        return text[0] == '/' ? (intmax_t)-left_bits : 0;
+    }
+    return text[0] == '/' ? left / right : left % right;
+}
+
+/* Parse binary operators binding at least as tightly as
+ * MIN_PRECEDENCE, by precedence climbing.
+ */
+static intmax_t parse_binary(ExpressionParser *parser, int min_precedence,
+                             bool evaluate) {
+    intmax_t left = parse_unary(parser, evaluate);
+
+    while (!parser->failed) {
+        const BinaryOperator *op = peek_operator(parser);
+        if (op == NULL || op->precedence < min_precedence) {
+            break;
+        }
+        parser->p += strlen(op->text);
+
+        // && and || don't evaluate their right operand if they don't
+        // need to.
+        bool evaluate_right = evaluate;
+        if ((strcmp(op->text, "&&") == 0 && left == 0) ||
+            (strcmp(op->text, "||") == 0 && left != 0)) {
+            evaluate_right = false;
+        }
+
+        intmax_t right =
+            parse_binary(parser, op->precedence + 1, evaluate_right);
+        left = apply_operator(parser, op, left, right, evaluate);
+    }
+    return left;
+}
+
+static intmax_t parse_conditional(ExpressionParser *parser, bool evaluate) {
+    intmax_t condition = parse_binary(parser, 1, evaluate);
+
+    skip_expression_spaces(parser);
+    if (parser->p == parser->end || *parser->p != '?') {
+        return condition;
+    }
+    parser->p++;
+
+    intmax_t then_value = parse_conditional(parser, evaluate && condition);
+    skip_expression_spaces(parser);
+    if (parser->p == parser->end || *parser->p != ':') {
+        expression_error(parser, "expected ':'");
+        return 0;
+    }
+    parser->p++;
+    intmax_t else_value = parse_conditional(parser, evaluate && !condition);
+
+    return condition ? then_value : else_value;
+}
+
+/* Evaluate the controlling expression of an #if or #elif. */
+static bool evaluate_condition(Preprocessor *pp, Cursor *cursor) {
+    // Replace defined(NAME) before expanding macros, so NAME itself
+    // isn't expanded.
+    Buffer replaced = {NULL, 0, 0};
+    while (cursor->p < cursor->end) {
+        Slice identifier;
+        if (!read_identifier(cursor, &identifier)) {
+            buffer_push(&replaced, *cursor->p);
+            cursor->p++;
+            continue;
+        }
+        if (!slice_equals(identifier, "defined")) {
+            buffer_append(&replaced, identifier.start, identifier.length);
+            continue;
+        }
+
+        skip_spaces(cursor);
+        bool parenthesized = cursor->p < cursor->end && *cursor->p == '(';
+        if (parenthesized) {
+            cursor->p++;
+            skip_spaces(cursor);
+        }
+
+        Slice name;
+        if (!read_identifier(cursor, &name)) {
+            preprocessor_error(pp, "operator 'defined' requires an identifier");
+            free(replaced.data);
+            return false;
+        }
+
+        if (parenthesized) {
+            skip_spaces(cursor);
+            if (cursor->p == cursor->end || *cursor->p != ')') {
+                preprocessor_error(pp, "missing ')' after 'defined'");
+                free(replaced.data);
+                return false;
+            }
+            cursor->p++;
+        }
+
+        bool defined = find_macro(pp, intern(name.start, name.length)) != NULL;
+        buffer_push(&replaced, defined ? '1' : '0');
+    }
+
+    Buffer expanded = {NULL, 0, 0};
+    if (replaced.length > 0) {
+        expand(pp, replaced.data, replaced.length, &expanded);
+    }
+    free(replaced.data);
+    // strtoumax must not read a number past the end of the expression.
+    buffer_push(&expanded, '\0');
+    expanded.length--;
+
+    ExpressionParser parser = {pp, expanded.data,
+                               expanded.data + expanded.length, false};
+    intmax_t value = parse_conditional(&parser, true);
+    skip_expression_spaces(&parser);
+    if (parser.p != parser.end) {
+        expression_error(&parser, "missing binary operator");
+    }
+    free(expanded.data);
+
+    return !parser.failed && value != 0;
+}
+
+static bool is_active(Preprocessor *pp) {
+    return pp->conditional_depth == 0 ||
+           pp->conditionals[pp->conditional_depth - 1].active;
+}
+
+/* Enter an #if whose condition is CONDITION. Inside code we're
+ * skipping, no branch can be taken.
+ */
+static void push_conditional(Preprocessor *pp, bool condition) {
+    if (pp->conditional_depth == pp->conditional_capacity) {
+        pp->conditional_capacity = pp->conditional_capacity == 0
+                                       ? INITIAL_CONDITIONALS_SIZE
+                                       : pp->conditional_capacity * 2;
+        pp->conditionals =
+            realloc(pp->conditionals,
+                    pp->conditional_capacity * sizeof(Conditional));
+    }
+
+    bool parent_active = is_active(pp);
+    Conditional *conditional = &pp->conditionals[pp->conditional_depth++];
+    conditional->active = parent_active && condition;
+    conditional->taken = !parent_active || condition;
+    conditional->seen_else = false;
+    conditional->line = pp->line;
+}
+
+/* The innermost #if, for an #elif, #else or #endif called NAME. */
+static Conditional *current_conditional(Preprocessor *pp, char *name) {
+    if (pp->conditional_depth == 0) {
+        preprocessor_error(pp, "#%s without #if", name);
+        return NULL;
+    }
+    Conditional *conditional = &pp->conditionals[pp->conditional_depth - 1];
+    if (conditional->seen_else && strcmp(name, "endif") != 0) {
+        preprocessor_error(pp, "#%s after #else", name);
+        return NULL;
+    }
+    return conditional;
+}
+
+static void process_source(Preprocessor *pp, SourceFile *source);
+
+static void include_file(Preprocessor *pp, Cursor *cursor) {
+    skip_spaces(cursor);
+    char close;
+    if (cursor->p < cursor->end && *cursor->p == '"') {
+        close = '"';
+    } else if (cursor->p < cursor->end && *cursor->p == '<') {
+        close = '>';
+    } else {
+        preprocessor_error(pp, "#include expects \"FILENAME\" or <FILENAME>");
+        return;
+    }
+
+    const char *start = ++cursor->p;
+    while (cursor->p < cursor->end && *cursor->p != close) {
+        cursor->p++;
+    }
+    if (cursor->p == cursor->end) {
+        preprocessor_error(pp, "missing terminating %c character", close);
+        return;
+    }
+    Slice name = {start, cursor->p - start};
+
+    if (pp->include_depth >= MAX_INCLUDE_DEPTH) {
+        preprocessor_error(pp, "#include nested too deeply");
+        return;
+    }
+
+    SourceFile *header = find_include(pp, name, close == '"');
+    if (header == NULL) {
+        preprocessor_error(pp, "%.*s: No such file or directory",
+                           (int)name.length, name.start);
+        return;
+    }
+
+    char *file_name = pp->file_name;
+    int line = pp->line;
+
+    pp->include_depth++;
+    process_source(pp, header);
+    pp->include_depth--;
+
+    pp->file_name = file_name;
+    pp->line = line;
+}
+
+/* Handle the directive after the '#' at CURSOR. */
+static void process_directive(Preprocessor *pp, Cursor *cursor) {
+    skip_spaces(cursor);
+    Slice name;
+    if (!read_identifier(cursor, &name)) {
+        // A # on its own is a null directive.
+        if (cursor->p < cursor->end && is_active(pp)) {
+            preprocessor_error(pp, "invalid preprocessing directive");
+        }
+        return;
+    }
+
+    bool active = is_active(pp);
+    if (slice_equals(name, "ifdef") || slice_equals(name, "ifndef")) {
+        bool condition = false;
+        if (active) {
+            Slice macro_name;
+            skip_spaces(cursor);
+            if (!read_identifier(cursor, &macro_name)) {
+                preprocessor_error(pp, "no macro name given in #%.*s",
+                                   (int)name.length, name.start);
+            } else {
+                condition = find_macro(pp, intern(macro_name.start,
+                                                  macro_name.length)) != NULL;
+            }
+            if (slice_equals(name, "ifndef")) {
+                condition = !condition;
+            }
+        }
+        push_conditional(pp, condition);
+
+    } else if (slice_equals(name, "if")) {
+        push_conditional(pp, active && evaluate_condition(pp, cursor));
+
+    } else if (slice_equals(name, "elif")) {
+        Conditional *conditional = current_conditional(pp, "elif");
+        if (conditional == NULL) {
+            return;
+        }
+        if (conditional->taken) {
+            conditional->active = false;
+        } else {
+            conditional->active = evaluate_condition(pp, cursor);
+            conditional->taken = conditional->active;
+        }
+
+    } else if (slice_equals(name, "else")) {
+        Conditional *conditional = current_conditional(pp, "else");
+        if (conditional == NULL) {
+            return;
+        }
+        conditional->active = !conditional->taken;
+        conditional->taken = true;
+        conditional->seen_else = true;
+
+    } else if (slice_equals(name, "endif")) {
+        if (current_conditional(pp, "endif") != NULL) {
+            pp->conditional_depth--;
+        }
+
+    } else if (!active) {
+        // Other directives in code we're skipping don't matter.
+
+    } else if (slice_equals(name, "define")) {
+        define_macro(pp, cursor);
+
+    } else if (slice_equals(name, "undef")) {
+        undefine_macro(pp, cursor);
+
+    } else if (slice_equals(name, "include")) {
+        include_file(pp, cursor);
+
+    } else if (slice_equals(name, "error")) {
+        skip_spaces(cursor);
+        preprocessor_error(pp, "#error %.*s", (int)(cursor->end - cursor->p),
+                           cursor->p);
+
+    } else if (slice_equals(name, "warning")) {
+        skip_spaces(cursor);
+        warnx("%s:%d: #warning %.*s", pp->file_name, pp->line,
+              (int)(cursor->end - cursor->p), cursor->p);
+
+    } else if (slice_equals(name, "pragma") || slice_equals(name, "line")) {
+        // We have no pragmas, and don't track lines in the output.
+
+    } else {
+        preprocessor_error(pp, "invalid preprocessing directive #%.*s",
+                           (int)name.length, name.start);
+    }
+}
+
+/* Preprocess SOURCE onto the output. Runs of lines between
+ * directives are expanded together, so a macro call may span lines.
+ * We emit a newline for every directive or skipped line, so the
+ * output of a file without includes lines up with its source.
+ */
+static void process_source(Preprocessor *pp, SourceFile *source) {
+    int depth = pp->conditional_depth;
+    pp->file_name = source->path;
+
+    const char *end = source->text + source->length;
+    // The first line we haven't expanded yet, or NULL.
+    const char *pending = NULL;
+    int pending_line = 0;
+
+    const char *line = source->text;
+    int line_number = 1;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline == NULL ? end : newline;
+
+        const char *p = line;
+        while (p < line_end && is_space(*p)) {
+            p++;
+        }
+
+        if (p < line_end && *p == '#') {
+            if (pending != NULL) {
+                pp->line = pending_line;
+                expand(pp, pending, line - pending, &pp->output);
+                pending = NULL;
+            }
+
+            pp->line = line_number;
+            Cursor cursor = {p + 1, line_end};
+            process_directive(pp, &cursor);
+            buffer_push(&pp->output, '\n');
+
+        } else if (!is_active(pp)) {
+            buffer_push(&pp->output, '\n');
+
+        } else if (pending == NULL) {
+            pending = line;
+            pending_line = line_number;
+        }
+
+        line = newline == NULL ? end : newline + 1;
+        line_number++;
+    }
+
+    if (pending != NULL) {
+        pp->line = pending_line;
+        expand(pp, pending, end - pending, &pp->output);
+        if (end[-1] != '\n') {
+            buffer_push(&pp->output, '\n');
+        }
+    }
+
+    if (pp->conditional_depth > depth) {
+        pp->line = pp->conditionals[depth].line;
+        preprocessor_error(pp, "unterminated #if");
+        pp->conditional_depth = depth;
+    }
+}
+
+Preprocessor *preprocessor_new(void) {
+    Preprocessor *pp = malloc(sizeof(Preprocessor));
+    pp->include_dirs = list_new();
+    pp->headers = list_new();
+
+    pp->macros = NULL;
+    pp->macros_capacity = 0;
+
+    pp->conditionals = NULL;
+    pp->conditional_depth = 0;
+    pp->conditional_capacity = 0;
+
+    pp->include_depth = 0;
+    pp->file_name = NULL;
+    pp->line = 0;
+    pp->failed = false;
+
+    pp->output = (Buffer){NULL, 0, 0};
+
+    return pp;
+}
+
+/* Search DIR for headers, after any directories added before it. */
+void preprocessor_add_include_dir(Preprocessor *pp, char *dir) {
+    list_append(pp->include_dirs, dir);
+}
+
+/* Preprocess the file FILE_NAME, returning text for the lexer.
+ * Files with no directives are returned as they are mapped, without
+ * being copied. Returns NULL if the file can't be read or has errors,
+ * which we've reported.
+ */
+SourceBuffer *preprocess(Preprocessor *pp, char *file_name) {
+    pp->failed = false;
+
+    SourceBuffer *raw = source_buffer_map(file_name);
+    if (raw == NULL) {
+        warn("%s", file_name);
+        return NULL;
+    }
+    if (!needs_preprocessing(raw->data, raw->length)) {
+        return raw;
+    }
+
+    SourceFile *source = clean_source(pp, file_name, raw);
+    source_buffer_free(raw);
+
+    buffer_reserve(&pp->output, source->length + SOURCE_BUFFER_PADDING);
+    process_source(pp, source);
+    source_file_free(source);
+    forget_macros(pp);
+
+    Buffer output = pp->output;
+    pp->output = (Buffer){NULL, 0, 0};
+
+    if (pp->failed) {
+        free(output.data);
+        return NULL;
+    }
+
+    buffer_reserve(&output, SOURCE_BUFFER_PADDING);
+    return source_buffer_from_heap(output.data, output.length);
+}
+
+void preprocessor_free(Preprocessor *pp) {
+    forget_macros(pp);
+    free(pp->macros);
+
+    for (int i = 0; i < list_length(pp->headers); i++) {
+        source_file_free(list_get(pp->headers, i));
+    }
+    list_free(pp->headers);
+    list_free(pp->include_dirs);
+
+    free(pp->conditionals);
+    free(pp->output.data);
+    free(pp);
+}
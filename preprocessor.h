@@ -0,0 +1,22 @@
+#ifndef MC_PREPROCESSOR_H
+#define MC_PREPROCESSOR_H
+
+#include "source_buffer.h"
+
+/* A C preprocessor that runs in-process, so we don't need to start
+ * gcc -E and go through a temporary file. It handles #include,
+ * object-like and function-like #define, #undef and conditional
+ * compilation with #if, #ifdef, #ifndef, #elif and #else.
+ *
+ * Macros are forgotten after each file, but the text of every header
+ * is read and cleaned once and then kept, so a header included by
+ * many files in one invocation only touches the disk once.
+ */
+typedef struct Preprocessor Preprocessor;
+
+Preprocessor *preprocessor_new(void);
+void preprocessor_add_include_dir(Preprocessor *pp, char *dir);
+SourceBuffer *preprocess(Preprocessor *pp, char *file_name);
+void preprocessor_free(Preprocessor *pp);
+
+#endif
@@ -0,0 +1,473 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "regalloc.h"
+#include "symbol_map.h"
+#include "syntax.h"
+
+// Registers we keep locals in. They must survive calls, so we only
+// use callee-saved registers.
+static const Register I386_LOCAL_REGISTERS[] = {EBX, ESI, EDI};
+static const Register X86_64_LOCAL_REGISTERS[] = {EBX, R12, R13, R14, R15};
+#define MAX_LOCAL_REGISTERS 5
+
+// A reference inside a loop counts this many times more than one
+// outside it, up to MAX_LOOP_WEIGHT.
+#define LOOP_WEIGHT_FACTOR 8
+#define MAX_LOOP_WEIGHT 512
+
+/* The name of the 32-bit view of REG. */
+char *register_name(Register reg) {
+    static char *names[] = {"%eax",  "%ecx",  "%edx",  "%ebx",  "%esi",
+                            "%edi",  "%r8d",  "%r9d",  "%r10d", "%r11d",
+                            "%r12d", "%r13d", "%r14d", "%r15d"};
+    assert(reg > NO_REGISTER && reg < NUM_REGISTERS);
+    return names[reg];
+}
+
+/* The name of the whole of REG, as pushed and popped on ARCH. */
+char *register_full_name(Register reg, TargetArch arch) {
+    static char *names[] = {"%rax", "%rcx", "%rdx", "%rbx", "%rsi",
+                            "%rdi", "%r8",  "%r9",  "%r10", "%r11",
+                            "%r12", "%r13", "%r14", "%r15"};
+    assert(reg > NO_REGISTER && reg < NUM_REGISTERS);
+    return arch == TARGET_X86_64 ? names[reg] : register_name(reg);
+}
+
+/* Return the name of the low byte of REG, or NULL if REG has no
+ * addressable low byte (%esi and %edi on i386).
+ */
+char *register_byte_name(Register reg, TargetArch arch) {
+    static char *names[] = {"%al",   "%cl",   "%dl",   "%bl",   "%sil",
+                            "%dil",  "%r8b",  "%r9b",  "%r10b", "%r11b",
+                            "%r12b", "%r13b", "%r14b", "%r15b"};
+    assert(reg > NO_REGISTER && reg < NUM_REGISTERS);
+    if (arch == TARGET_I386 && (reg == ESI || reg == EDI)) {
+        return NULL;
+    }
+    return names[reg];
+}
+
+bool register_exists(Register reg, TargetArch arch) {
+    return arch == TARGET_X86_64 || reg <= EDI;
+}
+
+/* Must a function preserve REG for its caller? This follows the
+ * System V ABI for each architecture.
+ */
+bool register_is_callee_saved(Register reg, TargetArch arch) {
+    if (arch == TARGET_X86_64) {
+        return reg == EBX || reg >= R12;
+    }
+    return reg >= EBX;
+}
+
+/* Can SYNTAX be used directly as the source operand of an
+ * instruction, without first loading it into a register?
+ */
+bool is_direct_operand(Syntax *syntax) {
+    return syntax->type == IMMEDIATE || syntax->type == VARIABLE;
+}
+
+/* The Sethi-Ullman number of the expression SYNTAX: how many
+ * registers we need to evaluate it without spilling.
+ */
+int register_need(Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return register_need(syntax->unary_expression->expression);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+        int left_need = register_need(binary_syntax->left);
+        int right_need = is_direct_operand(binary_syntax->right)
+                             ? 0
+                             : register_need(binary_syntax->right);
+
+        if (left_need == right_need) {
+            return left_need + 1;
+        }
+        return left_need > right_need ? left_need : right_need;
+
+    } else if (syntax->type == ASSIGNMENT) {
+        return register_need(syntax->assignment->expression);
+    }
+
+    // Leaves, and function calls which always return in %eax.
+    return 1;
+}
+
+/* The largest register need of any expression in the statement
+ * SYNTAX.
+ */
+static int statement_register_need(Syntax *syntax) {
+    int need = 0, statement_need;
+
+    if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            statement_need = statement_register_need(list_get(statements, i));
+            if (statement_need > need) {
+                need = statement_need;
+            }
+        }
+        return need;
+
+    } else if (syntax->type == IF_STATEMENT) {
+        need = register_need(syntax->if_statement->condition);
+        statement_need = statement_register_need(syntax->if_statement->then);
+        return statement_need > need ? statement_need : need;
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        need = register_need(syntax->while_statement->condition);
+        statement_need = statement_register_need(syntax->while_statement->body);
+        return statement_need > need ? statement_need : need;
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        return register_need(syntax->return_statement->expression);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        return register_need(syntax->define_var_statement->init_value);
+
+    } else if (syntax->type == FUNCTION) {
+        return statement_register_need(syntax->function->root_block);
+    }
+
+    return register_need(syntax);
+}
+
+typedef struct LoopRange {
+    int start;
+    int end;
+} LoopRange;
+
+typedef struct Numbering {
+    int position;
+    int weight;
+    List *intervals;
+    // The same intervals, by variable name.
+    SymbolMap *interval_index;
+    List *loops;
+} Numbering;
+
+/* Record a reference to VAR_NAME at the current position. We only
+ * track parameters and variables that are defined in this function.
+ * resolve_scopes has given every local a name of its own, so one
+ * interval per name is enough.
+ */
+static void touch_variable(Numbering *numbering, Symbol var_name,
+                           bool is_definition) {
+    LiveInterval *interval =
+        symbol_map_get(numbering->interval_index, var_name);
+    if (interval == NULL) {
+        if (!is_definition) {
+            return;
+        }
+
+        interval = malloc(sizeof(LiveInterval));
+        interval->var_name = var_name;
+        interval->start = numbering->position;
+        interval->weight = 0;
+        interval->reg = NO_REGISTER;
+        list_append(numbering->intervals, interval);
+        symbol_map_set(numbering->interval_index, var_name, interval);
+    }
+
+    interval->end = numbering->position;
+    interval->weight += numbering->weight;
+    numbering->position++;
+}
+
+static void number_syntax(Numbering *numbering, Syntax *syntax) {
+    if (syntax->type == VARIABLE) {
+        touch_variable(numbering, syntax->variable->var_name, false);
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        number_syntax(numbering, syntax->unary_expression->expression);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        number_syntax(numbering, syntax->binary_expression->left);
+        number_syntax(numbering, syntax->binary_expression->right);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        number_syntax(numbering, syntax->assignment->expression);
+        touch_variable(numbering, syntax->assignment->var_name, false);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = syntax->function_call->function_arguments
+                              ->function_arguments->arguments;
+        for (int i = 0; i < list_length(arguments); i++) {
+            number_syntax(numbering, list_get(arguments, i));
+        }
+
+    } else if (syntax->type == DEFINE_VAR) {
+        Symbol var_name = syntax->define_var_statement->var_name;
+        int start = numbering->position;
+        number_syntax(numbering, syntax->define_var_statement->init_value);
+        touch_variable(numbering, var_name, true);
+
+        // The initial value is evaluated straight into the variable's
+        // register, so it can't share one with a variable read there.
+        LiveInterval *interval =
+            symbol_map_get(numbering->interval_index, var_name);
+        if (interval->start > start) {
+            interval->start = start;
+        }
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        number_syntax(numbering, syntax->return_statement->expression);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        number_syntax(numbering, syntax->if_statement->condition);
+        number_syntax(numbering, syntax->if_statement->then);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        LoopRange *loop = malloc(sizeof(LoopRange));
+        loop->start = numbering->position;
+
+        int outer_weight = numbering->weight;
+        if (numbering->weight < MAX_LOOP_WEIGHT) {
+            numbering->weight *= LOOP_WEIGHT_FACTOR;
+        }
+
+        number_syntax(numbering, syntax->while_statement->condition);
+        number_syntax(numbering, syntax->while_statement->body);
+
+        numbering->weight = outer_weight;
+        loop->end = numbering->position;
+        list_append(numbering->loops, loop);
+
+    } else if (syntax->type == BLOCK) {
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            number_syntax(numbering, list_get(statements, i));
+        }
+    }
+}
+
+/* A variable that is live anywhere in a loop must stay live until
+ * the loop's back edge, so extend intervals to cover the whole
+ * loop. Extending for an outer loop may make an interval overlap
+ * another loop, so repeat until nothing changes.
+ */
+static void extend_over_loops(List *intervals, List *loops) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < list_length(loops); i++) {
+            LoopRange *loop = list_get(loops, i);
+
+            for (int j = 0; j < list_length(intervals); j++) {
+                LiveInterval *interval = list_get(intervals, j);
+                if (interval->start <= loop->end &&
+                    interval->end >= loop->start && interval->end < loop->end) {
+                    interval->end = loop->end;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static int compare_interval_start(const void *a, const void *b) {
+    const LiveInterval *left = *(LiveInterval *const *)a;
+    const LiveInterval *right = *(LiveInterval *const *)b;
+    return left->start - right->start;
+}
+
+/* Linear scan register allocation (Poletto and Sarkar), spilling
+ * the interval with the lowest weight when we run out.
+ */
+static void linear_scan(List *intervals, const Register *local_registers,
+                        int local_register_count) {
+    int count = list_length(intervals);
+    if (count == 0) {
+        return;
+    }
+
+    LiveInterval **sorted = malloc(count * sizeof(LiveInterval *));
+    for (int i = 0; i < count; i++) {
+        sorted[i] = list_get(intervals, i);
+    }
+    qsort(sorted, count, sizeof(LiveInterval *), compare_interval_start);
+
+    LiveInterval *active[MAX_LOCAL_REGISTERS];
+    int active_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        LiveInterval *current = sorted[i];
+
+        // Expire intervals that ended before this one started.
+        for (int j = 0; j < active_count;) {
+            if (active[j]->end < current->start) {
+                active[j] = active[--active_count];
+            } else {
+                j++;
+            }
+        }
+
+        if (active_count < local_register_count) {
+            // Take the first local register no active interval holds.
+            for (int r = 0; r < local_register_count; r++) {
+                bool taken = false;
+                for (int j = 0; j < active_count; j++) {
+                    if (active[j]->reg == local_registers[r]) {
+                        taken = true;
+                    }
+                }
+
+                if (!taken) {
+                    current->reg = local_registers[r];
+                    break;
+                }
+            }
+            active[active_count++] = current;
+            continue;
+        }
+
+        int coldest = 0;
+        for (int j = 1; j < active_count; j++) {
+            if (active[j]->weight < active[coldest]->weight) {
+                coldest = j;
+            }
+        }
+
+        if (active[coldest]->weight < current->weight) {
+            current->reg = active[coldest]->reg;
+            active[coldest]->reg = NO_REGISTER;
+            active[coldest] = current;
+        }
+    }
+
+    free(sorted);
+}
+
+RegAlloc *regalloc_new(Syntax *function, TargetArch arch) {
+    assert(function->type == FUNCTION);
+
+    RegAlloc *regalloc = malloc(sizeof(RegAlloc));
+    regalloc->arch = arch;
+    regalloc->intervals = list_new();
+    regalloc->interval_index = symbol_map_new();
+
+    Numbering numbering = {0, 1, regalloc->intervals, regalloc->interval_index,
+                           list_new()};
+    // Parameters are defined on entry.
+    List *parameters = function->function->parameters;
+    for (int i = 0; i < list_length(parameters); i++) {
+        Parameter *parameter = list_get(parameters, i);
+        touch_variable(&numbering, parameter->name, true);
+    }
+    number_syntax(&numbering, function->function->root_block);
+    extend_over_loops(regalloc->intervals, numbering.loops);
+
+    for (int i = 0; i < list_length(numbering.loops); i++) {
+        free(list_get(numbering.loops, i));
+    }
+    list_free(numbering.loops);
+
+    if (arch == TARGET_X86_64) {
+        linear_scan(regalloc->intervals, X86_64_LOCAL_REGISTERS,
+                    sizeof(X86_64_LOCAL_REGISTERS) / sizeof(Register));
+    } else {
+        linear_scan(regalloc->intervals, I386_LOCAL_REGISTERS,
+                    sizeof(I386_LOCAL_REGISTERS) / sizeof(Register));
+    }
+
+    bool local_register[NUM_REGISTERS] = {false};
+    for (int i = 0; i < list_length(regalloc->intervals); i++) {
+        LiveInterval *interval = list_get(regalloc->intervals, i);
+        if (interval->reg != NO_REGISTER) {
+            local_register[interval->reg] = true;
+        }
+    }
+
+    // Temporaries always get the caller-saved registers. We only
+    // take callee-saved registers that no local uses, and only as
+    // many as the hungriest expression needs.
+    int need = statement_register_need(function);
+    regalloc->temp_pool_size = 0;
+    regalloc->saved_count = 0;
+    for (Register reg = EAX; reg < NUM_REGISTERS; reg++) {
+        regalloc->busy[reg] = false;
+
+        if (register_exists(reg, arch) &&
+            !register_is_callee_saved(reg, arch)) {
+            regalloc->temp_pool[regalloc->temp_pool_size++] = reg;
+        }
+    }
+
+    for (Register reg = EAX; reg < NUM_REGISTERS; reg++) {
+        if (!register_exists(reg, arch) ||
+            !register_is_callee_saved(reg, arch)) {
+            continue;
+        }
+
+        if (local_register[reg]) {
+            regalloc->saved[regalloc->saved_count++] = reg;
+        } else if (regalloc->temp_pool_size < need) {
+            regalloc->temp_pool[regalloc->temp_pool_size++] = reg;
+            regalloc->saved[regalloc->saved_count++] = reg;
+        }
+    }
+
+    return regalloc;
+}
+
+void regalloc_free(RegAlloc *regalloc) {
+    if (regalloc != NULL) {
+        for (int i = 0; i < list_length(regalloc->intervals); i++) {
+            free(list_get(regalloc->intervals, i));
+        }
+        list_free(regalloc->intervals);
+        symbol_map_free(regalloc->interval_index);
+        free(regalloc);
+    }
+}
+
+/* Return the register holding local VAR_NAME, or NO_REGISTER if it
+ * lives on the stack.
+ */
+Register regalloc_local_register(RegAlloc *regalloc, Symbol var_name) {
+    LiveInterval *interval = symbol_map_get(regalloc->interval_index, var_name);
+    if (interval == NULL) {
+        return NO_REGISTER;
+    }
+    return interval->reg;
+}
+
+/* Reserve a free temporary register, or return NO_REGISTER if they
+ * are all in use and the caller must spill.
+ */
+Register regalloc_acquire(RegAlloc *regalloc) {
+    for (int i = 0; i < regalloc->temp_pool_size; i++) {
+        Register reg = regalloc->temp_pool[i];
+        if (!regalloc->busy[reg]) {
+            regalloc->busy[reg] = true;
+            return reg;
+        }
+    }
+    return NO_REGISTER;
+}
+
+/* As regalloc_acquire, but only return registers with an
+ * addressable low byte, as required by SETcc.
+ */
+Register regalloc_acquire_byte(RegAlloc *regalloc) {
+    for (int i = 0; i < regalloc->temp_pool_size; i++) {
+        Register reg = regalloc->temp_pool[i];
+        if (!regalloc->busy[reg] &&
+            register_byte_name(reg, regalloc->arch) != NULL) {
+            regalloc->busy[reg] = true;
+            return reg;
+        }
+    }
+    return NO_REGISTER;
+}
+
+void regalloc_release(RegAlloc *regalloc, Register reg) {
+    regalloc->busy[reg] = false;
+}
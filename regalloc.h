@@ -0,0 +1,86 @@
+#ifndef MC_REGALLOC_H
+#define MC_REGALLOC_H
+
+#include <stdbool.h>
+
+#include "intern.h"
+#include "list.h"
+#include "symbol_map.h"
+#include "syntax.h"
+#include "target.h"
+
+/* General purpose registers. We only compute on 32-bit values, so
+ * they're named after their 32-bit views. R8 to R15 only exist on
+ * x86-64.
+ */
+typedef enum {
+    NO_REGISTER = -1,
+    EAX,
+    ECX,
+    EDX,
+    EBX,
+    ESI,
+    EDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+    NUM_REGISTERS
+} Register;
+
+typedef struct LiveInterval {
+    Symbol var_name;
+    // Positions in the linear numbering of variable references in
+    // the function body, inclusive.
+    int start;
+    int end;
+    // Uses weighted by loop depth, so we keep hot locals in registers.
+    int weight;
+    Register reg;
+} LiveInterval;
+
+/******************************************************************************
+ *
+ * Register assignment for a single function: which locals live in
+ * registers (by linear scan over their live intervals), which
+ * registers may hold expression temporaries, and which of those
+ * temporaries are currently in use.
+ *
+ ******************************************************************************/
+typedef struct RegAlloc {
+    TargetArch arch;
+    List *intervals;
+    // The same intervals, by variable name.
+    SymbolMap *interval_index;
+
+    Register temp_pool[NUM_REGISTERS];
+    int temp_pool_size;
+
+    // Callee-saved registers we clobber, so must save in the prologue.
+    Register saved[NUM_REGISTERS];
+    int saved_count;
+
+    bool busy[NUM_REGISTERS];
+} RegAlloc;
+
+char *register_name(Register reg);
+char *register_full_name(Register reg, TargetArch arch);
+char *register_byte_name(Register reg, TargetArch arch);
+bool register_exists(Register reg, TargetArch arch);
+bool register_is_callee_saved(Register reg, TargetArch arch);
+
+bool is_direct_operand(Syntax *syntax);
+int register_need(Syntax *syntax);
+
+RegAlloc *regalloc_new(Syntax *function, TargetArch arch);
+void regalloc_free(RegAlloc *regalloc);
+Register regalloc_local_register(RegAlloc *regalloc, Symbol var_name);
+Register regalloc_acquire(RegAlloc *regalloc);
+Register regalloc_acquire_byte(RegAlloc *regalloc);
+void regalloc_release(RegAlloc *regalloc, Register reg);
+
+#endif
@@ -1,10 +1,79 @@
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// A test program that runs for longer than this is killed.
+#define RUN_TIMEOUT_SECONDS 10
+
+// How many of the slowest tests we list at the end.
+#define SLOWEST_TEST_COUNT 5
+
+// With --stress, one mc process compiles this many copies of every
+// test on this many threads.
+#define STRESS_COPIES 8
+#define STRESS_THREADS "-j16"
+
+typedef enum {
+    PHASE_COMPILE,
+    PHASE_ASSEMBLE,
+    PHASE_LINK,
+    PHASE_RUN,
+    PHASE_COUNT
+} Phase;
+
+static const char *PHASE_NAMES[PHASE_COUNT] = {"compile", "assemble", "link",
+                                               "run"};
+static const char *PHASE_FAILURES[PHASE_COUNT] = {"Compilation", "Assembling",
+                                                  "Linking", "Running"};
+
+typedef struct Test {
+    char *name;
+    int expected_return;
+    // The text of each `// warning: TEXT` line in the test, one per
+    // line, or NULL. Each must appear in what mc prints to stderr when
+    // it compiles the test on its own; --stress doesn't check them.
+    char *expected_warnings;
+    bool passed;
+    // Why the test failed, if it did.
+    char message[256];
+    double seconds[PHASE_COUNT];
+} Test;
+
+/******************************************************************************
+ *
+ * Everything the workers share. Workers take the next test under LOCK
+ * and otherwise only touch their own Test, so the results need no
+ * further locking.
+ *
+ ******************************************************************************/
+typedef struct TestRun {
+    Test *tests;
+    int test_count;
+    int next_test;
+    pthread_mutex_t lock;
+
+    // Absolute paths, since each test runs in its own directory.
+    char compiler[PATH_MAX];
+    char test_dir[PATH_MAX];
+    char **compiler_flags;
+    int flag_count;
+    bool emit_asm;
+    bool is_64_bit;
+    // Where --stress compiled every test to, or NULL if we compile
+    // each test on its own.
+    char *stress_dir;
+} TestRun;
 
 // A test src is simply one that contains two consecutive underscores.
 bool is_test_program(char *file_name) {
@@ -22,85 +91,538 @@ bool is_test_program(char *file_name) {
     return false;
 }
 
-int run_test(char *test_program_name) {
-    // We blindly assume that our test srcs never have a file name
-    // longer than 1024 bytes minus the name of the compiler executable.
-    char *command = malloc(1024);
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
 
-    // If it contains a 'retNUMBER' file name, extract it.
-    int expected_return = -1;
-    char *return_position = strstr(test_program_name, "ret");
-    if (return_position != NULL) {
-        return_position += strlen("ret");
+/* Run ARGV in DIRECTORY, discarding its stdout, and add the time it
+ * took to SECONDS. If ERROR_FILE isn't NULL, its stderr is written to
+ * that file in DIRECTORY. Returns the wait status, or -1 if we
+ * couldn't start it.
+ */
+static int run_command(char **argv, char *directory, char *error_file,
+                       double *seconds) {
+    double start = now();
 
-        expected_return = atoi(return_position);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        // Only async-signal-safe calls in here: we were forked from a
+        // multithreaded process.
+        int dev_null = open("/dev/null", O_WRONLY);
+        if (chdir(directory) != 0 || dev_null < 0) {
+            _exit(127);
+        }
+        dup2(dev_null, STDOUT_FILENO);
+        if (error_file != NULL) {
+            int errors = open(error_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (errors < 0) {
+                _exit(127);
+            }
+            dup2(errors, STDERR_FILENO);
+        }
+        alarm(RUN_TIMEOUT_SECONDS);
+        execvp(argv[0], argv);
+        _exit(127);
     }
 
-    snprintf(command, 1024, "./build/mc test_src/%s >/dev/null",
-             test_program_name);
-    int result = system(command);
-    free(command);
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+    }
+    *seconds += now() - start;
+    return status;
+}
 
-    if (result != 0) {
-        printf("[%s] Compilation failed!\n", test_program_name);
-        return result;
+/* Run one phase of TEST, recording a failure message if its command
+ * didn't exit successfully. ERROR_FILE is as for run_command.
+ */
+static bool run_phase(Test *test, Phase phase, char **argv, char *directory,
+                      char *error_file) {
+    int status =
+        run_command(argv, directory, error_file, &test->seconds[phase]);
+    if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return true;
     }
 
-    if ((result = system("as out.s -o out.o --32")) != 0) {
-        printf("[%s] Assembling failed!\n", test_program_name);
-        return result;
+    snprintf(test->message, sizeof(test->message), "[%s] %s failed!",
+             test->name, PHASE_FAILURES[phase]);
+    return false;
+}
+
+/* Check that TEST's program exited with the value it should have. */
+static bool check_exit_status(Test *test, int status) {
+    if (status == -1) {
+        snprintf(test->message, sizeof(test->message),
+                 "[%s] Could not run the program!", test->name);
+    } else if (WIFSIGNALED(status)) {
+        snprintf(test->message, sizeof(test->message),
+                 "[%s] Killed by signal %d!", test->name, WTERMSIG(status));
+    } else if (WEXITSTATUS(status) != test->expected_return) {
+        snprintf(test->message, sizeof(test->message),
+                 "[%s] Expected %d, but got %d!", test->name,
+                 test->expected_return, WEXITSTATUS(status));
+    } else {
+        return true;
     }
+    return false;
+}
 
-    if ((result = system("ld -m elf_i386 -s -o out out.o")) != 0) {
-        printf("[%s] Linking failed!\n", test_program_name);
-        return result;
+/* Check that the stderr mc wrote to DIRECTORY/warnings has every
+ * warning TEST expects.
+ */
+static bool check_warnings(Test *test, char *directory) {
+    if (test->expected_warnings == NULL) {
+        return true;
     }
 
-    result = WEXITSTATUS(system("./out"));
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/warnings", directory);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        snprintf(test->message, sizeof(test->message),
+                 "[%s] Could not read the warnings!", test->name);
+        return false;
+    }
 
-    system("rm out.s out.o out");
+    char *warnings = NULL;
+    size_t length = 0;
+    FILE *buffer = open_memstream(&warnings, &length);
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        fputc(c, buffer);
+    }
+    fclose(buffer);
+    fclose(file);
 
-    if (result != expected_return) {
-        printf("[%s] Expected %d, but got %d!\n", test_program_name,
-               expected_return, result);
-        return 1;
-    } else {
-        return 0;
+    bool found_all = true;
+    char *expected = test->expected_warnings;
+    while (*expected != '\0') {
+        char *end = strchr(expected, '\n');
+        *end = '\0';
+        bool found = strstr(warnings, expected) != NULL;
+        if (!found && found_all) {
+            snprintf(test->message, sizeof(test->message),
+                     "[%s] Expected the warning \"%s\"!", test->name,
+                     expected);
+            found_all = false;
+        }
+        *end = '\n';
+        expected = end + 1;
     }
+
+    free(warnings);
+    return found_all;
 }
 
-int main() {
-    DIR *test_dir = opendir("test_src");
+/* The path of copy COPY of TEST in the --stress directory: its source
+ * if EXTENSION is ".c", or the program compiled from it if "".
+ */
+static void stress_path(char *path, size_t size, TestRun *run, Test *test,
+                        int copy, char *extension) {
+    int base_length = strlen(test->name) - strlen(".c");
+    snprintf(path, size, "%s/%s/c%d_%.*s%s", run->stress_dir,
+             extension[0] == '\0' ? "out" : "src", copy, base_length,
+             test->name, extension);
+}
+
+/* Compile STRESS_COPIES copies of every test with a single mc, so
+ * that it parses and compiles many files on different threads at
+ * once. The copies are symlinks to the tests, with distinct names.
+ */
+static bool compile_stress_copies(TestRun *run, double *seconds) {
+    char path[2 * PATH_MAX];
+    snprintf(path, sizeof(path), "%s/src", run->stress_dir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/out", run->stress_dir);
+    mkdir(path, 0777);
+
+    snprintf(path, sizeof(path), "%s/inputs", run->stress_dir);
+    FILE *inputs = fopen(path, "w");
+    if (inputs == NULL) {
+        return false;
+    }
+    for (int i = 0; i < run->test_count; i++) {
+        char source[2 * PATH_MAX];
+        snprintf(source, sizeof(source), "%s/%s", run->test_dir,
+                 run->tests[i].name);
+        for (int copy = 0; copy < STRESS_COPIES; copy++) {
+            stress_path(path, sizeof(path), run, &run->tests[i], copy, ".c");
+            symlink(source, path);
+            fprintf(inputs, "%s\n", path);
+        }
+    }
+    fclose(inputs);
+
+    // Quoted includes are found through -I, since the copies aren't
+    // next to the headers.
+    char *compile[64];
+    int arg_count = 0;
+    compile[arg_count++] = run->compiler;
+    for (int i = 0; i < run->flag_count && arg_count < 56; i++) {
+        compile[arg_count++] = run->compiler_flags[i];
+    }
+    compile[arg_count++] = STRESS_THREADS;
+    compile[arg_count++] = "-I";
+    compile[arg_count++] = run->test_dir;
+    compile[arg_count++] = "-o";
+    compile[arg_count++] = "out";
+    compile[arg_count++] = "@inputs";
+    compile[arg_count] = NULL;
+
+    int status = run_command(compile, run->stress_dir, NULL, seconds);
+    return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void remove_stress_copies(TestRun *run) {
+    char path[2 * PATH_MAX];
+    for (int i = 0; i < run->test_count; i++) {
+        for (int copy = 0; copy < STRESS_COPIES; copy++) {
+            stress_path(path, sizeof(path), run, &run->tests[i], copy, ".c");
+            unlink(path);
+            stress_path(path, sizeof(path), run, &run->tests[i], copy, "");
+            unlink(path);
+        }
+    }
+
+    const char *entries[] = {"inputs", "src", "out"};
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", run->stress_dir, entries[i]);
+        remove(path);
+    }
+    rmdir(run->stress_dir);
+}
+
+/* Run every copy of TEST that --stress compiled. */
+static void run_stress_test(TestRun *run, Test *test) {
+    for (int copy = 0; copy < STRESS_COPIES; copy++) {
+        char path[2 * PATH_MAX];
+        stress_path(path, sizeof(path), run, test, copy, "");
+        char *program[] = {path, NULL};
+
+        int status = run_command(program, run->stress_dir, NULL,
+                                 &test->seconds[PHASE_RUN]);
+        if (!check_exit_status(test, status)) {
+            return;
+        }
+    }
+    test->passed = true;
+}
+
+static void run_test(TestRun *run, Test *test) {
+    char directory[] = "/tmp/mc-test-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        snprintf(test->message, sizeof(test->message),
+                 "[%s] Could not create a temporary directory!", test->name);
+        return;
+    }
+
+    char source[2 * PATH_MAX];
+    snprintf(source, sizeof(source), "%s/%s", run->test_dir, test->name);
+
+    // The compiler writes ./out itself, unless we asked for assembly
+    // to check it against the GNU toolchain.
+    char *compile[64];
+    int arg_count = 0;
+    compile[arg_count++] = run->compiler;
+    for (int i = 0; i < run->flag_count && arg_count < 60; i++) {
+        compile[arg_count++] = run->compiler_flags[i];
+    }
+    compile[arg_count++] = "-o";
+    compile[arg_count++] = run->emit_asm ? "out.s" : "out";
+    compile[arg_count++] = source;
+    compile[arg_count] = NULL;
+
+    char *assemble[] = {"as", "out.s", "-o", "out.o",
+                        run->is_64_bit ? "--64" : "--32", NULL};
+    char *link[] = {"ld", "-m", run->is_64_bit ? "elf_x86_64" : "elf_i386",
+                    "-s", "-o", "out", "out.o", NULL};
+    char *program[] = {"./out", NULL};
+
+    char *error_file = test->expected_warnings != NULL ? "warnings" : NULL;
+    if (!run_phase(test, PHASE_COMPILE, compile, directory, error_file) ||
+        !check_warnings(test, directory)) {
+        goto cleanup;
+    }
+    if (run->emit_asm &&
+        (!run_phase(test, PHASE_ASSEMBLE, assemble, directory, NULL) ||
+         !run_phase(test, PHASE_LINK, link, directory, NULL))) {
+        goto cleanup;
+    }
+
+    int status =
+        run_command(program, directory, NULL, &test->seconds[PHASE_RUN]);
+    test->passed = check_exit_status(test, status);
+
+cleanup:;
+    const char *outputs[] = {"out.s", "out.o", "out", "warnings"};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", directory, outputs[i]);
+        unlink(path);
+    }
+    rmdir(directory);
+}
+
+static void *worker(void *argument) {
+    TestRun *run = argument;
+
+    while (true) {
+        pthread_mutex_lock(&run->lock);
+        int index = run->next_test++;
+        pthread_mutex_unlock(&run->lock);
+
+        if (index >= run->test_count) {
+            return NULL;
+        }
+
+        Test *test = &run->tests[index];
+        if (run->stress_dir != NULL) {
+            run_stress_test(run, test);
+        } else {
+            run_test(run, test);
+        }
+
+        // Progress, as tests finish.
+        putchar(test->passed ? '.' : 'F');
+        fflush(stdout);
+    }
+}
+
+static int compare_names(const void *left, const void *right) {
+    return strcmp(((const Test *)left)->name, ((const Test *)right)->name);
+}
+
+static double total_seconds(const Test *test) {
+    double total = 0;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        total += test->seconds[phase];
+    }
+    return total;
+}
+
+static int compare_slowest(const void *left, const void *right) {
+    double difference = total_seconds(*(Test *const *)right) -
+                        total_seconds(*(Test *const *)left);
+    return (difference > 0) - (difference < 0);
+}
+
+static void print_times(Test *test) {
+    printf("  %-28s %8.2fms", test->name, total_seconds(test) * 1000);
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (test->seconds[phase] > 0) {
+            printf("  %s %.2fms", PHASE_NAMES[phase],
+                   test->seconds[phase] * 1000);
+        }
+    }
+    printf("\n");
+}
+
+/* Read the `// warning: TEXT` lines of the test source at PATH, as
+ * Test.expected_warnings.
+ */
+static char *read_expected_warnings(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
 
+    const char *prefix = "// warning: ";
+    char *warnings = NULL;
+    size_t length = 0;
+    FILE *buffer = open_memstream(&warnings, &length);
+
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, file) != -1) {
+        char *text = line;
+        while (*text == ' ') {
+            text++;
+        }
+        if (strncmp(text, prefix, strlen(prefix)) == 0) {
+            text += strlen(prefix);
+            text[strcspn(text, "\r\n")] = '\0';
+            fprintf(buffer, "%s\n", text);
+        }
+    }
+    free(line);
+    fclose(file);
+    fclose(buffer);
+
+    if (length == 0) {
+        free(warnings);
+        return NULL;
+    }
+    return warnings;
+}
+
+/* Collect the test programs in test_src, sorted by name so that the
+ * report doesn't depend on directory order.
+ */
+static bool find_tests(TestRun *run) {
+    DIR *test_dir = opendir("test_src");
     if (test_dir == NULL) {
-        printf("Could not open test_src directory!");
-        exit(1);
+        return false;
     }
 
-    int tests_run = 0, tests_passed = 0;
+    int capacity = 64;
+    run->tests = calloc(capacity, sizeof(Test));
 
     struct dirent *file;
-    char *file_name;
-    int test_result;
     while ((file = readdir(test_dir)) != NULL) {
-        file_name = file->d_name;
+        if (!is_test_program(file->d_name)) {
+            continue;
+        }
+        if (run->test_count == capacity) {
+            capacity *= 2;
+            run->tests = realloc(run->tests, capacity * sizeof(Test));
+        }
+
+        Test *test = &run->tests[run->test_count++];
+        memset(test, 0, sizeof(Test));
+        test->name = strdup(file->d_name);
+
+        // If it contains a '__retNUMBER' file name, extract it.
+        test->expected_return = -1;
+        char *return_position = strstr(test->name, "__ret");
+        if (return_position != NULL) {
+            test->expected_return = atoi(return_position + strlen("__ret"));
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "test_src/%s", test->name);
+        test->expected_warnings = read_expected_warnings(path);
+    }
+    closedir(test_dir);
 
-        if (is_test_program(file_name)) {
-            test_result = run_test(file_name);
+    qsort(run->tests, run->test_count, sizeof(Test), compare_names);
+    return true;
+}
 
-            tests_run++;
-            if (test_result == 0) {
-                printf(".");
-                tests_passed++;
-            } else {
-                printf("F");
+int main(int argc, char *argv[]) {
+    TestRun run = {0};
+    pthread_mutex_init(&run.lock, NULL);
+
+    // -jN sets the number of workers (a bare -j, as `make test -j`
+    // passes, means one per CPU), --times prints the time of every
+    // test and --stress compiles them all in one mc. Any other
+    // arguments are passed on to the compiler, e.g. -O1.
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool print_all_times = false;
+    bool stress = false;
+    run.compiler_flags = malloc(argc * sizeof(char *));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            jobs = atol(argv[i] + 2);
+        } else if (strcmp(argv[i], "--times") == 0) {
+            print_all_times = true;
+        } else if (strcmp(argv[i], "--stress") == 0) {
+            stress = true;
+        } else {
+            run.compiler_flags[run.flag_count++] = argv[i];
+            if (strcmp(argv[i], "--emit=asm") == 0) {
+                run.emit_asm = true;
+            } else if (strcmp(argv[i], "--target=x86_64") == 0) {
+                run.is_64_bit = true;
             }
         }
     }
-    printf("\n\n%d tests run, %d passed, %d failed.\n", tests_run, tests_passed,
-           tests_run - tests_passed);
+    if (jobs < 1) {
+        jobs = 1;
+    }
 
-    closedir(test_dir);
+    if (realpath("build/mc", run.compiler) == NULL ||
+        realpath("test_src", run.test_dir) == NULL || !find_tests(&run)) {
+        printf("Could not find build/mc and the test_src directory!\n");
+        exit(1);
+    }
+
+    if (jobs > run.test_count) {
+        jobs = run.test_count > 0 ? run.test_count : 1;
+    }
+
+    double start = now();
+
+    char stress_dir[] = "/tmp/mc-stress-XXXXXX";
+    if (stress) {
+        if (run.emit_asm) {
+            printf("--stress can't be used with --emit=asm!\n");
+            exit(1);
+        }
+        if (mkdtemp(stress_dir) == NULL) {
+            printf("Could not create a temporary directory!\n");
+            exit(1);
+        }
+        run.stress_dir = stress_dir;
+
+        double seconds = 0;
+        bool compiled = compile_stress_copies(&run, &seconds);
+        printf("Compiled %d files in one process in %.2fs.\n",
+               run.test_count * STRESS_COPIES, seconds);
+        if (!compiled) {
+            printf("Compilation failed!\n");
+            remove_stress_copies(&run);
+            exit(1);
+        }
+    }
+
+    pthread_t *workers = malloc(jobs * sizeof(pthread_t));
+    for (long i = 0; i < jobs; i++) {
+        pthread_create(&workers[i], NULL, worker, &run);
+    }
+    for (long i = 0; i < jobs; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double elapsed = now() - start;
+    if (stress) {
+        remove_stress_copies(&run);
+    }
+
+    printf("\n");
+    int tests_passed = 0;
+    for (int i = 0; i < run.test_count; i++) {
+        if (run.tests[i].passed) {
+            tests_passed++;
+        } else {
+            printf("%s\n", run.tests[i].message);
+        }
+    }
+
+    if (print_all_times) {
+        printf("\nTimes:\n");
+        for (int i = 0; i < run.test_count; i++) {
+            print_times(&run.tests[i]);
+        }
+    }
+
+    Test **slowest = malloc(run.test_count * sizeof(Test *));
+    for (int i = 0; i < run.test_count; i++) {
+        slowest[i] = &run.tests[i];
+    }
+    qsort(slowest, run.test_count, sizeof(Test *), compare_slowest);
+    printf("\nSlowest tests:\n");
+    for (int i = 0; i < run.test_count && i < SLOWEST_TEST_COUNT; i++) {
+        print_times(slowest[i]);
+    }
+
+    printf("\n%d tests run, %d passed, %d failed in %.2fs with -j%ld.\n",
+           run.test_count, tests_passed, run.test_count - tests_passed,
+           elapsed, jobs);
+
+    for (int i = 0; i < run.test_count; i++) {
+        free(run.tests[i].name);
+        free(run.tests[i].expected_warnings);
+    }
+    free(slowest);
+    free(workers);
+    free(run.tests);
+    free(run.compiler_flags);
+    pthread_mutex_destroy(&run.lock);
 
-    return tests_run - tests_passed;
+    return run.test_count - tests_passed;
 }
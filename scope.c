@@ -0,0 +1,178 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "intern.h"
+#include "list.h"
+#include "scope.h"
+#include "symbol_map.h"
+#include "syntax.h"
+#include "timing.h"
+
+/* A local in scope, and the name we gave it. */
+typedef struct ScopedName {
+    Symbol original;
+    Symbol renamed;
+    // The binding of ORIGINAL that this one hides, or NULL.
+    struct ScopedName *shadowed;
+    // Where this binding is in ScopeResolver.in_scope.
+    int index;
+} ScopedName;
+
+/******************************************************************************
+ *
+ * The register allocator, the SSA builder and the -O1 passes identify
+ * locals by name, so a variable defined in a block that hides one
+ * outside it would be mistaken for its namesake. We give every
+ * definition that hides a visible variable a name of its own, and
+ * rewrite the references in its scope to match, so names are unique
+ * wherever two variables are live at once.
+ *
+ ******************************************************************************/
+typedef struct ScopeResolver {
+    // The innermost binding of each name, as ScopedName*.
+    SymbolMap *bindings;
+    // Every binding in scope, innermost last, so closing a scope can
+    // restore the ones it hid.
+    List *in_scope;
+    // Where the innermost scope starts in IN_SCOPE.
+    int scope_start;
+    // Numbers the names we introduce, so they're unique.
+    int renamed_count;
+} ScopeResolver;
+
+static Symbol resolve_name(ScopeResolver *resolver, Symbol name) {
+    ScopedName *binding = symbol_map_get(resolver->bindings, name);
+    return binding == NULL ? name : binding->renamed;
+}
+
+/* Bring a local called NAME into scope, and return the name it
+ * should have.
+ */
+static Symbol define_name(ScopeResolver *resolver, Symbol name) {
+    ScopedName *binding = malloc(sizeof(ScopedName));
+    binding->original = name;
+    binding->renamed = name;
+    binding->shadowed = symbol_map_get(resolver->bindings, name);
+    binding->index = list_length(resolver->in_scope);
+
+    if (binding->shadowed != NULL) {
+        // The same warnings as Environment gives at -O0.
+        if (binding->shadowed->index >= resolver->scope_start) {
+            warnx("Redefinition of '%s'", symbol_name(name));
+        } else {
+            warnx("Definition of '%s' shadows a variable in an outer scope",
+                  symbol_name(name));
+        }
+
+        // A '.' can't occur in a C identifier, so this can't clash with
+        // a name in the program. The inliner and the loop optimizer add
+        // dotted names too, but they end in ".inlineN" and ".loopN".
+        char *original = symbol_name(name);
+        int length = snprintf(NULL, 0, "%s.shadow%d", original,
+                              resolver->renamed_count);
+        char *buffer = malloc(length + 1);
+        snprintf(buffer, length + 1, "%s.shadow%d", original,
+                 resolver->renamed_count);
+        binding->renamed = intern_string(buffer);
+        free(buffer);
+        resolver->renamed_count++;
+    }
+
+    symbol_map_set(resolver->bindings, name, binding);
+    list_append(resolver->in_scope, binding);
+    return binding->renamed;
+}
+
+/* Forget every binding made since IN_SCOPE had length START. */
+static void close_scope(ScopeResolver *resolver, int start) {
+    while (list_length(resolver->in_scope) > start) {
+        ScopedName *binding = list_pop(resolver->in_scope);
+        symbol_map_set(resolver->bindings, binding->original,
+                       binding->shadowed);
+        free(binding);
+    }
+}
+
+static void resolve_syntax(ScopeResolver *resolver, Syntax *syntax) {
+    if (syntax->type == VARIABLE) {
+        syntax->variable->var_name =
+            resolve_name(resolver, syntax->variable->var_name);
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        resolve_syntax(resolver, syntax->unary_expression->expression);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        resolve_syntax(resolver, syntax->binary_expression->left);
+        resolve_syntax(resolver, syntax->binary_expression->right);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        resolve_syntax(resolver, syntax->assignment->expression);
+        syntax->assignment->var_name =
+            resolve_name(resolver, syntax->assignment->var_name);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments = syntax->function_call->function_arguments
+                              ->function_arguments->arguments;
+        for (int i = 0; i < list_length(arguments); i++) {
+            resolve_syntax(resolver, list_get(arguments, i));
+        }
+
+    } else if (syntax->type == DEFINE_VAR) {
+        // The initial value still sees any variable we're hiding.
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+        resolve_syntax(resolver, define_var_statement->init_value);
+        define_var_statement->var_name =
+            define_name(resolver, define_var_statement->var_name);
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        resolve_syntax(resolver, syntax->return_statement->expression);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        resolve_syntax(resolver, syntax->if_statement->condition);
+        resolve_syntax(resolver, syntax->if_statement->then);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        resolve_syntax(resolver, syntax->while_statement->condition);
+        resolve_syntax(resolver, syntax->while_statement->body);
+
+    } else if (syntax->type == BLOCK) {
+        int outer_start = resolver->scope_start;
+        resolver->scope_start = list_length(resolver->in_scope);
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            resolve_syntax(resolver, list_get(statements, i));
+        }
+        close_scope(resolver, resolver->scope_start);
+        resolver->scope_start = outer_start;
+
+    } else if (syntax->type == FUNCTION) {
+        List *parameters = syntax->function->parameters;
+        for (int i = 0; i < list_length(parameters); i++) {
+            Parameter *parameter = list_get(parameters, i);
+            parameter->name = define_name(resolver, parameter->name);
+        }
+        resolve_syntax(resolver, syntax->function->root_block);
+        close_scope(resolver, 0);
+
+    } else if (syntax->type == TOP_LEVEL) {
+        List *declarations = syntax->top_level->declarations;
+        for (int i = 0; i < list_length(declarations); i++) {
+            resolve_syntax(resolver, list_get(declarations, i));
+        }
+    }
+}
+
+/* Rename the locals in SYNTAX that hide a variable of an outer scope
+ * (or redefine one in their own), so each has a unique name while
+ * it's in scope.
+ */
+Syntax *resolve_scopes(Syntax *syntax) {
+    ScopeResolver resolver = {symbol_map_new(), list_new(), 0, 0};
+    resolve_syntax(&resolver, syntax);
+
+    timing_count("renamed locals", resolver.renamed_count);
+    symbol_map_free(resolver.bindings);
+    list_free(resolver.in_scope);
+    return syntax;
+}
@@ -0,0 +1,8 @@
+#ifndef MC_SCOPE_H
+#define MC_SCOPE_H
+
+#include "syntax.h"
+
+Syntax *resolve_scopes(Syntax *syntax);
+
+#endif
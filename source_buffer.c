@@ -0,0 +1,110 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source_buffer.h"
+
+#define READ_CHUNK_SIZE 4096
+
+/* Read everything from FD onto the heap, for files we can't map such
+ * as pipes.
+ */
+static SourceBuffer *read_source(int fd) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t length = 0;
+    char *data = malloc(capacity);
+
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, data + length,
+                              capacity - length - SOURCE_BUFFER_PADDING)) > 0) {
+        length += bytes_read;
+        if (capacity - length - SOURCE_BUFFER_PADDING == 0) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+
+    if (bytes_read < 0) {
+        free(data);
+        return NULL;
+    }
+    return source_buffer_from_heap(data, length);
+}
+
+/* Map the file at PATH for reading. The mapping is private and
+ * writable because flex briefly writes a NUL after each token; only
+ * the pages it touches are copied. Returns NULL and sets errno if the
+ * file can't be read.
+ */
+SourceBuffer *source_buffer_map(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(file_stat.st_mode)) {
+        SourceBuffer *buffer = read_source(fd);
+        close(fd);
+        return buffer;
+    }
+
+    size_t length = file_stat.st_size;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_length =
+        (length + SOURCE_BUFFER_PADDING + page_size - 1) / page_size *
+        page_size;
+
+    // Reserve zeroed pages for the text and its padding, then map the
+    // file over the start. The rest of the file's last page reads as
+    // zero too, so the padding is there however long the file is.
+    char *data = mmap(NULL, mapped_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (length > 0 && mmap(data, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, mapped_length);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    SourceBuffer *buffer = malloc(sizeof(SourceBuffer));
+    buffer->data = data;
+    buffer->length = length;
+    buffer->mapped_length = mapped_length;
+    return buffer;
+}
+
+/* Wrap the LENGTH bytes of text at DATA, which must have room for
+ * the padding after them. The SourceBuffer takes ownership of DATA.
+ */
+SourceBuffer *source_buffer_from_heap(char *data, size_t length) {
+    for (int i = 0; i < SOURCE_BUFFER_PADDING; i++) {
+        data[length + i] = '\0';
+    }
+
+    SourceBuffer *buffer = malloc(sizeof(SourceBuffer));
+    buffer->data = data;
+    buffer->length = length;
+    buffer->mapped_length = 0;
+    return buffer;
+}
+
+void source_buffer_free(SourceBuffer *buffer) {
+    if (buffer->mapped_length > 0) {
+        munmap(buffer->data, buffer->mapped_length);
+    } else {
+        free(buffer->data);
+    }
+    free(buffer);
+}
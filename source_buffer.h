@@ -0,0 +1,25 @@
+#ifndef MC_SOURCE_BUFFER_H
+#define MC_SOURCE_BUFFER_H
+
+#include <stddef.h>
+
+// flex scans a buffer in place if it ends with two NUL bytes.
+#define SOURCE_BUFFER_PADDING 2
+
+/* Source text ready for the lexer: LENGTH bytes at DATA, followed by
+ * SOURCE_BUFFER_PADDING NUL bytes. The text is either a private
+ * memory mapping of a file, so reading it copies nothing, or a heap
+ * buffer that we generated.
+ */
+typedef struct SourceBuffer {
+    char *data;
+    size_t length;
+    // The bytes mapped at DATA, or 0 if DATA is on the heap.
+    size_t mapped_length;
+} SourceBuffer;
+
+SourceBuffer *source_buffer_map(char *path);
+SourceBuffer *source_buffer_from_heap(char *data, size_t length);
+void source_buffer_free(SourceBuffer *buffer);
+
+#endif
@@ -5,9 +5,13 @@
 
 typedef struct Stack {
     int size;
+    // The number of items there's room for before we must grow.
+    int capacity;
     void **content;
 } Stack;
 
+#define INITIAL_STACK_SIZE 32
+
 Stack *stack_new();
 
 void stack_free(Stack *stack);
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "symbol_map.h"
+
+#define INITIAL_SYMBOL_MAP_SIZE 16
+
+static SymbolMapEntry *new_entries(size_t capacity) {
+    SymbolMapEntry *entries = malloc(capacity * sizeof(SymbolMapEntry));
+    for (size_t i = 0; i < capacity; i++) {
+        entries[i].key = NO_SYMBOL;
+        entries[i].value = NULL;
+    }
+    return entries;
+}
+
+SymbolMap *symbol_map_new(void) {
+    SymbolMap *map = malloc(sizeof(SymbolMap));
+    map->capacity = INITIAL_SYMBOL_MAP_SIZE;
+    map->size = 0;
+    map->entries = new_entries(map->capacity);
+    return map;
+}
+
+/* Return the index of the entry for KEY: the entry holding it, or
+ * the empty entry where it belongs. Symbols are dense small integers,
+ * so we scramble them with a Fibonacci hash, as Environment does.
+ */
+static size_t find_entry(SymbolMapEntry *entries, size_t capacity,
+                         Symbol key) {
+    size_t index = ((uint32_t)(key * 2654435769u) >> 8) & (capacity - 1);
+    while (entries[index].key != NO_SYMBOL && entries[index].key != key) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+/* Return the value for KEY, or NULL if it has none. */
+void *symbol_map_get(SymbolMap *map, Symbol key) {
+    return map->entries[find_entry(map->entries, map->capacity, key)].value;
+}
+
+void symbol_map_set(SymbolMap *map, Symbol key, void *value) {
+    // Keep the table at most half full, so probe sequences stay short.
+    if ((map->size + 1) * 2 > map->capacity) {
+        size_t capacity = map->capacity * 2;
+        SymbolMapEntry *entries = new_entries(capacity);
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (map->entries[i].key != NO_SYMBOL) {
+                entries[find_entry(entries, capacity, map->entries[i].key)] =
+                    map->entries[i];
+            }
+        }
+
+        free(map->entries);
+        map->entries = entries;
+        map->capacity = capacity;
+    }
+
+    SymbolMapEntry *entry =
+        &map->entries[find_entry(map->entries, map->capacity, key)];
+    if (entry->key == NO_SYMBOL) {
+        entry->key = key;
+        map->size++;
+    }
+    entry->value = value;
+}
+
+void symbol_map_free(SymbolMap *map) {
+    if (map != NULL) {
+        free(map->entries);
+        free(map);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef MC_SYMBOL_MAP_H
+#define MC_SYMBOL_MAP_H
+
+#include <stddef.h>
+
+#include "intern.h"
+
+typedef struct SymbolMapEntry {
+    // NO_SYMBOL if the entry is empty.
+    Symbol key;
+    void *value;
+} SymbolMapEntry;
+
+/******************************************************************************
+ *
+ * A map from symbols to pointers, for passes that look up every
+ * local of a function by name. An open addressing hash table, like
+ * Environment but without scopes.
+ *
+ ******************************************************************************/
+typedef struct SymbolMap {
+    SymbolMapEntry *entries;
+    // Always a power of two.
+    size_t capacity;
+    size_t size;
+} SymbolMap;
+
+SymbolMap *symbol_map_new(void);
+void *symbol_map_get(SymbolMap *map, Symbol key);
+void symbol_map_set(SymbolMap *map, Symbol key, void *value);
+void symbol_map_free(SymbolMap *map);
+
+#endif
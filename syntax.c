@@ -2,25 +2,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "flat_syntax.h"
 #include "list.h"
 #include "syntax.h"
 
+// When set, syntax nodes and their lists are allocated here, and the
+// whole tree is released with arena_free instead of syntax_free. Each
+// thread compiling a file has its own.
+__thread Arena *syntax_arena = NULL;
+
+static void *syntax_alloc(size_t size) {
+    if (syntax_arena != NULL) {
+        return arena_alloc(syntax_arena, size);
+    }
+    return malloc(size);
+}
+
+List *syntax_list_new(void) {
+    if (syntax_arena != NULL) {
+        return list_new_in(syntax_arena);
+    }
+    return list_new();
+}
+
 Syntax *immediate_new(int value) {
-    Immediate *immediate = malloc(sizeof(Immediate));
+    Immediate *immediate = syntax_alloc(sizeof(Immediate));
     immediate->value = value;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = IMMEDIATE;
     syntax->immediate = immediate;
 
     return syntax;
 }
 
-Syntax *variable_new(char *var_name) {
-    Variable *variable = malloc(sizeof(Variable));
+Syntax *variable_new(Symbol var_name) {
+    Variable *variable = syntax_alloc(sizeof(Variable));
     variable->var_name = var_name;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = VARIABLE;
     syntax->variable = variable;
 
@@ -28,11 +49,11 @@ Syntax *variable_new(char *var_name) {
 }
 
 Syntax *bitwise_negation_new(Syntax *expression) {
-    UnaryExpression *unary_syntax = malloc(sizeof(UnaryExpression));
+    UnaryExpression *unary_syntax = syntax_alloc(sizeof(UnaryExpression));
     unary_syntax->unary_type = BITWISE_NEGATION;
     unary_syntax->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = UNARY_OPERATOR;
     syntax->unary_expression = unary_syntax;
 
@@ -40,11 +61,11 @@ Syntax *bitwise_negation_new(Syntax *expression) {
 }
 
 Syntax *logical_negation_new(Syntax *expression) {
-    UnaryExpression *unary_syntax = malloc(sizeof(UnaryExpression));
+    UnaryExpression *unary_syntax = syntax_alloc(sizeof(UnaryExpression));
     unary_syntax->unary_type = LOGICAL_NEGATION;
     unary_syntax->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = UNARY_OPERATOR;
     syntax->unary_expression = unary_syntax;
 
@@ -52,12 +73,12 @@ Syntax *logical_negation_new(Syntax *expression) {
 }
 
 Syntax *addition_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+    BinaryExpression *binary_syntax = syntax_alloc(sizeof(BinaryExpression));
     binary_syntax->binary_type = ADDITION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
@@ -65,12 +86,12 @@ Syntax *addition_new(Syntax *left, Syntax *right) {
 }
 
 Syntax *subtraction_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+    BinaryExpression *binary_syntax = syntax_alloc(sizeof(BinaryExpression));
     binary_syntax->binary_type = SUBTRACTION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
@@ -78,12 +99,12 @@ Syntax *subtraction_new(Syntax *left, Syntax *right) {
 }
 
 Syntax *multiplication_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+    BinaryExpression *binary_syntax = syntax_alloc(sizeof(BinaryExpression));
     binary_syntax->binary_type = MULTIPLICATION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
@@ -91,12 +112,12 @@ Syntax *multiplication_new(Syntax *left, Syntax *right) {
 }
 
 Syntax *less_than_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+    BinaryExpression *binary_syntax = syntax_alloc(sizeof(BinaryExpression));
     binary_syntax->binary_type = LESS_THAN;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
@@ -104,24 +125,24 @@ Syntax *less_than_new(Syntax *left, Syntax *right) {
 }
 
 Syntax *less_or_equal_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+    BinaryExpression *binary_syntax = syntax_alloc(sizeof(BinaryExpression));
     binary_syntax->binary_type = LESS_THAN_OR_EQUAL;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *function_call_new(char *function_name, Syntax *func_args) {
-    FunctionCall *function_call = malloc(sizeof(FunctionCall));
+Syntax *function_call_new(Symbol function_name, Syntax *func_args) {
+    FunctionCall *function_call = syntax_alloc(sizeof(FunctionCall));
     function_call->function_name = function_name;
     function_call->function_arguments = func_args;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = FUNCTION_CALL;
     syntax->function_call = function_call;
 
@@ -129,22 +150,22 @@ Syntax *function_call_new(char *function_name, Syntax *func_args) {
 }
 
 Syntax *function_arguments_new() {
-    FunctionArguments *func_args = malloc(sizeof(FunctionArguments));
-    func_args->arguments = list_new();
+    FunctionArguments *func_args = syntax_alloc(sizeof(FunctionArguments));
+    func_args->arguments = syntax_list_new();
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = FUNCTION_ARGUMENTS;
     syntax->function_arguments = func_args;
 
     return syntax;
 }
 
-Syntax *assignment_new(char *var_name, Syntax *expression) {
-    Assignment *assignment = malloc(sizeof(Assignment));
+Syntax *assignment_new(Symbol var_name, Syntax *expression) {
+    Assignment *assignment = syntax_alloc(sizeof(Assignment));
     assignment->var_name = var_name;
     assignment->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = ASSIGNMENT;
     syntax->assignment = assignment;
 
@@ -152,10 +173,10 @@ Syntax *assignment_new(char *var_name, Syntax *expression) {
 }
 
 Syntax *return_statement_new(Syntax *expression) {
-    ReturnStatement *return_statement = malloc(sizeof(ReturnStatement));
+    ReturnStatement *return_statement = syntax_alloc(sizeof(ReturnStatement));
     return_statement->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = RETURN_STATEMENT;
     syntax->return_statement = return_statement;
 
@@ -163,10 +184,10 @@ Syntax *return_statement_new(Syntax *expression) {
 }
 
 Syntax *block_new(List *statements) {
-    Block *block = malloc(sizeof(Block));
+    Block *block = syntax_alloc(sizeof(Block));
     block->statements = statements;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = BLOCK;
     syntax->block = block;
 
@@ -174,24 +195,24 @@ Syntax *block_new(List *statements) {
 }
 
 Syntax *if_new(Syntax *condition, Syntax *then) {
-    IfStatement *if_statement = malloc(sizeof(IfStatement));
+    IfStatement *if_statement = syntax_alloc(sizeof(IfStatement));
     if_statement->condition = condition;
     if_statement->then = then;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = IF_STATEMENT;
     syntax->if_statement = if_statement;
 
     return syntax;
 }
 
-Syntax *define_var_new(char *var_name, Syntax *init_value) {
+Syntax *define_var_new(Symbol var_name, Syntax *init_value) {
     DefineVarStatement *define_var_statement =
-        malloc(sizeof(DefineVarStatement));
+        syntax_alloc(sizeof(DefineVarStatement));
     define_var_statement->var_name = var_name;
     define_var_statement->init_value = init_value;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = DEFINE_VAR;
     syntax->define_var_statement = define_var_statement;
 
@@ -199,24 +220,31 @@ Syntax *define_var_new(char *var_name, Syntax *init_value) {
 }
 
 Syntax *while_new(Syntax *condition, Syntax *body) {
-    WhileStatement *while_statement = malloc(sizeof(WhileStatement));
+    WhileStatement *while_statement = syntax_alloc(sizeof(WhileStatement));
     while_statement->condition = condition;
     while_statement->body = body;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = WHILE_SYNTAX;
     syntax->while_statement = while_statement;
 
     return syntax;
 }
 
-Syntax *function_new(char *name, Syntax *root_block) {
-    Function *function = malloc(sizeof(Function));
+Parameter *parameter_new(Symbol name) {
+    Parameter *parameter = syntax_alloc(sizeof(Parameter));
+    parameter->name = name;
+    return parameter;
+}
+
+/* Create a function taking PARAMETERS, a list of Parameter. */
+Syntax *function_new(Symbol name, List *parameters, Syntax *root_block) {
+    Function *function = syntax_alloc(sizeof(Function));
     function->name = name;
-    function->parameters = NULL;
+    function->parameters = parameters;
     function->root_block = root_block;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = FUNCTION;
     syntax->function = function;
 
@@ -224,10 +252,10 @@ Syntax *function_new(char *name, Syntax *root_block) {
 }
 
 Syntax *top_level_new() {
-    TopLevel *top_level = malloc(sizeof(TopLevel));
-    top_level->declarations = list_new();
+    TopLevel *top_level = syntax_alloc(sizeof(TopLevel));
+    top_level->declarations = syntax_list_new();
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_alloc(sizeof(Syntax));
     syntax->type = TOP_LEVEL;
     syntax->top_level = top_level;
 
@@ -247,11 +275,15 @@ void syntax_list_free(List *syntaxes) {
 }
 
 void syntax_free(Syntax *syntax) {
+    if (syntax_arena != NULL) {
+        // Everything is freed with the arena.
+        return;
+    }
+
     if (syntax->type == IMMEDIATE) {
         free(syntax->immediate);
 
     } else if (syntax->type == VARIABLE) {
-        free(syntax->variable->var_name);
         free(syntax->variable);
 
     } else if (syntax->type == UNARY_OPERATOR) {
@@ -265,7 +297,6 @@ void syntax_free(Syntax *syntax) {
 
     } else if (syntax->type == FUNCTION_CALL) {
         syntax_free(syntax->function_call->function_arguments);
-        free(syntax->function_call->function_name);
         free(syntax->function_call);
 
     } else if (syntax->type == FUNCTION_ARGUMENTS) {
@@ -281,7 +312,6 @@ void syntax_free(Syntax *syntax) {
         free(syntax->return_statement);
 
     } else if (syntax->type == DEFINE_VAR) {
-        free(syntax->define_var_statement->var_name);
         syntax_free(syntax->define_var_statement->init_value);
         free(syntax->define_var_statement);
 
@@ -290,13 +320,16 @@ void syntax_free(Syntax *syntax) {
         free(syntax->block);
 
     } else if (syntax->type == FUNCTION) {
-        free(syntax->function->name);
+        List *parameters = syntax->function->parameters;
+        for (int i = 0; i < list_length(parameters); i++) {
+            free(list_get(parameters, i));
+        }
+        list_free(parameters);
         syntax_free(syntax->function->root_block);
 
         free(syntax->function);
 
     } else if (syntax->type == ASSIGNMENT) {
-        free(syntax->assignment->var_name);
         syntax_free(syntax->assignment->expression);
 
         free(syntax->assignment);
@@ -316,49 +349,68 @@ void syntax_free(Syntax *syntax) {
     free(syntax);
 }
 
-char *syntax_type_name(Syntax *syntax) {
-    if (syntax->type == IMMEDIATE) {
+/* Free the operator node SYNTAX but not its operands, which the
+ * caller has taken over.
+ */
+void syntax_node_free(Syntax *syntax) {
+    if (syntax_arena != NULL) {
+        return;
+    }
+
+    if (syntax->type == UNARY_OPERATOR) {
+        free(syntax->unary_expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        free(syntax->binary_expression);
+    }
+    free(syntax);
+}
+
+/* The name of syntax of kind TYPE. OPERATOR_TYPE is the
+ * UnaryExpressionType or BinaryExpressionType of operators, and
+ * ignored otherwise.
+ */
+char *syntax_kind_name(SyntaxType type, int operator_type) {
+    if (type == IMMEDIATE) {
         return "IMMEDIATE";
-    } else if (syntax->type == VARIABLE) {
+    } else if (type == VARIABLE) {
         return "VARIABLE";
-    } else if (syntax->type == UNARY_OPERATOR) {
-        if (syntax->unary_expression->unary_type == BITWISE_NEGATION) {
-            return "UNARY BITWISE_NEGATION";
-        } else if (syntax->unary_expression->unary_type == LOGICAL_NEGATION) {
+    } else if (type == UNARY_OPERATOR) {
+        if (operator_type == BITWISE_NEGATION) {
             return "UNARY BITWISE_NEGATION";
+        } else if (operator_type == LOGICAL_NEGATION) {
+            return "UNARY LOGICAL_NEGATION";
         }
-    } else if (syntax->type == BINARY_OPERATOR) {
-        if (syntax->binary_expression->binary_type == ADDITION) {
+    } else if (type == BINARY_OPERATOR) {
+        if (operator_type == ADDITION) {
             return "ADDITION";
-        } else if (syntax->binary_expression->binary_type == SUBTRACTION) {
+        } else if (operator_type == SUBTRACTION) {
             return "SUBTRACTION";
-        } else if (syntax->binary_expression->binary_type == MULTIPLICATION) {
+        } else if (operator_type == MULTIPLICATION) {
             return "MULTIPLICATION";
-        } else if (syntax->binary_expression->binary_type == LESS_THAN) {
+        } else if (operator_type == LESS_THAN) {
             return "LESS THAN";
-        } else if (syntax->binary_expression->binary_type ==
-                   LESS_THAN_OR_EQUAL) {
+        } else if (operator_type == LESS_THAN_OR_EQUAL) {
             return "LESS THAN OR EQUAL";
         }
-    } else if (syntax->type == FUNCTION_CALL) {
+    } else if (type == FUNCTION_CALL) {
         return "FUNCTION CALL";
-    } else if (syntax->type == FUNCTION_ARGUMENTS) {
+    } else if (type == FUNCTION_ARGUMENTS) {
         return "FUNCTION ARGUMENTS";
-    } else if (syntax->type == IF_STATEMENT) {
+    } else if (type == IF_STATEMENT) {
         return "IF";
-    } else if (syntax->type == RETURN_STATEMENT) {
+    } else if (type == RETURN_STATEMENT) {
         return "RETURN";
-    } else if (syntax->type == DEFINE_VAR) {
+    } else if (type == DEFINE_VAR) {
         return "DEFINE VARIABLE";
-    } else if (syntax->type == BLOCK) {
+    } else if (type == BLOCK) {
         return "BLOCK";
-    } else if (syntax->type == FUNCTION) {
+    } else if (type == FUNCTION) {
         return "FUNCTION";
-    } else if (syntax->type == ASSIGNMENT) {
+    } else if (type == ASSIGNMENT) {
         return "ASSIGNMENT";
-    } else if (syntax->type == WHILE_SYNTAX) {
+    } else if (type == WHILE_SYNTAX) {
         return "WHILE";
-    } else if (syntax->type == TOP_LEVEL) {
+    } else if (type == TOP_LEVEL) {
         return "TOP LEVEL";
     }
 
@@ -366,106 +418,22 @@ char *syntax_type_name(Syntax *syntax) {
     return "??? UNKNOWN SYNTAX";
 }
 
-void print_syntax_indented(Syntax *syntax, int indent) {
-    for (int i = 0; i < indent; i++) {
-        printf(" ");
-    }
-
-    char *syntax_type_string = syntax_type_name(syntax);
-
-    if (syntax->type == IMMEDIATE) {
-        printf("%s %d\n", syntax_type_string, syntax->immediate->value);
-    } else if (syntax->type == VARIABLE) {
-        printf("%s '%s'\n", syntax_type_string, syntax->variable->var_name);
-    } else if (syntax->type == UNARY_OPERATOR) {
-        printf("%s\n", syntax_type_string);
-        print_syntax_indented(syntax->unary_expression->expression, indent + 4);
-
+char *syntax_type_name(Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return syntax_kind_name(syntax->type,
+                                syntax->unary_expression->unary_type);
     } else if (syntax->type == BINARY_OPERATOR) {
-        printf("%s LEFT\n", syntax_type_string);
-        print_syntax_indented(syntax->binary_expression->left, indent + 4);
-
-        for (int i = 0; i < indent; i++) {
-            printf(" ");
-        }
-
-        printf("%s RIGHT\n", syntax_type_string);
-        print_syntax_indented(syntax->binary_expression->right, indent + 4);
-
-    } else if (syntax->type == FUNCTION_CALL) {
-        printf("%s '%s'\n", syntax_type_string,
-               syntax->function_call->function_name);
-        print_syntax_indented(syntax->function_call->function_arguments,
-                              indent);
-
-    } else if (syntax->type == FUNCTION_ARGUMENTS) {
-        printf("%s\n", syntax_type_string);
-
-        List *arguments = syntax->function_arguments->arguments;
-        Syntax *argument;
-        for (int i = 0; i < list_length(arguments); i++) {
-            argument = list_get(arguments, i);
-            print_syntax_indented(argument, indent + 4);
-        }
-
-    } else if (syntax->type == IF_STATEMENT) {
-        printf("%s CONDITION\n", syntax_type_string);
-        print_syntax_indented(syntax->if_statement->condition, indent + 4);
-
-        for (int i = 0; i < indent; i++) {
-            printf(" ");
-        }
-
-        printf("%s THEN\n", syntax_type_string);
-        print_syntax_indented(syntax->if_statement->then, indent + 4);
-
-    } else if (syntax->type == RETURN_STATEMENT) {
-        printf("%s\n", syntax_type_string);
-        print_syntax_indented(syntax->return_statement->expression, indent + 4);
-
-    } else if (syntax->type == DEFINE_VAR) {
-        printf("%s '%s'\n", syntax_type_string,
-               syntax->define_var_statement->var_name);
-
-        for (int i = 0; i < indent; i++) {
-            printf(" ");
-        }
-
-        printf("'%s' INITIAL VALUE\n", syntax->define_var_statement->var_name);
-        print_syntax_indented(syntax->define_var_statement->init_value,
-                              indent + 4);
-
-    } else if (syntax->type == BLOCK) {
-        printf("%s\n", syntax_type_string);
-
-        List *statements = syntax->block->statements;
-        for (int i = 0; i < list_length(statements); i++) {
-            print_syntax_indented(list_get(statements, i), indent + 4);
-        }
-
-    } else if (syntax->type == FUNCTION) {
-        printf("%s '%s'\n", syntax_type_string, syntax->function->name);
-        print_syntax_indented(syntax->function->root_block, indent + 4);
-
-    } else if (syntax->type == ASSIGNMENT) {
-        printf("%s '%s'\n", syntax_type_string, syntax->assignment->var_name);
-        print_syntax_indented(syntax->assignment->expression, indent + 4);
-
-    } else if (syntax->type == WHILE_SYNTAX) {
-        printf("%s\n", syntax_type_string);
-        print_syntax_indented(syntax->assignment->expression, indent + 4);
-
-    } else if (syntax->type == TOP_LEVEL) {
-        printf("%s\n", syntax_type_string);
-
-        List *declarations = syntax->top_level->declarations;
-        for (int i = 0; i < list_length(declarations); i++) {
-            print_syntax_indented(list_get(declarations, i), indent + 4);
-        }
-
-    } else {
-        printf("??? UNKNOWN SYNTAX TYPE\n");
+        return syntax_kind_name(syntax->type,
+                                syntax->binary_expression->binary_type);
     }
+    return syntax_kind_name(syntax->type, 0);
 }
 
-void print_syntax(Syntax *syntax) { print_syntax_indented(syntax, 0); }
+/* Print SYNTAX as an indented tree. We print through the flat
+ * layout, which is also how we check it stays in sync with the tree.
+ */
+void print_syntax(Syntax *syntax) {
+    FlatSyntax *flat = flatten_syntax(syntax);
+    print_flat_syntax(flat);
+    flat_syntax_free(flat);
+}
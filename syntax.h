@@ -1,6 +1,8 @@
 #ifndef MC_SYNTAX_H
 #define MC_SYNTAX_H
 
+#include "arena.h"
+#include "intern.h"
 #include "list.h"
 
 typedef enum {
@@ -40,7 +42,7 @@ typedef struct Immediate {
 
 typedef struct Variable {
     // TODO: once we have other types, we will need to store type here.
-    char *var_name;
+    Symbol var_name;
 } Variable;
 
 typedef struct UnaryExpression {
@@ -59,12 +61,12 @@ typedef struct FunctionArguments {
 } FunctionArguments;
 
 typedef struct FunctionCall {
-    char *function_name;
+    Symbol function_name;
     Syntax *function_arguments;
 } FunctionCall;
 
 typedef struct Assignment {
-    char *var_name;
+    Symbol var_name;
     Syntax *expression;
 } Assignment;
 
@@ -74,7 +76,7 @@ typedef struct IfStatement {
 } IfStatement;
 
 typedef struct DefineVarStatement {
-    char *var_name;
+    Symbol var_name;
     Syntax *init_value;
 } DefineVarStatement;
 
@@ -92,14 +94,15 @@ typedef struct Block {
 } Block;
 
 typedef struct Function {
-    char *name;
+    Symbol name;
+    // A list of Parameter, in order.
     List *parameters;
     Syntax *root_block;
 } Function;
 
 typedef struct Parameter {
     // TODO: once we have other types, we will need to store type here.
-    char *name;
+    Symbol name;
 } Parameter;
 
 typedef struct TopLevel {
@@ -127,7 +130,7 @@ struct Syntax {
 };
 
 Syntax *immediate_new(int value);
-Syntax *variable_new(char *var_name);
+Syntax *variable_new(Symbol var_name);
 Syntax *bitwise_negation_new(Syntax *expression);
 Syntax *logical_negation_new(Syntax *expression);
 Syntax *addition_new(Syntax *left, Syntax *right);
@@ -135,18 +138,25 @@ Syntax *subtraction_new(Syntax *left, Syntax *right);
 Syntax *multiplication_new(Syntax *left, Syntax *right);
 Syntax *less_than_new(Syntax *left, Syntax *right);
 Syntax *less_or_equal_new(Syntax *left, Syntax *right);
-Syntax *function_call_new(char *function_name, Syntax *func_args);
+Syntax *function_call_new(Symbol function_name, Syntax *func_args);
 Syntax *function_arguments_new();
-Syntax *assignment_new(char *var_name, Syntax *expression);
+Syntax *assignment_new(Symbol var_name, Syntax *expression);
 Syntax *return_statement_new(Syntax *expression);
 Syntax *block_new(List *statements);
 Syntax *if_new(Syntax *condition, Syntax *then);
-Syntax *define_var_new(char *var_name, Syntax *init_value);
+Syntax *define_var_new(Symbol var_name, Syntax *init_value);
 Syntax *while_new(Syntax *condition, Syntax *body);
-Syntax *function_new(char *name, Syntax *root_block);
+Parameter *parameter_new(Symbol name);
+Syntax *function_new(Symbol name, List *parameters, Syntax *root_block);
 Syntax *top_level_new();
 
+extern __thread Arena *syntax_arena;
+
+List *syntax_list_new(void);
+
 void syntax_free(Syntax *syntax);
+void syntax_node_free(Syntax *syntax);
+char *syntax_kind_name(SyntaxType type, int operator_type);
 char *syntax_type_name(Syntax *syntax);
 void print_syntax(Syntax *syntax);
 
@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "target.h"
+
+static Target TARGETS[] = {
+    {TARGET_I386, "i386", 4, "%ebp", "%esp", "pushl", "popl"},
+    {TARGET_X86_64, "x86_64", 8, "%rbp", "%rsp", "pushq", "popq"},
+};
+
+#define NUM_TARGETS (sizeof(TARGETS) / sizeof(Target))
+
+Target *target_get(TargetArch arch) {
+    for (size_t i = 0; i < NUM_TARGETS; i++) {
+        if (TARGETS[i].arch == arch) {
+            return &TARGETS[i];
+        }
+    }
+    return NULL;
+}
+
+/* Look up a target by its --target name, returning NULL if we don't
+ * support it.
+ */
+Target *target_from_name(char *name) {
+    for (size_t i = 0; i < NUM_TARGETS; i++) {
+        if (strcmp(TARGETS[i].name, name) == 0) {
+            return &TARGETS[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef MC_TARGET_H
+#define MC_TARGET_H
+
+typedef enum { TARGET_I386, TARGET_X86_64 } TargetArch;
+
+/* The facts about an architecture that the code generators need:
+ * how wide a stack slot is and what the stack registers are called.
+ */
+typedef struct Target {
+    TargetArch arch;
+    char *name;
+    // Size in bytes of pushed values, saved registers and stack slots.
+    int word_size;
+    char *frame_pointer;
+    char *stack_pointer;
+    char *push;
+    char *pop;
+} Target;
+
+Target *target_get(TargetArch arch);
+Target *target_from_name(char *name);
+
+#endif
@@ -0,0 +1,36 @@
+int main() {
+    int a = 3;
+    int b = 5;
+    int c = 7;
+    int d = 2;
+    int result = 0;
+    if (!(a < b)) {
+        result = 100;
+    }
+    if (b <= a) {
+        result = result + 50;
+    }
+    if (!(b <= a)) {
+        result = result + 1;
+    }
+    if (0) {
+        result = 200;
+    }
+    if (a) {
+        result = result + 2;
+    }
+    if ((a + b) * (c - d) * ((a - d) * (b + c)) <
+        (a * b + c * d) * (b - d + c * a)) {
+        result = result + 4;
+    }
+
+    int n = 0;
+    while (!(4 <= n)) {
+        n = n + 1;
+    }
+    int m = 0;
+    while (m < 0) {
+        m = m + 10;
+    }
+    return result + n * 10 + m;
+}
@@ -0,0 +1,32 @@
+int twice(int x) {
+    return x + x;
+    x = 100;
+    return x;
+}
+
+int main() {
+    int unused = twice(4) * 3;
+    int a = 1;
+    a = 2;
+    int b = a + 5;
+    if (0) {
+        b = 100;
+    }
+    if (1) {
+        b = b + 1;
+    }
+    while (0) {
+        b = 0;
+    }
+
+    int total = 0;
+    int i = 0;
+    while (i < 3) {
+        int scratch = i * 7;
+        total = total + i;
+        i = i + 1;
+    }
+    b + 1;
+    return b * 10 + total + twice(1);
+    b = 0;
+}
@@ -0,0 +1,12 @@
+int nothing() {
+}
+
+int main() {
+    int x = 3;
+    if (x) {
+    }
+    while (0) {
+    }
+    nothing();
+    return x;
+}
@@ -0,0 +1 @@
+int main() { return 2 * 3 + 4; }
@@ -0,0 +1 @@
+int main() { return 65536 * 65536 + 7; }
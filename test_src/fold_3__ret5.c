@@ -0,0 +1,6 @@
+int five() { return 5; }
+
+int main() {
+    int x = five();
+    return !!(x * 1 + 0) * (x - 0) + five() * 0 + !!!0 * 0;
+}
@@ -0,0 +1,20 @@
+int step(int count, int by) {
+    int next = count + by;
+    if (99 < next) {
+        next = next - 100;
+    }
+    return next;
+}
+
+int main() {
+    // Enough iterations to overflow the stack if each one took a
+    // fresh slot for its locals and temporaries.
+    int i = 0;
+    int count = 0;
+    while (i < 3000061) {
+        int by = (i + 1) - i;
+        count = step(count, by);
+        i = i + 1;
+    }
+    return count;
+}
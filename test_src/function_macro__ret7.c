@@ -0,0 +1,21 @@
+#define ADD(a, b) ((a) + (b))
+#define THREE 3
+#define TWICE(x) ADD(x, x)
+
+#if defined(THREE) && THREE * 2 == 6
+#define FOUR 4
+#else
+#define FOUR 40
+#endif
+
+#ifdef NOT_DEFINED
+#error "NOT_DEFINED should not be defined"
+#elif FOUR > 10
+#define RESULT 0
+#else
+#define RESULT ADD(THREE, FOUR)
+#endif
+
+int main() {
+    return TWICE(RESULT) - 7;
+}
@@ -0,0 +1,3 @@
+#include "macros.h"
+
+int main() { return square_plus_five(); }
@@ -0,0 +1,33 @@
+int square(int x) {
+    return x * x;
+}
+
+int sum_of_squares(int a, int b) {
+    int x = square(a);
+    if (1) {
+        int y = square(b);
+        a = y;
+    }
+    return x + a;
+}
+
+int clamp(int x) {
+    if (10 < x) {
+        return 10;
+    }
+    return x;
+}
+
+int count_down(int n) {
+    while (0 < n) {
+        n = n - 1;
+    }
+    return n;
+}
+
+int main() {
+    int x = 2;
+    int y = sum_of_squares(x, square(x) - 1) + clamp(x + 1);
+    count_down(3);
+    return y + count_down(x) + 41;
+}
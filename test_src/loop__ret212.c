@@ -0,0 +1,22 @@
+int main() {
+    int n = 8;
+    int k = 3;
+    int i = 0;
+    int total = 0;
+    while (i < n) {
+        total = total + i * 4 + (k * k + n);
+        i = i + 1;
+        total = total - i * k;
+    }
+
+    int j = 6;
+    while (0 < j) {
+        int row = 0;
+        while (row < 2) {
+            total = total + j * k;
+            row = row + 1;
+        }
+        j = j - 2;
+    }
+    return total;
+}
@@ -0,0 +1,17 @@
+int h(int n) {
+    int loop = n + 1;
+    return loop;
+}
+
+int main() {
+    int k = 3;
+    int i = 0;
+    int s = 0;
+    // Inlining h copies its local as loop.N, while hoisting k * 7 out
+    // of the loop makes a temporary of its own.
+    while (i < 5) {
+        s = s + (k * 7) + h(i);
+        i = i + 1;
+    }
+    return s;
+}
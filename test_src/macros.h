@@ -0,0 +1,7 @@
+// Included by include_header__ret9.c.
+#define SQUARE(x) ((x) * (x))
+
+int square_plus_five() {
+    int a = 2;
+    return SQUARE(a) + 5;
+}
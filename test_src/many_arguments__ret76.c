@@ -0,0 +1,13 @@
+int seven() {
+    return 7;
+}
+
+int eight(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return 3;
+}
+
+int main() {
+    int x = 1;
+    int total = (x + 2) * seven() + eight(x, x + 1, seven(), 4, 5, 6, seven() * 2, 8);
+    return total + (x + 3) * (seven() + (x + 1) * eight(1, 2, 3, 4, 5, 6, 7, 8));
+}
@@ -0,0 +1,13 @@
+int pick(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a + b * 2 + h * 3 - g;
+}
+
+int twice(int x) {
+    x = x * 2;
+    return x;
+}
+
+int main() {
+    int seven = 7;
+    return pick(1, 2, 3, 4, 5, 6, seven, twice(seven)) + twice(twice(4)) * 2;
+}
@@ -0,0 +1,10 @@
+int main() {
+    int a = 1;
+    int b = 2;
+    int c = 3;
+    int d = 4;
+    int e = 5;
+    return ((a + b) * (c + d) - (e - a) * (b + c)) *
+               ((d + e) * (a + c) - (b + e) * (c - a)) -
+           ((e * d - c) - (b - a * e)) * ((a + e) - (c * b - d));
+}
@@ -0,0 +1,13 @@
+int three() { return 3; }
+
+int main() {
+    int i = 0;
+    int sum = 0;
+    int unused = 7;
+    int k = 2;
+    while (i < 10) {
+        sum = sum + (i * k + three()) * (1 + three() - k);
+        i = i + 1;
+    }
+    return sum - unused;
+}
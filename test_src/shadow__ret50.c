@@ -0,0 +1,25 @@
+int hide(int a) {
+    int y = a;
+    if (a) {
+        int y = 40;
+        a = y;
+    }
+    return y + a;
+}
+
+int main() {
+    int x = 1;
+    if (1) {
+        int x = 2;
+        x = x + 5;
+    }
+    int total = 0;
+    int i = 0;
+    while (i < 3) {
+        int x = i * 2;
+        total = total + x;
+        i = i + 1;
+    }
+    // 1 + 43 + 6
+    return x + hide(3) + total;
+}
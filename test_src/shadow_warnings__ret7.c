@@ -0,0 +1,22 @@
+// warning: Definition of 'x' shadows a variable in an outer scope
+// warning: Definition of 'n' shadows a variable in an outer scope
+// warning: Redefinition of 'y'
+
+int f(int n) {
+    if (n) {
+        int n = 2;
+        return n;
+    }
+    return 0;
+}
+
+int main() {
+    int x = 1;
+    int y = 2;
+    if (x) {
+        int x = 3;
+        y = y + x;
+    }
+    int y = 4;
+    return x + y + f(1);
+}
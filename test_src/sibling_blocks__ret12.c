@@ -0,0 +1,13 @@
+int main() {
+    int a = 0;
+    int b = 0;
+    if (1) {
+        int t = 5;
+        a = t;
+    }
+    if (1) {
+        int t = 7;
+        b = t;
+    }
+    return a + b;
+}
@@ -0,0 +1,14 @@
+int main() {
+    int a = 1;
+    int b = 2;
+    int i = 0;
+    while (i < 5) {
+        int t = a;
+        a = b;
+        b = t;
+        if (i < 2) { a = a + 10; }
+        if (a < 0) { return 99; }
+        i = i + 1;
+    }
+    return a * 3 + b;
+}
@@ -0,0 +1,24 @@
+int count(int n, int total) {
+    if (n < 1) {
+        return total;
+    }
+    return count(n - 1, total + 1);
+}
+
+int even(int n) {
+    if (n < 1) {
+        return 1;
+    }
+    return odd(n - 1);
+}
+
+int odd(int n) {
+    if (n < 1) {
+        return 0;
+    }
+    return even(n - 1);
+}
+
+int main() {
+    return count(30000, 0) - 30000 + even(1001) * 10 + odd(7) * 40 + 2;
+}
@@ -0,0 +1,21 @@
+int pick(int d, int a, int b) {
+    // Returning early keeps this from being inlined.
+    if (d < 1) {
+        return b;
+    }
+    return a;
+}
+
+int count_down(int d, int a, int b, int c, int e) {
+    if (0 < d) {
+        // The arguments make calls of their own, which must not
+        // clobber the ones already evaluated.
+        return count_down(d - 1, pick(1, b, 12) + 1, 18 < e, c,
+                          pick(2, e, b));
+    }
+    return a + b + c;
+}
+
+int main() {
+    return count_down(18, 21, 8, 3, 21);
+}
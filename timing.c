@@ -0,0 +1,323 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "timing.h"
+
+// Spans can't nest deeper than this on one thread.
+#define MAX_SPAN_DEPTH 64
+
+#define MAX_PHASES 32
+#define MAX_COUNTERS 16
+
+/* A finished span, for the trace. Times are in microseconds since
+ * timing_start.
+ */
+typedef struct TraceEvent {
+    char *name;
+    const char *category;
+    double start;
+    double duration;
+    int thread;
+} TraceEvent;
+
+/* The total time spent in the phases with one name, for the report. */
+typedef struct PhaseTotal {
+    char *name;
+    // How many phases it was nested in, for indenting the report.
+    int depth;
+    double wall;
+    double cpu;
+} PhaseTotal;
+
+typedef struct Counter {
+    const char *name;
+    long total;
+} Counter;
+
+typedef struct OpenSpan {
+    const char *category;
+    char *name;
+    // Where to add our time, if we're in the "phase" category.
+    PhaseTotal *phase;
+    double wall_start;
+    double cpu_start;
+} OpenSpan;
+
+/******************************************************************************
+ *
+ * Everything recorded so far, shared by all threads and guarded by
+ * LOCK. Each thread keeps its own stack of open spans.
+ *
+ ******************************************************************************/
+static struct {
+    bool enabled;
+    bool report;
+    char *trace_file;
+    double start;
+
+    TraceEvent *events;
+    int event_count;
+    int event_capacity;
+
+    PhaseTotal phases[MAX_PHASES];
+    int phase_count;
+
+    Counter counters[MAX_COUNTERS];
+    int counter_count;
+
+    int thread_count;
+} timing;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread OpenSpan open_spans[MAX_SPAN_DEPTH];
+static __thread int open_span_count = 0;
+// Spans we didn't open because they nested too deeply, so their
+// span_end calls must be ignored.
+static __thread int dropped_span_count = 0;
+// Numbered from 1, in the order threads first record a span. 0 until
+// then.
+static __thread int thread_number = 0;
+
+static double seconds(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Start recording. REPORT asks for the --time-report summary, and
+ * TRACE_FILE, if not NULL, is where we write the trace.
+ */
+void timing_start(bool report, char *trace_file) {
+    timing.enabled = true;
+    timing.report = report;
+    timing.trace_file = trace_file;
+    timing.start = seconds(CLOCK_MONOTONIC);
+}
+
+bool timing_enabled(void) { return timing.enabled; }
+
+/* The totals for the phase NAME, added in the order phases first
+ * start so the report reads top to bottom. Called with LOCK held.
+ */
+static PhaseTotal *find_phase(const char *name) {
+    for (int i = 0; i < timing.phase_count; i++) {
+        if (strcmp(timing.phases[i].name, name) == 0) {
+            return &timing.phases[i];
+        }
+    }
+    if (timing.phase_count == MAX_PHASES) {
+        return NULL;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < open_span_count; i++) {
+        if (open_spans[i].phase != NULL) {
+            depth++;
+        }
+    }
+
+    PhaseTotal *phase = &timing.phases[timing.phase_count++];
+    phase->name = strdup(name);
+    phase->depth = depth;
+    phase->wall = 0;
+    phase->cpu = 0;
+    return phase;
+}
+
+/* Start a span called NAME, nested in any span this thread has open.
+ * NAME is copied.
+ */
+void span_begin(const char *category, const char *name) {
+    if (!timing.enabled) {
+        return;
+    }
+    if (open_span_count == MAX_SPAN_DEPTH) {
+        dropped_span_count++;
+        return;
+    }
+
+    OpenSpan *span = &open_spans[open_span_count];
+    span->category = category;
+    span->name = strdup(name);
+    span->phase = NULL;
+    if (strcmp(category, "phase") == 0) {
+        pthread_mutex_lock(&lock);
+        span->phase = find_phase(name);
+        pthread_mutex_unlock(&lock);
+    }
+    open_span_count++;
+    span->cpu_start = seconds(CLOCK_THREAD_CPUTIME_ID);
+    span->wall_start = seconds(CLOCK_MONOTONIC);
+}
+
+/* End the innermost span this thread has open. */
+void span_end(void) {
+    if (!timing.enabled || open_span_count == 0) {
+        return;
+    }
+    if (dropped_span_count > 0) {
+        dropped_span_count--;
+        return;
+    }
+
+    double wall_end = seconds(CLOCK_MONOTONIC);
+    double cpu_end = seconds(CLOCK_THREAD_CPUTIME_ID);
+    OpenSpan *span = &open_spans[--open_span_count];
+
+    pthread_mutex_lock(&lock);
+    if (thread_number == 0) {
+        thread_number = ++timing.thread_count;
+    }
+
+    if (span->phase != NULL) {
+        span->phase->wall += wall_end - span->wall_start;
+        span->phase->cpu += cpu_end - span->cpu_start;
+    }
+
+    if (timing.trace_file != NULL) {
+        if (timing.event_count == timing.event_capacity) {
+            timing.event_capacity =
+                timing.event_capacity == 0 ? 1024 : timing.event_capacity * 2;
+            timing.events = realloc(
+                timing.events, timing.event_capacity * sizeof(TraceEvent));
+        }
+        TraceEvent *event = &timing.events[timing.event_count++];
+        event->name = span->name;
+        event->category = span->category;
+        event->start = (span->wall_start - timing.start) * 1e6;
+        event->duration = (wall_end - span->wall_start) * 1e6;
+        event->thread = thread_number;
+    } else {
+        free(span->name);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Add COUNT to the counter NAME, which must be a string constant. */
+void timing_count(const char *name, long count) {
+    if (!timing.enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    Counter *counter = NULL;
+    for (int i = 0; i < timing.counter_count; i++) {
+        if (strcmp(timing.counters[i].name, name) == 0) {
+            counter = &timing.counters[i];
+            break;
+        }
+    }
+    if (counter == NULL && timing.counter_count < MAX_COUNTERS) {
+        counter = &timing.counters[timing.counter_count++];
+        counter->name = name;
+        counter->total = 0;
+    }
+    if (counter != NULL) {
+        counter->total += count;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void print_report(FILE *out) {
+    if (timing.thread_count > 1) {
+        fprintf(out, "Phase times are summed over %d threads.\n",
+                timing.thread_count);
+    }
+    fprintf(out, "%-24s %12s %12s\n", "Phase", "Wall (ms)", "CPU (ms)");
+    for (int i = 0; i < timing.phase_count; i++) {
+        PhaseTotal *phase = &timing.phases[i];
+        fprintf(out, "%*s%-*s %12.3f %12.3f\n", phase->depth * 2, "",
+                24 - phase->depth * 2, phase->name, phase->wall * 1000,
+                phase->cpu * 1000);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                 usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    fprintf(out, "%-24s %12.3f %12.3f\n", "Total",
+            (seconds(CLOCK_MONOTONIC) - timing.start) * 1000, cpu * 1000);
+
+    fprintf(out, "\n");
+    for (int i = 0; i < timing.counter_count; i++) {
+        fprintf(out, "%-24s %12ld\n", timing.counters[i].name,
+                timing.counters[i].total);
+    }
+    // Linux reports this in kilobytes.
+    fprintf(out, "%-24s %9ld KB\n", "Peak RSS", usage.ru_maxrss);
+}
+
+/* Write STRING as a JSON string. */
+static void write_json_string(FILE *out, const char *string) {
+    fputc('"', out);
+    for (; *string != '\0'; string++) {
+        unsigned char c = *string;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* Write the spans as complete ("X") events, in the Trace Event Format
+ * that chrome://tracing and Perfetto read.
+ */
+static bool write_trace(char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        warn("%s", path);
+        return false;
+    }
+
+    fprintf(out, "{\"traceEvents\": [\n");
+    for (int i = 0; i < timing.event_count; i++) {
+        TraceEvent *event = &timing.events[i];
+        fprintf(out, "  {\"name\": ");
+        write_json_string(out, event->name);
+        fprintf(out,
+                ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+                "\"dur\": %.3f, \"pid\": 1, \"tid\": %d}%s\n",
+                event->category, event->start, event->duration,
+                event->thread, i + 1 < timing.event_count ? "," : "");
+    }
+    fprintf(out, "], \"displayTimeUnit\": \"ms\"}\n");
+
+    return fclose(out) == 0;
+}
+
+/* Print the report and write the trace, if asked for, and free what
+ * we recorded.
+ */
+bool timing_finish(void) {
+    if (!timing.enabled) {
+        return true;
+    }
+
+    bool result = true;
+    if (timing.report) {
+        print_report(stderr);
+    }
+    if (timing.trace_file != NULL) {
+        result = write_trace(timing.trace_file);
+    }
+
+    for (int i = 0; i < timing.event_count; i++) {
+        free(timing.events[i].name);
+    }
+    free(timing.events);
+    for (int i = 0; i < timing.phase_count; i++) {
+        free(timing.phases[i].name);
+    }
+    timing.enabled = false;
+    return result;
+}
@@ -0,0 +1,21 @@
+#ifndef MC_TIMING_H
+#define MC_TIMING_H
+
+#include <stdbool.h>
+
+/* Where compile time goes. Code marks spans of work with span_begin
+ * and span_end, which nest. Spans in the "phase" category are summed
+ * by name for --time-report, and every span is written to the
+ * --trace file as a Chrome trace event.
+ *
+ * Until timing_start is called, spans and counts cost one branch.
+ * All functions may be called from any thread.
+ */
+void timing_start(bool report, char *trace_file);
+void span_begin(const char *category, const char *name);
+void span_end(void);
+void timing_count(const char *name, long count);
+bool timing_enabled(void);
+bool timing_finish(void);
+
+#endif